@@ -92,13 +92,15 @@ LIBOBJ = stdlib\snprintf.$(O) stdlib\vsnprintf.$(O) stdlib\strlcpy.$(O) \
 	asm\pragma.$(O) \
 	asm\assemble.$(O) asm\labels.$(O) asm\parser.$(O) \
 	asm\preproc.$(O) asm\quote.$(O) asm\pptok.$(O) \
-	asm\listing.$(O) asm\eval.$(O) asm\exprlib.$(O) asm\exprdump.$(O) \
+	asm\listing.$(O) asm\listjson.$(O) asm\relax.$(O) asm\eval.$(O) asm\exprlib.$(O) asm\exprdump.$(O) \
 	asm\stdscan.$(O) \
 	asm\strfunc.$(O) asm\tokhash.$(O) \
 	asm\segalloc.$(O) \
 	asm\preproc-nop.$(O) \
 	asm\rdstrnum.$(O) \
 	asm\srcfile.$(O) \
+	asm\batch.$(O) asm\server.$(O) asm\outcache.$(O) asm\stats.$(O) \
+	asm\trace.$(O) \
 	macros\macros.$(O) \
 	\
 	output\outform.$(O) output\outlib.$(O) output\legacy.$(O) \
@@ -109,7 +111,8 @@ LIBOBJ = stdlib\snprintf.$(O) stdlib\vsnprintf.$(O) stdlib\strlcpy.$(O) \
 	output\outdbg.$(O) output\outieee.$(O) output\outmacho.$(O) \
 	output\codeview.$(O) \
 	\
-	disasm\disasm.$(O) disasm\sync.$(O)
+	disasm\disasm.$(O) disasm\sync.$(O) disasm\flow.$(O) \
+	disasm\objfile.$(O)
 
 SUBDIRS  = stdlib nasmlib output asm disasm x86 common macros
 XSUBDIRS = test doc nsis rdoff
@@ -186,6 +186,7 @@
 #include "tables.h"
 #include "disp8.h"
 #include "listing.h"
+#include "stats.h"
 
 enum match_result {
     /*
@@ -323,6 +324,40 @@ static void warn_overflow_out(int64_t data, int size, enum out_sign sign)
         warn_overflow(size);
 }
 
+/*
+ * While the first repetition of a TIMES line is being assembled,
+ * out() copies its bytes here, and notes whether they are fixed
+ * data that can be replicated for the rest; see out_times().
+ * Lines that issue diagnostics are not replicated, so that the
+ * diagnostics are repeated for every copy as before.
+ */
+static struct times_capture {
+    uint8_t *buf;
+    size_t len, size;
+    bool ok;
+    uint64_t diags;             /* diag_count when the line was started */
+} *times_capture;
+
+static void capture_output(const struct out_data *data, bool fixed)
+{
+    struct times_capture *tc = times_capture;
+
+    if (!tc->ok)
+        return;
+
+    if (!fixed || data->type != OUT_RAWDATA || data->segment == NO_SEG) {
+        tc->ok = false;
+        return;
+    }
+
+    if (tc->len + data->size > tc->size) {
+        tc->size = (tc->len + data->size) << 1;
+        tc->buf = nasm_realloc(tc->buf, tc->size);
+    }
+    memcpy(tc->buf + tc->len, data->data, data->size);
+    tc->len += data->size;
+}
+
 /*
  * This routine wrappers the real output format's output routine,
  * in order to pass a copy of the data off to the listing file
@@ -351,10 +386,15 @@ static void out(struct out_data *data)
     uint64_t zeropad = 0;
     int64_t addrval;
     int32_t fixseg;             /* Segment for which to produce fixed data */
+    bool fixed;                 /* Independent of the output position */
 
     if (!data->size)
         return;                 /* Nothing to do */
 
+    fixed = data->type == OUT_RAWDATA ||
+        (data->type == OUT_ADDRESS &&
+         data->tsegment == NO_SEG && data->twrt == NO_SEG);
+
     /*
      * Convert addresses to RAWDATA if possible
      * XXX: not all backends want this for global symbols!!!!
@@ -428,10 +468,16 @@ static void out(struct out_data *data)
         zeropad = data->size - amax;
         data->size = amax;
     }
+
+    if (unlikely(times_capture))
+        capture_output(data, fixed && !zeropad);
+
     lfmt->output(data);
 
     if (likely(data->segment != NO_SEG)) {
+        stats_enter(STATS_OUTPUT);
         ofmt->output(data);
+        stats_leave();
     } else {
         /* Outputting to ABSOLUTE section - only reserve is permitted */
         if (data->type != OUT_RESERVE)
@@ -446,7 +492,9 @@ static void out(struct out_data *data)
         data->type     = OUT_ZERODATA;
         data->size     = zeropad;
         lfmt->output(data);
+        stats_enter(STATS_OUTPUT);
         ofmt->output(data);
+        stats_leave();
         data->offset  += zeropad;
         data->insoffs += zeropad;
         data->size    += zeropad;  /* Restore original size value */
@@ -539,6 +587,16 @@ static void out_reladdr(struct out_data *data, const struct operand *opx,
     out(data);
 }
 
+/*
+ * Set by jmp_match() when it has chosen between the short form of a
+ * jump and the templates following it from the distance to its
+ * target; insn_size() passes this on to the relaxation engine.
+ */
+static struct jmp_span {
+    bool valid;
+    int64_t ssize;              /* Size of the short form */
+} jmp_span;
+
 static bool jmp_match(int32_t segment, int64_t offset, int bits,
                       insn * ins, const struct itemplate *temp)
 {
@@ -556,13 +614,18 @@ static bool jmp_match(int32_t segment, int64_t offset, int bits,
 
     isize = calcsize(segment, offset, bits, ins, temp);
 
-    if (ins->oprs[0].opflags & OPFLAG_UNKNOWN)
+    if (ins->oprs[0].opflags & OPFLAG_UNKNOWN) {
         /* Be optimistic in pass 1 */
+        relax_unpredictable();
         return true;
+    }
 
     if (ins->oprs[0].segment != segment)
         return false;
 
+    jmp_span.valid = true;
+    jmp_span.ssize = isize;
+
     isize = ins->oprs[0].offset - offset - isize; /* isize is delta */
     is_byte = (isize >= -128 && isize <= 127); /* is it byte size? */
 
@@ -580,11 +643,49 @@ static bool jmp_match(int32_t segment, int64_t offset, int bits,
          */
         nasm_warn(WARN_BND | ERR_PASS2 ,
                    "jmp short does not init bnd regs - bnd prefix dropped");
+        relax_unpredictable();  /* The near form would keep the prefix */
     }
 
     return is_byte;
 }
 
+/*
+ * The size of the form a jump would take if its short form could not
+ * be used: that of the first template after the short one which
+ * matches without needing jmp_match().
+ */
+static int64_t jmp_near_size(int32_t segment, int64_t offset, int bits,
+                             insn *ins, const struct itemplate *temp)
+{
+    while ((++temp)->opcode != I_none) {
+        if (matches(temp, ins, bits) == MOK_GOOD)
+            return calcsize(segment, offset, bits, ins, temp);
+    }
+    return -1;
+}
+
+/*
+ * Tell the relaxation engine about a jump whose form was chosen by
+ * jmp_match(); temp is the template chosen.
+ */
+static void record_jmp_span(int32_t segment, int64_t offset, int bits,
+                            insn *ins, const struct itemplate *temp)
+{
+    const operand *op = &ins->oprs[0];
+    int64_t size, nsize;
+
+    if ((temp->code[0] & ~1) == 0370) {
+        size  = jmp_span.ssize;
+        nsize = jmp_near_size(segment, offset, bits, ins, temp);
+    } else {
+        size  = calcsize(segment, offset, bits, ins, temp);
+        nsize = size;
+    }
+
+    relax_span(segment, offset, jmp_span.ssize, nsize, size,
+               op->offset, op->opflags & OPFLAG_PREVPASS);
+}
+
 static inline int64_t merge_resb(insn *ins, int64_t isize)
 {
     int nbytes = resb_bytes(ins->opcode);
@@ -601,6 +702,103 @@ static inline int64_t merge_resb(insn *ins, int64_t isize)
     return isize;
 }
 
+/*
+ * TIMES replication.  A line which refers to no segment has the same
+ * size wherever it is placed, and unless it contains a relative
+ * reference, the same encoding; it is sized or encoded once and
+ * multiplied out rather than processed once per repetition.
+ */
+static bool oprs_fixed(const insn *ins)
+{
+    int i;
+
+    for (i = 0; i < ins->operands; i++) {
+        if (ins->oprs[i].segment != NO_SEG || ins->oprs[i].wrt != NO_SEG)
+            return false;
+    }
+    return true;
+}
+
+static inline int64_t merge_times(insn *ins, int64_t isize)
+{
+    isize *= ins->times;
+    ins->times = 1;
+    return isize;
+}
+
+/* Largest block of replicated data to hand to out() at once */
+#define TIMES_MAX_BUF (ZERO_BUF_SIZE * 16)
+
+/*
+ * Start capturing the output of the first repetition of a TIMES line
+ */
+static void times_begin(struct times_capture *tc, const insn *ins)
+{
+    if (ins->times <= 1)
+        return;
+
+    tc->buf = NULL;
+    tc->len = tc->size = 0;
+    tc->ok = true;
+    times_capture = tc;
+}
+
+/*
+ * Emit the remaining repetitions, if the first one could be captured
+ */
+static void out_times(struct out_data *data, insn *ins,
+                      struct times_capture *tc)
+{
+    uint64_t n, per;
+    size_t blk, len;
+
+    if (times_capture != tc)
+        return;
+
+    times_capture = NULL;
+    if (!tc->ok || !tc->len || tc->diags != diag_count) {
+        /* Nothing safe to replicate; let the caller iterate */
+        nasm_free(tc->buf);
+        return;
+    }
+
+    lfmt->uplevel(LIST_TIMES, ins->times);
+
+    len = tc->len;
+    n = ins->times - 1;
+    if (n) {
+        per = len < TIMES_MAX_BUF ? TIMES_MAX_BUF / len : 1;
+        if (per > n)
+            per = n;
+
+        /* Fill a block with as many copies as will fit */
+        blk = len * per;
+        if (blk > tc->size)
+            tc->buf = nasm_realloc(tc->buf, blk);
+        while (tc->len < blk) {
+            size_t m = blk - tc->len;
+            if (m > tc->len)
+                m = tc->len;
+            memcpy(tc->buf + tc->len, tc->buf, m);
+            tc->len += m;
+        }
+
+        data->itemp = NULL;
+        while (n) {
+            uint64_t k = n < per ? n : per;
+            data->insoffs = 0;
+            data->inslen = 0;
+            out_rawdata(data, tc->buf, k * len);
+            n -= k;
+        }
+    }
+
+    lfmt->downlevel(LIST_TIMES);
+
+    nasm_free(tc->buf);
+    ins->times = 1;             /* Tell the upper layer not to iterate */
+}
+
 /* This must be handle non-power-of-2 alignment values */
 static inline size_t pad_bytes(size_t len, size_t align)
 {
@@ -651,6 +849,7 @@ static void out_eops(struct out_data *data, const extop *e)
         case EOT_DB_FLOAT:
         case EOT_DB_STRING:
         case EOT_DB_STRING_FREE:
+        case EOT_DB_PACKED:
         {
             size_t pad, len;
 
@@ -686,10 +885,13 @@ int64_t assemble(int32_t segment, int64_t start, int bits, insn *instruction)
     struct out_data data;
     const struct itemplate *temp;
     enum match_result m;
+    struct times_capture tc;
 
     if (instruction->opcode == I_none)
         return 0;
 
+    tc.diags = diag_count;
+
     nasm_zero(data);
     data.offset = start;
     data.segment = segment;
@@ -697,7 +899,9 @@ int64_t assemble(int32_t segment, int64_t start, int bits, insn *instruction)
     data.bits = bits;
 
     if (opcode_is_db(instruction->opcode)) {
+        times_begin(&tc, instruction);
         out_eops(&data, instruction->eops);
+        out_times(&data, instruction, &tc);
     } else if (instruction->opcode == I_INCBIN) {
         const char *fname = instruction->eops->val.string.data;
         FILE *fp;
@@ -818,7 +1022,9 @@ int64_t assemble(int32_t segment, int64_t start, int bits, insn *instruction)
         /* Check to see if we need an address-size prefix */
         add_asp(instruction, bits);
 
+        stats_enter(STATS_MATCH);
         m = find_match(&temp, instruction, data.segment, data.offset, bits);
+        stats_leave();
 
         if (m == MOK_GOOD) {
             /* Matches! */
@@ -875,13 +1081,17 @@ int64_t assemble(int32_t segment, int64_t start, int bits, insn *instruction)
             data.bits = bits;
             data.insoffs = 0;
 
+            stats_enter(STATS_MATCH);
             data.inslen = calcsize(data.segment, data.offset,
                                    bits, instruction, temp);
+            stats_leave();
             nasm_assert(data.inslen >= 0);
             data.inslen = merge_resb(instruction, data.inslen);
 
+            times_begin(&tc, instruction);
             gencode(&data, instruction);
             nasm_assert(data.insoffs == data.inslen);
+            out_times(&data, instruction, &tc);
         } else {
             /* No match */
             switch (m) {
@@ -1078,6 +1288,7 @@ static int64_t len_extops(const extop *e)
         case EOT_DB_STRING:
         case EOT_DB_STRING_FREE:
         case EOT_DB_FLOAT:
+        case EOT_DB_PACKED:
             pad = pad_bytes(e->val.string.len, e->elem);
             isize += e->dup * (e->val.string.len + pad);
             break;
@@ -1103,6 +1314,7 @@ int64_t insn_size(int32_t segment, int64_t offset, int bits, insn *instruction)
     const struct itemplate *temp;
     enum match_result m;
     int64_t isize = 0;
+    uint64_t diags = diag_count;
 
     if (instruction->opcode == I_none) {
         return 0;
@@ -1112,6 +1324,8 @@ int64_t insn_size(int32_t segment, int64_t offset, int bits, insn *instruction)
     } else if (opcode_is_db(instruction->opcode)) {
         isize = len_extops(instruction->eops);
         debug_set_db_type(instruction);
+        if (diags == diag_count)
+            isize = merge_times(instruction, isize);
         return isize;
     } else if (instruction->opcode == I_INCBIN) {
         const extop *e = instruction->eops;
@@ -1148,13 +1362,23 @@ int64_t insn_size(int32_t segment, int64_t offset, int bits, insn *instruction)
         /* Check to see if we need an address-size prefix */
         add_asp(instruction, bits);
 
+        jmp_span.valid = false;
+        stats_enter(STATS_MATCH);
         m = find_match(&temp, instruction, segment, offset, bits);
+        stats_leave();
         if (m != MOK_GOOD)
             return -1;              /* No match */
 
+        if (jmp_span.valid && relax_recording())
+            record_jmp_span(segment, offset, bits, instruction, temp);
+
+        stats_enter(STATS_MATCH);
         isize = calcsize(segment, offset, bits, instruction, temp);
+        stats_leave();
         debug_set_type(instruction);
         isize = merge_resb(instruction, isize);
+        if (oprs_fixed(instruction) && diags == diag_count)
+            isize = merge_times(instruction, isize);
 
         return isize;
     }
@@ -51,4 +51,16 @@ int64_t assemble(int32_t segment, int64_t offset, int bits, insn *instruction);
 bool process_directives(char *);
 void process_pragma(char *);
 
+/* relax.c */
+void relax_begin(void);
+bool relax_recording(void);
+void relax_disable(void);
+void relax_unpredictable(void);
+void relax_span(int32_t segment, int64_t offset, int ssize, int nsize,
+                int size, int64_t target, bool stale);
+void relax_label(int32_t oldseg, int64_t oldoff, int32_t segment,
+                 int64_t offset);
+bool relax_solve(void);
+void relax_cleanup(void);
+
 #endif
@@ -0,0 +1,144 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 1996-2020 The NASM Authors - All Rights Reserved
+ *   See the file AUTHORS included with the NASM distribution for
+ *   the specific copyright holders.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+/*
+ * batch.c      worker processes for --batch
+ *
+ * This is kept apart from the rest of the assembler because the
+ * system headers needed here may define names, like REG_RCX, which
+ * clash with ours.
+ */
+
+#include "compiler.h"
+
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_WAIT_H
+# include <sys/wait.h>
+#endif
+
+#include "nasmlib.h"
+#include "error.h"
+#include "batch.h"
+
+#if defined(HAVE_FORK) && defined(HAVE_WAITPID) && defined(HAVE_SYS_WAIT_H)
+
+int batch_jobs(int njobs, int maxjobs, void (*failed)(int job, int sig))
+{
+    pid_t *pids;
+    int first = 0, next = 0, running = 0, done = 0;
+
+    if (maxjobs < 1) {
+        maxjobs = 1;
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+        {
+            long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+            if (ncpu > 1)
+                maxjobs = ncpu > INT_MAX ? INT_MAX : (int)ncpu;
+        }
+#endif
+    }
+
+    nasm_newn(pids, njobs);
+
+    while (next < njobs || running) {
+        pid_t pid;
+        int status, job;
+
+        /*
+         * Run the first job on its own, so that anything it leaves
+         * behind for the others, such as a --prelude-cache file, is
+         * only written once.
+         */
+        while (next < njobs && running < (done ? maxjobs : 1)) {
+            fflush(NULL);       /* Don't let the worker inherit buffered output */
+            pid = fork();
+            if (pid == 0) {
+                nasm_free(pids);
+                return next;
+            }
+            if (pid < 0)
+                nasm_fatalf(ERR_NOFILE, "unable to start a batch worker: %s",
+                            strerror(errno));
+
+            pids[next++] = pid;
+            running++;
+        }
+
+        pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            nasm_fatalf(ERR_NOFILE, "waiting for a batch worker: %s",
+                        strerror(errno));
+        }
+
+        for (job = first; job < next; job++) {
+            if (pids[job] == pid)
+                break;
+        }
+        if (job >= next)
+            continue;           /* Not one of ours */
+
+        pids[job] = 0;
+        running--;
+        done++;
+        while (first < next && !pids[first])
+            first++;
+
+        if (WIFSIGNALED(status))
+            failed(job, WTERMSIG(status));
+        else if (!WIFEXITED(status) || WEXITSTATUS(status))
+            failed(job, 0);
+    }
+
+    nasm_free(pids);
+    return -1;
+}
+
+#else
+
+int batch_jobs(int njobs, int maxjobs, void (*failed)(int job, int sig))
+{
+    (void)njobs;
+    (void)maxjobs;
+    (void)failed;
+
+    nasm_fatalf(ERR_USAGE, "--batch is not supported on this platform");
+    return -1;
+}
+
+#endif
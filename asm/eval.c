@@ -973,7 +973,10 @@ static expr *expr6(void)
                 label_ofs = in_absolute ? absolute.offset : location.offset;
             } else {
                 enum label_type ltype;
-                ltype = lookup_label(tokval->t_charptr, &label_seg, &label_ofs);
+                bool current;
+
+                ltype = lookup_label_pass(tokval->t_charptr,
+                                          &label_seg, &label_ofs, &current);
                 if (ltype == LBL_none) {
                     scope = local_scope(tokval->t_charptr);
                     if (critical) {
@@ -987,9 +990,16 @@ static expr *expr6(void)
                     type = EXPR_UNKNOWN;
                     label_seg = NO_SEG;
                     label_ofs = 1;
-                } else if (is_extern(ltype)) {
-                    if (opflags)
+                } else {
+                    if (opflags && is_extern(ltype))
                         *opflags |= OPFLAG_EXTERN;
+                    /*
+                     * Only instruction operands (the callers which
+                     * ask for hints) care; other callers treat any
+                     * flag at all as a forward reference.
+                     */
+                    if (opflags && hint && !current)
+                        *opflags |= OPFLAG_PREVPASS;
                 }
             }
             addtotemp(type, label_ofs);
@@ -42,7 +42,9 @@
 #include "nasmlib.h"
 #include "error.h"
 #include "hashtbl.h"
+#include "stats.h"
 #include "labels.h"
+#include "assemble.h"
 
 /*
  * A dot-local label is one that begins with exactly one period. Things
@@ -268,6 +270,19 @@ static union label *find_label(const char *label, bool create, bool *created)
 
 enum label_type lookup_label(const char *label,
                              int32_t *segment, int64_t *offset)
+{
+    bool current;
+
+    return lookup_label_pass(label, segment, offset, &current);
+}
+
+/*
+ * As lookup_label(), but also tell if the label has been defined
+ * earlier in this pass, as opposed to its value being left over from
+ * the previous one.
+ */
+enum label_type lookup_label_pass(const char *label, int32_t *segment,
+                                  int64_t *offset, bool *current)
 {
     union label *lptr;
 
@@ -281,6 +296,7 @@ enum label_type lookup_label(const char *label,
         lptr->defn.lastref = lpass;
         *segment = lptr->defn.segment;
         *offset = lptr->defn.offset;
+        *current = lptr->defn.defined == lpass;
         return lptr->defn.type;
     }
 
@@ -498,6 +514,9 @@ void define_label(const char *label, int32_t segment,
         size = 0;               /* This is a hack... */
     }
 
+    if (lastdef && lastdef != lpass)
+        relax_label(lptr->defn.segment, lptr->defn.offset, segment, offset);
+
     changed = created || !lastdef ||
         lptr->defn.segment != segment ||
         lptr->defn.offset != offset ||
@@ -575,6 +594,72 @@ void backend_label(const char *label, int32_t segment, int64_t offset)
     define_label(label, segment, offset, false);
 }
 
+/*
+ * Labels as they were before shift_labels() last moved them, so that
+ * unshift_labels() can put them back if the move turns out wrong.
+ */
+static struct label_pos {
+    union label *lptr;
+    int32_t segment;
+    int64_t offset;
+} *saved;
+static size_t nsaved, saved_size;
+
+/*
+ * Move every label defined in this pass to where the next pass is
+ * expected to put it; used by the jump relaxation (relax.c).
+ */
+void shift_labels(int64_t (*shift)(int32_t segment, int64_t offset))
+{
+    union label *lptr = ldata;
+    int64_t lpass = pass_count() + 1;
+
+    nsaved = 0;
+    while (lptr) {
+        if (lptr->admin.movingon == END_BLOCK) {
+            lptr = lptr->admin.next;
+            continue;
+        }
+        if (lptr->admin.movingon == END_LIST)
+            break;
+
+        if (lptr->defn.defined == lpass && lptr->defn.segment != NO_SEG &&
+            lptr->defn.type != LBL_COMMON) {
+            struct label_pos *lp;
+
+            if (nsaved >= saved_size) {
+                saved_size = saved_size ? saved_size << 1 : 1024;
+                saved = nasm_realloc(saved, saved_size * sizeof *saved);
+            }
+            lp = &saved[nsaved++];
+            lp->lptr    = lptr;
+            lp->segment = lptr->defn.segment;
+            lp->offset  = lptr->defn.offset;
+
+            lptr->defn.offset = shift(lptr->defn.segment, lptr->defn.offset);
+        }
+
+        lptr++;
+    }
+}
+
+/*
+ * Put the labels back where they were before shift_labels(), undoing
+ * any changes made by the passes since.
+ */
+void unshift_labels(void)
+{
+    size_t i;
+
+    for (i = 0; i < nsaved; i++) {
+        union label *lptr = saved[i].lptr;
+
+        lptr->defn.segment = saved[i].segment;
+        lptr->defn.offset  = saved[i].offset;
+    }
+    nsaved = 0;
+}
+
 int init_labels(void)
 {
     ldata = lfree = nasm_malloc(LBLK_SIZE);
@@ -600,8 +685,13 @@ void cleanup_labels(void)
 
     initialized = false;
 
+    stats_hash(STATS_LABELS, &ltab);
     hash_free(&ltab);
 
+    nasm_free(saved);
+    saved = NULL;
+    nsaved = saved_size = 0;
+
     lptr = lhold = ldata;
     while (lptr) {
         lptr = &lptr[LABEL_BLOCK-1];
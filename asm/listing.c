@@ -48,6 +48,8 @@
 #define LIST_MAX_LEN 1024       /* something sensible */
 #define LIST_INDENT  40
 #define LIST_HEXBIT  18
+#define LIST_BUF_LEN 65536      /* output buffer size */
+#define LIST_LINE_LEN (LIST_MAX_LEN + LIST_HEXBIT + 64) /* max formatted line */
 
 typedef struct MacroInhibit MacroInhibit;
 
@@ -59,7 +61,10 @@ static struct MacroInhibit {
 
 static const char xdigit[] = "0123456789ABCDEF";
 
-#define HEX(a,b) (*(a)=xdigit[((b)>>4)&15],(a)[1]=xdigit[(b)&15]);
+/* Two hex digits for every byte value, set up by list_init() */
+static char hexbyte[256][2];
+
+#define HEX(a,b) memcpy((a), hexbyte[(uint8_t)(b)], 2);
 
 uint64_t list_options, active_list_options;
 
@@ -69,8 +74,26 @@ static bool listlinep;
 static struct strlist *list_errors;
 
 static char listdata[2 * LIST_INDENT];  /* we need less than that actually */
+static size_t listdatalen;
 static int32_t listoffset;
 
+/*
+ * Collapsing of long data runs (-Lc): after the first row of hex
+ * for a source line, further bytes are only counted.
+ */
+static int listrows;                    /* hex rows emitted for this line */
+static uint64_t listskip;               /* bytes not shown */
+static int64_t listskipoffset;
+
+/*
+ * The listing is formatted into this buffer and written out with
+ * fwrite() whenever it fills up.
+ */
+static char *listbuf;
+static size_t listbuflen;
+
+static void list_emit_skip(void);
+
 static int32_t listlineno;
 
 static int suppress;            /* for INCBIN & TIMES special cases */
@@ -79,55 +102,122 @@ static int listlevel, listlevel_e;
 
 static FILE *listfp;
 
+static void list_flush(void)
+{
+    if (listbuflen) {
+        nasm_write(listbuf, listbuflen, listfp);
+        listbuflen = 0;
+    }
+}
+
+/*
+ * Make room for at least len bytes in the output buffer
+ */
+static inline char *list_reserve(size_t len)
+{
+    if (listbuflen + len > LIST_BUF_LEN)
+        list_flush();
+    return listbuf + listbuflen;
+}
+
+static void list_puts(const char *str)
+{
+    size_t len = strlen(str);
+
+    if (len > LIST_BUF_LEN) {
+        list_flush();
+        nasm_write(str, len, listfp);
+    } else {
+        memcpy(list_reserve(len), str, len);
+        listbuflen += len;
+    }
+}
+
+static char *list_level(char *q, const char *pfx)
+{
+    if (listlevel_e)
+        q += sprintf(q, "%s%s<%d>", pfx, (listlevel < 10 ? " " : ""),
+                     listlevel_e);
+    return q;
+}
+
 static void list_emit(void)
 {
     int i;
     const struct strlist_entry *e;
+    char *q;
+    uint32_t offs;
+
+    if (listlinep || listdatalen) {
+        q = list_reserve(LIST_LINE_LEN);
+        q += sprintf(q, "%6"PRId32" ", listlineno);
+
+        if (listdatalen) {
+            offs = listoffset;
+            for (i = 28; i >= 0; i -= 4)
+                *q++ = xdigit[(offs >> i) & 15];
+            *q++ = ' ';
+            memcpy(q, listdata, listdatalen);
+            q += listdatalen;
+            /* A long <res ...> tag can run past the hex column */
+            if (listdatalen <= LIST_HEXBIT + 1) {
+                memset(q, ' ', LIST_HEXBIT + 1 - listdatalen);
+                q += LIST_HEXBIT + 1 - listdatalen;
+            }
+        } else {
+            memset(q, ' ', LIST_HEXBIT + 10);
+            q += LIST_HEXBIT + 10;
+        }
 
-    if (listlinep || *listdata) {
-        fprintf(listfp, "%6"PRId32" ", listlineno);
-
-        if (listdata[0])
-            fprintf(listfp, "%08"PRIX32" %-*s", listoffset, LIST_HEXBIT + 1,
-                    listdata);
-        else
-            fprintf(listfp, "%*s", LIST_HEXBIT + 10, "");
-
-        if (listlevel_e)
-            fprintf(listfp, "%s<%d>", (listlevel < 10 ? " " : ""),
-                    listlevel_e);
-        else if (listlinep)
-            fprintf(listfp, "    ");
+        if (listlevel_e) {
+            q = list_level(q, "");
+        } else if (listlinep) {
+            memcpy(q, "    ", 4);
+            q += 4;
+        }
 
-        if (listlinep)
-            fprintf(listfp, " %s", listline);
+        if (listlinep) {
+            size_t len = strlen(listline);
+            *q++ = ' ';
+            memcpy(q, listline, len);
+            q += len;
+        }
 
-        putc('\n', listfp);
+        *q++ = '\n';
+        listbuflen = q - listbuf;
         listlinep = false;
         listdata[0] = '\0';
+        listdatalen = 0;
     }
 
     if (list_errors) {
         static const char fillchars[] = " --***XX";
-        char fillchar;
 
         strlist_for_each(e, list_errors) {
-            fprintf(listfp, "%6"PRId32"          ", listlineno);
-            fillchar = fillchars[e->pvt.u & ERR_MASK];
-            for (i = 0; i < LIST_HEXBIT; i++)
-                putc(fillchar, listfp);
-
-            if (listlevel_e)
-                fprintf(listfp, " %s<%d>", (listlevel < 10 ? " " : ""),
-                        listlevel_e);
-            else
-                fprintf(listfp, "     ");
+            q = list_reserve(LIST_LINE_LEN);
+            q += sprintf(q, "%6"PRId32"          ", listlineno);
+            memset(q, fillchars[e->pvt.u & ERR_MASK], LIST_HEXBIT);
+            q += LIST_HEXBIT;
+
+            if (listlevel_e) {
+                q = list_level(q, " ");
+            } else {
+                memcpy(q, "     ", 5);
+                q += 5;
+            }
 
-            fprintf(listfp, "  %s\n", e->str);
+            memcpy(q, "  ", 2);
+            q += 2;
+            listbuflen = q - listbuf;
+            list_puts(e->str);
+            list_puts("\n");
         }
 
         strlist_free(&list_errors);
     }
+
+    if (list_option('w'))
+        list_flush();
 }
 
 static void list_cleanup(void)
@@ -141,14 +231,19 @@ static void list_cleanup(void)
         nasm_free(temp);
     }
 
+    list_emit_skip();
     list_emit();
+    list_flush();
     fclose(listfp);
     listfp = NULL;
+    nasm_free(listbuf);
+    listbuf = NULL;
 }
 
 static void list_init(const char *fname)
 {
     enum file_flags flags = NF_TEXT;
+    int i;
 
     if (listfp)
         list_cleanup();
@@ -167,7 +262,19 @@ static void list_init(const char *fname)
         return;
     }
 
+    for (i = 0; i < 256; i++) {
+        hexbyte[i][0] = xdigit[i >> 4];
+        hexbyte[i][1] = xdigit[i & 15];
+    }
+
+    listbuf = nasm_malloc(LIST_BUF_LEN);
+    listbuflen = 0;
+
     *listline = '\0';
+    *listdata = '\0';
+    listdatalen = 0;
+    listrows = 0;
+    listskip = 0;
     listlineno = 0;
     list_errors = NULL;
     listlevel = 0;
@@ -178,15 +285,68 @@ static void list_init(const char *fname)
     mistack->inhibiting = true;
 }
 
-static void list_out(int64_t offset, char *str)
+/*
+ * Emit the current row of hex data and start a continuation row
+ */
+static void list_continue(void)
 {
-    if (strlen(listdata) + strlen(str) > LIST_HEXBIT) {
-        strcat(listdata, "-");
-        list_emit();
-    }
-    if (!listdata[0])
+    listdata[listdatalen++] = '-';
+    listdata[listdatalen] = '\0';
+    list_emit();
+    listrows++;
+}
+
+static void list_out(int64_t offset, const char *str)
+{
+    size_t len = strlen(str);
+
+    if (listdatalen + len > LIST_HEXBIT)
+        list_continue();
+    if (!listdatalen)
         listoffset = offset;
-    strcat(listdata, str);
+    memcpy(listdata + listdatalen, str, len + 1);
+    listdatalen += len;
+}
+
+/*
+ * Output a block of data bytes, as many to a row as will fit
+ */
+static void list_hexdata(int64_t offset, const uint8_t *p, uint64_t size)
+{
+    size_t n;
+    char *q;
+
+    while (size) {
+        if (listrows && list_option('c')) {
+            if (!listskip)
+                listskipoffset = offset;
+            listskip += size;
+            return;
+        }
+
+        if (listdatalen + 2 > LIST_HEXBIT) {
+            list_continue();
+            continue;
+        }
+
+        if (!listdatalen)
+            listoffset = offset;
+
+        n = (LIST_HEXBIT - listdatalen) >> 1;
+        if (n > size)
+            n = size;
+
+        q = listdata + listdatalen;
+        listdatalen += n << 1;
+        offset += n;
+        size -= n;
+        while (n--) {
+            HEX(q, *p);
+            q += 2;
+            p++;
+        }
+        *q = '\0';
+    }
 }
 
 static void list_address(int64_t offset, const char *brackets,
@@ -222,6 +382,18 @@ static void list_size(int64_t offset, const char *tag, uint64_t size)
     list_out(offset, buf);
 }
 
+/*
+ * Show the number of bytes collapsed by -Lc, if any
+ */
+static void list_emit_skip(void)
+{
+    if (listskip) {
+        list_size(listskipoffset, "more", listskip);
+        listskip = 0;
+    }
+    listrows = 0;
+}
+
 static void list_output(const struct out_data *data)
 {
     char q[24];
@@ -229,7 +401,6 @@ static void list_output(const struct out_data *data)
     uint64_t offset = data->offset;
     const uint8_t *p = data->data;
 
-
     if (!listfp || suppress || user_nolist)
         return;
 
@@ -245,15 +416,10 @@ static void list_output(const struct out_data *data)
     case OUT_RAWDATA:
     {
 	if (size == 0) {
-            if (!listdata[0])
+            if (!listdatalen)
                 listoffset = data->offset;
         } else if (p) {
-            while (size--) {
-                HEX(q, *p);
-                q[2] = '\0';
-                list_out(offset++, q);
-                p++;
-            }
+            list_hexdata(offset, p, size);
         } else {
             /* Used for listing on non-code generation passes with -Lp */
             list_size(offset, "len", size);
@@ -302,6 +468,7 @@ static void list_line(int type, int32_t lineno, const char *line)
             nasm_free(temp);
         }
     }
+    list_emit_skip();
     list_emit();
     if (lineno >= 0)
         listlineno = lineno;
@@ -451,3 +618,19 @@ static const struct lfmt nasm_list = {
 };
 
 const struct lfmt *lfmt = &nasm_list;
+
+/*
+ * Select the listing file format by name; returns false if the
+ * name is not recognized.
+ */
+bool list_set_format(const char *name)
+{
+    if (!nasm_stricmp(name, "text"))
+        lfmt = &nasm_list;
+    else if (!nasm_stricmp(name, "json"))
+        lfmt = &json_list;
+    else
+        return false;
+
+    return true;
+}
@@ -116,6 +116,10 @@ struct lfmt {
 extern const struct lfmt *lfmt;
 extern bool user_nolist;
 
+/* Machine-readable (newline-delimited JSON) listing format */
+extern const struct lfmt json_list;
+bool list_set_format(const char *name);
+
 /*
  * list_options are the requested options; active_list_options gets
  * set when a pass starts.
@@ -0,0 +1,322 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 1996-2020 The NASM Authors - All Rights Reserved
+ *   See the file AUTHORS included with the NASM distribution for
+ *   the specific copyright holders.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * listjson.c   machine-readable listing file generator
+ *
+ * Writes one JSON object per line (newline-delimited JSON) for every
+ * chunk of output handed to the listing engine, so that tools can
+ * build address-to-source maps without parsing the text listing.
+ * Output produced by INCBIN or by the repeated iterations of TIMES
+ * is collapsed into a single record carrying only a length.
+ *
+ * As in the text listing, output is attributed to the last source or
+ * macro line listed, and carries its nesting level; the lines of a
+ * .nolist macro are not listed, so their output gets the level of
+ * the line which invoked the macro.
+ */
+
+#include "compiler.h"
+
+#include "nasm.h"
+#include "nasmlib.h"
+#include "error.h"
+#include "listing.h"
+#include "srcfile.h"
+
+static FILE *jsonfp;
+static int jsonlevel;           /* macro/include nesting level */
+static int jsonlevel_e;         /* level of the line last listed */
+static int nolistlevel;         /* level of the outermost .nolist macro */
+static int suppress;            /* for INCBIN & TIMES special cases */
+
+/* Output collapsed while INCBIN or TIMES is active */
+static struct json_run {
+    struct src_location where;
+    int level;
+    int32_t segment;
+    int64_t offset;
+    uint64_t size;
+    const char *type;
+} run;
+
+static const char xdigit[] = "0123456789ABCDEF";
+
+static inline void json_string(const char *str)
+{
+    fwritejson(str, jsonfp);
+}
+
+/*
+ * Start a record; the caller adds any type-specific fields and
+ * terminates it with json_end().
+ */
+static void json_begin(const struct src_location *where, int level,
+                       const char *type)
+{
+    fputs("{\"file\":", jsonfp);
+    json_string(where->filename ? where->filename : "");
+    fprintf(jsonfp, ",\"line\":%"PRId32",\"level\":%d,\"type\":\"%s\"",
+            where->lineno, level, type);
+}
+
+static void json_chunk(int32_t segment, int64_t offset, uint64_t size)
+{
+    fprintf(jsonfp, ",\"segment\":%"PRId32",\"offset\":%"PRId64
+            ",\"length\":%"PRIu64, segment, offset, size);
+}
+
+static inline void json_end(void)
+{
+    fputs("}\n", jsonfp);
+}
+
+static void json_flush_run(void)
+{
+    if (!run.type)
+        return;
+
+    json_begin(&run.where, run.level, run.type);
+    json_chunk(run.segment, run.offset, run.size);
+    json_end();
+    run.type = NULL;
+}
+
+static void json_cleanup(void)
+{
+    if (!jsonfp)
+        return;
+
+    json_flush_run();
+    fclose(jsonfp);
+    jsonfp = NULL;
+}
+
+static void json_init(const char *fname)
+{
+    if (jsonfp)
+        json_cleanup();
+
+    if (!fname || fname[0] == '\0')
+        return;
+
+    jsonfp = nasm_open_write(fname, list_option('w') ? NF_TEXT|NF_IOLBF
+                                                     : NF_TEXT);
+    if (!jsonfp) {
+        nasm_nonfatal("unable to open listing file `%s'", fname);
+        return;
+    }
+
+    jsonlevel = jsonlevel_e = nolistlevel = 0;
+    suppress = 0;
+    run.type = NULL;
+}
+
+static void json_output(const struct out_data *data)
+{
+    struct src_location where;
+    const uint8_t *p;
+    uint64_t n;
+
+    if (!jsonfp || user_nolist || !data->size)
+        return;
+
+    if (suppress) {
+        if (run.type && run.segment == data->segment &&
+            run.offset + (int64_t)run.size == data->offset) {
+            run.size += data->size;
+            return;
+        }
+        json_flush_run();
+        run.where   = src_where();
+        run.level   = jsonlevel_e;
+        run.segment = data->segment;
+        run.offset  = data->offset;
+        run.size    = data->size;
+        run.type    = (suppress & 1) ? "incbin" : "times";
+        return;
+    }
+
+    where = src_where();
+
+    switch (data->type) {
+    case OUT_RAWDATA:
+        json_begin(&where, jsonlevel_e, "data");
+        json_chunk(data->segment, data->offset, data->size);
+        if (data->data) {
+            /* With -Lp on a non-final pass, only the size is known */
+            fputs(",\"bytes\":\"", jsonfp);
+            for (p = data->data, n = data->size; n; n--, p++) {
+                putc(xdigit[*p >> 4], jsonfp);
+                putc(xdigit[*p & 15], jsonfp);
+            }
+            putc('"', jsonfp);
+        }
+        break;
+
+    case OUT_ZERODATA:
+        json_begin(&where, jsonlevel_e, "zero");
+        json_chunk(data->segment, data->offset, data->size);
+        break;
+
+    case OUT_RESERVE:
+        json_begin(&where, jsonlevel_e, "reserve");
+        json_chunk(data->segment, data->offset, data->size);
+        break;
+
+    case OUT_ADDRESS:
+    case OUT_RELADDR:
+        json_begin(&where, jsonlevel_e,
+                   data->type == OUT_ADDRESS ? "address" : "reladdr");
+        json_chunk(data->segment, data->offset, data->size);
+        fprintf(jsonfp, ",\"target\":%"PRId32",\"value\":%"PRId64,
+                data->tsegment, data->toffset);
+        break;
+
+    case OUT_SEGMENT:
+        json_begin(&where, jsonlevel_e, "segment");
+        json_chunk(data->segment, data->offset, data->size);
+        fprintf(jsonfp, ",\"target\":%"PRId32, data->tsegment);
+        break;
+
+    default:
+        panic();
+    }
+    json_end();
+}
+
+static void json_line(int type, int32_t lineno, const char *line)
+{
+    (void)lineno;
+    (void)line;
+
+    if (!jsonfp || user_nolist)
+        return;
+
+    if (nolistlevel && type == LIST_MACRO)
+        return;
+
+    jsonlevel_e = jsonlevel;
+}
+
+static void json_uplevel(int type, int64_t size)
+{
+    (void)size;
+
+    if (!jsonfp)
+        return;
+
+    switch (type) {
+    case LIST_INCBIN:
+        suppress |= 1;
+        break;
+    case LIST_TIMES:
+        suppress |= 2;
+        break;
+    case LIST_MACRO_NOLIST:
+        jsonlevel++;
+        if (!nolistlevel)
+            nolistlevel = jsonlevel;
+        break;
+    default:
+        jsonlevel++;
+        break;
+    }
+}
+
+static void json_downlevel(int type)
+{
+    if (!jsonfp)
+        return;
+
+    switch (type) {
+    case LIST_INCBIN:
+        suppress &= ~1;
+        break;
+    case LIST_TIMES:
+        suppress &= ~2;
+        break;
+    default:
+        jsonlevel--;
+        if (jsonlevel < nolistlevel)
+            nolistlevel = 0;
+        break;
+    }
+
+    if (!suppress)
+        json_flush_run();
+}
+
+static void json_error(errflags severity, const char *fmt, ...)
+{
+    static const char * const severities[ERR_MASK+1] = {
+        "listmsg", "debug", "info", "warning",
+        "error", "fatal", "critical", "panic"
+    };
+    struct src_location where;
+    va_list ap;
+    char *msg;
+
+    if (!jsonfp)
+        return;
+
+    va_start(ap, fmt);
+    msg = nasm_vasprintf(fmt, ap);
+    va_end(ap);
+
+    where = src_where();
+    json_begin(&where, jsonlevel_e, "message");
+    fputs(",\"severity\":", jsonfp);
+    json_string(severities[severity & ERR_MASK]);
+    fputs(",\"text\":", jsonfp);
+    json_string(msg);
+    json_end();
+
+    nasm_free(msg);
+}
+
+static void json_set_offset(uint64_t offset)
+{
+    (void)offset;
+}
+
+const struct lfmt json_list = {
+    json_init,
+    json_cleanup,
+    json_output,
+    json_line,
+    json_uplevel,
+    json_downlevel,
+    json_error,
+    json_set_offset
+};
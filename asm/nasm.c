@@ -55,6 +55,11 @@
 #include "outform.h"
 #include "listing.h"
 #include "iflag.h"
+#include "batch.h"
+#include "server.h"
+#include "outcache.h"
+#include "stats.h"
+#include "trace.h"
 #include "ver.h"
 
 /*
@@ -72,6 +77,11 @@ struct forwrefinfo {            /* info held on forward refs. */
 const char *_progname;
 
 static void parse_cmdline(int, char **, int);
+static void check_filenames(void);
+static void open_error_file(void);
+static void select_dfmt(void);
+static void batch_run(void);
+static void server_run(void);
 static void assemble_file(const char *, struct strlist *);
 static bool skip_this_pass(errflags severity);
 static void usage(void);
@@ -89,6 +99,7 @@ static const struct error_format *errfmt = &errfmt_gnu;
 static struct strlist *warn_list;
 
 unsigned int debug_nasm;        /* Debugging messages? */
+uint64_t diag_count;            /* Diagnostics not suppressed so far */
 
 static bool using_debug_info, opt_verbose_info;
 static const char *debug_format;
@@ -98,6 +109,12 @@ static const char *debug_format;
 #endif
 static bool abort_on_panic = ABORT_ON_PANIC;
 static bool keep_all;
+static const char *batch_file;
+static int batch_jobs_max;
+static const char *server_path;
+static char *cache_dir;
+static int stats_format;         /* 1 for text, 2 for JSON */
+static const char *trace_file;
 
 bool tasm_compatible_mode = false;
 enum pass_type _pass_type;
@@ -148,6 +165,7 @@ bool pp_noline;                 /* Ignore %line directives */
 #define OP_NORMAL           (1U << 0)
 #define OP_PREPROCESS       (1U << 1)
 #define OP_DEPEND           (1U << 2)
+#define OP_CACHED           (1U << 3) /* Outputs restored from the cache */
 
 static unsigned int operating_mode;
 
@@ -299,29 +317,29 @@ static void define_macros(void)
 
     if (oct->have_local) {
         strftime(temp, sizeof temp, "__?DATE?__=\"%Y-%m-%d\"", &oct->local);
-        preproc->pre_define(temp);
+        preproc->sys_define(temp);
         strftime(temp, sizeof temp, "__?DATE_NUM?__=%Y%m%d", &oct->local);
-        preproc->pre_define(temp);
+        preproc->sys_define(temp);
         strftime(temp, sizeof temp, "__?TIME?__=\"%H:%M:%S\"", &oct->local);
-        preproc->pre_define(temp);
+        preproc->sys_define(temp);
         strftime(temp, sizeof temp, "__?TIME_NUM?__=%H%M%S", &oct->local);
-        preproc->pre_define(temp);
+        preproc->sys_define(temp);
     }
 
     if (oct->have_gm) {
         strftime(temp, sizeof temp, "__?UTC_DATE?__=\"%Y-%m-%d\"", &oct->gm);
-        preproc->pre_define(temp);
+        preproc->sys_define(temp);
         strftime(temp, sizeof temp, "__?UTC_DATE_NUM?__=%Y%m%d", &oct->gm);
-        preproc->pre_define(temp);
+        preproc->sys_define(temp);
         strftime(temp, sizeof temp, "__?UTC_TIME?__=\"%H:%M:%S\"", &oct->gm);
-        preproc->pre_define(temp);
+        preproc->sys_define(temp);
         strftime(temp, sizeof temp, "__?UTC_TIME_NUM?__=%H%M%S", &oct->gm);
-        preproc->pre_define(temp);
+        preproc->sys_define(temp);
     }
 
     if (oct->have_posix) {
         snprintf(temp, sizeof temp, "__?POSIX_TIME?__=%"PRId64, oct->posix);
-        preproc->pre_define(temp);
+        preproc->sys_define(temp);
     }
 
     /*
@@ -331,7 +349,7 @@ static void define_macros(void)
      */
     snprintf(temp, sizeof(temp), "__?OUTPUT_FORMAT?__=%s",
              ofmt_alias ? ofmt_alias->shortname : ofmt->shortname);
-    preproc->pre_define(temp);
+    preproc->sys_define(temp);
 
     /*
      * Output-format specific macros.
@@ -344,7 +362,7 @@ static void define_macros(void)
      */
     if (dfmt != &null_debug_form) {
         snprintf(temp, sizeof(temp), "__?DEBUG_FORMAT?__=%s", dfmt->shortname);
-        preproc->pre_define(temp);
+        preproc->sys_define(temp);
     }
 }
 
@@ -372,9 +390,6 @@ static void emit_dependencies(struct strlist *list)
     const char *wrapstr, *nulltarget;
     const struct strlist_entry *l;
 
-    if (!list)
-        return;
-
     wrapstr = wmake ? " &\n " : " \\\n ";
     nulltarget = wmake ? "\t%null\n" : "";
 
@@ -410,8 +425,6 @@ static void emit_dependencies(struct strlist *list)
         }
     }
 
-    strlist_free(&list);
-
     if (deps != stdout)
         fclose(deps);
 }
@@ -477,6 +490,22 @@ int main(int argc, char **argv)
     if (!_progname || !_progname[0])
         _progname = "nasm";
 
+    /* A client passes its command line on to a server, if there is one */
+    if (argc > 1 && !nasm_strnicmp(argv[1], "--connect", 9)) {
+        int skip = 0;
+
+        if (argv[1][9] == '=') {
+            server_connect(argv[1] + 10, argc - 2, argv + 2);
+            skip = 1;
+        } else if (!argv[1][9] && argc > 2) {
+            server_connect(argv[2], argc - 3, argv + 3);
+            skip = 2;
+        }
+        argv[skip] = argv[0];
+        argv += skip;
+        argc -= skip;
+    }
+
     timestamp();
 
     iflag_set_default_cpu(&cpu);
@@ -515,19 +544,7 @@ int main(int argc, char **argv)
     }
 
     /* At this point we have ofmt and the name of the desired debug format */
-    if (!using_debug_info) {
-        /* No debug info, redirect to the null backend (empty stubs) */
-        dfmt = &null_debug_form;
-    } else if (!debug_format) {
-        /* Default debug format for this backend */
-        dfmt = ofmt->default_dfmt;
-    } else {
-        dfmt = dfmt_find(ofmt, debug_format);
-        if (!dfmt) {
-            nasm_fatalf(ERR_USAGE, "unrecognized debug format `%s' for output format `%s'",
-                       debug_format, ofmt->shortname);
-        }
-    }
+    select_dfmt();
 
     preproc_init(include_path);
 
@@ -538,6 +555,17 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    /* In these modes, only a worker set up for one file gets past here */
+    if (batch_file)
+        batch_run();
+    else if (server_path)
+        server_run();
+
+    if (stats_format)
+        stats_init(stats_format == 2);
+    if (trace_file)
+        trace_init(trace_file);
+
     /* Save away the default state of warnings */
     init_warnings();
 
@@ -567,18 +595,54 @@ int main(int argc, char **argv)
     if (!depend_target)
         depend_target = quote_for_make(outname);
 
-    if (!(operating_mode & (OP_PREPROCESS|OP_NORMAL))) {
+    /* Only a plain assembly, with nothing written to stdout, is cached */
+    if (cache_dir && (operating_mode & OP_NORMAL) &&
+        !((operating_mode & OP_DEPEND) && !strcmp(depend_file, "-"))) {
+        const char *files[OC_SLOTS];
+
+        files[OC_OBJECT] = outname;
+        files[OC_DEPEND] = (operating_mode & OP_DEPEND) ? depend_file : NULL;
+        files[OC_LIST]   = listname;
+
+        outcache_key("ofmt", ofmt->shortname);
+        outcache_key("dfmt", using_debug_info ? dfmt->shortname : NULL);
+        if (using_debug_info || !strcmp(ofmt->shortname, "dbg")) {
+            /* These record the name of the output and where it is */
+            char *cwd = nasm_realpath(".");
+            outcache_key("cwd", cwd);
+            outcache_key("outname", outname);
+            nasm_free(cwd);
+        }
+        if (operating_mode & OP_DEPEND)
+            outcache_key("target", depend_target);
+
+        if (outcache_lookup(cache_dir, files))
+            operating_mode = OP_CACHED;
+        else if (!depend_list)
+            depend_list = strlist_alloc(true);
+    } else {
+        nasm_free(cache_dir);
+        cache_dir = NULL;
+    }
+
+    if (!(operating_mode & (OP_PREPROCESS|OP_NORMAL|OP_CACHED))) {
             char *line;
 
             if (depend_missing_ok)
                 preproc->include_path(NULL);    /* "assume generated" */
 
-            preproc->reset(inname, PP_DEPS, depend_list);
-            ofile = NULL;
-            while ((line = preproc->getline()))
-                nasm_free(line);
-            preproc->cleanup_pass();
-            reset_warnings();
+            if (!preproc->scan_deps(inname, depend_list)) {
+                /* Fall back to running the preprocessor proper */
+                strlist_free(&depend_list);
+                depend_list = strlist_alloc(true);
+
+                preproc->reset(inname, PP_DEPS, depend_list);
+                ofile = NULL;
+                while ((line = preproc->getline()))
+                    nasm_free(line);
+                preproc->cleanup_pass();
+                reset_warnings();
+            }
     } else if (operating_mode & OP_PREPROCESS) {
             char *line;
             const char *file_name = NULL;
@@ -637,7 +701,11 @@ int main(int argc, char **argv)
         assemble_file(inname, depend_list);
 
         if (!terminate_after_phase) {
+            stats_enter(STATS_WRITE);
+            trace_begin("output", "write output", src_where());
             ofmt->cleanup();
+            trace_end();
+            stats_leave();
             cleanup_labels();
             fflush(ofile);
             if (ferror(ofile))
@@ -654,12 +722,20 @@ int main(int argc, char **argv)
 
     preproc->cleanup_session();
 
-    if (depend_list && !terminate_after_phase)
+    if ((operating_mode & OP_DEPEND) && !terminate_after_phase)
         emit_dependencies(depend_list);
 
+    if (cache_dir && !(operating_mode & OP_CACHED) &&
+        !terminate_after_phase && !diag_count)
+        outcache_store(depend_list);
+    strlist_free(&depend_list);
+
     if (want_usage)
         usage();
 
+    stats_report(inname);
+    trace_close();
+
     raa_free(offsets);
     saa_free(forwrefs);
     eval_cleanup();
@@ -861,7 +937,16 @@ enum text_options {
     OPT_LIMIT,
     OPT_KEEP_ALL,
     OPT_NO_LINE,
-    OPT_DEBUG
+    OPT_DEBUG,
+    OPT_LIST_FORMAT,
+    OPT_PRELUDE_CACHE,
+    OPT_BATCH,
+    OPT_JOBS,
+    OPT_SERVER,
+    OPT_CONNECT,
+    OPT_CACHE,
+    OPT_STATS,
+    OPT_TRACE
 };
 enum need_arg {
     ARG_NO,
@@ -893,6 +978,15 @@ static const struct textargs textopts[] = {
     {"keep-all", OPT_KEEP_ALL, ARG_NO, 0},
     {"no-line",  OPT_NO_LINE, ARG_NO, 0},
     {"debug",    OPT_DEBUG, ARG_MAYBE, 0},
+    {"list-format", OPT_LIST_FORMAT, ARG_YES, 0},
+    {"prelude-cache", OPT_PRELUDE_CACHE, ARG_YES, 0},
+    {"batch",    OPT_BATCH, ARG_YES, 0},
+    {"jobs",     OPT_JOBS,  ARG_YES, 0},
+    {"server",   OPT_SERVER, ARG_YES, 0},
+    {"connect",  OPT_CONNECT, ARG_YES, 0},
+    {"cache",    OPT_CACHE, ARG_YES, 0},
+    {"stats",    OPT_STATS, ARG_MAYBE, 0},
+    {"trace",    OPT_TRACE, ARG_YES, 0},
     {NULL, OPT_BOGUS, ARG_NO, 0}
 };
 
@@ -906,8 +1000,10 @@ static void show_version(void)
 static bool stopoptions = false;
 static bool process_arg(char *p, char *q, int pass)
 {
+    const char *arg = p;
     char *param;
     bool advance = false;
+    bool key = true;            /* Part of the key for the output cache */
 
     if (!p || !p[0])
         return false;
@@ -928,6 +1024,7 @@ static bool process_arg(char *p, char *q, int pass)
         case 'o':       /* output file */
             if (pass == 2)
                 copy_filename(&outname, param, "output");
+            key = false;        /* Keyed in main() where it matters */
             break;
 
         case 'f':       /* output format */
@@ -1255,6 +1352,59 @@ static bool process_arg(char *p, char *q, int pass)
                 case OPT_DEBUG:
                     debug_nasm = param ? strtoul(param, NULL, 10) : debug_nasm+1;
                     break;
+                case OPT_LIST_FORMAT:
+                    if (pass == 1 && !list_set_format(param))
+                        nasm_nonfatalf(ERR_USAGE,
+                                       "unknown listing format `%s'", param);
+                    break;
+                case OPT_PRELUDE_CACHE:
+                    if (pass == 2)
+                        preproc->prelude_cache(param);
+                    break;
+                case OPT_BATCH:
+                    if (pass == 1)
+                        copy_filename(&batch_file, param, "batch");
+                    break;
+                case OPT_SERVER:
+                    if (pass == 1)
+                        copy_filename(&server_path, param, "server");
+                    break;
+                case OPT_CONNECT:
+                    if (pass == 1)
+                        nasm_nonfatalf(ERR_USAGE,
+                                       "`--connect' must be the first option");
+                    break;
+                case OPT_CACHE:
+                    if (pass == 2) {
+                        nasm_free(cache_dir);
+                        cache_dir = nasm_strdup(param);
+                    }
+                    key = false;    /* Where is not what */
+                    break;
+                case OPT_STATS:
+                    if (pass != 1)
+                        break;
+                    if (!param || !nasm_stricmp(param, "text"))
+                        stats_format = 1;
+                    else if (!nasm_stricmp(param, "json"))
+                        stats_format = 2;
+                    else
+                        nasm_nonfatalf(ERR_USAGE,
+                                       "unknown statistics format `%s'", param);
+                    break;
+                case OPT_TRACE:
+                    if (pass == 1)
+                        copy_filename(&trace_file, param, "trace");
+                    key = false;    /* Where is not what */
+                    break;
+                case OPT_JOBS:
+                    if (pass == 1) {
+                        batch_jobs_max = atoi(param);
+                        if (batch_jobs_max < 1)
+                            nasm_nonfatalf(ERR_USAGE,
+                                           "invalid number of jobs `%s'", param);
+                    }
+                    break;
                 case OPT_HELP:
                     help(stdout);
                     exit(0);
@@ -1277,6 +1427,9 @@ static bool process_arg(char *p, char *q, int pass)
         copy_filename(&inname, p, "input");
     }
 
+    if (pass == 2 && key)
+        outcache_key(arg, advance ? q : NULL);
+
     return advance;
 }
 
@@ -1437,13 +1590,20 @@ static void parse_cmdline(int argc, char **argv, int pass)
         argv += advance, argc -= advance;
     }
 
-    /*
-     * Look for basic command line typos. This definitely doesn't
-     * catch all errors, but it might help cases of fumbled fingers.
-     */
     if (pass != 2)
         return;
 
+    if (!batch_file && !server_path)
+        check_filenames();
+    open_error_file();
+}
+
+/*
+ * Look for basic command line typos. This definitely doesn't
+ * catch all errors, but it might help cases of fumbled fingers.
+ */
+static void check_filenames(void)
+{
     if (!inname)
         nasm_fatalf(ERR_USAGE, "no input file specified");
     else if ((errname && !strcmp(inname, errname)) ||
@@ -1451,7 +1611,10 @@ static void parse_cmdline(int argc, char **argv, int pass)
              (listname &&  !strcmp(inname, listname))  ||
              (depend_file && !strcmp(inname, depend_file)))
         nasm_fatalf(ERR_USAGE, "will not overwrite input file");
+}
 
+static void open_error_file(void)
+{
     if (errname) {
         error_file = nasm_open_write(errname, NF_TEXT);
         if (!error_file) {
@@ -1461,6 +1624,229 @@ static void parse_cmdline(int argc, char **argv, int pass)
     }
 }
 
+static void select_dfmt(void)
+{
+    if (!using_debug_info) {
+        /* No debug info, redirect to the null backend (empty stubs) */
+        dfmt = &null_debug_form;
+    } else if (!debug_format) {
+        /* Default debug format for this backend */
+        dfmt = ofmt->default_dfmt;
+    } else {
+        dfmt = dfmt_find(ofmt, debug_format);
+        if (!dfmt) {
+            nasm_fatalf(ERR_USAGE, "unrecognized debug format `%s' for output format `%s'",
+                       debug_format, ofmt->shortname);
+        }
+    }
+}
+
+/*
+ * Batch mode: each line of the batch file holds the input file and
+ * options for one assembly, written as on the command line.  All the
+ * setup common to the whole batch is done once, and then a worker
+ * process is forked for each line, so they start out with the option
+ * parsing, tables and include path already in place.
+ */
+struct batch_entry {
+    int line;                   /* Line number in the batch file */
+    int argc;
+    char **argv;                /* NULL-terminated */
+};
+
+static struct batch_entry *batch_entries;
+static int batch_nfailed;
+
+/*
+ * Split a line at white space; double quotes group words containing
+ * white space.  The words are stored in place.
+ */
+static char **batch_split(char *p, int *argcp)
+{
+    char **argv = NULL;
+    int argc = 0, size = 0;
+
+    while (*(p = nasm_skip_spaces(p))) {
+        char *q = p;
+        bool quoted = false;
+
+        if (argc + 2 > size) {
+            size = size ? size << 1 : 8;
+            argv = nasm_realloc(argv, size * sizeof *argv);
+        }
+        argv[argc++] = q;
+
+        while (*p && (quoted || !nasm_isspace(*p))) {
+            if (*p == '\"')
+                quoted = !quoted;
+            else
+                *q++ = *p;
+            p++;
+        }
+        if (*p)
+            p++;
+        *q = '\0';
+    }
+
+    if (argv)
+        argv[argc] = NULL;
+    *argcp = argc;
+    return argv;
+}
+
+static struct batch_entry *batch_read(const char *file, int *nentries)
+{
+    FILE *fp;
+    char *buf = NULL, *p, *eol;
+    size_t len = 0, size = 0, n;
+    struct batch_entry *entries = NULL;
+    int nent = 0, esize = 0, line = 0;
+
+    fp = nasm_open_read(file, NF_TEXT);
+    if (!fp)
+        nasm_fatalf(ERR_USAGE, "unable to open batch file `%s'", file);
+
+    do {
+        if (size - len < BUFSIZ) {
+            size += size + BUFSIZ;
+            buf = nasm_realloc(buf, size + 1);
+        }
+        n = fread(buf + len, 1, size - len, fp);
+        len += n;
+    } while (n);
+    if (ferror(fp))
+        nasm_fatalf(ERR_USAGE, "error reading batch file `%s'", file);
+    fclose(fp);
+    buf[len] = '\0';
+
+    for (p = buf; *p; p = eol) {
+        struct batch_entry *e;
+        char **argv;
+        int argc;
+
+        line++;
+        eol = p + strcspn(p, "\r\n");
+        if (*eol == '\r' && eol[1] == '\n')
+            *eol++ = '\0';
+        if (*eol)
+            *eol++ = '\0';
+
+        p = nasm_skip_spaces(p);
+        if (*p == '#')
+            continue;           /* Comment */
+
+        argv = batch_split(p, &argc);
+        if (!argc)
+            continue;
+
+        if (nent >= esize) {
+            esize = esize ? esize << 1 : 64;
+            entries = nasm_realloc(entries, esize * sizeof *entries);
+        }
+        e = &entries[nent++];
+        e->line = line;
+        e->argc = argc;
+        e->argv = argv;
+    }
+
+    /* The words point into buf, which is never freed */
+    *nentries = nent;
+    return entries;
+}
+
+/*
+ * Set up a worker for one file.  Its options come on top of those
+ * given on the command line, processed in the same two phases; with
+ * env, they are preceded by those in its own NASMENV.
+ */
+static void worker_setup(int argc, char **argv, bool env)
+{
+    bool had_errname = !!errname;
+    const char *envreal = env ? getenv("NASMENV") : NULL;
+    int pass, i;
+
+    /* Failures of earlier jobs are none of this one's business */
+    terminate_after_phase = false;
+
+    for (pass = 1; pass <= 2; pass++) {
+        stopoptions = false;
+        if (envreal) {
+            char *envcopy = nasm_strdup(envreal);
+            process_args(envcopy, pass);
+            nasm_free(envcopy);
+        }
+        for (i = 0; i < argc; i++) {
+            if (process_arg(argv[i], argv[i+1], pass))
+                i++;
+        }
+        if (pass == 1) {
+            /* Redo the system definitions for this job's format */
+            select_dfmt();
+            preproc_init(include_path);
+        }
+    }
+
+    if (!had_errname)
+        open_error_file();
+    check_filenames();
+
+    if (terminate_after_phase)
+        exit(1);
+}
+
+static void batch_failed(int job, int sig)
+{
+    const struct batch_entry *e = &batch_entries[job];
+
+    batch_nfailed++;
+    if (sig)
+        nasm_nonfatalf(ERR_NOFILE, "%s:%d: assembly terminated by signal %d",
+                       batch_file, e->line, sig);
+    else
+        nasm_nonfatalf(ERR_NOFILE, "%s:%d: assembly failed",
+                       batch_file, e->line);
+}
+
+static void batch_run(void)
+{
+    int nentries, job;
+
+    if (inname || outname || listname || depend_file)
+        nasm_fatalf(ERR_USAGE, "with --batch, input and output files go in the batch file");
+
+    batch_entries = batch_read(batch_file, &nentries);
+
+    job = batch_jobs(nentries, batch_jobs_max, batch_failed);
+    if (job >= 0) {
+        worker_setup(batch_entries[job].argc, batch_entries[job].argv, false);
+        return;
+    }
+
+    exit(batch_nfailed ? 1 : 0);
+}
+
+/*
+ * Server mode: a worker is forked for each request from a client
+ * started with --connect, and set up with the client's command line
+ * on top of the server's own.
+ */
+static void server_run(void)
+{
+    char **argv;
+    int argc;
+
+    if (inname || outname || listname || depend_file)
+        nasm_fatalf(ERR_USAGE, "with --server, input and output files come from the clients");
+
+    /* Every worker can start from the prelude as run with our own options */
+    preproc->prelude_warm();
+
+    argv = server_listen(server_path, &argc);
+
+    timestamp();                /* For the client's time zone, and now */
+    worker_setup(argc, argv, true);
+}
+
 static void forward_refs(insn *instruction)
 {
     int i;
@@ -1547,9 +1933,12 @@ static void process_insn(insn *instruction)
 static void assemble_file(const char *fname, struct strlist *depend_list)
 {
     char *line;
+    const struct linetok *toks;
+    size_t ntoks;
     insn output_ins;
     uint64_t prev_offset_changed;
     int64_t stall_count = 0; /* Make sure we make forward progress... */
+    bool relaxed = false;    /* Labels were moved by relax_solve() */
 
     switch (cmd_sb) {
     case 16:
@@ -1624,6 +2013,14 @@ static void assemble_file(const char *fname, struct strlist *depend_list)
         ofmt->reset();
         switch_segment(ofmt->section(NULL, &globalbits));
         preproc->reset(fname, PP_NORMAL, pass_final() ? depend_list : NULL);
+        relax_begin();
+        stats_pass_begin();
+        if (trace_enabled) {
+            char name[64];
+            snprintf(name, sizeof name, "pass %"PRId64" (%s)",
+                     pass_count(), pass_type_name());
+            trace_begin("pass", name, src_where());
+        }
 
         globallineno = 0;
 
@@ -1640,10 +2037,15 @@ static void assemble_file(const char *fname, struct strlist *depend_list)
                 goto end_of_line; /* Just do final cleanup */
 
             /* Not a directive, or even something that starts with [ */
+            toks = preproc->tokens(&ntoks);
+            stdscan_set_tokens(toks, ntoks);
+            stats_enter(STATS_PARSE);
             parse_line(line, &output_ins);
+            stats_leave();
             forward_refs(&output_ins);
             process_insn(&output_ins);
             cleanup_insn(&output_ins);
+            stdscan_set_tokens(NULL, 0);
 
         end_of_line:
             nasm_free(line);
@@ -1701,7 +2103,24 @@ static void assemble_file(const char *fname, struct strlist *depend_list)
             }
         }
 
+        /*
+         * While labels are still moving, try to settle the sizes of
+         * all the jumps at once rather than one pass at a time. If
+         * the pass after that still sees labels move, the prediction
+         * was upset by something other than jumps: put the labels
+         * back as they were before it, and carry on with plain
+         * passes so that the result is what it would have been.
+         */
+        if (relaxed && global_offset_changed) {
+            relax_disable();
+            unshift_labels();
+        }
+        relaxed = global_offset_changed && !terminate_after_phase &&
+            relax_solve();
+
         reset_warnings();
+        stats_pass_end(globallineno);
+        trace_end();
     }
 
     if (opt_verbose_info && pass_final()) {
@@ -1709,6 +2128,7 @@ static void assemble_file(const char *fname, struct strlist *depend_list)
         nasm_info("assembly required 1+%"PRId64"+2 passes\n", pass_count()-3);
     }
 
+    relax_cleanup();
     lfmt->cleanup();
     strlist_free(&warn_list);
 }
@@ -1832,6 +2252,8 @@ static fatal_func die_hard(errflags true_type, errflags severity)
         ofile = NULL;
     }
 
+    trace_close();
+
     if (severity & ERR_USAGE)
         usage();
 
@@ -1906,6 +2328,8 @@ void nasm_verror(errflags severity, const char *fmt, va_list args)
     if (is_suppressed(severity))
         return;
 
+    diag_count++;
+
     if (!(severity & ERR_NOFILE)) {
         src_get(&lineno, &currentfile);
         if (!currentfile) {
@@ -2033,6 +2457,13 @@ static void help(FILE *out)
         "\n"
         "    -o outfile    write output to outfile\n"
         "    --keep-all    output files will not be removed even if an error happens\n"
+        "    --batch file  assemble each input file and options listed in file\n"
+        "    --jobs n      run up to n of the --batch assemblies at a time\n"
+        "    --server sock serve assembly requests at the Unix socket sock\n"
+        "    --connect sock (first option) have the server at sock do the work\n"
+        "    --cache dir   reuse the outputs of an identical earlier assembly kept in dir\n"
+        "    --stats[=json] report time spent and other statistics on stderr\n"
+        "    --trace file  write a timeline of the assembly to file, for Perfetto\n"
         "\n"
         "    -Xformat      specifiy error reporting format (gnu or vc)\n"
         "    -s            redirect error messages to stdout\n"
@@ -2061,6 +2492,7 @@ static void help(FILE *out)
         "    -l listfile   write listing to a list file\n"
         "    -Lflags...    add optional information to the list file\n"
         "       -Lb        show builtin macro packages (standard and %use)\n"
+        "       -Lc        collapse data longer than one line to a byte count\n"
         "       -Ld        show byte and repeat counts in decimal, not hex\n"
         "       -Le        show the preprocessed output\n"
         "       -Lf        ignore .nolist (force output)\n"
@@ -2069,6 +2501,7 @@ static void help(FILE *out)
         "       -Ls        show all single-line macro definitions\n"
         "       -Lw        flush the output after every line\n"
         "       -L+        enable all listing options (very verbose!)\n"
+        "   --list-format fmt  write the list file as text (default) or json\n"
         "\n"
         "    -Oflags...    optimize opcodes, immediates and branch offsets\n"
         "       -O0        no optimization\n"
@@ -2086,6 +2519,7 @@ static void help(FILE *out)
         "   --pragma str   pre-executes a specific %%pragma\n"
         "   --before str   add line (usually a preprocessor statement) before the input\n"
         "   --no-line      ignore %line directives in input\n"
+        "   --prelude-cache file  keep the macro state after -P/-D/-U etc. in file\n"
         "\n"
         "   --prefix str   prepend the given string to the names of all extern,\n"
         "                  common and global symbols (also --gprefix)\n"
@@ -0,0 +1,494 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 1996-2020 The NASM Authors - All Rights Reserved
+ *   See the file AUTHORS included with the NASM distribution for
+ *   the specific copyright holders.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+/*
+ * outcache.c   a cache of finished outputs, keyed by their inputs
+ *
+ * With --cache, the object file, dependency file and listing of a
+ * successful assembly are kept in a cache directory, and a later
+ * assembly of the same inputs with the same options copies them from
+ * there instead of assembling anything.  Only the contents of the
+ * files matter, not their timestamps.
+ *
+ * Which files an assembly reads is only known once it is done, so a
+ * lookup takes two steps.  The options, output and debug formats and
+ * the version of NASM make up the first key, under which a manifest
+ * lists the inputs last read with those options and the MD5 digest of
+ * each; files which were looked for and not found are listed as well,
+ * including every place on the include path that was tried, as are
+ * the environment variables read with %! or %ifenv and the digests of
+ * their values.  If all of them are still the same, the first key and
+ * those lines together are the key the outputs were stored under.
+ *
+ * An assembly which expanded one of the date and time macros is not
+ * stored at all, as its output is different every time.
+ *
+ * Everything is written to a temporary file and renamed into place,
+ * so assemblies sharing a cache never see a partial file; the digests
+ * of the outputs, kept in the manifest, catch any other damage.
+ */
+
+#include "compiler.h"
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "nasmlib.h"
+#include "error.h"
+#include "md5.h"
+#include "ver.h"
+#include "outcache.h"
+
+#define MANIFEST_MAGIC "nasm-outcache 2"
+#define HEXBYTES (MD5_HASHBYTES*2)
+
+static const char * const slot_ext[OC_SLOTS] = { "o", "d", "l" };
+
+static MD5_CTX key_ctx;
+static bool key_started;
+static unsigned char key_digest[MD5_HASHBYTES];
+
+static const char *cache_dir;
+static const char *out_files[OC_SLOTS];
+
+/* Noted while assembling after a miss */
+static struct strlist *missing;         /* Files not found */
+static struct strlist *environ_lines;   /* Manifest lines for %! */
+static bool dated;                      /* Date or time macros expanded */
+
+void outcache_key(const char *what, const char *arg)
+{
+    if (!key_started) {
+        MD5Init(&key_ctx);
+        key_started = true;
+    }
+
+    MD5Update(&key_ctx, (const unsigned char *)what, strlen(what) + 1);
+    if (arg)
+        MD5Update(&key_ctx, (const unsigned char *)arg, strlen(arg) + 1);
+    else
+        MD5Update(&key_ctx, (const unsigned char *)"\377", 1);
+}
+
+static void hex_digest(char *hex, const unsigned char *digest)
+{
+    static const char hexdigits[] = "0123456789abcdef";
+    int i;
+
+    for (i = 0; i < MD5_HASHBYTES; i++) {
+        *hex++ = hexdigits[digest[i] >> 4];
+        *hex++ = hexdigits[digest[i] & 15];
+    }
+    *hex = '\0';
+}
+
+static bool parse_digest(unsigned char *digest, const char *hex)
+{
+    int i, v;
+
+    for (i = 0; i < HEXBYTES; i++) {
+        char c = hex[i];
+
+        if (c >= '0' && c <= '9')
+            v = c - '0';
+        else if (c >= 'a' && c <= 'f')
+            v = c - 'a' + 10;
+        else
+            return false;
+
+        if (i & 1)
+            digest[i >> 1] |= v;
+        else
+            digest[i >> 1] = v << 4;
+    }
+
+    return true;
+}
+
+static void md5_buffer(unsigned char *digest, const void *buf, size_t len)
+{
+    MD5_CTX ctx;
+
+    MD5Init(&ctx);
+    MD5Update(&ctx, buf, len);
+    MD5Final(digest, &ctx);
+}
+
+/* The name of a file in the cache directory */
+static char *cache_file(const char *hex, const char *ext)
+{
+    char *name = nasm_asprintf("%s.%s", hex, ext);
+    char *path = nasm_catfile(cache_dir, name);
+
+    nasm_free(name);
+    return path;
+}
+
+static char *read_file(const char *file, size_t *lenp)
+{
+    FILE *fp;
+    off_t len;
+    char *buf = NULL;
+
+    fp = nasm_open_read(file, NF_BINARY);
+    if (!fp)
+        return NULL;
+
+    len = nasm_file_size(fp);
+    if (len != (off_t)-1) {
+        buf = nasm_malloc(len + 1);
+        if (fread(buf, 1, len, fp) == (size_t)len) {
+            buf[len] = '\0';
+            *lenp = len;
+        } else {
+            nasm_free(buf);
+            buf = NULL;
+        }
+    }
+
+    fclose(fp);
+    return buf;
+}
+
+static bool write_file(const char *file, const void *data, size_t len)
+{
+    FILE *fp;
+    bool ok;
+
+    fp = nasm_open_write(file, NF_BINARY);
+    if (!fp)
+        return false;
+
+    ok = fwrite(data, 1, len, fp) == len;
+    ok &= !fclose(fp);
+    return ok;
+}
+
+/* Write a file in the cache, so that it appears all at once */
+static bool put_file(const char *file, const void *data, size_t len)
+{
+    char *tmp;
+    bool ok;
+
+#ifdef HAVE_GETPID
+    tmp = nasm_asprintf("%s.%ld.tmp", file, (long)getpid());
+#else
+    tmp = nasm_strcat(file, ".tmp");
+#endif
+
+    ok = write_file(tmp, data, len);
+    if (ok && rename(tmp, file)) {
+        /* Not every system renames over an existing file */
+        remove(file);
+        ok = !rename(tmp, file);
+    }
+    if (!ok)
+        remove(tmp);
+
+    nasm_free(tmp);
+    return ok;
+}
+
+/* The key of the outputs: the first key, and each manifest line checked */
+static void result_start(MD5_CTX *ctx)
+{
+    MD5Init(ctx);
+    MD5Update(ctx, key_digest, MD5_HASHBYTES);
+}
+
+static void result_add(MD5_CTX *ctx, const char *line)
+{
+    MD5Update(ctx, (const unsigned char *)line, strlen(line) + 1);
+}
+
+/* Parse "digest name" or "- name", as in i and e lines */
+static const char *parse_entry(const char *p, bool *present,
+                               unsigned char *digest)
+{
+    *present = *p != '-';
+    if (*present) {
+        if (!parse_digest(digest, p))
+            return NULL;
+        p += HEXBYTES;
+    } else {
+        p++;
+    }
+    return *p == ' ' ? p + 1 : NULL;
+}
+
+/* The manifest line for an environment variable and its value */
+static const struct strlist_entry *
+environ_line(struct strlist *list, const char *name, const char *value)
+{
+    unsigned char digest[MD5_HASHBYTES];
+    char hex[HEXBYTES + 1];
+
+    if (!value)
+        return strlist_printf(list, "e - %s", name);
+
+    md5_buffer(digest, value, strlen(value));
+    hex_digest(hex, digest);
+    return strlist_printf(list, "e %s %s", hex, name);
+}
+
+void outcache_missing(const char *file)
+{
+    if (!cache_dir)
+        return;
+
+    if (!missing)
+        missing = strlist_alloc(true);
+    strlist_add(missing, file);
+}
+
+void outcache_environ(const char *name, const char *value)
+{
+    if (!cache_dir)
+        return;
+
+    if (!environ_lines)
+        environ_lines = strlist_alloc(true);
+    environ_line(environ_lines, name, value);
+}
+
+void outcache_dated(void)
+{
+    dated = true;
+}
+
+bool outcache_lookup(const char *dir, const char * const files[OC_SLOTS])
+{
+    MD5_CTX ctx;
+    unsigned char digest[MD5_HASHBYTES], want[MD5_HASHBYTES];
+    unsigned char out_digest[OC_SLOTS][MD5_HASHBYTES];
+    bool have[OC_SLOTS];
+    char *data[OC_SLOTS];
+    size_t len[OC_SLOTS];
+    char hex[HEXBYTES + 1];
+    char *manifest, *line, *next, *file;
+    size_t mlen;
+    int slot;
+    bool hit = false;
+
+    cache_dir = dir;
+    memcpy(out_files, files, sizeof out_files);
+
+    outcache_key("version", nasm_version);
+    outcache_key("signature", nasm_signature());
+    ctx = key_ctx;
+    MD5Final(key_digest, &ctx);
+    hex_digest(hex, key_digest);
+
+    file = cache_file(hex, "m");
+    manifest = read_file(file, &mlen);
+    nasm_free(file);
+    if (!manifest)
+        return false;
+
+    memset(have, 0, sizeof have);
+    memset(data, 0, sizeof data);
+
+    if (strncmp(manifest, MANIFEST_MAGIC "\n", sizeof MANIFEST_MAGIC))
+        goto done;
+
+    result_start(&ctx);
+    for (line = manifest + sizeof MANIFEST_MAGIC; *line; line = next) {
+        next = strchr(line, '\n');
+        if (!next)
+            goto done;
+        *next++ = '\0';
+
+        if (line[0] == 'i' && line[1] == ' ') {
+            /* An input: "i digest file", or "i - file" if missing */
+            bool present;
+            const char *name = parse_entry(line + 2, &present, want);
+
+            if (!name || MD5File(name, digest) != present ||
+                (present && memcmp(want, digest, MD5_HASHBYTES)))
+                goto done;
+            result_add(&ctx, line);
+        } else if (line[0] == 'e' && line[1] == ' ') {
+            /* An environment variable: "e digest name", or "e - name" */
+            bool present;
+            const char *name = parse_entry(line + 2, &present, want);
+            const char *value;
+
+            if (!name)
+                goto done;
+            value = getenv(name);
+            if (!value != !present)
+                goto done;
+            if (value) {
+                md5_buffer(digest, value, strlen(value));
+                if (memcmp(want, digest, MD5_HASHBYTES))
+                    goto done;
+            }
+            result_add(&ctx, line);
+        } else if (line[0] == 'o' && line[1] == ' ') {
+            /* An output: "o slot digest" */
+            slot = line[2] - '0';
+            if (slot < 0 || slot >= OC_SLOTS || line[3] != ' ' ||
+                !parse_digest(out_digest[slot], line + 4))
+                goto done;
+            have[slot] = true;
+        } else {
+            goto done;
+        }
+    }
+    MD5Final(digest, &ctx);
+    hex_digest(hex, digest);
+
+    for (slot = 0; slot < OC_SLOTS; slot++) {
+        if (!files[slot])
+            continue;
+        if (!have[slot])
+            goto done;
+
+        file = cache_file(hex, slot_ext[slot]);
+        data[slot] = read_file(file, &len[slot]);
+        nasm_free(file);
+        if (!data[slot])
+            goto done;
+
+        md5_buffer(digest, data[slot], len[slot]);
+        if (memcmp(digest, out_digest[slot], MD5_HASHBYTES))
+            goto done;
+    }
+
+    /* Everything is there, so this is a hit whatever happens now */
+    hit = true;
+    for (slot = 0; slot < OC_SLOTS; slot++) {
+        if (files[slot] && !write_file(files[slot], data[slot], len[slot]))
+            nasm_nonfatal("unable to write output file `%s'", files[slot]);
+    }
+
+done:
+    for (slot = 0; slot < OC_SLOTS; slot++)
+        nasm_free(data[slot]);
+    nasm_free(manifest);
+    return hit;
+}
+
+void outcache_store(const struct strlist *inputs)
+{
+    const struct strlist_entry *e;
+    struct strlist *manifest;
+    MD5_CTX ctx;
+    unsigned char digest[MD5_HASHBYTES];
+    char hex[HEXBYTES + 1], dhex[HEXBYTES + 1];
+    char *data, *file;
+    size_t len;
+    int slot;
+    bool ok = true;
+
+    if (!cache_dir || dated)
+        return;
+
+    manifest = strlist_alloc(false);
+    strlist_add(manifest, MANIFEST_MAGIC);
+
+    result_start(&ctx);
+    strlist_for_each(e, inputs) {
+        const struct strlist_entry *l;
+
+        if (strchr(e->str, '\n')) {
+            ok = false;         /* Cannot be listed in the manifest */
+            goto done;
+        }
+        if (MD5File(e->str, digest)) {
+            hex_digest(dhex, digest);
+            l = strlist_printf(manifest, "i %s %s", dhex, e->str);
+        } else {
+            l = strlist_printf(manifest, "i - %s", e->str);
+        }
+        result_add(&ctx, l->str);
+    }
+    strlist_for_each(e, missing) {
+        if (strchr(e->str, '\n')) {
+            ok = false;
+            goto done;
+        }
+        if (MD5File(e->str, digest))
+            goto done;          /* Appeared meanwhile; try again next time */
+        result_add(&ctx, strlist_printf(manifest, "i - %s", e->str)->str);
+    }
+    strlist_for_each(e, environ_lines) {
+        if (strchr(e->str, '\n')) {
+            ok = false;
+            goto done;
+        }
+        result_add(&ctx, strlist_add(manifest, e->str)->str);
+    }
+    MD5Final(digest, &ctx);
+    hex_digest(hex, digest);
+
+    for (slot = 0; slot < OC_SLOTS; slot++) {
+        if (!out_files[slot])
+            continue;
+
+        data = read_file(out_files[slot], &len);
+        if (!data) {
+            ok = false;
+            goto done;
+        }
+
+        md5_buffer(digest, data, len);
+        hex_digest(dhex, digest);
+        strlist_printf(manifest, "o %d %s", slot, dhex);
+
+        file = cache_file(hex, slot_ext[slot]);
+        ok = put_file(file, data, len);
+        nasm_free(file);
+        nasm_free(data);
+        if (!ok)
+            goto done;
+    }
+
+    /* The manifest goes last, once everything it refers to is there */
+    hex_digest(hex, key_digest);
+    file = cache_file(hex, "m");
+    data = strlist_linearize(manifest, '\n');
+    ok = put_file(file, data, strlist_size(manifest));
+    nasm_free(data);
+    nasm_free(file);
+
+done:
+    if (!ok)
+        nasm_warn(WARN_OTHER, "unable to store the output in cache directory `%s'",
+                  cache_dir);
+    strlist_free(&manifest);
+    strlist_free(&missing);
+    strlist_free(&environ_lines);
+}
@@ -0,0 +1,83 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 1996-2020 The NASM Authors - All Rights Reserved
+ *   See the file AUTHORS included with the NASM distribution for
+ *   the specific copyright holders.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+/*
+ * outcache.h - cache of finished outputs for --cache
+ */
+
+#ifndef NASM_OUTCACHE_H
+#define NASM_OUTCACHE_H
+
+#include "strlist.h"
+
+/* The outputs which are cached, indexed by slot */
+enum outcache_slot {
+    OC_OBJECT,                  /* The object file */
+    OC_DEPEND,                  /* The dependency file from -MD */
+    OC_LIST,                    /* The listing file */
+    OC_SLOTS
+};
+
+/*
+ * Add something which affects the outputs to the key they are
+ * cached under: an option and its argument, if it took one, or
+ * anything else with a null argument.
+ */
+void outcache_key(const char *what, const char *arg);
+
+/*
+ * Look up the outputs for the key in the cache directory dir, and
+ * write them to the files named for each slot (NULL for an output
+ * which is not wanted).  Returns true if they were found and written.
+ */
+bool outcache_lookup(const char *dir, const char * const files[OC_SLOTS]);
+
+/*
+ * While assembling after a miss: a file looked for and not found,
+ * such as each place on the include path an include file was not
+ * in, and an environment variable read (value NULL if unset).
+ */
+void outcache_missing(const char *file);
+void outcache_environ(const char *name, const char *value);
+
+/* The date or time went into the output, so it is not to be stored */
+void outcache_dated(void);
+
+/*
+ * After a successful assembly which missed in the cache, store its
+ * outputs in it, under the inputs it read.
+ */
+void outcache_store(const struct strlist *inputs);
+
+#endif
@@ -42,6 +42,7 @@
 #include "nasm.h"
 #include "insns.h"
 #include "nasmlib.h"
+#include "bytesex.h"
 #include "error.h"
 #include "stdscan.h"
 #include "eval.h"
@@ -408,6 +409,39 @@ static int value_to_extop(expr *vect, extop *eop, int32_t myseg)
     return 0;
 }
 
+/*
+ * Runs of two or more constant integers of the same size are stored
+ * as a single byte string (EOT_DB_PACKED) rather than as a chain of
+ * extops, so that large data tables are cheap to size and emit.
+ * Anything which needs a relocation, or a diagnostic from the output
+ * stage, is left as an ordinary EOT_DB_NUMBER.
+ */
+static bool is_packable(const extop *eop)
+{
+    return eop->type == EOT_DB_NUMBER && eop->dup == 1 &&
+        eop->elem >= 1 && eop->elem <= 8 &&
+        eop->val.num.segment == NO_SEG && eop->val.num.wrt == NO_SEG &&
+        !eop->val.num.relative &&
+        !overflow_general(eop->val.num.offset, eop->elem) &&
+        location.segment != NO_SEG;
+}
+
+static void pack_number(extop *packed, size_t *size, int64_t value)
+{
+    size_t len = packed->val.string.len;
+    uint8_t *p;
+
+    if (len + packed->elem > *size) {
+        *size = *size ? *size << 1 : 64;
+        packed->val.string.data =
+            nasm_realloc(packed->val.string.data, *size);
+    }
+
+    p = (uint8_t *)packed->val.string.data + len;
+    WRITEADDR(p, value, packed->elem);
+    packed->val.string.len = len + packed->elem;
+}
+
 /*
  * Parse an extended expression, used by db et al. "elem" is the element
  * size; initially comes from the specific opcode (e.g. db == 1) but
@@ -416,6 +450,8 @@ static int value_to_extop(expr *vect, extop *eop, int32_t myseg)
 static int parse_eops(extop **result, bool critical, int elem)
 {
     extop *eop = NULL, *prev = NULL;
+    extop *packed = NULL;       /* Packed run being appended to */
+    size_t packed_size = 0;     /* Allocated size of its data */
     extop **tail = result;
     int sign;
     int i = tokval.t_type;
@@ -461,6 +497,8 @@ static int parse_eops(extop **result, bool critical, int elem)
                 eop->val   = subexpr->val;
                 eop->type  = subexpr->type;
                 eop->dup  *= subexpr->dup;
+                if (subexpr->type == EOT_DB_PACKED)
+                    eop->elem = subexpr->elem;
                 nasm_free(subexpr);
             } else {
                 eop->type = EOT_EXTOP;
@@ -593,6 +631,21 @@ static int parse_eops(extop **result, bool critical, int elem)
             /* Coalesce multiple EOT_DB_RESERVE */
             prev->dup += eop->dup;
             nasm_free(eop);
+        } else if (prev && prev->elem == eop->elem && is_packable(eop) &&
+                   (prev == packed || is_packable(prev))) {
+            /* Coalesce constant integers into a packed byte string */
+            if (prev != packed) {
+                int64_t value = prev->val.num.offset;
+
+                prev->type = EOT_DB_PACKED;
+                prev->val.string.data = NULL;
+                prev->val.string.len = 0;
+                packed = prev;
+                packed_size = 0;
+                pack_number(packed, &packed_size, value);
+            }
+            pack_number(packed, &packed_size, eop->val.num.offset);
+            nasm_free(eop);
         } else {
             /* Add this eop to the end of the chain */
             prev = eop;
@@ -1325,6 +1378,7 @@ static void free_eops(extop *e)
             break;
 
         case EOT_DB_STRING_FREE:
+        case EOT_DB_PACKED:
             nasm_free(e->val.string.data);
             break;
 
@@ -73,6 +73,14 @@ static void nop_reset(const char *file, enum preproc_mode mode,
     strlist_add(deplist, file);
 }
 
+static bool nop_scan_deps(const char *file, struct strlist *deplist)
+{
+    (void)file;
+    (void)deplist;
+
+    return false;
+}
+
 static char *nop_getline(void)
 {
     char *buffer, *p, *q;
@@ -133,6 +141,13 @@ static char *nop_getline(void)
     return buffer;
 }
 
+static const struct linetok *nop_tokens(size_t *ntoks)
+{
+    /* We never split up the line; leave it all to the scanner */
+    *ntoks = 0;
+    return NULL;
+}
+
 static void nop_cleanup_pass(void)
 {
     if (nop_fp) {
@@ -156,6 +171,11 @@ static void nop_pre_define(char *definition)
     (void)definition;
 }
 
+static void nop_sys_define(char *definition)
+{
+    (void)definition;
+}
+
 static void nop_pre_undefine(char *definition)
 {
     (void)definition;
@@ -177,6 +197,16 @@ static void nop_include_path(struct strlist *list)
     (void)list;
 }
 
+static void nop_prelude_cache(const char *file)
+{
+    (void)file;
+}
+
+static void nop_prelude_warm(void)
+{
+    /* Nothing to do */
+}
+
 static void nop_error_list_macros(errflags severity)
 {
     (void)severity;
@@ -191,15 +221,20 @@ static bool nop_suppress_error(errflags severity)
 const struct preproc_ops preproc_nop = {
     nop_init,
     nop_reset,
+    nop_scan_deps,
     nop_getline,
+    nop_tokens,
     nop_cleanup_pass,
     nop_cleanup_session,
     nop_extra_stdmac,
     nop_pre_define,
+    nop_sys_define,
     nop_pre_undefine,
     nop_pre_include,
     nop_pre_command,
     nop_include_path,
+    nop_prelude_cache,
+    nop_prelude_warm,
     nop_error_list_macros,
     nop_suppress_error
 };
@@ -63,6 +63,11 @@
 #include "compiler.h"
 
 #include "nctype.h"
+#include <errno.h>
+
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 
 #include "nasm.h"
 #include "nasmlib.h"
@@ -75,6 +80,11 @@
 #include "tokens.h"
 #include "tables.h"
 #include "listing.h"
+#include "md5.h"
+#include "ver.h"
+#include "stats.h"
+#include "trace.h"
+#include "outcache.h"
 
 typedef struct SMacro SMacro;
 typedef struct MMacro MMacro;
@@ -444,6 +454,7 @@ struct Include {
     struct mstk mstk;
     int lineno, lineinc;
     bool nolist;
+    bool traced;                /* A --trace span is open for the file */
 };
 
 /*
@@ -465,6 +476,9 @@ struct deadman {
 
 static struct deadman smacro_deadman, mmacro_deadman;
 
+/* A --trace span is open for the outermost multi-line macro call */
+static bool mmacro_traced;
+
 /*
  * Conditional assembly: we maintain a separate stack of these for
  * each level of file inclusion. (The only reason we keep the
@@ -574,6 +588,7 @@ static struct strlist *deplist;
 static uint64_t unique;     /* unique identifier numbers */
 
 static Line *predef = NULL;
+static Line *sysdef = NULL;     /* Made by NASM itself, run before predef */
 static bool do_predef;
 static enum preproc_mode pp_mode;
 
@@ -616,6 +631,58 @@ static macros_t *extrastdmac;
  */
 static bool *use_loaded;
 
+/*
+ * State of the prelude snapshot (--prelude-cache); see the comment
+ * before snap_begin().
+ */
+enum snap_state {
+    SNAP_NONE,                  /* No snapshot, or not usable */
+    SNAP_CHECK,                 /* Snapshot file not examined yet */
+    SNAP_SAVE,                  /* Record the prelude and write it out */
+    SNAP_LOAD,                  /* Snapshot is valid; load it */
+    SNAP_WARM                   /* Made before a fork; check it first */
+};
+
+struct snapbuf {
+    unsigned char *p;
+    size_t len, size;
+};
+
+static struct {
+    enum snap_state state;
+    const char *file;           /* Snapshot file name */
+    const unsigned char *data;  /* Snapshot file contents */
+    size_t len;
+    bool mapped;                /* data is mapped, not allocated */
+    const unsigned char *body;  /* Start of the saved state in data */
+
+    unsigned char key[MD5_HASHBYTES];
+    const unsigned char *deps_at; /* Dependency list in data */
+    uint32_t ndeps;
+
+    /* Recording the prelude */
+    bool recording;
+    const Include *prelude;     /* Virtual include file of the prelude */
+    uint64_t diags;             /* diag_count when the prelude started */
+    bool pass_used;             /* __?PASS?__ has been expanded */
+    bool env_used;              /* The environment has been read */
+    struct strlist *deps;       /* Files the prelude read */
+    struct snapbuf lines;       /* Lines the prelude emitted */
+    uint32_t nlines;
+
+    /* Replaying the emitted lines */
+    const unsigned char *replay;
+    uint32_t nreplay;
+    struct src_location where;  /* Where the prelude left off */
+} snap;
+
+/* Note a file read by the prelude */
+static inline void snap_dep(const char *file)
+{
+    if (unlikely(snap.recording))
+        strlist_add(snap.deps, file);
+}
+
 /*
  * Forward declarations.
  */
@@ -832,6 +899,9 @@ static const char *pp_getenv(const Token *t, bool warn)
     }
 
     v = getenv(txt);
+    outcache_environ(txt, v);
+    if (unlikely(snap.recording))
+        snap.env_used = true;   /* Not part of the snapshot key */
     if (warn && !v) {
 	/*!
 	 *!environment [on] nonexistent environment variable
@@ -1113,6 +1183,8 @@ static void free_mmacro_table(struct hash_table *mmt)
 
 static void free_macros(void)
 {
+    stats_hash(STATS_SMACROS, &smacros);
+    stats_hash(STATS_MMACROS, &mmacros);
     free_smacro_table(&smacros);
     free_mmacro_table(&mmacros);
 }
@@ -1172,6 +1244,31 @@ hash_findix(struct hash_table *hash, const char *str)
     return p ? *p : NULL;
 }
 
+/*
+ * All the predefinitions, in reverse order like the lists themselves:
+ * the last to be run comes first, and the system ones last.
+ */
+static const Line **predef_lines(size_t *np)
+{
+    const Line **pds;
+    const Line *pd;
+    size_t n = 0;
+
+    list_for_each(pd, predef)
+        n++;
+    list_for_each(pd, sysdef)
+        n++;
+    nasm_newn(pds, n);
+    *np = n;
+
+    n = 0;
+    list_for_each(pd, predef)
+        pds[n++] = pd;
+    list_for_each(pd, sysdef)
+        pds[n++] = pd;
+    return pds;
+}
+
 /*
  * read line from standart macros set,
  * if there no more left -- return NULL
@@ -1220,7 +1317,9 @@ static char *line_from_stdmac(void)
         if (*stdmacnext) {
             stdmacpos = *stdmacnext++;
         } else if (do_predef) {
-            Line *pd, *l;
+            const Line **pds;
+            Line *l;
+            size_t i, npd;
 
             /*
              * Nasty hack: here we push the contents of
@@ -1229,14 +1328,16 @@ static char *line_from_stdmac(void)
              * implement the pre-include and pre-define
              * features.
              */
-            list_for_each(pd, predef) {
+            pds = predef_lines(&npd);
+            for (i = 0; i < npd; i++) {
                 nasm_new(l);
                 l->next     = istk->expansion;
-                l->first    = dup_tlist(pd->first, NULL);
+                l->first    = dup_tlist(pds[i]->first, NULL);
                 l->finishes = NULL;
 
                 istk->expansion = l;
             }
+            nasm_free(pds);
             do_predef = false;
         }
     }
@@ -1331,10 +1432,12 @@ static char *read_line(void)
     char *line;
     FILE *f = istk->fp;
 
+    stats_enter(STATS_READ);
     if (f)
         line = line_from_file(f);
     else
         line = line_from_stdmac();
+    stats_leave();
 
     if (!line)
         return NULL;
@@ -1716,6 +1819,8 @@ static Token *alloc_Token(void)
 {
     Token *t = freeTokens;
 
+    stats_count(STATS_TOKENS);
+
     if (unlikely(!t)) {
         Token *block;
         size_t i;
@@ -1775,6 +1880,7 @@ static void delete_Blocks(void)
 static inline Token *alloc_Token(void)
 {
     Token *t;
+    stats_count(STATS_TOKENS);
     nasm_new(*t);
     return t;
 }
@@ -2194,6 +2300,7 @@ static FILE *inc_fopen_search(const char *file, char **slpath,
             return fp;
         }
 
+        outcache_missing(sp);
         nasm_free(sp);
 
         if (!ip) {
@@ -2238,7 +2345,7 @@ static FILE *inc_fopen(const char *file,
          * Add file to dependency path.
          */
         if (path || omode != INC_NEEDED)
-            strlist_add(dhead, file);
+            strlist_add(dhead, path ? path : file);
     }
 
     if (!path) {
@@ -2689,6 +2796,38 @@ smacro_expand_default(const SMacro *s, Token **params, int nparams)
     return dup_tlist(s->expansion, NULL);
 }
 
+/* Predefined by nasm.c, but different on every run */
+static bool is_dated_macro(const char *name)
+{
+    static const char * const dated[] = {
+        "__?DATE?__", "__?DATE_NUM?__", "__?TIME?__", "__?TIME_NUM?__",
+        "__?UTC_DATE?__", "__?UTC_DATE_NUM?__", "__?UTC_TIME?__",
+        "__?UTC_TIME_NUM?__", "__?POSIX_TIME?__", NULL
+    };
+    const char * const *dp;
+
+    if (name[0] != '_' || name[1] != '_' || name[2] != '?')
+        return false;
+
+    for (dp = dated; *dp; dp++) {
+        if (!strcmp(name, *dp))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Expansion of the date and time macros, which keeps the output out
+ * of the --cache.  The prelude snapshot leaves them out, and defines
+ * them again after loading.
+ */
+static Token *
+smacro_expand_dated(const SMacro *s, Token **params, int nparams)
+{
+    outcache_dated();
+    return smacro_expand_default(s, params, nparams);
+}
+
 /*
  * Emit a macro defintion or undef to the listing file, if
  * desired. This is similar to detoken(), but it handles the reverse
@@ -2991,6 +3130,8 @@ static SMacro *define_smacro(const char *mname, bool casesense,
         if (tmpl->expand)
             smac->expand = tmpl->expand;
     }
+    if (smac->expand == smacro_expand_default && is_dated_macro(mname))
+        smac->expand = smacro_expand_dated;
     if (list_option('s')) {
         list_smacro_def((smac->alias ? PP_DEFALIAS : PP_DEFINE)
                         + !casesense, ctx, smac);
@@ -3572,7 +3713,9 @@ static int do_directive(Token *tline, Token **output)
         if (t->next)
             nasm_warn(WARN_OTHER, "trailing garbage after `%s' ignored", dname);
 
-        strlist_add(deplist, unquote_token_cstr(t));
+        p = unquote_token_cstr(t);
+        strlist_add(deplist, p);
+        snap_dep(p);
         goto done;
 
     case PP_INCLUDE:
@@ -3587,16 +3730,20 @@ static int do_directive(Token *tline, Token **output)
         if (t->next)
             nasm_warn(WARN_OTHER, "trailing garbage after `%s' ignored", dname);
         p = unquote_token_cstr(t);
+        trace_begin("include", p, src_where());
         nasm_new(inc);
         inc->next = istk;
         found_path = NULL;
         inc->fp = inc_fopen(p, deplist, &found_path,
                             (pp_mode == PP_DEPS)
                             ? INC_OPTIONAL : INC_NEEDED, NF_TEXT);
+        snap_dep(found_path ? found_path : p);
         if (!inc->fp) {
             /* -MG given but file not found */
             nasm_free(inc);
+            trace_end();
         } else {
+            inc->traced = trace_enabled;
             inc->fname = src_set_fname(found_path ? found_path : p);
             inc->lineno = src_set_linnum(0);
             inc->lineinc = 1;
@@ -5399,6 +5546,7 @@ static SMacro *expand_one_smacro(Token ***tpp)
 
     /* Don't do this until after expansion or we will clobber mname */
     free_tlist(mstart);
+    stats_count(STATS_SMACRO_EXPANSIONS);
     goto done;
 
     /*
@@ -5829,8 +5977,13 @@ static int expand_mmacro(Token * tline)
         return 0;
     }
 
+    if (!mmacro_deadman.levels) {
+        trace_begin("macro", mname, src_where());
+        mmacro_traced = trace_enabled;
+    }
     mmacro_deadman.total++;
     mmacro_deadman.levels++;
+    stats_count(STATS_MMACRO_EXPANSIONS);
 
     /*
      * Fix up the parameters: this involves stripping leading and
@@ -6081,204 +6234,1116 @@ static void pp_add_magic_stdmac(void)
     }
 }
 
-static void
-pp_reset(const char *file, enum preproc_mode mode, struct strlist *dep_list)
+/*
+ * Prelude snapshots.
+ *
+ * The prelude is everything that is run before the first line of
+ * the input file: the standard macro packages, and the -p, -d, -u,
+ * --pragma and --before options.  With --prelude-cache, the first
+ * pass to run it records the state it leaves behind -- the
+ * single-line and multi-line macro tables, the context stack, the
+ * %use packages loaded, and the %stacksize, %arg, %local and %aliases
+ * settings -- along with the lines it emits and the files it reads,
+ * and writes all of that to the snapshot file.  Every later pass, and
+ * every later run for which the snapshot is still valid, rebuilds
+ * that state from the file rather than preprocessing the prelude.
+ *
+ * A snapshot is valid if it was written by the same version of NASM,
+ * with the same prelude options (which include the output and debug
+ * formats), include path, limits and warning settings, and if each
+ * file the prelude read still has the same MD5 hash.  Otherwise the
+ * prelude is run as usual and the snapshot rewritten.  The date and
+ * time macros are left out of the comparison and defined again after
+ * loading.  A prelude which issues any diagnostic, expands
+ * __?PASS?__, reads an environment variable, ends inside a macro
+ * definition or redefines one of the magic macros is not saved.
+ *
+ * A server runs the prelude once before it starts listening, and
+ * keeps the snapshot in memory even without --prelude-cache.  Each
+ * worker forked from it checks the snapshot against its own options
+ * and the files before using it, as if it had just been read.
+ */
+#define SNAP_MAGIC      "NASMPRE\032"
+#define SNAP_VERSION    2
+#define SNAP_NULL       0xffffffffU     /* Length of a null string */
+
+static bool snap_is_volatile(const Line *pd)
 {
-    int apass;
-    struct Include *inc;
+    Token *t = pd->first;
 
-    cstk = NULL;
-    defining = NULL;
-    nested_mac_count = 0;
-    nested_rep_count = 0;
-    init_macros();
-    unique = 0;
-    deplist = dep_list;
-    pp_mode = mode;
-    do_aliases = true;
+    if (!tok_type(t, TOK_PREPROC_ID) || strcmp(tok_text(t), "%define"))
+        return false;
 
-    if (!use_loaded)
-        use_loaded = nasm_malloc(use_package_count * sizeof(bool));
-    memset(use_loaded, 0, use_package_count * sizeof(bool));
+    t = skip_white(t->next);
+    return tok_type(t, TOK_ID) && is_dated_macro(tok_text(t));
+}
 
-    /* First set up the top level input file */
-    nasm_new(istk);
-    istk->fp = nasm_open_read(file, NF_TEXT);
-    src_set(0, file);
-    istk->lineinc = 1;
-    if (!istk->fp)
-	nasm_fatalf(ERR_NOFILE, "unable to open input file `%s'", file);
+/*
+ * Writing.  Numbers are stored seven bits to a byte, least significant
+ * first, with the top bit set on all but the last byte; strings are a
+ * length followed by the text and a null byte.
+ */
+static unsigned char *snap_reserve(struct snapbuf *b, size_t n)
+{
+    unsigned char *q;
 
-    strlist_add(deplist, file);
+    if (b->size - b->len < n) {
+        b->size = (b->len + n) << 1;
+        b->p = nasm_realloc(b->p, b->size);
+    }
+    q = b->p + b->len;
+    b->len += n;
+    return q;
+}
 
-    /*
-     * Set up the stdmac packages as a virtual include file,
-     * indicated by a null file pointer.
-     */
-    nasm_new(inc);
-    inc->next = istk;
-    inc->fname = src_set_fname(NULL);
-    inc->nolist = !list_option('b');
-    istk = inc;
-    lfmt->uplevel(LIST_INCLUDE, 0);
+static void snap_putnum(struct snapbuf *b, uint64_t v)
+{
+    while (v >= 0x80) {
+        *snap_reserve(b, 1) = (unsigned char)v | 0x80;
+        v >>= 7;
+    }
+    *snap_reserve(b, 1) = (unsigned char)v;
+}
 
-    pp_add_magic_stdmac();
+static void snap_putstr(struct snapbuf *b, const char *str, size_t len)
+{
+    unsigned char *q;
 
-    if (tasm_compatible_mode)
-        pp_add_stdmac(nasm_stdmac_tasm);
+    if (!str) {
+        snap_putnum(b, SNAP_NULL);
+        return;
+    }
 
-    pp_add_stdmac(nasm_stdmac_nasm);
-    pp_add_stdmac(nasm_stdmac_version);
+    snap_putnum(b, len);
+    q = snap_reserve(b, len + 1);
+    memcpy(q, str, len);
+    q[len] = '\0';
+}
 
-    if (extrastdmac)
-        pp_add_stdmac(extrastdmac);
+static void snap_putcstr(struct snapbuf *b, const char *str)
+{
+    snap_putstr(b, str, str ? strlen(str) : 0);
+}
 
-    stdmacpos  = stdmacros[0];
-    stdmacnext = &stdmacros[1];
+static void snap_puttok(struct snapbuf *b, const Token *t)
+{
+    snap_putnum(b, t->type);
+    snap_putstr(b, tok_text(t), t->len);
+}
 
-    do_predef = true;
+static void snap_puttlist(struct snapbuf *b, const Token *list)
+{
+    const Token *t;
+    uint32_t n = 0;
 
-    /*
-     * Define the __?PASS?__ macro.  This is defined here unlike all the
-     * other builtins, because it is special -- it varies between
-     * passes -- but there is really no particular reason to make it
-     * magic.
-     *
-     * 0 = dependencies only
-     * 1 = preparatory passes
-     * 2 = final pass
-     * 3 = preproces only
-     */
-    switch (mode) {
-    case PP_NORMAL:
-        apass = pass_final() ? 2 : 1;
-        break;
-    case PP_DEPS:
-        apass = 0;
-        break;
-    case PP_PREPROC:
-        apass = 3;
-        break;
-    default:
-        panic();
+    list_for_each(t, list)
+        n++;
+    snap_putnum(b, n);
+    list_for_each(t, list)
+        snap_puttok(b, t);
+}
+
+/* Magic macros are not saved, but created afresh when loading */
+static void snap_putsmacros(struct snapbuf *b, struct hash_table *smt)
+{
+    struct hash_iterator it;
+    const struct hash_node *np;
+
+    hash_for_each(smt, it, np) {
+        const SMacro *s;
+        uint32_t n = 0;
+        int i;
+
+        list_for_each(s, (const SMacro *)np->data) {
+            if (s->expand == smacro_expand_default)
+                n++;
+        }
+        if (!n)
+            continue;
+
+        snap_putcstr(b, np->key);
+        snap_putnum(b, n);
+        list_for_each(s, (const SMacro *)np->data) {
+            if (s->expand != smacro_expand_default)
+                continue;
+
+            snap_putcstr(b, s->name);
+            snap_putnum(b, s->casesense | (s->greedy << 1) |
+                        (s->alias << 2) | (!!s->params << 3));
+            snap_putnum(b, s->nparam);
+            if (s->params) {
+                for (i = 0; i < s->nparam; i++) {
+                    snap_putnum(b, s->params[i].flags);
+                    snap_puttok(b, &s->params[i].name);
+                }
+            }
+            snap_puttlist(b, s->expansion);
+        }
     }
+    snap_putcstr(b, NULL);
+}
+
+static void snap_putmmacros(struct snapbuf *b)
+{
+    struct hash_iterator it;
+    const struct hash_node *np;
+
+    hash_for_each(&mmacros, it, np) {
+        const MMacro *m;
+        const Line *l;
+        uint32_t n = 0;
+
+        list_for_each(m, (const MMacro *)np->data)
+            n++;
+        if (!n)
+            continue;
 
-    define_smacro("__?PASS?__", true, make_tok_num(NULL, apass), NULL);
+        snap_putcstr(b, np->key);
+        snap_putnum(b, n);
+        list_for_each(m, (const MMacro *)np->data) {
+            snap_putcstr(b, m->name);
+            snap_putnum(b, m->nparam_min);
+            snap_putnum(b, m->nparam_max);
+            snap_putnum(b, m->casesense | (m->plus << 1) |
+                        (m->nolist << 2) | (m->capture_label << 3));
+            snap_putnum(b, m->max_depth);
+            snap_puttlist(b, m->dlist);
+            n = 0;
+            list_for_each(l, m->expansion)
+                n++;
+            snap_putnum(b, n);
+            list_for_each(l, m->expansion)
+                snap_puttlist(b, l->first);
+            snap_putcstr(b, m->fname);
+            snap_putnum(b, m->xline);
+        }
+    }
+    snap_putcstr(b, NULL);
 }
 
-static void pp_init(void)
+static void snap_putstate(struct snapbuf *b)
 {
+    Context *ctx;
+    uint32_t n;
+    size_t i;
+
+    snap_putnum(b, unique);
+    snap_putnum(b, StackSize);
+    snap_putcstr(b, StackPointer);
+    snap_putnum(b, ArgOffset);
+    snap_putnum(b, LocalOffset);
+    snap_putnum(b, do_aliases);
+    snap_putnum(b, use_package_count);
+    for (i = 0; i < (size_t)use_package_count; i++)
+        snap_putnum(b, use_loaded[i]);
+
+    snap_putsmacros(b, &smacros);
+    snap_putmmacros(b);
+
+    n = 0;
+    list_for_each(ctx, cstk)
+        n++;
+    snap_putnum(b, n);
+    list_for_each(ctx, cstk) {
+        snap_putcstr(b, ctx->name);
+        snap_putnum(b, ctx->number);
+        snap_putnum(b, ctx->depth);
+        snap_putsmacros(b, &ctx->localmac);
+    }
+
+    snap_putnum(b, snap.nlines);
+    memcpy(snap_reserve(b, snap.lines.len), snap.lines.p, snap.lines.len);
 }
 
 /*
- * Get a line of tokens. If we popped the macro expansion/include stack,
- * we return a pointer to the dummy token tok_pop; at that point if
- * istk is NULL then we have reached end of input;
+ * Reading.  The state proper is only read once its MD5 hash has been
+ * checked, so running off the end of it is a bug, and fatal.
  */
-static Token tok_pop;           /* Dummy token placeholder */
+struct snapread {
+    const unsigned char *p, *end;
+    bool fatal;                 /* Die if the data is bad */
+    bool bad;                   /* Ran out of data */
+};
 
-static Token *pp_tokline(void)
+static const unsigned char *snap_take(struct snapread *r, size_t n)
 {
-    while (true) {
-        Line *l = istk->expansion;
-        Token *tline = NULL;
-        Token *dtline;
+    const unsigned char *q = r->p;
 
-        /*
-         * Fetch a tokenized line, either from the macro-expansion
-         * buffer or from the input file.
-         */
-        tline = NULL;
-        while (l && l->finishes) {
-            MMacro *fm = l->finishes;
+    if (unlikely((size_t)(r->end - q) < n)) {
+        if (r->fatal)
+            nasm_fatal("prelude cache `%s' is corrupt", snap.file);
+        r->bad = true;
+        r->p = r->end;
+        return NULL;
+    }
+    r->p += n;
+    return q;
+}
 
-            if (!fm->name && fm->in_progress > 1) {
-                /*
-                 * This is a macro-end marker for a macro with no
-                 * name, which means it's not really a macro at all
-                 * but a %rep block, and the `in_progress' field is
-                 * more than 1, meaning that we still need to
-                 * repeat. (1 means the natural last repetition; 0
-                 * means termination by %exitrep.) We have
-                 * therefore expanded up to the %endrep, and must
-                 * push the whole block on to the expansion buffer
-                 * again. We don't bother to remove the macro-end
-                 * marker: we'd only have to generate another one
-                 * if we did.
-                 */
-                fm->in_progress--;
-                list_for_each(l, fm->expansion) {
-                    Token *t, *tt, **tail;
-                    Line *ll;
+static uint64_t snap_getnum(struct snapread *r)
+{
+    const unsigned char *q;
+    uint64_t v = 0;
+    int shift = 0;
 
-                    nasm_new(ll);
-                    ll->next = istk->expansion;
-                    tail = &ll->first;
+    do {
+        q = snap_take(r, 1);
+        if (!q)
+            return 0;
+        if (shift < 64)
+            v |= (uint64_t)(*q & 0x7f) << shift;
+        shift += 7;
+    } while (*q & 0x80);
 
-                    list_for_each(t, l->first) {
-                        if (t->len) {
-                            tt = *tail = dup_Token(NULL, t);
-                            tail = &tt->next;
-                        }
-                    }
-                    istk->expansion = ll;
-                }
-                break;
-            } else {
-                MMacro *m = istk->mstk.mstk;
+    return v;
+}
 
-                /*
-                 * Check whether a `%rep' was started and not ended
-                 * within this macro expansion. This can happen and
-                 * should be detected. It's a fatal error because
-                 * I'm too confused to work out how to recover
-                 * sensibly from it.
-                 */
-                if (defining) {
-                    if (defining->name)
-                        nasm_panic("defining with name in expansion");
-                    else if (m->name)
-                        nasm_fatal("`%%rep' without `%%endrep' within"
-				   " expansion of macro `%s'", m->name);
-                }
+static const char *snap_getstr(struct snapread *r, size_t *lenp)
+{
+    uint32_t len = snap_getnum(r);
+    const char *str = NULL;
+
+    if (len != SNAP_NULL) {
+        str = (const char *)snap_take(r, (size_t)len + 1);
+        if (str && str[len]) {
+            r->bad = true;
+            str = NULL;
+        }
+    }
+    *lenp = str ? len : 0;
+    return str;
+}
 
-                /*
-                 * FIXME:  investigate the relationship at this point between
-                 * istk->mstk.mstk and fm
-                 */
-                istk->mstk = m->mstk;
-                if (m->name) {
-                    /*
-                     * This was a real macro call, not a %rep, and
-                     * therefore the parameter information needs to
-                     * be freed and the iteration count/nesting
-                     * depth adjusted.
-                     */
+static const char *snap_getname(struct snapread *r)
+{
+    size_t len;
+    const char *str = snap_getstr(r, &len);
 
-                    if (!--mmacro_deadman.levels) {
-                        /*
-                         * If all mmacro processing done,
-                         * clear all counters and the deadman
-                         * message trigger.
-                         */
-                        nasm_zero(mmacro_deadman); /* Clear all counters */
-                    }
+    return str ? str : "";
+}
 
-#if 0
-                    if (m->prev) {
-                        pop_mmacro(m);
-                        fm->in_progress --;
-                    } else
-#endif
-                    {
-                        nasm_free(m->params);
-                        free_tlist(m->iline);
-                        nasm_free(m->paramlen);
-                        fm->in_progress = 0;
-                    }
-                }
+static void snap_gettok(struct snapread *r, Token *t)
+{
+    size_t len;
+    const char *text;
 
-                /*
+    t->type = snap_getnum(r);
+    text = snap_getstr(r, &len);
+    if (!text)
+        text = "";
+
+    t->len = tok_check_len(len);
+    if (len > INLINE_TEXT)
+        t->text.p.ptr = nasm_malloc(len + 1);
+    memcpy(tok_text_buf(t), text, len + 1);
+}
+
+static Token *snap_gettlist(struct snapread *r)
+{
+    uint32_t n = snap_getnum(r);
+    Token *list = NULL;
+    Token **tail = &list;
+
+    while (n--) {
+        Token *t = alloc_Token();
+
+        snap_gettok(r, t);
+        *tail = t;
+        tail = &t->next;
+    }
+    return list;
+}
+
+/*
+ * The loaded macros go in front of any already in the table (the
+ * magic macros), which is where they would have been defined.
+ */
+static void snap_getsmacros(struct snapread *r, struct hash_table *smt)
+{
+    const char *key;
+    size_t len;
+
+    while ((key = snap_getstr(r, &len))) {
+        SMacro **head = (SMacro **)hash_findi_add(smt, key);
+        SMacro *list = NULL;
+        SMacro **tail = &list;
+        uint32_t n = snap_getnum(r);
+
+        while (n--) {
+            SMacro *s;
+            unsigned int flags;
+            int i;
+
+            nasm_new(s);
+            s->name      = nasm_strdup(snap_getname(r));
+            flags        = snap_getnum(r);
+            s->casesense = !!(flags & 1);
+            s->greedy    = !!(flags & 2);
+            s->alias     = !!(flags & 4);
+            s->nparam    = (int32_t)snap_getnum(r);
+            s->expand    = smacro_expand_default;
+            if (flags & 8) {
+                nasm_newn(s->params, s->nparam);
+                for (i = 0; i < s->nparam; i++) {
+                    s->params[i].flags = snap_getnum(r);
+                    snap_gettok(r, &s->params[i].name);
+                }
+            }
+            s->expansion = snap_gettlist(r);
+
+            *tail = s;
+            tail = &s->next;
+        }
+
+        *tail = *head;
+        *head = list;
+    }
+}
+
+static void snap_getmmacros(struct snapread *r)
+{
+    const char *key;
+    size_t len;
+
+    while ((key = snap_getstr(r, &len))) {
+        MMacro **tail = (MMacro **)hash_findi_add(&mmacros, key);
+        uint32_t n = snap_getnum(r);
+
+        while (*tail)
+            tail = &(*tail)->next;
+
+        while (n--) {
+            MMacro *m;
+            Line **ltail;
+            unsigned int flags;
+            uint32_t nlines;
+            const char *fname;
+            size_t len;
+
+            nasm_new(m);
+            m->name          = nasm_strdup(snap_getname(r));
+            m->nparam_min    = (int32_t)snap_getnum(r);
+            m->nparam_max    = (int32_t)snap_getnum(r);
+            flags            = snap_getnum(r);
+            m->casesense     = !!(flags & 1);
+            m->plus          = !!(flags & 2);
+            m->nolist        = !!(flags & 4);
+            m->capture_label = !!(flags & 8);
+            m->max_depth     = (int32_t)snap_getnum(r);
+            m->dlist         = snap_gettlist(r);
+            if (m->dlist)
+                count_mmac_params(m->dlist, &m->ndefs, &m->defaults);
+
+            nlines = snap_getnum(r);
+            ltail = &m->expansion;
+            while (nlines--) {
+                Line *l;
+
+                nasm_new(l);
+                l->first = snap_gettlist(r);
+                *ltail = l;
+                ltail = &l->next;
+            }
+
+            fname = snap_getstr(r, &len);
+            if (fname) {
+                /* Use the name as kept by srcfile.c */
+                const char *oldname = src_set_fname(fname);
+                m->fname = src_set_fname(oldname);
+            }
+            m->xline = (int32_t)snap_getnum(r);
+            m->dstk.mmac = m;
+
+            *tail = m;
+            tail = &m->next;
+        }
+    }
+}
+
+/* The key covers everything besides the files which affects the prelude */
+static void snap_key(unsigned char key[MD5_HASHBYTES])
+{
+    struct snapbuf b;
+    const struct strlist_entry *ip;
+    const Line **pds;
+    size_t npd;
+    MD5_CTX ctx;
+    int i;
+
+    nasm_zero(b);
+    snap_putcstr(&b, nasm_version);
+    snap_putnum(&b, SNAP_VERSION);
+    snap_putnum(&b, tasm_compatible_mode);
+    snap_putnum(&b, pp_noline);
+    for (i = 0; i <= LIMIT_MAX; i++)
+        snap_putnum(&b, nasm_limit[i]);
+    memcpy(snap_reserve(&b, sizeof warning_state), warning_state,
+           sizeof warning_state);
+
+    snap_putnum(&b, strlist_count(ipath_list));
+    strlist_for_each(ip, ipath_list)
+        snap_putcstr(&b, ip->str);
+
+    pds = predef_lines(&npd);
+    snap_putnum(&b, npd);
+    while (npd--) {
+        if (!snap_is_volatile(pds[npd]))
+            snap_puttlist(&b, pds[npd]->first);
+    }
+    nasm_free(pds);
+
+    MD5Init(&ctx);
+    MD5Update(&ctx, b.p, b.len);
+    MD5Final(key, &ctx);
+    nasm_free(b.p);
+}
+
+static void snap_free_data(void)
+{
+    if (snap.mapped)
+        nasm_unmap_file(snap.data, snap.len);
+    else
+        nasm_free((void *)snap.data);
+    snap.data = NULL;
+    snap.mapped = false;
+}
+
+/*
+ * Check the header of the snapshot in snap.data, and optionally the
+ * files it depends on.
+ */
+static bool snap_parse(bool check_files)
+{
+    struct snapread r;
+    const unsigned char *q;
+    unsigned char digest[MD5_HASHBYTES];
+    uint32_t n;
+    uint64_t bodylen;
+    MD5_CTX ctx;
+
+    r.p     = snap.data;
+    r.end   = snap.data + snap.len;
+    r.fatal = false;
+    r.bad   = false;
+
+    q = snap_take(&r, 8);
+    if (!q || memcmp(q, SNAP_MAGIC, 8))
+        return false;
+    q = snap_take(&r, MD5_HASHBYTES);
+    if (!q || memcmp(q, snap.key, MD5_HASHBYTES))
+        return false;
+
+    snap.ndeps = n = snap_getnum(&r);
+    snap.deps_at = r.p;
+    while (n-- && !r.bad) {
+        size_t len;
+        const char *file = snap_getstr(&r, &len);
+
+        q = snap_take(&r, MD5_HASHBYTES);
+        if (!file || !q)
+            return false;
+        if (check_files && (!MD5File(file, digest) ||
+                            memcmp(q, digest, MD5_HASHBYTES)))
+            return false;
+    }
+
+    bodylen = snap_getnum(&r);
+    q = snap_take(&r, MD5_HASHBYTES);
+    if (!q || bodylen != (uint64_t)(r.end - r.p))
+        return false;
+
+    MD5Init(&ctx);
+    MD5Update(&ctx, r.p, bodylen);
+    MD5Final(digest, &ctx);
+    if (memcmp(q, digest, MD5_HASHBYTES))
+        return false;
+
+    snap.body = r.p;
+    return true;
+}
+
+static bool snap_read(void)
+{
+    FILE *fp;
+    off_t len;
+    bool ok = false;
+
+    fp = nasm_open_read(snap.file, NF_BINARY|NF_FORMAP);
+    if (!fp)
+        return false;
+
+    len = nasm_file_size(fp);
+    if (len <= 0 || len != (off_t)(size_t)len)
+        goto close;
+
+    snap.len = len;
+    snap.data = nasm_map_file(fp, 0, len);
+    snap.mapped = !!snap.data;
+    if (!snap.mapped) {
+        unsigned char *buf = nasm_malloc(len);
+
+        snap.data = buf;
+        if (fread(buf, 1, len, fp) != (size_t)len)
+            goto close;
+    }
+
+    ok = snap_parse(true);
+
+close:
+    fclose(fp);
+    if (!ok && snap.data)
+        snap_free_data();
+    return ok;
+}
+
+static void snap_write(const struct snapbuf *b)
+{
+    char *tmp;
+    FILE *fp;
+    bool ok = false;
+
+    /* Other runs may be writing the same snapshot at the same time */
+#ifdef HAVE_GETPID
+    tmp = nasm_asprintf("%s.%ld.tmp", snap.file, (long)getpid());
+#else
+    tmp = nasm_strcat(snap.file, ".tmp");
+#endif
+
+    fp = nasm_open_write(tmp, NF_BINARY);
+    if (fp) {
+        ok = fwrite(b->p, 1, b->len, fp) == b->len;
+        ok = !fclose(fp) && ok;
+        if (ok && rename(tmp, snap.file)) {
+            /* Some systems can't rename over an existing file */
+            remove(snap.file);
+            ok = !rename(tmp, snap.file);
+        }
+        if (!ok)
+            remove(tmp);
+    }
+
+    if (!ok)
+        nasm_warn(WARN_OTHER, "unable to write prelude cache `%s': %s",
+                  snap.file, strerror(errno));
+
+    nasm_free(tmp);
+}
+
+/* __?PASS?__, while the prelude is being recorded */
+static Token *
+stdmac_pass(const SMacro *s, Token **params, int nparams)
+{
+    snap.pass_used = true;
+    return smacro_expand_default(s, params, nparams);
+}
+
+/* Is the macro name still defined only as the given magic macro? */
+static bool snap_magic_intact(const char *name, ExpandSMacro func)
+{
+    const SMacro *s;
+    int n = 0;
+
+    list_for_each(s, (const SMacro *)hash_findix(&smacros, name)) {
+        if (!nasm_stricmp(s->name, name)) {
+            if (s->expand != func)
+                return false;
+            n++;
+        }
+    }
+    return n == 1;
+}
+
+/* The listing options which show the prelude itself being processed */
+static bool snap_listed(void)
+{
+    return list_option('b') || list_option('s') || list_option('d');
+}
+
+/*
+ * Called at the start of each pass; returns true if the prelude
+ * should be loaded from the snapshot.
+ */
+static bool snap_begin(void)
+{
+    if (snap.state == SNAP_WARM) {
+        snap_key(snap.key);
+        if (snap_parse(true)) {
+            snap.state = SNAP_LOAD;
+        } else {
+            snap_free_data();
+            snap.state = snap.file ? SNAP_CHECK : SNAP_NONE;
+        }
+    }
+
+    if (snap.state == SNAP_CHECK) {
+        snap_key(snap.key);
+        snap.state = snap_read() ? SNAP_LOAD : SNAP_SAVE;
+    }
+
+    return snap.state == SNAP_LOAD && !snap_listed();
+}
+
+/* Start recording the prelude, run from the virtual include file inc */
+static void snap_record(const Include *inc)
+{
+    if (snap.state != SNAP_SAVE || snap_listed())
+        return;
+
+    snap.recording = true;
+    snap.prelude   = inc;
+    snap.diags     = diag_count;
+    snap.pass_used = false;
+    snap.env_used  = false;
+    snap.lines.len = 0;
+    snap.nlines    = 0;
+    strlist_free(&snap.deps);
+    snap.deps      = strlist_alloc(true);
+}
+
+static void snap_record_line(const char *line)
+{
+    struct src_location where = src_where();
+
+    snap_putcstr(&snap.lines, line);
+    snap_putcstr(&snap.lines, where.filename);
+    snap_putnum(&snap.lines, where.lineno);
+    snap.nlines++;
+}
+
+/* The prelude is done; save it if we can */
+static void snap_end_prelude(void)
+{
+    struct snapbuf b, body;
+    const struct strlist_entry *e;
+    const struct magic_macros *m;
+    MD5_CTX ctx;
+    bool ok;
+
+    snap.recording = false;
+    snap.prelude = NULL;
+
+    ok = !defining && diag_count == snap.diags && !snap.pass_used &&
+        !snap.env_used && snap_magic_intact("__?PASS?__", stdmac_pass);
+    for (m = magic_macros; ok && m->name; m++)
+        ok = snap_magic_intact(m->name, m->func);
+
+    nasm_zero(b);
+    if (ok) {
+        memcpy(snap_reserve(&b, 8), SNAP_MAGIC, 8);
+        memcpy(snap_reserve(&b, MD5_HASHBYTES), snap.key, MD5_HASHBYTES);
+        snap_putnum(&b, strlist_count(snap.deps));
+        strlist_for_each(e, snap.deps) {
+            snap_putcstr(&b, e->str);
+            if (!MD5File(e->str, snap_reserve(&b, MD5_HASHBYTES))) {
+                ok = false;     /* Missing, so it can't be checked */
+                break;
+            }
+        }
+    }
+
+    if (ok) {
+        nasm_zero(body);
+        snap_putstate(&body);
+        snap_putnum(&b, body.len);
+        MD5Init(&ctx);
+        MD5Update(&ctx, body.p, body.len);
+        MD5Final(snap_reserve(&b, MD5_HASHBYTES), &ctx);
+        memcpy(snap_reserve(&b, body.len), body.p, body.len);
+        nasm_free(body.p);
+
+        if (snap.file)
+            snap_write(&b);
+
+        /* Later passes use it straight away */
+        snap.data = b.p;
+        snap.len = b.len;
+        snap.mapped = false;
+        ok = snap_parse(false);
+        if (!ok)
+            snap_free_data();
+    } else {
+        nasm_free(b.p);
+    }
+
+    strlist_free(&snap.deps);
+    snap.state = ok ? SNAP_LOAD : SNAP_NONE;
+}
+
+/* Load the state left by the prelude */
+static void snap_load(void)
+{
+    struct snapread r;
+    const Line **pds;
+    const char *sp;
+    Context **ctail;
+    size_t npd;
+    uint32_t i, n;
+    size_t len;
+
+    r.end   = snap.data + snap.len;
+    r.fatal = true;
+    r.bad   = false;
+
+    r.p = snap.deps_at;
+    for (i = 0; i < snap.ndeps; i++) {
+        strlist_add(deplist, snap_getname(&r));
+        snap_take(&r, MD5_HASHBYTES);
+    }
+
+    r.p = snap.body;
+    unique      = snap_getnum(&r);
+    StackSize   = (int32_t)snap_getnum(&r);
+    sp          = snap_getname(&r);
+    StackPointer = !strcmp(sp, "rbp") ? "rbp" : !strcmp(sp, "bp") ? "bp" : "ebp";
+    ArgOffset   = (int32_t)snap_getnum(&r);
+    LocalOffset = (int32_t)snap_getnum(&r);
+    do_aliases  = snap_getnum(&r);
+    n = snap_getnum(&r);
+    for (i = 0; i < n; i++) {
+        bool loaded = snap_getnum(&r);
+        if (i < (uint32_t)use_package_count)
+            use_loaded[i] = loaded;
+    }
+
+    snap_getsmacros(&r, &smacros);
+    snap_getmmacros(&r);
+
+    n = snap_getnum(&r);
+    ctail = &cstk;
+    while (n--) {
+        Context *ctx;
+        const char *name;
+
+        nasm_new(ctx);
+        name = snap_getstr(&r, &len);
+        ctx->name = name ? nasm_strdup(name) : NULL;
+        ctx->number = snap_getnum(&r);
+        ctx->depth = snap_getnum(&r);
+        snap_getsmacros(&r, &ctx->localmac);
+        *ctail = ctx;
+        ctail = &ctx->next;
+    }
+
+    snap.nreplay = snap_getnum(&r);
+    snap.replay  = r.p;
+    snap.where   = src_where();
+
+    /* Bring the date and time up to date, in command line order */
+    pds = predef_lines(&npd);
+    while (npd--) {
+        if (snap_is_volatile(pds[npd])) {
+            Token *dtline;
+            do_directive(dup_tlist(pds[npd]->first, NULL), &dtline);
+        }
+    }
+    nasm_free(pds);
+}
+
+/*
+ * Return the next line emitted by the prelude, or NULL if there are
+ * no more.
+ */
+static char *snap_replay(void)
+{
+    struct snapread r;
+    const char *line, *fname;
+    size_t len;
+    int32_t lineno;
+
+    if (!snap.nreplay) {
+        snap.replay = NULL;
+        src_update(snap.where);
+        return NULL;
+    }
+
+    r.p     = snap.replay;
+    r.end   = snap.data + snap.len;
+    r.fatal = true;
+    r.bad   = false;
+
+    line   = snap_getname(&r);
+    fname  = snap_getstr(&r, &len);
+    lineno = (int32_t)snap_getnum(&r);
+
+    snap.replay = r.p;
+    snap.nreplay--;
+
+    src_set(lineno, fname);
+    return nasm_strdup(line);
+}
+
+static void snap_cleanup(void)
+{
+    if (snap.data)
+        snap_free_data();
+    nasm_free(snap.lines.p);
+    strlist_free(&snap.deps);
+    nasm_zero(snap);
+}
+
+static void pp_prelude_cache(const char *file)
+{
+    snap.file = file;
+    snap.state = file ? SNAP_CHECK : SNAP_NONE;
+}
+
+static void pp_reset(const char *file, enum preproc_mode mode,
+                     struct strlist *dep_list);
+static char *pp_getline(void);
+static void pp_cleanup_pass(void);
+
+/*
+ * Run the prelude on its own, with no input file, and keep the
+ * snapshot in memory for the workers a server forks later.
+ */
+static void pp_prelude_warm(void)
+{
+    char *line;
+
+    if (snap.state == SNAP_NONE) {
+        snap_key(snap.key);
+        snap.state = SNAP_SAVE;
+    }
+
+    pp_reset(NULL, PP_PREPROC, NULL);
+    while ((line = pp_getline()))
+        nasm_free(line);
+    pp_cleanup_pass();
+
+    /*
+     * The include files were looked up relative to the server's own
+     * working directory, which the workers do not share
+     */
+    hash_free_all(&FileHash, true);
+
+    if (snap.state == SNAP_LOAD)
+        snap.state = SNAP_WARM;
+}
+
+static void
+pp_reset(const char *file, enum preproc_mode mode, struct strlist *dep_list)
+{
+    int apass;
+    struct Include *inc;
+    SMacro tmpl;
+
+    cstk = NULL;
+    defining = NULL;
+    nested_mac_count = 0;
+    nested_rep_count = 0;
+    init_macros();
+    unique = 0;
+    deplist = dep_list;
+    pp_mode = mode;
+    do_aliases = true;
+
+    if (!use_loaded)
+        use_loaded = nasm_malloc(use_package_count * sizeof(bool));
+    memset(use_loaded, 0, use_package_count * sizeof(bool));
+
+    /* First set up the top level input file, if any */
+    nasm_new(istk);
+    src_set(0, file);
+    istk->lineinc = 1;
+    if (file) {
+        istk->fp = nasm_open_read(file, NF_TEXT);
+        if (!istk->fp)
+            nasm_fatalf(ERR_NOFILE, "unable to open input file `%s'", file);
+        strlist_add(deplist, file);
+    }
+
+    if (snap_begin()) {
+        /* The prelude has been run before */
+        stdmacpos = NULL;
+        do_predef = false;
+        pp_add_magic_stdmac();
+        snap_load();
+    } else {
+        /*
+         * Set up the stdmac packages as a virtual include file,
+         * indicated by a null file pointer.
+         */
+        nasm_new(inc);
+        inc->next = istk;
+        inc->fname = src_set_fname(NULL);
+        inc->nolist = !list_option('b');
+        istk = inc;
+        lfmt->uplevel(LIST_INCLUDE, 0);
+
+        pp_add_magic_stdmac();
+
+        /* A server worker may not have the format the server ran it for */
+        nasm_zero(stdmacros);
+        if (tasm_compatible_mode)
+            pp_add_stdmac(nasm_stdmac_tasm);
+
+        pp_add_stdmac(nasm_stdmac_nasm);
+        pp_add_stdmac(nasm_stdmac_version);
+
+        if (extrastdmac)
+            pp_add_stdmac(extrastdmac);
+
+        stdmacpos  = stdmacros[0];
+        stdmacnext = &stdmacros[1];
+
+        do_predef = true;
+
+        snap_record(inc);
+    }
+
+    /*
+     * Define the __?PASS?__ macro.  This is defined here unlike all the
+     * other builtins, because it is special -- it varies between
+     * passes -- but there is really no particular reason to make it
+     * magic.  The exception is while the prelude is being recorded
+     * for a snapshot, which is only valid if it does not use it.
+     *
+     * 0 = dependencies only
+     * 1 = preparatory passes
+     * 2 = final pass
+     * 3 = preproces only
+     */
+    switch (mode) {
+    case PP_NORMAL:
+        apass = pass_final() ? 2 : 1;
+        break;
+    case PP_DEPS:
+        apass = 0;
+        break;
+    case PP_PREPROC:
+        apass = 3;
+        break;
+    default:
+        panic();
+    }
+
+    nasm_zero(tmpl);
+    tmpl.expand = stdmac_pass;
+    define_smacro("__?PASS?__", true, make_tok_num(NULL, apass),
+                  snap.recording ? &tmpl : NULL);
+}
+
+static void pp_init(void)
+{
+    /* A batch or server worker makes its own system definitions */
+    free_llist(sysdef);
+    sysdef = NULL;
+    extrastdmac = NULL;
+}
+
+/*
+ * Get a line of tokens. If we popped the macro expansion/include stack,
+ * we return a pointer to the dummy token tok_pop; at that point if
+ * istk is NULL then we have reached end of input;
+ */
+static Token tok_pop;           /* Dummy token placeholder */
+
+static Token *pp_tokline(void)
+{
+    while (true) {
+        Line *l = istk->expansion;
+        Token *tline = NULL;
+        Token *dtline;
+
+        /*
+         * Fetch a tokenized line, either from the macro-expansion
+         * buffer or from the input file.
+         */
+        tline = NULL;
+        while (l && l->finishes) {
+            MMacro *fm = l->finishes;
+
+            if (!fm->name && fm->in_progress > 1) {
+                /*
+                 * This is a macro-end marker for a macro with no
+                 * name, which means it's not really a macro at all
+                 * but a %rep block, and the `in_progress' field is
+                 * more than 1, meaning that we still need to
+                 * repeat. (1 means the natural last repetition; 0
+                 * means termination by %exitrep.) We have
+                 * therefore expanded up to the %endrep, and must
+                 * push the whole block on to the expansion buffer
+                 * again. We don't bother to remove the macro-end
+                 * marker: we'd only have to generate another one
+                 * if we did.
+                 */
+                fm->in_progress--;
+                list_for_each(l, fm->expansion) {
+                    Token *t, *tt, **tail;
+                    Line *ll;
+
+                    nasm_new(ll);
+                    ll->next = istk->expansion;
+                    tail = &ll->first;
+
+                    list_for_each(t, l->first) {
+                        if (t->len) {
+                            tt = *tail = dup_Token(NULL, t);
+                            tail = &tt->next;
+                        }
+                    }
+                    istk->expansion = ll;
+                }
+                break;
+            } else {
+                MMacro *m = istk->mstk.mstk;
+
+                /*
+                 * Check whether a `%rep' was started and not ended
+                 * within this macro expansion. This can happen and
+                 * should be detected. It's a fatal error because
+                 * I'm too confused to work out how to recover
+                 * sensibly from it.
+                 */
+                if (defining) {
+                    if (defining->name)
+                        nasm_panic("defining with name in expansion");
+                    else if (m->name)
+                        nasm_fatal("`%%rep' without `%%endrep' within"
+				   " expansion of macro `%s'", m->name);
+                }
+
+                /*
+                 * FIXME:  investigate the relationship at this point between
+                 * istk->mstk.mstk and fm
+                 */
+                istk->mstk = m->mstk;
+                if (m->name) {
+                    /*
+                     * This was a real macro call, not a %rep, and
+                     * therefore the parameter information needs to
+                     * be freed and the iteration count/nesting
+                     * depth adjusted.
+                     */
+
+                    if (!--mmacro_deadman.levels) {
+                        /*
+                         * If all mmacro processing done,
+                         * clear all counters and the deadman
+                         * message trigger.
+                         */
+                        nasm_zero(mmacro_deadman); /* Clear all counters */
+                        if (mmacro_traced) {
+                            trace_end();
+                            mmacro_traced = false;
+                        }
+                    }
+
+#if 0
+                    if (m->prev) {
+                        pop_mmacro(m);
+                        fm->in_progress --;
+                    } else
+#endif
+                    {
+                        nasm_free(m->params);
+                        free_tlist(m->iline);
+                        nasm_free(m->paramlen);
+                        fm->in_progress = 0;
+                    }
+                }
+
+                /*
                  * FIXME It is incorrect to always free_mmacro here.
                  * It leads to usage-after-free.
                  *
@@ -6339,6 +7404,10 @@ static Token *pp_tokline(void)
                 /* only set line and file name if there's a next node */
                 if (i->next)
                     src_set(i->lineno, i->fname);
+                if (i == snap.prelude)
+                    snap_end_prelude();
+                if (i->traced)
+                    trace_end();
                 istk = i->next;
                 lfmt->downlevel(LIST_INCLUDE);
                 nasm_free(i);
@@ -6419,11 +7488,35 @@ static Token *pp_tokline(void)
     }
 }
 
+/*
+ * The tokens of the line last returned by pp_getline(), kept so that
+ * the parser can use them rather than lexing the line again.
+ */
+static Token *line_tokens;
+static const char *line_text;
+static struct linetok *linetoks;
+static size_t linetoks_size;
+
+static void free_line_tokens(void)
+{
+    free_tlist(line_tokens);
+    line_tokens = NULL;
+    line_text = NULL;
+}
+
 static char *pp_getline(void)
 {
     char *line = NULL;
     Token *tline;
 
+    free_line_tokens();
+
+    stats_enter(STATS_PREPROC);
+    if (unlikely(snap.replay) && (line = snap_replay())) {
+        stats_leave();
+        return line;
+    }
+
     while (true) {
         tline = pp_tokline();
         if (tline == &tok_pop) {
@@ -6438,22 +7531,100 @@ static char *pp_getline(void)
              * De-tokenize the line and emit it.
              */
             line = detoken(tline, true);
-            free_tlist(tline);
+            line_tokens = tline;
+            line_text = line;
             break;
         }
     }
 
-    if (list_option('e') && istk && !istk->nolist && line && line[0]) {
-        char *buf = nasm_strcat(" ;;; ", line);
-        lfmt->line(LIST_MACRO, -1, buf);
-        nasm_free(buf);
+    if (unlikely(snap.recording) && line)
+        snap_record_line(line);
+
+    if (list_option('e') && istk && !istk->nolist && line && line[0]) {
+        char *buf = nasm_strcat(" ;;; ", line);
+        lfmt->line(LIST_MACRO, -1, buf);
+        nasm_free(buf);
+    }
+
+    stats_leave();
+    return line;
+}
+
+/*
+ * Hand over those tokens of the last line which stdscan() would have
+ * split up in exactly the same way: identifiers and numbers which are
+ * not followed by anything that would have continued them.
+ */
+static const struct linetok *pp_tokens(size_t *ntoks)
+{
+    const char *pos = line_text;
+    size_t n = 0;
+    const Token *t;
+
+    list_for_each(t, line_tokens) {
+        const char *text = tok_text(t);
+        const char *end = pos + t->len;
+        enum linetok_type type;
+
+        switch (t->type) {
+        case TOK_ID:
+        {
+            const char *p = text + (*text == '$');
+
+            if (!nasm_isidstart(*p) || t->len >= IDLEN_MAX)
+                goto skip;
+            while (nasm_isidchar(*++p))
+                ;
+            if (p != text + t->len)
+                goto skip;
+            type = LT_ID;
+            break;
+        }
+
+        case TOK_NUMBER:
+        case TOK_FLOAT:
+            if (!nasm_isnumstart(*text) || *end == '.')
+                goto skip;
+            type = t->type == TOK_NUMBER ? LT_NUMBER : LT_FLOAT;
+            break;
+
+        default:
+            goto skip;
+        }
+
+        if (nasm_isidchar(*end))
+            goto skip;
+
+        if (n >= linetoks_size) {
+            linetoks_size = linetoks_size ? linetoks_size << 1 : 64;
+            linetoks = nasm_realloc(linetoks,
+                                    linetoks_size * sizeof *linetoks);
+        }
+        linetoks[n].pos  = pos;
+        linetoks[n].text = text;
+        linetoks[n].len  = t->len;
+        linetoks[n].type = type;
+        if (type == LT_ID && *text != '$')
+            nasm_token_hash(text, &linetoks[n].tv);
+        n++;
+
+    skip:
+        pos = end;
     }
 
-    return line;
+    *ntoks = n;
+    return n ? linetoks : NULL;
 }
 
 static void pp_cleanup_pass(void)
 {
+    free_line_tokens();
+
+    snap.recording = false;
+    snap.prelude = NULL;
+    snap.replay = NULL;
+    snap.nreplay = 0;
+
     if (defining) {
         if (defining->name) {
             nasm_nonfatal("end of file while still defining macro `%s'",
@@ -6469,10 +7640,17 @@ static void pp_cleanup_pass(void)
     while (cstk)
         ctx_pop();
     free_macros();
+    if (mmacro_traced) {
+        trace_end();
+        mmacro_traced = false;
+    }
     while (istk) {
         Include *i = istk;
         istk = istk->next;
-        fclose(i->fp);
+        if (i->fp)
+            fclose(i->fp);
+        if (i->traced)
+            trace_end();
         nasm_free(i);
     }
     while (cstk)
@@ -6482,9 +7660,17 @@ static void pp_cleanup_pass(void)
 
 static void pp_cleanup_session(void)
 {
+    snap_cleanup();
+
+    nasm_free(linetoks);
+    linetoks = NULL;
+    linetoks_size = 0;
+
     nasm_free(use_loaded);
     free_llist(predef);
     predef = NULL;
+    free_llist(sysdef);
+    sysdef = NULL;
     delete_Blocks();
     ipath_list = NULL;
 }
@@ -6510,7 +7696,7 @@ static void pp_pre_include(char *fname)
     predef = l;
 }
 
-static void pp_pre_define(char *definition)
+static Line *make_pre_define(char *definition)
 {
     Token *def, *space;
     Line *l;
@@ -6531,12 +7717,27 @@ static void pp_pre_define(char *definition)
         nasm_warn(WARN_OTHER, "pre-defining non ID `%s\'\n", definition);
 
     l = nasm_malloc(sizeof(Line));
-    l->next = predef;
     l->first = def;
     l->finishes = NULL;
+    return l;
+}
+
+static void pp_pre_define(char *definition)
+{
+    Line *l = make_pre_define(definition);
+
+    l->next = predef;
     predef = l;
 }
 
+static void pp_sys_define(char *definition)
+{
+    Line *l = make_pre_define(definition);
+
+    l->next = sysdef;
+    sysdef = l;
+}
+
 static void pp_pre_undefine(char *definition)
 {
     Token *def, *space;
@@ -6649,18 +7850,531 @@ static void pp_error_list_macros(errflags severity)
     src_update(saved);
 }
 
+/*
+ * Fast dependency scan for -M.
+ *
+ * Rather than running the preprocessor over the whole input, only
+ * the directive lines are tokenized, and only the directives which
+ * can affect which files get included are interpreted: %include,
+ * %depend, calls to the standard incbin macro, the block structure,
+ * and %ifdef/%ifndef on macros the scanner has seen defined or
+ * undefined (typically include guards).  Anything the scanner cannot
+ * decide exactly the way the preprocessor would -- an include file
+ * name that is not a literal string, an include inside a conditional
+ * the scanner cannot evaluate, inside a macro definition or %rep
+ * block, and so on -- makes it give up, and the caller falls back to
+ * a full PP_DEPS run.  Include files are looked up with inc_fopen(),
+ * so the FileHash cache is shared with that run.
+ */
+#define DEPSCAN_MAX_DEPTH 64    /* Include nesting before giving up */
+
+enum depscan_block {
+    DSB_TRUE,                   /* Conditional, emitting branch */
+    DSB_FALSE,                  /* Conditional, no branch taken yet */
+    DSB_DONE,                   /* Conditional, branch already taken */
+    DSB_UNKNOWN,                /* Conditional we cannot evaluate */
+    DSB_MACRO,                  /* %macro definition */
+    DSB_REP                     /* %rep block */
+};
+
+enum depscan_region {
+    DSR_LIVE,                   /* Lines are definitely processed */
+    DSR_DEAD,                   /* Lines are definitely skipped */
+    DSR_UNSURE                  /* Lines may be processed */
+};
+
+enum depscan_macro {
+    DSM_DEFINED = 1,
+    DSM_UNDEFINED,
+    DSM_UNKNOWN                 /* Changed somewhere we can't follow */
+};
+
+struct depscan {
+    struct strlist *deplist;
+    struct hash_table macros;   /* Macro name -> enum depscan_macro */
+    bool unsure;                /* Some definition we could not follow */
+    int depth;                  /* Include nesting */
+    char *line;                 /* Logical line buffer */
+    size_t linesize;
+};
+
+/* Block stack of the current file */
+struct depscan_stack {
+    enum depscan_block *blk;
+    size_t n, size;
+};
+
+static bool ds_scan_file(struct depscan *ds, const char *file);
+
+static enum depscan_region ds_region(const struct depscan_stack *st)
+{
+    size_t i;
+
+    for (i = 0; i < st->n; i++) {
+        switch (st->blk[i]) {
+        case DSB_TRUE:
+            break;
+        case DSB_FALSE:
+        case DSB_DONE:
+            return DSR_DEAD;
+        default:
+            return DSR_UNSURE;
+        }
+    }
+    return DSR_LIVE;
+}
+
+static void ds_set_macro(struct depscan *ds, const char *name,
+                         enum depscan_macro state)
+{
+    struct hash_insert hi;
+    void **hp;
+
+    hp = hash_find(&ds->macros, name, &hi);
+    if (!hp)
+        hash_add(&hi, nasm_strdup(name), (void *)(size_t)state);
+    else if ((size_t)*hp != DSM_UNKNOWN)
+        *hp = (void *)(size_t)state;
+}
+
+/*
+ * Evaluate %ifdef with a single macro name: returns DSB_TRUE,
+ * DSB_FALSE or DSB_UNKNOWN.
+ */
+static enum depscan_block ds_ifdef(struct depscan *ds, Token *t, bool neg)
+{
+    void **hp;
+    const char *name;
+    enum depscan_macro state;
+
+    t = skip_white(t);
+    if (!tok_type(t, TOK_ID) || skip_white(t->next) || ds->unsure)
+        return DSB_UNKNOWN;
+
+    name = tok_text(t);
+    hp = hash_find(&ds->macros, name, NULL);
+    if (hp)
+        state = (size_t)*hp;
+    else if (name[0] == '_' && name[1] == '_')
+        state = DSM_UNKNOWN;    /* Possibly a builtin macro */
+    else
+        state = DSM_UNDEFINED;
+
+    if (state == DSM_UNKNOWN)
+        return DSB_UNKNOWN;
+
+    return ((state == DSM_DEFINED) ^ neg) ? DSB_TRUE : DSB_FALSE;
+}
+
+/*
+ * Handle a literal %include or %depend.
+ */
+static bool ds_include(struct depscan *ds, enum preproc_token op, Token *t)
+{
+    const char *file;
+    const char *found_path;
+
+    t = skip_white(t);
+    if (!t || t->next ||
+        (t->type != TOK_STRING && t->type != TOK_INTERNAL_STRING))
+        return false;
+
+    file = unquote_token_cstr(t);
+    if (op == PP_DEPEND) {
+        strlist_add(ds->deplist, file);
+        return true;
+    }
+
+    /* Same lookup as a PP_DEPS run; a missing file is not an error */
+    found_path = NULL;
+    inc_fopen(file, ds->deplist, &found_path, INC_PROBE, NF_TEXT);
+    if (!found_path)
+        return true;
+
+    return ds_scan_file(ds, found_path);
+}
+
+/*
+ * The standard incbin macro adds its file to the dependencies, so
+ * calls to it need to be found too.
+ */
+static bool ds_has_incbin(const char *line)
+{
+    for (; *line; line++) {
+        if ((*line | 0x20) == 'i' && !nasm_strnicmp(line, "incbin", 6))
+            return true;
+    }
+    return false;
+}
+
+static bool ds_is_incbin(const Token *t)
+{
+    return tok_type(t, TOK_ID) && !nasm_stricmp(tok_text(t), "incbin");
+}
+
+/*
+ * Handle a possible call to the incbin macro with a literal file
+ * name, the way its %pathsearch and %depend would.
+ */
+static bool ds_incbin(struct depscan *ds, enum depscan_region region,
+                      Token *tline)
+{
+    Token *t;
+    const char *file;
+    const char *found_path;
+
+    t = skip_white(tline);
+    if (!tok_type(t, TOK_ID))
+        return true;
+    if (!ds_is_incbin(t)) {
+        /* It may be preceded by a label */
+        t = skip_white(t->next);
+        if (tok_is(t, ':'))
+            t = skip_white(t->next);
+        if (!ds_is_incbin(t))
+            return true;
+    }
+
+    if (region != DSR_LIVE)
+        return false;
+
+    t = skip_white(t->next);
+    if (!tok_type(t, TOK_STRING))
+        return false;
+    if (skip_white(t->next) && !tok_is(skip_white(t->next), ','))
+        return false;
+
+    file = unquote_token_cstr(t);
+    inc_fopen(file, NULL, &found_path, INC_PROBE, NF_BINARY);
+    strlist_add(ds->deplist, found_path ? found_path : file);
+    return true;
+}
+
+static void ds_push(struct depscan_stack *st, enum depscan_block blk)
+{
+    if (st->n >= st->size) {
+        st->size = st->size ? st->size << 1 : 16;
+        st->blk = nasm_realloc(st->blk, st->size * sizeof *st->blk);
+    }
+    st->blk[st->n++] = blk;
+}
+
+/*
+ * Process one tokenized line.  Returns false to abandon the scan.
+ */
+static bool ds_directive(struct depscan *ds, struct depscan_stack *st,
+                         Token *tline)
+{
+    enum preproc_token op;
+    enum depscan_region region;
+    enum depscan_block *top;
+    const char *dname;
+    Token *t;
+
+    tline = skip_white(tline);
+    if (!tok_type(tline, TOK_PREPROC_ID))
+        return true;
+
+    dname = tok_text(tline);
+    if (dname[1] == '%')
+        return true;
+
+    op = pp_token_hash(dname);
+    if (PP_HAS_CASE(op) & PP_INSENSITIVE(op)) {
+        op--;
+        /* Case-insensitive macro names are not tracked */
+        if (op != PP_MACRO && op != PP_RMACRO && op != PP_UNMACRO)
+            ds->unsure = true;
+    }
+
+    region = ds_region(st);
+    top = st->n ? &st->blk[st->n - 1] : NULL;
+
+    if ((unsigned int)op < PP_ELIF) {
+        /* %if* */
+        if (region == DSR_DEAD)
+            ds_push(st, DSB_DONE);
+        else if (region == DSR_LIVE && PP_COND(op) == PP_IFDEF)
+            ds_push(st, ds_ifdef(ds, tline->next, PP_COND_NEGATIVE(op)));
+        else
+            ds_push(st, DSB_UNKNOWN);
+        return true;
+    }
+
+    if (PP_IS_COND(op) || op == PP_ELSE) {
+        /* %elif* and %else */
+        if (!top || *top >= DSB_MACRO)
+            return false;
+
+        if (*top == DSB_TRUE) {
+            *top = DSB_DONE;
+        } else if (*top == DSB_FALSE) {
+            st->n--;            /* Evaluate in the enclosing region */
+            if (op == PP_ELSE)
+                *top = DSB_TRUE;
+            else if (ds_region(st) == DSR_LIVE && PP_COND(op) == PP_IFDEF)
+                *top = ds_ifdef(ds, tline->next, PP_COND_NEGATIVE(op));
+            else
+                *top = DSB_UNKNOWN;
+            st->n++;
+        }
+        return true;
+    }
+
+    if (region != DSR_DEAD) {
+        /* Anything that could redefine or wrap incbin */
+        for (t = tline->next; t; t = t->next) {
+            if (ds_is_incbin(t))
+                return false;
+        }
+    }
+
+    switch (op) {
+    case PP_MACRO:
+    case PP_RMACRO:
+        ds_push(st, DSB_MACRO);
+        return true;
+
+    case PP_REP:
+        ds_push(st, DSB_REP);
+        return true;
+
+    case PP_ENDIF:
+        if (!top || *top >= DSB_MACRO)
+            return false;
+        st->n--;
+        return true;
+
+    case PP_ENDM:
+    case PP_ENDMACRO:
+        if (!top || *top != DSB_MACRO)
+            return false;
+        st->n--;
+        return true;
+
+    case PP_ENDREP:
+        if (!top || *top != DSB_REP)
+            return false;
+        st->n--;
+        return true;
+
+    default:
+        break;
+    }
+
+    if (region == DSR_DEAD)
+        return true;
+
+    switch (op) {
+    case PP_INCLUDE:
+    case PP_DEPEND:
+        return region == DSR_LIVE && ds_include(ds, op, tline->next);
+
+    case PP_ERROR:
+    case PP_FATAL:
+    case PP_WARNING:
+        /* Let the full run report the message */
+        return region != DSR_LIVE;
+
+    case PP_DEFINE:
+    case PP_XDEFINE:
+    case PP_ASSIGN:
+    case PP_DEFSTR:
+    case PP_DEFTOK:
+    case PP_STRCAT:
+    case PP_STRLEN:
+    case PP_SUBSTR:
+    case PP_PATHSEARCH:
+    case PP_UNDEF:
+        t = skip_white(tline->next);
+        if (tok_type(t, TOK_ID))
+            ds_set_macro(ds, tok_text(t),
+                         region == DSR_UNSURE ? DSM_UNKNOWN :
+                         op == PP_UNDEF ? DSM_UNDEFINED : DSM_DEFINED);
+        else if (!tok_type(t, TOK_LOCAL_MACRO))
+            ds->unsure = true;
+        return true;
+
+    case PP_CLEAR:
+    case PP_DEFALIAS:
+    case PP_UNDEFALIAS:
+    case PP_ALIASES:
+    case PP_USE:
+    case PP_ARG:
+    case PP_LOCAL:
+    case PP_STACKSIZE:
+        ds->unsure = true;
+        return true;
+
+    default:
+        return true;
+    }
+}
+
+/*
+ * Extract the next logical line into ds->line, following the rules
+ * of line_from_file() for line ends and continuation lines.
+ */
+static void ds_getline(struct depscan *ds, const char **pp, const char *end)
+{
+    const char *p = *pp;
+    size_t n = 0;
+    char c;
+
+    while (p < end) {
+        c = *p++;
+        if (c == '\\' && p < end && (*p == '\r' || *p == '\n')) {
+            if (*p++ == '\r' && p < end && *p == '\n')
+                p++;
+            continue;
+        }
+        if (c == '\r') {
+            if (p < end && *p == '\n')
+                p++;
+            break;
+        }
+        if (c == '\n' || c == '\0' || c == 032)
+            break;
+        if (n + 1 >= ds->linesize) {
+            ds->linesize <<= 1;
+            ds->line = nasm_realloc(ds->line, ds->linesize);
+        }
+        ds->line[n++] = c;
+    }
+
+    ds->line[n] = '\0';
+    *pp = p;
+}
+
+static bool ds_scan_file(struct depscan *ds, const char *file)
+{
+    struct depscan_stack st;
+    FILE *fp;
+    off_t len;
+    const void *map = NULL;
+    char *buf = NULL;
+    const char *p, *end;
+    bool ok = false;
+
+    if (ds->depth >= DEPSCAN_MAX_DEPTH)
+        return false;
+
+    fp = nasm_open_read(file, NF_BINARY|NF_FORMAP);
+    if (!fp)
+        return false;
+
+    len = nasm_file_size(fp);
+    if (len == (off_t)-1)
+        goto close;
+
+    map = nasm_map_file(fp, 0, len);
+    if (map) {
+        p = map;
+    } else {
+        buf = nasm_malloc(len + 1);
+        if (fread(buf, 1, len, fp) != (size_t)len)
+            goto close;
+        p = buf;
+    }
+    end = p + len;
+
+    ds->depth++;
+    nasm_zero(st);
+    ok = true;
+    while (ok && p < end) {
+        const char *line;
+        Token *tline;
+
+        ds_getline(ds, &p, end);
+        line = nasm_skip_spaces(ds->line);
+        if (*line == '%') {
+            tline = tokenize(line);
+            ok = ds_directive(ds, &st, tline);
+            free_tlist(tline);
+        } else if (ds_has_incbin(line) && ds_region(&st) != DSR_DEAD) {
+            tline = tokenize(line);
+            ok = ds_incbin(ds, ds_region(&st), tline);
+            free_tlist(tline);
+        }
+    }
+    if (st.n)
+        ok = false;     /* Unterminated block; let the full run complain */
+    nasm_free(st.blk);
+    ds->depth--;
+
+close:
+    if (map)
+        nasm_unmap_file(map, len);
+    nasm_free(buf);
+    fclose(fp);
+    return ok;
+}
+
+static bool pp_scan_deps(const char *file, struct strlist *deplist)
+{
+    struct depscan ds;
+    struct depscan_stack st;
+    struct hash_iterator it;
+    const struct hash_node *np;
+    const Line **pds;
+    size_t npd;
+    bool ok = true;
+
+    if (tasm_compatible_mode)
+        return false;
+
+    nasm_zero(ds);
+    ds.deplist = deplist;
+    ds.linesize = 512;
+    ds.line = nasm_malloc(ds.linesize);
+
+    strlist_add(deplist, file);
+
+    /*
+     * -D, -U, -P, --before and --pragma are run before the first line
+     * of input, in command line order.
+     */
+    pds = predef_lines(&npd);
+
+    nasm_zero(st);
+    while (ok && npd--) {
+        Token *tline = dup_tlist(pds[npd]->first, NULL);
+        ok = ds_directive(&ds, &st, tline);
+        free_tlist(tline);
+    }
+    if (st.n)
+        ok = false;
+    nasm_free(st.blk);
+    nasm_free(pds);
+
+    if (ok)
+        ok = ds_scan_file(&ds, file);
+
+    hash_for_each(&ds.macros, it, np)
+        nasm_free((void *)np->key);
+    hash_free(&ds.macros);
+    nasm_free(ds.line);
+
+    return ok;
+}
+
 const struct preproc_ops nasmpp = {
     pp_init,
     pp_reset,
+    pp_scan_deps,
     pp_getline,
+    pp_tokens,
     pp_cleanup_pass,
     pp_cleanup_session,
     pp_extra_stdmac,
     pp_pre_define,
+    pp_sys_define,
     pp_pre_undefine,
     pp_pre_include,
     pp_pre_command,
     pp_include_path,
+    pp_prelude_cache,
+    pp_prelude_warm,
     pp_error_list_macros,
     pp_suppress_error
 };
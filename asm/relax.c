@@ -0,0 +1,366 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 1996-2020 The NASM Authors - All Rights Reserved
+ *   See the file AUTHORS included with the NASM distribution for
+ *   the specific copyright holders.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * relax.c      span-dependent jump relaxation
+ *
+ * Whether a jump can use its short form depends on the distance to
+ * its target, which in turn depends on the sizes of all the jumps in
+ * between.  Left to itself, the assembler settles this by repeating
+ * optimization passes until no label moves, which for code full of
+ * branches can take a large number of complete passes.
+ *
+ * Instead, every jump for which jmp_match() had a choice is recorded
+ * during an optimization pass, together with the sizes of both of its
+ * forms and its target.  At the end of the pass, the sizes are solved
+ * on this compact description alone: starting from all short jumps,
+ * any jump whose target is out of range is grown, until nothing
+ * changes.  Sizes only ever grow, so this terminates.  The labels are
+ * then moved to where the solution puts them.
+ *
+ * The next pass verifies the prediction; if label values feed back
+ * into anything other than jump sizes (alignment, TIMES counts,
+ * immediates and the like) it will find labels still moving.  The
+ * labels are then put back where the recording pass left them and
+ * relaxation is turned off, so that the plain passes which follow
+ * produce the same result as if it had never been tried.
+ */
+
+#include "compiler.h"
+
+#include "nasm.h"
+#include "nasmlib.h"
+#include "error.h"
+#include "assemble.h"
+#include "labels.h"
+
+struct span {
+    int32_t segment;
+    int32_t ssize;              /* Size of the short form */
+    int32_t nsize;              /* Size of the near form */
+    int32_t size;               /* Size used in this pass */
+    int64_t offset;             /* Start of the jump */
+    int64_t target;             /* Target offset */
+    int64_t before;             /* Growth of the jumps before this one */
+    bool stale;                 /* Target is from the previous pass */
+    bool isshort;               /* Current choice of the solver */
+};
+
+/* A label redefined in this pass, and where it was in the last one */
+struct moved {
+    int32_t segment;
+    int64_t oldoff, newoff;
+};
+
+static bool disabled;           /* Turned off after a bad prediction */
+static bool recording;          /* Recording in this pass */
+static bool unpredictable;      /* Something was not recorded */
+
+static struct span *spans;
+static size_t nspans, spans_size;
+static struct moved *moves;
+static size_t nmoves, moves_size;
+
+void relax_begin(void)
+{
+    recording = !disabled && pass_type() == PASS_OPT;
+    unpredictable = false;
+    nspans = nmoves = 0;
+}
+
+bool relax_recording(void)
+{
+    return recording;
+}
+
+void relax_disable(void)
+{
+    disabled = true;
+    recording = false;
+}
+
+void relax_unpredictable(void)
+{
+    unpredictable = true;
+}
+
+void relax_span(int32_t segment, int64_t offset, int ssize, int nsize,
+                int size, int64_t target, bool stale)
+{
+    struct span *s;
+
+    if (!recording)
+        return;
+
+    if (segment == NO_SEG || nsize <= 0) {
+        unpredictable = true;
+        return;
+    }
+
+    if (nspans >= spans_size) {
+        spans_size = spans_size ? spans_size << 1 : 1024;
+        spans = nasm_realloc(spans, spans_size * sizeof *spans);
+    }
+
+    s = &spans[nspans++];
+    s->segment = segment;
+    s->ssize   = ssize;
+    s->nsize   = nsize;
+    s->size    = size;
+    s->offset  = offset;
+    s->target  = target;
+    s->before  = 0;
+    s->stale   = stale;
+    s->isshort = true;
+}
+
+void relax_label(int32_t oldseg, int64_t oldoff, int32_t segment,
+                 int64_t offset)
+{
+    struct moved *m;
+
+    if (!recording)
+        return;
+
+    if (oldseg != segment) {
+        unpredictable = true;
+        return;
+    }
+
+    if (nmoves >= moves_size) {
+        moves_size = moves_size ? moves_size << 1 : 1024;
+        moves = nasm_realloc(moves, moves_size * sizeof *moves);
+    }
+
+    m = &moves[nmoves++];
+    m->segment = segment;
+    m->oldoff  = oldoff;
+    m->newoff  = offset;
+}
+
+static int cmp_span(const void *a, const void *b)
+{
+    const struct span *x = a, *y = b;
+
+    if (x->segment != y->segment)
+        return x->segment < y->segment ? -1 : 1;
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+static int cmp_moved(const void *a, const void *b)
+{
+    const struct moved *x = a, *y = b;
+
+    if (x->segment != y->segment)
+        return x->segment < y->segment ? -1 : 1;
+    return (x->oldoff > y->oldoff) - (x->oldoff < y->oldoff);
+}
+
+static inline int32_t span_size(const struct span *s)
+{
+    return s->isshort ? s->ssize : s->nsize;
+}
+
+/*
+ * Find the first span in [lo,hi) which starts at or after offset
+ */
+static size_t find_span(size_t lo, size_t hi, int64_t offset)
+{
+    while (lo < hi) {
+        size_t mid = lo + ((hi - lo) >> 1);
+
+        if (spans[mid].offset < offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * How much the jumps in [lo,hi) before offset have grown in total
+ */
+static int64_t growth(size_t lo, size_t hi, int64_t offset)
+{
+    size_t i = find_span(lo, hi, offset);
+    const struct span *s;
+
+    if (i < hi)
+        return spans[i].before;
+
+    s = &spans[hi - 1];
+    return s->before + span_size(s) - s->size;
+}
+
+/*
+ * Find the spans of a segment
+ */
+static bool segment_spans(int32_t segment, size_t *lo, size_t *hi)
+{
+    size_t l = 0, h = nspans;
+
+    while (l < h) {
+        size_t mid = l + ((h - l) >> 1);
+
+        if (spans[mid].segment < segment)
+            l = mid + 1;
+        else
+            h = mid;
+    }
+
+    *lo = h = l;
+    while (h < nspans && spans[h].segment == segment)
+        h++;
+    *hi = h;
+
+    return h > l;
+}
+
+/*
+ * Translate a target from the layout of the previous pass to that of
+ * this one, using the nearest label at or before it.
+ */
+static bool translate(int32_t segment, int64_t *target)
+{
+    size_t lo = 0, hi = nmoves;
+
+    while (lo < hi) {
+        size_t mid = lo + ((hi - lo) >> 1);
+        const struct moved *m = &moves[mid];
+
+        if (m->segment < segment ||
+            (m->segment == segment && m->oldoff <= *target))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (!lo || moves[lo - 1].segment != segment)
+        return false;
+
+    *target += moves[lo - 1].newoff - moves[lo - 1].oldoff;
+    return true;
+}
+
+/*
+ * Solve the sizes of the jumps in [lo,hi), all in the same segment
+ */
+static void solve(size_t lo, size_t hi)
+{
+    bool changed;
+    size_t i;
+
+    do {
+        int64_t before = 0;
+
+        for (i = lo; i < hi; i++) {
+            struct span *s = &spans[i];
+
+            s->before = before;
+            before += span_size(s) - s->size;
+        }
+
+        changed = false;
+        for (i = lo; i < hi; i++) {
+            struct span *s = &spans[i];
+            int64_t here, there, delta;
+
+            if (!s->isshort)
+                continue;
+
+            here  = s->offset + s->before + s->ssize;
+            there = s->target + growth(lo, hi, s->target);
+            delta = there - here;
+
+            if (delta < -128 || delta > 127) {
+                s->isshort = false;
+                changed = true;
+            }
+        }
+    } while (changed);
+}
+
+static int64_t shift_label(int32_t segment, int64_t offset)
+{
+    size_t lo, hi;
+
+    if (!segment_spans(segment, &lo, &hi))
+        return offset;
+
+    return offset + growth(lo, hi, offset);
+}
+
+bool relax_solve(void)
+{
+    size_t i, lo;
+    bool changed = false;
+
+    if (!recording || unpredictable || !nspans)
+        return false;
+
+    qsort(moves, nmoves, sizeof *moves, cmp_moved);
+    for (i = 0; i < nspans; i++) {
+        if (spans[i].stale && !translate(spans[i].segment, &spans[i].target))
+            return false;
+    }
+
+    qsort(spans, nspans, sizeof *spans, cmp_span);
+    for (lo = 0; lo < nspans; lo = i) {
+        for (i = lo + 1; i < nspans; i++) {
+            if (spans[i].segment != spans[lo].segment)
+                break;
+        }
+        solve(lo, i);
+    }
+
+    for (i = 0; i < nspans; i++) {
+        if (span_size(&spans[i]) != spans[i].size) {
+            changed = true;
+            break;
+        }
+    }
+
+    if (changed)
+        shift_labels(shift_label);
+
+    return changed;
+}
+
+void relax_cleanup(void)
+{
+    nasm_free(spans);
+    nasm_free(moves);
+    spans = NULL;
+    moves = NULL;
+    nspans = spans_size = nmoves = moves_size = 0;
+}
@@ -0,0 +1,426 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 1996-2020 The NASM Authors - All Rights Reserved
+ *   See the file AUTHORS included with the NASM distribution for
+ *   the specific copyright holders.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+/*
+ * server.c     a long-running nasm which assembles on request
+ *
+ * A server started with --server listens on a Unix domain socket.
+ * For each connection, it forks a worker which takes on the client's
+ * command line, working directory, environment and standard file
+ * descriptors, and from then on proceeds like any other invocation.
+ * The client waits for the worker's exit status and exits with it.
+ *
+ * Everything the server did before it started listening is therefore
+ * shared by all the workers, while the state of each assembly stays
+ * in a process of its own.
+ *
+ * A request is a 32-bit length in host byte order, sent together with
+ * the client's descriptors 0, 1 and 2, followed by that many bytes of
+ * null-terminated strings: the working directory, the number of
+ * arguments, the arguments, the number of environment variables and
+ * the environment.  The answer is the exit status as a 32-bit number.
+ */
+
+#include "compiler.h"
+
+#include <errno.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_WAIT_H
+# include <sys/wait.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#ifdef HAVE_SYS_UN_H
+# include <sys/un.h>
+#endif
+
+#include "nasmlib.h"
+#include "error.h"
+#include "server.h"
+
+#if defined(HAVE_FORK) && defined(HAVE_WAITPID) && defined(HAVE_SYS_WAIT_H) && \
+    defined(HAVE_SOCKET) && defined(HAVE_SYS_SOCKET_H) && defined(HAVE_SYS_UN_H)
+
+extern char **environ;
+
+#define SERVER_MAX_REQUEST (64 << 20)
+
+static bool server_address(struct sockaddr_un *sa, const char *path)
+{
+    nasm_zero(*sa);
+    sa->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof sa->sun_path)
+        return false;
+    strcpy(sa->sun_path, path);
+    return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+
+    while (len) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (!n)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Append a null-terminated string to the request */
+static void put_str(char **buf, size_t *len, size_t *size, const char *str)
+{
+    size_t n = strlen(str) + 1;
+
+    if (*size - *len < n) {
+        *size = (*len + n) << 1;
+        *buf = nasm_realloc(*buf, *size);
+    }
+    memcpy(*buf + *len, str, n);
+    *len += n;
+}
+
+static void put_num(char **buf, size_t *len, size_t *size, int n)
+{
+    char num[32];
+
+    snprintf(num, sizeof num, "%d", n);
+    put_str(buf, len, size, num);
+}
+
+bool server_connect(const char *path, int argc, char **argv)
+{
+    struct sockaddr_un sa;
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } ctl;
+    struct cmsghdr *cmsg;
+    char *buf = NULL, *cwd;
+    size_t len = 0, size = 0;
+    uint32_t hdr, status;
+    char **envp;
+    int fd, envc, i;
+
+    if (!server_address(&sa, path))
+        return false;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return false;
+    if (connect(fd, (struct sockaddr *)&sa, sizeof sa)) {
+        close(fd);
+        return false;           /* No server; assemble here */
+    }
+
+    cwd = nasm_realpath(".");
+    put_str(&buf, &len, &size, cwd);
+    nasm_free(cwd);
+
+    put_num(&buf, &len, &size, argc);
+    for (i = 0; i < argc; i++)
+        put_str(&buf, &len, &size, argv[i]);
+
+    for (envp = environ, envc = 0; *envp; envp++)
+        envc++;
+    put_num(&buf, &len, &size, envc);
+    for (envp = environ; *envp; envp++)
+        put_str(&buf, &len, &size, *envp);
+
+    hdr = len;
+    iov.iov_base = &hdr;
+    iov.iov_len  = sizeof hdr;
+
+    nasm_zero(msg);
+    nasm_zero(ctl);
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctl.buf;
+    msg.msg_controllen = sizeof ctl.buf;
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(3 * sizeof(int));
+    for (i = 0; i < 3; i++)
+        memcpy(CMSG_DATA(cmsg) + i * sizeof(int), &i, sizeof(int));
+
+    fflush(NULL);
+    if (sendmsg(fd, &msg, 0) != (ssize_t)sizeof hdr ||
+        !write_all(fd, buf, len) ||
+        !read_all(fd, &status, sizeof status))
+        nasm_fatalf(ERR_NOFILE, "lost connection to server `%s'", path);
+
+    exit(status);
+}
+
+/* Take the next string from a request */
+static char *get_str(char **p, char *end)
+{
+    char *str = *p;
+    char *nul = memchr(str, '\0', end - str);
+
+    if (!nul)
+        return NULL;
+    *p = nul + 1;
+    return str;
+}
+
+static char **get_strs(char **p, char *end, int *countp)
+{
+    char *num = get_str(p, end);
+    char **strs;
+    int count, i;
+
+    if (!num)
+        return NULL;
+    count = atoi(num);
+    if (count < 0 || count > end - *p)
+        return NULL;
+
+    strs = nasm_malloc((count + 1) * sizeof *strs);
+    for (i = 0; i < count; i++) {
+        strs[i] = get_str(p, end);
+        if (!strs[i]) {
+            nasm_free(strs);
+            return NULL;
+        }
+    }
+    strs[count] = NULL;
+
+    if (countp)
+        *countp = count;
+    return strs;
+}
+
+/*
+ * Serve one connection.  Returns the client's command line in the
+ * worker; the process which forked it reports its exit status.
+ */
+static char **server_request(int conn, int *argcp)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(3 * sizeof(int))];
+    } ctl;
+    struct cmsghdr *cmsg;
+    int fds[3] = { -1, -1, -1 };
+    char *buf, *p, *end, *cwd;
+    char **argv, **envp;
+    uint32_t hdr, status;
+    pid_t pid;
+    int i, ws;
+
+    nasm_zero(msg);
+    nasm_zero(ctl);
+    iov.iov_base       = &hdr;
+    iov.iov_len        = sizeof hdr;
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctl.buf;
+    msg.msg_controllen = sizeof ctl.buf;
+
+    if (recvmsg(conn, &msg, 0) != (ssize_t)sizeof hdr ||
+        hdr > SERVER_MAX_REQUEST)
+        exit(1);
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(3 * sizeof(int)))
+            memcpy(fds, CMSG_DATA(cmsg), sizeof fds);
+    }
+    if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0)
+        exit(1);
+
+    buf = nasm_malloc(hdr + 1);
+    if (!read_all(conn, buf, hdr))
+        exit(1);
+    buf[hdr] = '\0';
+    p = buf;
+    end = buf + hdr;
+
+    cwd = get_str(&p, end);
+    argv = cwd ? get_strs(&p, end, argcp) : NULL;
+    envp = argv ? get_strs(&p, end, NULL) : NULL;
+    if (!envp)
+        exit(1);
+
+    pid = fork();
+    if (pid == 0) {
+        for (i = 0; i < 3; i++) {
+            if (dup2(fds[i], i) < 0)
+                exit(1);
+            close(fds[i]);
+        }
+        close(conn);
+
+        environ = envp;
+        if (chdir(cwd))
+            nasm_fatalf(ERR_NOFILE, "unable to change to directory `%s': %s",
+                        cwd, strerror(errno));
+        return argv;
+    }
+
+    for (i = 0; i < 3; i++)
+        close(fds[i]);
+
+    status = 1;
+    if (pid > 0) {
+        while (waitpid(pid, &ws, 0) < 0) {
+            if (errno != EINTR)
+                exit(1);
+        }
+        if (WIFEXITED(ws))
+            status = WEXITSTATUS(ws);
+        else if (WIFSIGNALED(ws))
+            status = 128 + WTERMSIG(ws);
+    }
+
+    write_all(conn, &status, sizeof status);
+    exit(0);
+}
+
+char **server_listen(const char *path, int *argcp)
+{
+    struct sockaddr_un sa;
+    struct stat st;
+    mode_t oldmask;
+    int sock;
+
+    if (!server_address(&sa, path))
+        nasm_fatalf(ERR_NOFILE, "server socket name `%s' is too long", path);
+
+    /* Replace a socket left behind by an earlier server, but nothing else */
+    if (!lstat(path, &st)) {
+        if (!S_ISSOCK(st.st_mode))
+            nasm_fatalf(ERR_NOFILE, "`%s' exists and is not a socket", path);
+        unlink(path);
+    }
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0)
+        nasm_fatalf(ERR_NOFILE, "unable to create server socket: %s",
+                    strerror(errno));
+
+    /* Only the owner may ask us to assemble, and thus write files */
+    oldmask = umask(077);
+    if (bind(sock, (struct sockaddr *)&sa, sizeof sa) ||
+        listen(sock, SOMAXCONN))
+        nasm_fatalf(ERR_NOFILE, "unable to listen on `%s': %s",
+                    path, strerror(errno));
+    umask(oldmask);
+
+    for (;;) {
+        int conn;
+        pid_t pid;
+
+        /* Collect the workers which have finished */
+        while (waitpid(-1, NULL, WNOHANG) > 0)
+            ;
+
+        conn = accept(sock, NULL, NULL);
+        if (conn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            nasm_fatalf(ERR_NOFILE, "unable to accept a connection: %s",
+                        strerror(errno));
+        }
+
+        fflush(NULL);
+        pid = fork();
+        if (pid == 0) {
+            close(sock);
+            return server_request(conn, argcp);
+        }
+        if (pid < 0)
+            nasm_nonfatalf(ERR_NOFILE, "unable to start a server worker: %s",
+                           strerror(errno));
+        close(conn);
+    }
+}
+
+#else
+
+bool server_connect(const char *path, int argc, char **argv)
+{
+    (void)path;
+    (void)argc;
+    (void)argv;
+
+    return false;
+}
+
+char **server_listen(const char *path, int *argcp)
+{
+    (void)path;
+    (void)argcp;
+
+    nasm_fatalf(ERR_USAGE, "--server is not supported on this platform");
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,330 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 1996-2020 The NASM Authors - All Rights Reserved
+ *   See the file AUTHORS included with the NASM distribution for
+ *   the specific copyright holders.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+/*
+ * stats.c      timing and counters for --stats
+ *
+ * The time is split up among the phases of assembly by keeping a
+ * stack of the phases entered: when a phase is entered or left, the
+ * time since the last change is charged to the phase on top of the
+ * stack.  This takes two reads of the clock for each phase entered,
+ * which is why it is all skipped unless --stats is given; the
+ * counters are cheap enough to be kept up all the time.
+ */
+
+#include "compiler.h"
+
+#include <time.h>
+#ifdef HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
+
+#include "nasm.h"
+#include "nasmlib.h"
+#include "saa.h"
+#include "stats.h"
+
+#define MAX_DEPTH 32
+
+bool stats_enabled;
+uint64_t stats_counters[STATS_COUNTERS];
+
+static bool as_json;
+
+static uint64_t start_time, last_time;
+static uint64_t phase_time[STATS_PHASES];
+static enum stats_phase stack[MAX_DEPTH];
+static int depth;
+
+struct pass_stats {
+    int64_t passn;
+    enum pass_type type;
+    int64_t lines;
+    uint64_t time;
+};
+static struct pass_stats *passes;
+static size_t npasses, passes_size;
+static uint64_t pass_start;
+
+struct table_stats {
+    size_t entries, size;       /* At the largest */
+    uint64_t lookups, probes;
+    size_t max_probes;
+};
+static struct table_stats tables[STATS_TABLES];
+
+static const char * const phase_names[STATS_PHASES][2] = {
+    { "other",                   "other" },
+    { "reading",                 "reading" },
+    { "preprocessing",           "preprocessing" },
+    { "parse_line()",            "parsing" },
+    { "find_match()/calcsize()", "matching" },
+    { "output format",           "output" },
+    { "writing output",          "writing" }
+};
+
+static const char * const counter_names[STATS_COUNTERS][2] = {
+    { "single-line macro expansions",  "smacro_expansions" },
+    { "multi-line macro expansions",   "mmacro_expansions" },
+    { "preprocessor tokens allocated", "tokens" }
+};
+
+static const char * const table_names[STATS_TABLES][2] = {
+    { "labels",             "labels" },
+    { "single-line macros", "smacros" },
+    { "multi-line macros",  "mmacros" }
+};
+
+uint64_t stats_now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+
+    if (!clock_gettime(CLOCK_MONOTONIC, &ts))
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+    return (uint64_t)clock() * (1000000000 / CLOCKS_PER_SEC);
+}
+
+static inline double seconds(uint64_t ns)
+{
+    return ns / 1e9;
+}
+
+/* Charge the time since the last change to the current phase */
+static uint64_t charge(void)
+{
+    uint64_t t = stats_now();
+
+    phase_time[stack[depth - 1]] += t - last_time;
+    last_time = t;
+    return t;
+}
+
+void stats_push(enum stats_phase phase)
+{
+    charge();
+    if (depth < MAX_DEPTH)
+        stack[depth++] = phase;
+}
+
+void stats_pop(void)
+{
+    charge();
+    if (depth > 1)
+        depth--;
+}
+
+void stats_init(bool json)
+{
+    as_json = json;
+    stats_enabled = true;
+    depth = 1;
+    stack[0] = STATS_OTHER;
+    start_time = last_time = stats_now();
+}
+
+void stats_pass_begin(void)
+{
+    if (stats_enabled)
+        pass_start = charge();
+}
+
+void stats_pass_end(int64_t lines)
+{
+    struct pass_stats *ps;
+
+    if (!stats_enabled)
+        return;
+
+    if (npasses >= passes_size) {
+        passes_size = passes_size ? passes_size << 1 : 16;
+        passes = nasm_realloc(passes, passes_size * sizeof *passes);
+    }
+
+    ps = &passes[npasses++];
+    ps->passn = pass_count();
+    ps->type  = pass_type();
+    ps->lines = lines;
+    ps->time  = charge() - pass_start;
+}
+
+void stats_hash(enum stats_table table, const struct hash_table *head)
+{
+    struct table_stats *ts = &tables[table];
+
+    if (head->load > ts->entries) {
+        ts->entries = head->load;
+        ts->size    = head->size;
+    }
+    ts->lookups += head->lookups;
+    ts->probes  += head->probes;
+    if (head->max_probes > ts->max_probes)
+        ts->max_probes = head->max_probes;
+}
+
+/* Peak resident set size in kilobytes, or -1 if unknown */
+static int64_t peak_rss(void)
+{
+#if defined(HAVE_GETRUSAGE) && defined(HAVE_SYS_RESOURCE_H)
+    struct rusage ru;
+
+    if (!getrusage(RUSAGE_SELF, &ru)) {
+# ifdef __APPLE__
+        return ru.ru_maxrss >> 10; /* In bytes here */
+# else
+        return ru.ru_maxrss;
+# endif
+    }
+#endif
+    return -1;
+}
+
+static double avg_probes(const struct table_stats *ts)
+{
+    return ts->lookups ? (double)ts->probes / ts->lookups : 0.0;
+}
+
+static void report_text(FILE *f, const char *file, uint64_t total,
+                        size_t saa_total, size_t saa_peak, int64_t rss)
+{
+    const struct table_stats *ts;
+    size_t i;
+
+    fprintf(f, "Statistics for `%s':\n\n", file);
+
+    fprintf(f, "  %5s  %-10s %12s %12s\n", "pass", "type", "lines", "seconds");
+    for (i = 0; i < npasses; i++) {
+        fprintf(f, "  %5"PRId64"  %-10s %12"PRId64" %12.6f\n",
+                passes[i].passn, _pass_types[passes[i].type],
+                passes[i].lines, seconds(passes[i].time));
+    }
+    fputc('\n', f);
+
+    fprintf(f, "  %-30s %12s\n", "phase", "seconds");
+    for (i = 0; i < STATS_PHASES; i++)
+        fprintf(f, "  %-30s %12.6f\n", phase_names[i][0],
+                seconds(phase_time[i]));
+    fprintf(f, "  %-30s %12.6f\n\n", "total", seconds(total));
+
+    for (i = 0; i < STATS_COUNTERS; i++)
+        fprintf(f, "  %-30s %12"PRIu64"\n", counter_names[i][0],
+                stats_counters[i]);
+    fprintf(f, "  %-30s %12"PRIu64"\n\n", "labels",
+            (uint64_t)tables[STATS_LABELS].entries);
+
+    fprintf(f, "  %-20s %10s %10s %12s %10s %10s\n", "hash table",
+            "entries", "size", "lookups", "avg probes", "max probes");
+    for (i = 0; i < STATS_TABLES; i++) {
+        ts = &tables[i];
+        fprintf(f, "  %-20s %10"PRIu64" %10"PRIu64" %12"PRIu64" %10.3f %10"PRIu64"\n",
+                table_names[i][0], (uint64_t)ts->entries, (uint64_t)ts->size,
+                ts->lookups, avg_probes(ts), (uint64_t)ts->max_probes);
+    }
+    fputc('\n', f);
+
+    fprintf(f, "  %-30s %12"PRIu64" bytes\n", "SAA memory allocated",
+            (uint64_t)saa_total);
+    fprintf(f, "  %-30s %12"PRIu64" bytes\n", "SAA memory in use at most",
+            (uint64_t)saa_peak);
+    if (rss >= 0)
+        fprintf(f, "  %-30s %12"PRId64" kB\n", "peak RSS", rss);
+}
+
+static void report_json(FILE *f, const char *file, uint64_t total,
+                        size_t saa_total, size_t saa_peak, int64_t rss)
+{
+    const struct table_stats *ts;
+    size_t i;
+
+    fputs("{\n  \"file\": ", f);
+    fwritejson(file, f);
+
+    fputs(",\n  \"passes\": [", f);
+    for (i = 0; i < npasses; i++) {
+        fprintf(f, "%s\n    { \"pass\": %"PRId64", \"type\": \"%s\", "
+                "\"lines\": %"PRId64", \"seconds\": %.6f }",
+                i ? "," : "", passes[i].passn, _pass_types[passes[i].type],
+                passes[i].lines, seconds(passes[i].time));
+    }
+
+    fputs("\n  ],\n  \"phases\": {", f);
+    for (i = 0; i < STATS_PHASES; i++)
+        fprintf(f, "\n    \"%s\": %.6f,", phase_names[i][1],
+                seconds(phase_time[i]));
+    fprintf(f, "\n    \"total\": %.6f\n  },\n  \"counters\": {",
+            seconds(total));
+    for (i = 0; i < STATS_COUNTERS; i++)
+        fprintf(f, "\n    \"%s\": %"PRIu64",", counter_names[i][1],
+                stats_counters[i]);
+    fprintf(f, "\n    \"labels\": %"PRIu64"\n  },\n  \"hash_tables\": {",
+            (uint64_t)tables[STATS_LABELS].entries);
+    for (i = 0; i < STATS_TABLES; i++) {
+        ts = &tables[i];
+        fprintf(f, "%s\n    \"%s\": { \"entries\": %"PRIu64", "
+                "\"size\": %"PRIu64", \"lookups\": %"PRIu64", "
+                "\"avg_probes\": %.3f, \"max_probes\": %"PRIu64" }",
+                i ? "," : "", table_names[i][1],
+                (uint64_t)ts->entries, (uint64_t)ts->size, ts->lookups,
+                avg_probes(ts), (uint64_t)ts->max_probes);
+    }
+    fprintf(f, "\n  },\n  \"saa\": { \"allocated\": %"PRIu64", "
+            "\"peak\": %"PRIu64" },\n",
+            (uint64_t)saa_total, (uint64_t)saa_peak);
+    if (rss >= 0)
+        fprintf(f, "  \"peak_rss_kb\": %"PRId64"\n}\n", rss);
+    else
+        fputs("  \"peak_rss_kb\": null\n}\n", f);
+}
+
+void stats_report(const char *file)
+{
+    uint64_t total;
+    size_t saa_total, saa_peak;
+
+    if (!stats_enabled)
+        return;
+
+    total = charge() - start_time;
+    saa_usage(&saa_total, &saa_peak);
+
+    if (as_json)
+        report_json(stderr, file, total, saa_total, saa_peak, peak_rss());
+    else
+        report_text(stderr, file, total, saa_total, saa_peak, peak_rss());
+
+    nasm_free(passes);
+    passes = NULL;
+    npasses = passes_size = 0;
+}
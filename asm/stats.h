@@ -0,0 +1,112 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 1996-2020 The NASM Authors - All Rights Reserved
+ *   See the file AUTHORS included with the NASM distribution for
+ *   the specific copyright holders.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+/*
+ * stats.h - timing and counters for --stats
+ */
+
+#ifndef NASM_STATS_H
+#define NASM_STATS_H
+
+#include "compiler.h"
+#include "hashtbl.h"
+
+/*
+ * What the time is spent on.  The time of a phase does not include
+ * that of the phases entered while in it.
+ */
+enum stats_phase {
+    STATS_OTHER,                /* None of the below */
+    STATS_READ,                 /* Reading source lines */
+    STATS_PREPROC,              /* Preprocessing */
+    STATS_PARSE,                /* parse_line() */
+    STATS_MATCH,                /* find_match() and calcsize() */
+    STATS_OUTPUT,               /* Passing output to the output format */
+    STATS_WRITE,                /* Writing the output file: ofmt->cleanup() */
+    STATS_PHASES
+};
+
+enum stats_counter {
+    STATS_SMACRO_EXPANSIONS,
+    STATS_MMACRO_EXPANSIONS,
+    STATS_TOKENS,               /* Preprocessor tokens allocated */
+    STATS_COUNTERS
+};
+
+enum stats_table {
+    STATS_LABELS,
+    STATS_SMACROS,
+    STATS_MMACROS,
+    STATS_TABLES
+};
+
+extern bool stats_enabled;
+extern uint64_t stats_counters[STATS_COUNTERS];
+
+/* Monotonic time in nanoseconds */
+uint64_t stats_now(void);
+
+void stats_push(enum stats_phase phase);
+void stats_pop(void);
+
+static inline void stats_enter(enum stats_phase phase)
+{
+    if (unlikely(stats_enabled))
+        stats_push(phase);
+}
+
+static inline void stats_leave(void)
+{
+    if (unlikely(stats_enabled))
+        stats_pop();
+}
+
+static inline void stats_count(enum stats_counter counter)
+{
+    stats_counters[counter]++;
+}
+
+/* Start timing, for a report as text or JSON */
+void stats_init(bool json);
+
+void stats_pass_begin(void);
+void stats_pass_end(int64_t lines);
+
+/* Take note of the use of a hash table, before it is freed */
+void stats_hash(enum stats_table table, const struct hash_table *head);
+
+/* Write the report to stderr */
+void stats_report(const char *file);
+
+#endif
@@ -52,11 +52,31 @@ static char **stdscan_tempstorage = NULL;
 static int stdscan_tempsize = 0, stdscan_templen = 0;
 #define STDSCAN_TEMP_DELTA 256
 
+/*
+ * Tokens of the line being scanned as already split up by the
+ * preprocessor, if any; see stdscan_set_tokens().
+ */
+static const struct linetok *stdscan_toks = NULL;
+static size_t stdscan_ntoks = 0, stdscan_nexttok = 0;
+
 void stdscan_set(char *str)
 {
         stdscan_bufptr = str;
 }
 
+/*
+ * Use the preprocessor's tokens for the line about to be scanned;
+ * any time the scanner gets to the start of one of them, it is taken
+ * as it is rather than lexed again. Call with NULL once the line is
+ * done with.
+ */
+void stdscan_set_tokens(const struct linetok *toks, size_t ntoks)
+{
+    stdscan_toks = toks;
+    stdscan_ntoks = toks ? ntoks : 0;
+    stdscan_nexttok = 0;
+}
+
 char *stdscan_get(void)
 {
         return stdscan_bufptr;
@@ -102,6 +122,118 @@ static char *stdscan_copy(const char *p, int len)
     return text;
 }
 
+/*
+ * Find the preprocessor token starting at p, if there is one. The
+ * line is normally scanned from left to right, so look at the next
+ * token first.
+ */
+static const struct linetok *stdscan_find_token(const char *p)
+{
+    size_t lo, hi;
+
+    if (stdscan_nexttok < stdscan_ntoks) {
+        const char *next = stdscan_toks[stdscan_nexttok].pos;
+
+        if (next == p)
+            return &stdscan_toks[stdscan_nexttok++];
+        if (next > p && (!stdscan_nexttok ||
+                         stdscan_toks[stdscan_nexttok - 1].pos < p))
+            return NULL;
+    }
+
+    lo = 0;
+    hi = stdscan_ntoks;
+    while (lo < hi) {
+        size_t mid = lo + ((hi - lo) >> 1);
+
+        if (stdscan_toks[mid].pos < p)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    stdscan_nexttok = lo;
+    if (lo < stdscan_ntoks && stdscan_toks[lo].pos == p)
+        return &stdscan_toks[stdscan_nexttok++];
+
+    return NULL;
+}
+
+/*
+ * Finish classifying an identifier once nasm_token_hash() has looked
+ * it up
+ */
+static int stdscan_keyword_flags(struct tokenval *tv)
+{
+    if (unlikely(tv->t_flag & TFLAG_WARN)) {
+        /*!
+         *!ptr [on] non-NASM keyword used in other assemblers
+         *!  warns about keywords used in other assemblers that might
+         *!  indicate a mistake in the source code.  Currently only the MASM
+         *!  \c{PTR} keyword is recognized.
+         */
+        nasm_warn(WARN_PTR, "`%s' is not a NASM keyword",
+                   tv->t_charptr);
+    }
+
+    if (likely(!(tv->t_flag & TFLAG_BRC))) {
+        /* most of the tokens fall into this case */
+        return tv->t_type;
+    } else {
+        return tv->t_type = TOKEN_ID;
+    }
+}
+
+/*
+ * Classify an identifier in tv->t_charptr, of length len
+ */
+static int stdscan_keyword(struct tokenval *tv, size_t len)
+{
+    if (len > MAX_KEYWORD)
+        return tv->t_type = TOKEN_ID;       /* bypass all other checks */
+
+    nasm_token_hash(tv->t_charptr, tv);
+    return stdscan_keyword_flags(tv);
+}
+
+/*
+ * Take a token as the preprocessor split it up
+ */
+static int stdscan_linetok(const struct linetok *lt, struct tokenval *tv)
+{
+    bool rn_error;
+
+    stdscan_bufptr += lt->len;
+
+    switch (lt->type) {
+    case LT_ID:
+        tv->t_charptr = (char *)lt->text;
+        if (*lt->text == '$') {
+            tv->t_charptr++;
+            return tv->t_type = TOKEN_ID;
+        }
+        /* Looked up already by the preprocessor */
+        tv->t_integer = lt->tv.t_integer;
+        tv->t_inttwo  = lt->tv.t_inttwo;
+        tv->t_flag    = lt->tv.t_flag;
+        tv->t_type    = lt->tv.t_type;
+        return stdscan_keyword_flags(tv);
+
+    case LT_NUMBER:
+        tv->t_integer = readnum(lt->text, &rn_error);
+        if (rn_error)
+            return tv->t_type = TOKEN_ERRNUM;
+        return tv->t_type = TOKEN_NUM;
+
+    case LT_FLOAT:
+        tv->t_charptr = (char *)lt->text;
+        return tv->t_type = TOKEN_FLOAT;
+
+    default:
+        panic();
+    }
+}
+
 /*
  * a token is enclosed with braces. proper token type will be assigned
  * accordingly with the token flag.
@@ -134,12 +266,17 @@ int stdscan(void *private_data, struct tokenval *tv)
     if (!*stdscan_bufptr)
         return tv->t_type = TOKEN_EOS;
 
+    if (stdscan_ntoks) {
+        const struct linetok *lt = stdscan_find_token(stdscan_bufptr);
+        if (lt)
+            return stdscan_linetok(lt, tv);
+    }
+
     /* we have a token; either an id, a number or a char */
     if (nasm_isidstart(*stdscan_bufptr) ||
         (*stdscan_bufptr == '$' && nasm_isidstart(stdscan_bufptr[1]))) {
         /* now we've got an identifier */
         bool is_sym = false;
-        int token_type;
 
         if (*stdscan_bufptr == '$') {
             is_sym = true;
@@ -155,27 +292,10 @@ int stdscan(void *private_data, struct tokenval *tv)
         tv->t_charptr = stdscan_copy(r, stdscan_bufptr - r < IDLEN_MAX ?
                                      stdscan_bufptr - r : IDLEN_MAX - 1);
 
-        if (is_sym || stdscan_bufptr - r > MAX_KEYWORD)
+        if (is_sym)
             return tv->t_type = TOKEN_ID;       /* bypass all other checks */
 
-        token_type = nasm_token_hash(tv->t_charptr, tv);
-        if (unlikely(tv->t_flag & TFLAG_WARN)) {
-            /*!
-             *!ptr [on] non-NASM keyword used in other assemblers
-             *!  warns about keywords used in other assemblers that might
-             *!  indicate a mistake in the source code.  Currently only the MASM
-             *!  \c{PTR} keyword is recognized.
-             */
-            nasm_warn(WARN_PTR, "`%s' is not a NASM keyword",
-                       tv->t_charptr);
-        }
-
-        if (likely(!(tv->t_flag & TFLAG_BRC))) {
-            /* most of the tokens fall into this case */
-            return token_type;
-        } else {
-            return tv->t_type = TOKEN_ID;
-        }
+        return stdscan_keyword(tv, stdscan_bufptr - r);
     } else if (*stdscan_bufptr == '$' && !nasm_isnumchar(stdscan_bufptr[1])) {
         /*
          * It's a $ sign with no following hex number; this must
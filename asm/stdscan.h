@@ -41,6 +41,7 @@
 /* Standard scanner */
 void stdscan_set(char *str);
 char *stdscan_get(void);
+void stdscan_set_tokens(const struct linetok *toks, size_t ntoks);
 void stdscan_reset(void);
 int stdscan(void *private_data, struct tokenval *tv);
 int nasm_token_hash(const char *token, struct tokenval *tv);
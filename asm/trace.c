@@ -0,0 +1,120 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 1996-2020 The NASM Authors - All Rights Reserved
+ *   See the file AUTHORS included with the NASM distribution for
+ *   the specific copyright holders.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+/*
+ * trace.c      timeline of an assembly for --trace
+ *
+ * The spans are written as they begin and end, as "B" and "E" events
+ * in the Chrome trace event format, which Perfetto and about:tracing
+ * can show as a timeline.  The file is a JSON array, whose closing
+ * bracket those viewers do not require, so that what was written is
+ * still of use when the assembly stops on a fatal error.
+ */
+
+#include "compiler.h"
+
+#include "nasm.h"
+#include "nasmlib.h"
+#include "stats.h"
+#include "trace.h"
+
+bool trace_enabled;
+
+static FILE *trace_fp;
+static uint64_t start_time;
+static int depth;
+
+static void event(char ph)
+{
+    uint64_t t = stats_now() - start_time;
+
+    fprintf(trace_fp, ",\n{\"ph\":\"%c\",\"pid\":1,\"tid\":1,"
+            "\"ts\":%"PRIu64".%03u", ph,
+            t / 1000, (unsigned int)(t % 1000));
+}
+
+void trace_push(const char *cat, const char *name, struct src_location where)
+{
+    event('B');
+    fputs(",\"cat\":", trace_fp);
+    fwritejson(cat, trace_fp);
+    fputs(",\"name\":", trace_fp);
+    fwritejson(name, trace_fp);
+    if (where.filename) {
+        fputs(",\"args\":{\"file\":", trace_fp);
+        fwritejson(where.filename, trace_fp);
+        fprintf(trace_fp, ",\"line\":%"PRId32"}", where.lineno);
+    }
+    putc('}', trace_fp);
+    depth++;
+}
+
+void trace_pop(void)
+{
+    if (!depth)
+        return;
+
+    event('E');
+    putc('}', trace_fp);
+    depth--;
+}
+
+void trace_init(const char *file)
+{
+    trace_fp = nasm_open_write(file, NF_TEXT);
+    if (!trace_fp)
+        nasm_fatalf(ERR_NOFILE, "unable to open trace file `%s'", file);
+
+    /* The metadata event names the process after the input file */
+    fputs("[{\"ph\":\"M\",\"pid\":1,\"tid\":1,\"name\":\"process_name\","
+          "\"args\":{\"name\":", trace_fp);
+    fwritejson(inname, trace_fp);
+    fputs("}}", trace_fp);
+
+    start_time = stats_now();
+    trace_enabled = true;
+}
+
+void trace_close(void)
+{
+    if (!trace_enabled)
+        return;
+
+    while (depth)
+        trace_pop();
+    fputs("\n]\n", trace_fp);
+    fclose(trace_fp);
+    trace_fp = NULL;
+    trace_enabled = false;
+}
@@ -55,20 +55,6 @@
 #define fetch_or_return(_start, _ptr, _size, _need)         \
     fetch_safe(_start, _ptr, _size, _need, return 0)
 
-/*
- * Flags that go into the `segment' field of `insn' structures
- * during disassembly.
- */
-#define SEG_RELATIVE    1
-#define SEG_32BIT       2
-#define SEG_RMREG       4
-#define SEG_DISP8       8
-#define SEG_DISP16     16
-#define SEG_DISP32     32
-#define SEG_NODISP     64
-#define SEG_SIGNED    128
-#define SEG_64BIT     256
-
 /*
  * Prefix information
  */
@@ -209,7 +195,7 @@ static enum reg_enum whichreg(opflags_t regflags, int regval, int rex)
 }
 
 static uint32_t append_evex_reg_deco(char *buf, uint32_t num,
-                                    decoflags_t deco, uint8_t *evex)
+                                    decoflags_t deco, const uint8_t *evex)
 {
     const char * const er_names[] = {"rn-sae", "rd-sae", "ru-sae", "rz-sae"};
     uint32_t num_chars = 0;
@@ -242,7 +228,7 @@ static uint32_t append_evex_reg_deco(char *buf, uint32_t num,
 }
 
 static uint32_t append_evex_mem_deco(char *buf, uint32_t num, opflags_t type,
-                                     decoflags_t deco, uint8_t *evex)
+                                     decoflags_t deco, const uint8_t *evex)
 {
     uint32_t num_chars = 0;
 
@@ -421,7 +407,7 @@ static uint8_t *do_ea(uint8_t *data, int modrm, int asize,
 
             if (segsize == 64) {
                 vsib_hi = (rex & REX_X ? 8 : 0) |
-                          (evex[2] & EVEX_P2VP ? 0 : 16);
+                          (is_evex && !(evex[2] & EVEX_P2VP) ? 16 : 0);
             }
 
             if (type == EA_XMMVSIB)
@@ -1114,25 +1100,43 @@ static const char * const condition_name[16] = {
     "s", "ns", "pe", "po", "l", "nl", "ng", "g"
 };
 
-int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, int segsize,
-               int64_t offset, int autosync, iflag_t *prefer)
+/*
+ * Work out the absolute target of a relative operand
+ */
+static int64_t rel_target(const operand *o, int64_t offset, int32_t length,
+                          int segsize)
+{
+    int64_t offs = o->offset + offset + length;
+
+    /*
+     * sort out wraparound
+     */
+    if (!(o->segment & (SEG_32BIT|SEG_64BIT)))
+        offs &= 0xffff;
+    else if (segsize != 64)
+        offs &= 0xffffffff;
+
+    return offs;
+}
+
+int32_t disasm_decode(uint8_t *data, int32_t data_size, int segsize,
+                      int64_t offset, const iflag_t *prefer,
+                      struct disasm_insn *di)
 {
     const struct itemplate * const *p, * const *best_p;
     const struct disasm_index *ix;
     uint8_t *dp;
     int length, best_length = 0;
-    char *segover;
-    int i, slen, colon, n;
+    int i, n;
     uint8_t *origdata;
     int works;
-    insn tmp_ins, ins;
+    insn ins_buf[2], *tmp_ins, *best_ins;
     iflag_t goodness, best;
     int best_pref;
     struct prefix_info prefix;
     bool end_prefix;
-    bool is_evex;
-
-    memset(&ins, 0, sizeof ins);
+    const uint32_t *mask;
+    uint32_t need;
 
     /*
      * Scan for prefixes.
@@ -1140,7 +1144,6 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
     memset(&prefix, 0, sizeof prefix);
     prefix.asize = segsize;
     prefix.osize = (segsize == 64) ? 32 : segsize;
-    segover = NULL;
     origdata = data;
 
     ix = itable;
@@ -1166,27 +1169,27 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
 
         case 0x2E:
             fetch_or_return(origdata, data, data_size, 1);
-            segover = "cs", prefix.seg = *data++;
+            prefix.seg = *data++;
             break;
         case 0x36:
             fetch_or_return(origdata, data, data_size, 1);
-            segover = "ss", prefix.seg = *data++;
+            prefix.seg = *data++;
             break;
         case 0x3E:
             fetch_or_return(origdata, data, data_size, 1);
-            segover = "ds", prefix.seg = *data++;
+            prefix.seg = *data++;
             break;
         case 0x26:
             fetch_or_return(origdata, data, data_size, 1);
-            segover = "es", prefix.seg = *data++;
+            prefix.seg = *data++;
             break;
         case 0x64:
             fetch_or_return(origdata, data, data_size, 1);
-            segover = "fs", prefix.seg = *data++;
+            prefix.seg = *data++;
             break;
         case 0x65:
             fetch_or_return(origdata, data, data_size, 1);
-            segover = "gs", prefix.seg = *data++;
+            prefix.seg = *data++;
             break;
 
         case 0x66:
@@ -1322,9 +1325,31 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
         ix = (const struct disasm_index *)ix->p + *dp++;
     }
 
+    /*
+     * Build the decoder state for the prefilter masks; if there is a
+     * ModRM byte it is the one right after the opcode.
+     */
+    need = (segsize == 64) ? DM_LONG : DM_LEGACY;
+    need |= (prefix.osize == 16) ? DM_O16 :
+        (prefix.osize == 32) ? DM_O32 : DM_O64;
+    need |= (prefix.osize == (segsize == 16 ? 16 : 32)) ? DM_ODF : DM_ONDF;
+    need |= (prefix.rep == 0xF2) ? DM_REPNE :
+        (prefix.rep == 0xF3) ? DM_REP : DM_NOREP;
+    need |= prefix.osp ? DM_OSP : DM_NOOSP;
+    if (dp - origdata < data_size)
+        need |= DM_REG((*dp >> 3) & 7) |
+            ((*dp >> 6) == 3 ? DM_MODREG : DM_MODMEM);
+
+    tmp_ins  = &ins_buf[0];
+    best_ins = &ins_buf[1];
+
     p = (const struct itemplate * const *)ix->p;
-    for (n = ix->n; n; n--, p++) {
-        if ((length = matches(*p, data, &prefix, segsize, &tmp_ins))) {
+    mask = ix->mask;
+    for (n = ix->n; n; n--, p++, mask++) {
+        if ((*mask & need) != need)
+            continue;           /* Can't possibly match */
+
+        if ((length = matches(*p, data, &prefix, segsize, tmp_ins))) {
             works = true;
             /*
              * Final check to make sure the types of r/m match up.
@@ -1334,19 +1359,19 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
                 if (
                         /* If it's a mem-only EA but we have a
                            register, die. */
-                        ((tmp_ins.oprs[i].segment & SEG_RMREG) &&
+                        ((tmp_ins->oprs[i].segment & SEG_RMREG) &&
                          is_class(MEMORY, (*p)->opd[i])) ||
                         /* If it's a reg-only EA but we have a memory
                            ref, die. */
-                        (!(tmp_ins.oprs[i].segment & SEG_RMREG) &&
+                        (!(tmp_ins->oprs[i].segment & SEG_RMREG) &&
                          !(REG_EA & ~(*p)->opd[i]) &&
                          !((*p)->opd[i] & REG_SMASK)) ||
                         /* Register type mismatch (eg FS vs REG_DESS):
                            die. */
                         ((((*p)->opd[i] & (REGISTER | FPUREG)) ||
-                          (tmp_ins.oprs[i].segment & SEG_RMREG)) &&
+                          (tmp_ins->oprs[i].segment & SEG_RMREG)) &&
                          !whichreg((*p)->opd[i],
-                             tmp_ins.oprs[i].basereg, tmp_ins.rex))
+                             tmp_ins->oprs[i].basereg, tmp_ins->rex))
                    ) {
                     works = false;
                     break;
@@ -1367,7 +1392,7 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
                 goodness = iflag_xor(&goodness, prefer);
 		nprefix = 0;
 		for (i = 0; i < MAXPREFIX; i++)
-		    if (tmp_ins.prefixes[i])
+		    if (tmp_ins->prefixes[i])
 			nprefix++;
                 if (nprefix < best_pref ||
 		    (nprefix == best_pref &&
@@ -1377,7 +1402,8 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
                     best_p = p;
                     best_pref = nprefix;
                     best_length = length;
-                    ins = tmp_ins;
+                    best_ins = tmp_ins;
+                    tmp_ins = &ins_buf[best_ins == &ins_buf[0]];
                 }
             }
         }
@@ -1388,7 +1414,72 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
 
     /* Pick the best match */
     p = best_p;
-    length = best_length;
+    length = best_length + (data - origdata); /* fix up for prefixes */
+
+    di->temp = *p;
+    di->ins = *best_ins;
+    di->length = length;
+    di->segsize = segsize;
+    di->asize = prefix.asize;
+    di->segover = prefix.seg;
+    di->has_target = false;
+    di->target = 0;
+    for (i = 0; i < (*p)->operands; i++) {
+        const operand *o = &di->ins.oprs[i];
+        if (o->segment & SEG_RELATIVE) {
+            di->has_target = true;
+            di->target = rel_target(o, offset, length, segsize);
+            break;
+        }
+    }
+
+    return length;
+}
+
+/*
+ * Name of a segment override prefix byte
+ */
+static const char *segover_name(uint8_t seg)
+{
+    switch (seg) {
+    case 0x2E:
+        return "cs";
+    case 0x36:
+        return "ss";
+    case 0x3E:
+        return "ds";
+    case 0x26:
+        return "es";
+    case 0x64:
+        return "fs";
+    case 0x65:
+        return "gs";
+    default:
+        return NULL;
+    }
+}
+
+enum reg_enum disasm_reg(const struct disasm_insn *di, int op)
+{
+    opflags_t t = di->temp->opd[op];
+    const operand *o = &di->ins.oprs[op];
+
+    if (!((t & (REGISTER | FPUREG)) || (o->segment & SEG_RMREG)))
+        return R_none;
+
+    return whichreg(t, o->basereg, di->ins.rex);
+}
+
+int32_t disasm_format(const struct disasm_insn *di, char *output,
+                      int outbufsize, int64_t offset, int autosync)
+{
+    const struct itemplate *temp = di->temp;
+    const insn *ins = &di->ins;
+    int32_t length = di->length;
+    int segsize = di->segsize;
+    const char *segover = segover_name(di->segover);
+    int i, slen, colon;
+    bool is_evex;
 
     slen = 0;
 
@@ -1400,40 +1491,32 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
      *      be used for that purpose.
      */
     for (i = 0; i < MAXPREFIX; i++) {
-        const char *prefix = prefix_name(ins.prefixes[i]);
+        const char *prefix = prefix_name(ins->prefixes[i]);
         if (prefix)
             slen += snprintf(output+slen, outbufsize-slen, "%s ", prefix);
     }
 
-    i = (*p)->opcode;
+    i = temp->opcode;
     if (i >= FIRST_COND_OPCODE)
         slen += snprintf(output + slen, outbufsize - slen, "%s%s",
-                        nasm_insn_names[i], condition_name[ins.condition]);
+                        nasm_insn_names[i], condition_name[ins->condition]);
     else
         slen += snprintf(output + slen, outbufsize - slen, "%s",
                         nasm_insn_names[i]);
 
     colon = false;
-    is_evex = !!(ins.rex & REX_EV);
-    length += data - origdata;  /* fix up for prefixes */
-    for (i = 0; i < (*p)->operands; i++) {
-        opflags_t t = (*p)->opd[i];
-        decoflags_t deco = (*p)->deco[i];
-        const operand *o = &ins.oprs[i];
+    is_evex = !!(ins->rex & REX_EV);
+    for (i = 0; i < temp->operands; i++) {
+        opflags_t t = temp->opd[i];
+        decoflags_t deco = temp->deco[i];
+        const operand *o = &ins->oprs[i];
         int64_t offs;
 
         output[slen++] = (colon ? ':' : i == 0 ? ' ' : ',');
 
         offs = o->offset;
         if (o->segment & SEG_RELATIVE) {
-            offs += offset + length;
-            /*
-             * sort out wraparound
-             */
-            if (!(o->segment & (SEG_32BIT|SEG_64BIT)))
-                offs &= 0xffff;
-            else if (segsize != 64)
-                offs &= 0xffffffff;
+            offs = rel_target(o, offset, length, segsize);
 
             /*
              * add sync marker, if autosync is on
@@ -1450,7 +1533,7 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
         if ((t & (REGISTER | FPUREG)) ||
                 (o->segment & SEG_RMREG)) {
             enum reg_enum reg;
-            reg = whichreg(t, o->basereg, ins.rex);
+            reg = whichreg(t, o->basereg, ins->rex);
             if (t & TO)
                 slen += snprintf(output + slen, outbufsize - slen, "to ");
             slen += snprintf(output + slen, outbufsize - slen, "%s",
@@ -1460,7 +1543,7 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
                                  (int)((t & REGSET_MASK) >> (REGSET_SHIFT-1))-1);
             if (is_evex && deco)
                 slen += append_evex_reg_deco(output + slen, outbufsize - slen,
-                                             deco, ins.evex_p);
+                                             deco, ins->evex_p);
         } else if (!(UNITY & ~t)) {
             output[slen++] = '1';
         } else if (t & IMMEDIATE) {
@@ -1520,7 +1603,7 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
             if (t & BITS80)
                 slen +=
                     snprintf(output + slen, outbufsize - slen, "tword ");
-            if ((ins.evex_p[2] & EVEX_P2B) && (deco & BRDCAST_MASK)) {
+            if ((ins->evex_p[2] & EVEX_P2B) && (deco & BRDCAST_MASK)) {
                 /* when broadcasting, each element size should be used */
                 if (deco & BR_BITS32)
                     slen +=
@@ -1564,7 +1647,7 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
                         nasm_reg_names[(o->basereg-EXPR_REG_START)]);
                 started = true;
             }
-            if (o->indexreg != -1 && !itemp_has(*best_p, IF_MIB)) {
+            if (o->indexreg != -1 && !itemp_has(temp, IF_MIB)) {
                 if (started)
                     output[slen++] = '+';
                 slen += snprintf(output + slen, outbufsize - slen, "%s",
@@ -1616,7 +1699,7 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
                     snprintf(output + slen, outbufsize - slen,
                             "%s0x%"PRIx16"", prefix, offset);
             } else if (o->segment & SEG_DISP32) {
-                if (prefix.asize == 64) {
+                if (di->asize == 64) {
                     const char *prefix;
                     uint64_t offset = offs;
                     if ((int32_t)offs < 0 && started) {
@@ -1643,7 +1726,7 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
                 }
             }
 
-            if (o->indexreg != -1 && itemp_has(*best_p, IF_MIB)) {
+            if (o->indexreg != -1 && itemp_has(temp, IF_MIB)) {
                 output[slen++] = ',';
                 slen += snprintf(output + slen, outbufsize - slen, "%s",
                         nasm_reg_names[(o->indexreg-EXPR_REG_START)]);
@@ -1658,7 +1741,7 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
 
             if (is_evex && deco)
                 slen += append_evex_mem_deco(output + slen, outbufsize - slen,
-                                             t, deco, ins.evex_p);
+                                             t, deco, ins->evex_p);
         } else {
             slen +=
                 snprintf(output + slen, outbufsize - slen, "<operand%d>",
@@ -1677,6 +1760,17 @@ int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, i
     return length;
 }
 
+int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, int segsize,
+               int64_t offset, int autosync, iflag_t *prefer)
+{
+    struct disasm_insn di;
+
+    if (!disasm_decode(data, data_size, segsize, offset, prefer, &di))
+        return 0;
+
+    return disasm_format(&di, output, outbufsize, offset, autosync);
+}
+
 /*
  * This is called when we don't have a complete instruction.  If it
  * is a standalone *single-byte* prefix show it as such, otherwise
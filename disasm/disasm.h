@@ -38,10 +38,58 @@
 #ifndef NASM_DISASM_H
 #define NASM_DISASM_H
 
+#include "nasm.h"
 #include "iflag.h"
 
 #define INSN_MAX 32             /* one instruction can't be longer than this */
 
+/*
+ * Flags that go into the `segment' field of `insn' structures
+ * during disassembly.
+ */
+#define SEG_RELATIVE    1
+#define SEG_32BIT       2
+#define SEG_RMREG       4
+#define SEG_DISP8       8
+#define SEG_DISP16     16
+#define SEG_DISP32     32
+#define SEG_NODISP     64
+#define SEG_SIGNED    128
+#define SEG_64BIT     256
+
+/*
+ * A decoded instruction.  ins.oprs[] holds the raw operands as laid
+ * out by the template; register operands hold the register number
+ * from the encoding, use disasm_reg() to turn it into a register.
+ */
+struct itemplate;
+struct disasm_insn {
+    const struct itemplate *temp; /* matching template (opcode, operands) */
+    insn ins;                   /* operands, prefixes, condition code */
+    int32_t length;             /* length in bytes, including prefixes */
+    int segsize;                /* 16, 32 or 64 */
+    int asize;                  /* effective address size */
+    uint8_t segover;            /* segment override prefix byte, or 0 */
+    bool has_target;            /* has a relative (branch) operand */
+    int64_t target;             /* ... and this is where it goes */
+};
+
+/*
+ * Decode a single instruction at data, which is at address offset,
+ * without formatting it.  Returns its length, or 0 if it isn't a
+ * valid instruction.
+ */
+int32_t disasm_decode(uint8_t *data, int32_t data_size, int segsize,
+                      int64_t offset, const iflag_t *prefer,
+                      struct disasm_insn *di);
+
+/* Format an instruction returned by disasm_decode() as text */
+int32_t disasm_format(const struct disasm_insn *di, char *output,
+                      int outbufsize, int64_t offset, int autosync);
+
+/* The register in operand op, or R_none if it isn't a register */
+enum reg_enum disasm_reg(const struct disasm_insn *di, int op);
+
 int32_t disasm(uint8_t *data, int32_t data_size, char *output, int outbufsize, int segsize,
                int64_t offset, int autosync, iflag_t *prefer);
 int32_t eatbyte(uint8_t *data, char *output, int outbufsize, int segsize);
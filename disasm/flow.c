@@ -0,0 +1,267 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 1996-2020 The NASM Authors - All Rights Reserved
+ *   See the file AUTHORS included with the NASM distribution for
+ *   the specific copyright holders.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+/*
+ * flow.c   control flow-guided disassembly for the Netwide Disassembler
+ *
+ * Starting from a set of entry points, follow direct jumps and calls
+ * to find out which parts of the image are reachable code.  The code
+ * regions found, and any regions the user asked us to skip, are kept
+ * in a red-black tree keyed by start address.  None of them overlap:
+ * the regions to skip are merged as they are given, and only go into
+ * the tree once tracing starts.
+ */
+
+#include "compiler.h"
+
+#include "nasmlib.h"
+#include "rbtree.h"
+#include "insns.h"
+#include "disasm.h"
+#include "flow.h"
+
+struct region {
+    struct rbtree node;         /* node.key is the start address */
+    uint64_t end;               /* first address past the region */
+    bool code;                  /* code, as opposed to skipped */
+};
+
+static struct rbtree *regions;
+
+/* Regions to skip, sorted by address */
+static struct skip {
+    uint64_t start, end;
+} *skips;
+static size_t nskips, max_skips;
+
+/* Entry points still to be traced */
+static uint64_t *todo;
+static size_t ntodo, max_todo;
+
+void init_flow(void)
+{
+    regions = NULL;
+    nskips = 0;
+    ntodo = 0;
+}
+
+void flow_entry(uint64_t pos)
+{
+    if (ntodo >= max_todo) {
+        max_todo = max_todo ? max_todo << 1 : 256;
+        todo = nasm_realloc(todo, max_todo * sizeof(*todo));
+    }
+    todo[ntodo++] = pos;
+}
+
+static inline struct region *to_region(struct rbtree *node)
+{
+    return node ? container_of(node, struct region, node) : NULL;
+}
+
+/* The region containing pos, if any */
+static struct region *region_at(uint64_t pos)
+{
+    struct region *r = to_region(rb_search(regions, pos));
+
+    return (r && pos < r->end) ? r : NULL;
+}
+
+/* The first region starting after pos, if any */
+static struct region *region_after(uint64_t pos)
+{
+    struct rbtree *tree = regions, *best = NULL;
+
+    while (tree) {
+        if (tree->key > pos) {
+            best = tree;
+            tree = tree->left;
+        } else {
+            tree = tree->right;
+        }
+    }
+    return to_region(best);
+}
+
+static void add_region(uint64_t start, uint64_t end, bool code)
+{
+    struct region *r;
+
+    nasm_new(r);
+    r->node.key = start;
+    r->end = end;
+    r->code = code;
+    regions = rb_insert(regions, &r->node);
+}
+
+void flow_exclude(uint64_t pos, uint32_t length)
+{
+    uint64_t end = pos + length;
+    size_t i, j;
+
+    if (!length)
+        return;
+
+    /* Merge with the regions this one overlaps or touches */
+    for (i = 0; i < nskips && skips[i].end < pos; i++)
+        ;
+    for (j = i; j < nskips && skips[j].start <= end; j++) {
+        if (skips[j].start < pos)
+            pos = skips[j].start;
+        if (skips[j].end > end)
+            end = skips[j].end;
+    }
+
+    if (i == j) {
+        if (nskips >= max_skips) {
+            max_skips = max_skips ? max_skips << 1 : 16;
+            skips = nasm_realloc(skips, max_skips * sizeof(*skips));
+        }
+        memmove(skips + i + 1, skips + i, (nskips - i) * sizeof(*skips));
+        nskips++;
+    } else {
+        memmove(skips + i + 1, skips + j, (nskips - j) * sizeof(*skips));
+        nskips -= j - i - 1;
+    }
+    skips[i].start = pos;
+    skips[i].end = end;
+}
+
+bool flow_skip(size_t i, uint64_t *start, uint64_t *end)
+{
+    if (i >= nskips)
+        return false;
+
+    *start = skips[i].start;
+    *end = skips[i].end;
+    return true;
+}
+
+/*
+ * Does execution never fall through to the next instruction?
+ */
+static bool ends_flow(enum opcode opcode)
+{
+    switch (opcode) {
+    case I_JMP:
+    case I_JMPE:
+    case I_RET:
+    case I_RETF:
+    case I_RETN:
+    case I_RETW:
+    case I_RETFW:
+    case I_RETNW:
+    case I_RETD:
+    case I_RETFD:
+    case I_RETND:
+    case I_RETQ:
+    case I_RETFQ:
+    case I_RETNQ:
+    case I_IRET:
+    case I_IRETD:
+    case I_IRETQ:
+    case I_IRETW:
+    case I_HLT:
+    case I_UD0:
+    case I_UD1:
+    case I_UD2:
+    case I_UD2A:
+    case I_UD2B:
+    case I_SYSEXIT:
+    case I_SYSRET:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void flow_trace(uint8_t *data, uint64_t origin, uint64_t len,
+                int segsize, const iflag_t *prefer)
+{
+    struct disasm_insn di;
+    size_t i;
+
+    for (i = 0; i < nskips; i++)
+        add_region(skips[i].start, skips[i].end, false);
+    nskips = 0;
+
+    while (ntodo) {
+        uint64_t pos = todo[--ntodo];
+        uint64_t start, limit;
+        struct region *next;
+
+        if (pos < origin || pos - origin >= len || region_at(pos))
+            continue;
+
+        /* Stop before running into code we have already seen */
+        next = region_after(pos);
+        limit = origin + len;
+        if (next && next->node.key < limit)
+            limit = next->node.key;
+
+        start = pos;
+        while (pos < limit) {
+            int32_t n = disasm_decode(data + (pos - origin), INSN_MAX,
+                                      segsize, pos, prefer, &di);
+            if (!n || (uint64_t)n > limit - pos)
+                break;
+
+            pos += n;
+            if (di.has_target)
+                flow_entry(di.target);
+            if (ends_flow(di.temp->opcode))
+                break;
+        }
+
+        if (pos > start)
+            add_region(start, pos, true);
+    }
+}
+
+bool flow_next(uint64_t pos, uint64_t *start, uint64_t *end)
+{
+    struct region *r = region_at(pos);
+
+    if (!r)
+        r = region_after(pos);
+    while (r && !r->code)
+        r = region_after(r->node.key);
+
+    if (!r)
+        return false;
+
+    *start = r->node.key;
+    *end = r->end;
+    return true;
+}
@@ -0,0 +1,69 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 1996-2020 The NASM Authors - All Rights Reserved
+ *   See the file AUTHORS included with the NASM distribution for
+ *   the specific copyright holders.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+/*
+ * flow.h   header file for flow.c
+ */
+
+#ifndef NASM_FLOW_H
+#define NASM_FLOW_H
+
+#include "iflag.h"
+
+void init_flow(void);
+void flow_entry(uint64_t pos);
+void flow_exclude(uint64_t pos, uint32_t length);
+
+/*
+ * Get the i'th region to skip, in address order, after merging those
+ * which overlap or touch.  Returns false past the last one.  Only
+ * valid before flow_trace().
+ */
+bool flow_skip(size_t i, uint64_t *start, uint64_t *end);
+
+/*
+ * Trace the code reachable from the entry points in the len bytes of
+ * data loaded at origin; data must be followed by INSN_MAX bytes of
+ * padding.
+ */
+void flow_trace(uint8_t *data, uint64_t origin, uint64_t len,
+                int segsize, const iflag_t *prefer);
+
+/*
+ * Find the code region containing pos, or else the first one after
+ * it.  Returns false if there are none left.
+ */
+bool flow_next(uint64_t pos, uint64_t *start, uint64_t *end);
+
+#endif
@@ -46,17 +46,21 @@
 #include "error.h"
 #include "ver.h"
 #include "sync.h"
+#include "flow.h"
+#include "objfile.h"
 #include "disasm.h"
 
 #define BPL 8                   /* bytes per line of hex dump */
 
 static const char *help =
-    "usage: ndisasm [-a] [-i] [-h] [-r] [-u] [-b bits] [-o origin] [-s sync...]\n"
+    "usage: ndisasm [-a] [-i] [-c] [-h] [-n] [-r] [-u] [-b bits] [-o origin] [-s sync...]\n"
     "               [-e bytes] [-k start,bytes] [-p vendor] file\n"
     "   -a or -i activates auto (intelligent) sync\n"
+    "   -c only disassembles code reachable from the start and sync points\n"
     "   -u same as -b 32\n"
     "   -b 16, -b 32 or -b 64 sets the processor mode\n"
     "   -h displays this text\n"
+    "   -n treats the input as raw binary even if it is an ELF or COFF/PE file\n"
     "   -r or -v displays the version number\n"
     "   -e skips <bytes> bytes of header\n"
     "   -k avoids disassembling <bytes> bytes from position <start>\n"
@@ -64,6 +68,8 @@ static const char *help =
 
 static void output_ins(uint64_t, uint8_t *, int, char *);
 static void skip(uint32_t dist, FILE * fp);
+static void flow_disasm(FILE *fp, int64_t offset, int bits, iflag_t *prefer);
+static void obj_disasm(struct objfile *obj, int bits, iflag_t *prefer);
 
 void nasm_verror(errflags severity, const char *fmt, va_list val)
 {
@@ -87,10 +93,14 @@ int main(int argc, char **argv)
     char *pname = *argv;
     char *filename = NULL;
     uint32_t nextsync, synclen, initskip = 0L;
+    uint64_t skipstart, skipend;
+    size_t i;
     int lenread;
     int32_t lendis;
     bool autosync = false;
-    int bits = 16, b;
+    bool flow = false;
+    bool raw = false;
+    int bits = 0, b;
     bool eof = false;
     iflag_t prefer;
     bool rn_error;
@@ -102,6 +112,7 @@ int main(int argc, char **argv)
 
     offset = 0;
     init_sync();
+    init_flow();
 
     while (--argc) {
         char *v, *vv, *p = *++argv;
@@ -114,9 +125,17 @@ int main(int argc, char **argv)
                     autosync = true;
                     p++;
                     break;
+                case 'c':      /* follow control flow */
+                    flow = true;
+                    p++;
+                    break;
                 case 'h':
                     fputs(help, stderr);
                     return 0;
+                case 'n':      /* no object file detection */
+                    raw = true;
+                    p++;
+                    break;
                 case 'r':
                 case 'v':
                     fprintf(stderr,
@@ -124,6 +143,8 @@ int main(int argc, char **argv)
 			    nasm_version, nasm_date);
                     return 0;
                 case 'u':	/* -u for -b 32, -uu for -b 64 */
+		    if (!bits)
+			bits = 16;
 		    if (bits < 64)
 			bits <<= 1;
                     p++;
@@ -136,7 +157,7 @@ int main(int argc, char **argv)
                         return 1;
                     }
 		    b = strtoul(v, &ep, 10);
-		    if (*ep || !(bits == 16 || bits == 32 || bits == 64)) {
+		    if (*ep || !(b == 16 || b == 32 || b == 64)) {
                         fprintf(stderr, "%s: argument to `-b' should"
                                 " be 16, 32 or 64\n", pname);
                     } else {
@@ -167,7 +188,9 @@ int main(int argc, char **argv)
                                 pname);
                         return 1;
                     }
-                    add_sync(readnum(v, &rn_error), 0L);
+                    nextsync = readnum(v, &rn_error);
+                    add_sync(nextsync, 0L);
+                    flow_entry(nextsync);
                     if (rn_error) {
                         fprintf(stderr,
                                 "%s: `-s' requires a numeric argument\n",
@@ -221,7 +244,7 @@ int main(int argc, char **argv)
                                 pname);
                         return 1;
                     }
-                    add_sync(nextsync, synclen);
+                    flow_exclude(nextsync, synclen);
                     p = "";     /* force to next argument */
                     break;
                 case 'p':      /* preferred vendor */
@@ -283,9 +306,41 @@ int main(int argc, char **argv)
     } else
         fp = stdin;
 
+    /*
+     * An ELF or COFF/PE file is disassembled section by section;
+     * skipping a header with -e means the user wants the raw bytes.
+     */
+    if (fp != stdin && !raw && !initskip) {
+        struct objfile obj;
+
+        if (obj_open(fp, &obj)) {
+            obj_disasm(&obj, bits ? bits : obj.bits, &prefer);
+            obj_close(&obj);
+            fclose(fp);
+            return 0;
+        }
+    }
+
+    if (!bits)
+        bits = 16;
+
     if (initskip > 0)
         skip(initskip, fp);
 
+    if (flow) {
+        flow_disasm(fp, offset, bits, &prefer);
+        if (fp != stdin)
+            fclose(fp);
+        return 0;
+    }
+
+    /* The -k regions, merged so that no byte is skipped twice */
+    for (i = 0; flow_skip(i, &skipstart, &skipend); i++) {
+        for (; skipend - skipstart > UINT32_MAX; skipstart += UINT32_MAX)
+            add_sync(skipstart, UINT32_MAX);
+        add_sync(skipstart, skipend - skipstart);
+    }
+
     /*
      * This main loop is really horrible, and wants rewriting with
      * an axe. It'll stay the way it is for a while though, until I
@@ -344,6 +399,111 @@ int main(int argc, char **argv)
     return 0;
 }
 
+/*
+ * Control flow-guided disassembly: read the whole file, find the
+ * reachable code and only disassemble that, skipping everything else.
+ */
+static void flow_disasm(FILE *fp, int64_t offset, int bits, iflag_t *prefer)
+{
+    char outbuf[256];
+    uint8_t *data = NULL;
+    size_t len = 0, size = 0;
+    uint64_t pos, start, end, q;
+    int32_t lendis;
+
+    do {
+        size_t n;
+
+        if (size - len < 65536 + INSN_MAX) {
+            size = size ? size << 1 : 65536 + INSN_MAX;
+            data = nasm_realloc(data, size);
+        }
+        n = fread(data + len, 1, size - len - INSN_MAX, fp);
+        if (!n)
+            break;
+        len += n;
+    } while (!feof(fp));
+    memset(data + len, 0, INSN_MAX);
+
+    flow_entry(offset);
+    flow_trace(data, offset, len, bits, prefer);
+
+    pos = offset;
+    while (flow_next(pos, &start, &end)) {
+        if (start > pos)
+            fprintf(stdout, "%08"PRIX64"  skipping 0x%"PRIX64" bytes\n",
+                    pos, start - pos);
+        for (q = start; q < end; q += lendis) {
+            uint8_t *ip = data + (q - offset);
+
+            lendis = disasm(ip, INSN_MAX, outbuf, sizeof(outbuf),
+                            bits, q, false, prefer);
+            if (!lendis || (uint64_t)lendis > end - q)
+                lendis = eatbyte(ip, outbuf, sizeof(outbuf), bits);
+            output_ins(q, ip, lendis, outbuf);
+        }
+        pos = end;
+    }
+    if (pos < offset + len)
+        fprintf(stdout, "%08"PRIX64"  skipping 0x%"PRIX64" bytes\n",
+                pos, offset + len - pos);
+
+    nasm_free(data);
+}
+
+/*
+ * Disassemble each executable section of an object file or
+ * executable at its own address, labelling the symbols in it.  An
+ * instruction is never allowed to run across a symbol.
+ */
+static void obj_disasm(struct objfile *obj, int bits, iflag_t *prefer)
+{
+    char outbuf[256];
+    uint8_t tail[INSN_MAX * 2];
+    int i;
+
+    for (i = 0; i < obj->nsects; i++) {
+        const struct objsect *s = &obj->sects[i];
+        size_t sym = obj_find_sym(obj, s->index, s->addr);
+        uint64_t q, limit;
+        int32_t lendis;
+
+        fprintf(stdout, "%s%*ssection %s\n", i ? "\n" : "",
+                (BPL + 1) * 2 + 10, "", s->name);
+
+        for (q = 0; q < s->size; q += lendis) {
+            uint64_t addr = s->addr + q;
+            uint8_t *ip = (uint8_t *)s->data + q;
+
+            limit = s->size;
+            while (sym < obj->nsyms && obj->syms[sym].sect == s->index) {
+                const struct objsym *sy = &obj->syms[sym];
+
+                if (sy->addr > addr) {
+                    limit = sy->addr - s->addr;
+                    break;
+                }
+                fprintf(stdout, "%*s%s:\n", (BPL + 1) * 2 + 10, "",
+                        sy->name);
+                sym++;
+            }
+
+            /* Don't let the decoder look past the end of the image */
+            if (s->size - q < INSN_MAX) {
+                memset(tail, 0, sizeof tail);
+                memcpy(tail, ip, s->size - q);
+                ip = tail;
+            }
+
+            lendis = disasm(ip, INSN_MAX, outbuf, sizeof(outbuf),
+                            bits, addr, false, prefer);
+            if (!lendis || (uint64_t)lendis > limit - q)
+                lendis = eatbyte(ip, outbuf, sizeof(outbuf), bits);
+            output_ins(addr, ip, lendis, outbuf);
+        }
+    }
+}
+
 static void output_ins(uint64_t offset, uint8_t *data,
                        int datalen, char *insn)
 {
@@ -0,0 +1,589 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 1996-2020 The NASM Authors - All Rights Reserved
+ *   See the file AUTHORS included with the NASM distribution for
+ *   the specific copyright holders.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+/*
+ * objfile.c   ELF and COFF/PE input for the Netwide Disassembler
+ *
+ * The file is mapped (or, failing that, read) into memory once; the
+ * executable sections point straight into that image, and the symbols
+ * are collected into one array sorted by section and address so that
+ * the disassembler can walk them in step with the code.
+ */
+
+#include "compiler.h"
+
+#include "nasmlib.h"
+#include "nctype.h"
+#include "bytesex.h"
+#include "objfile.h"
+#include "../output/elf.h"
+#include "../output/pecoff.h"
+
+static inline uint16_t get16(const uint8_t *p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof v);
+    return cpu_to_le16(v);
+}
+
+static inline uint32_t get32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return cpu_to_le32(v);
+}
+
+static inline uint64_t get64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return cpu_to_le64(v);
+}
+
+/* Is [off, off+size) inside the image? */
+static inline bool in_image(const struct objfile *obj,
+                            uint64_t off, uint64_t size)
+{
+    return off <= obj->len && size <= obj->len - off;
+}
+
+/*
+ * Copy a string of at most max bytes out of the image, or return
+ * NULL if it runs off the end of the file.
+ */
+static char *image_str(const struct objfile *obj, uint64_t off, size_t max)
+{
+    const char *s, *e;
+
+    if (off >= obj->len)
+        return NULL;
+    s = (const char *)obj->image + off;
+    if (max > obj->len - off)
+        max = obj->len - off;
+    e = memchr(s, '\0', max);
+    return nasm_strndup(s, e ? (size_t)(e - s) : max);
+}
+
+static struct objsect *add_sect(struct objfile *obj)
+{
+    struct objsect *s;
+
+    obj->sects = nasm_realloc(obj->sects,
+                              (obj->nsects + 1) * sizeof *obj->sects);
+    s = &obj->sects[obj->nsects++];
+    nasm_zero(*s);
+    return s;
+}
+
+static void add_sym(struct objfile *obj, size_t *size,
+                    int sect, uint64_t addr, char *name)
+{
+    struct objsym *s;
+
+    if (obj->nsyms >= *size) {
+        *size = *size ? *size << 1 : 256;
+        obj->syms = nasm_realloc(obj->syms, *size * sizeof *obj->syms);
+    }
+    s = &obj->syms[obj->nsyms++];
+    s->sect = sect;
+    s->addr = addr;
+    s->name = name;
+}
+
+/*
+ * Map the file's section numbers, below n, to their place in
+ * obj->sects[], or to -1 for those which are not disassembled; this
+ * saves searching the sections for every symbol.
+ */
+static int *sect_map(const struct objfile *obj, unsigned int n)
+{
+    int *map = nasm_malloc(n * sizeof *map);
+    unsigned int i;
+    int j;
+
+    for (i = 0; i < n; i++)
+        map[i] = -1;
+    for (j = 0; j < obj->nsects; j++)
+        map[obj->sects[j].index] = j;
+    return map;
+}
+
+/*
+ * ELF
+ */
+
+/* The parts of a section header we care about, for either class */
+struct elf_shdr {
+    uint32_t name, type, link;
+    uint64_t flags, addr, offset, size, entsize;
+};
+
+static bool elf_shdr(const struct objfile *obj, bool is64,
+                     uint64_t off, struct elf_shdr *sh)
+{
+    if (is64) {
+        Elf64_Shdr s;
+
+        if (!in_image(obj, off, sizeof s))
+            return false;
+        memcpy(&s, obj->image + off, sizeof s);
+        sh->name    = cpu_to_le32(s.sh_name);
+        sh->type    = cpu_to_le32(s.sh_type);
+        sh->link    = cpu_to_le32(s.sh_link);
+        sh->flags   = cpu_to_le64(s.sh_flags);
+        sh->addr    = cpu_to_le64(s.sh_addr);
+        sh->offset  = cpu_to_le64(s.sh_offset);
+        sh->size    = cpu_to_le64(s.sh_size);
+        sh->entsize = cpu_to_le64(s.sh_entsize);
+    } else {
+        Elf32_Shdr s;
+
+        if (!in_image(obj, off, sizeof s))
+            return false;
+        memcpy(&s, obj->image + off, sizeof s);
+        sh->name    = cpu_to_le32(s.sh_name);
+        sh->type    = cpu_to_le32(s.sh_type);
+        sh->link    = cpu_to_le32(s.sh_link);
+        sh->flags   = cpu_to_le32(s.sh_flags);
+        sh->addr    = cpu_to_le32(s.sh_addr);
+        sh->offset  = cpu_to_le32(s.sh_offset);
+        sh->size    = cpu_to_le32(s.sh_size);
+        sh->entsize = cpu_to_le32(s.sh_entsize);
+    }
+    return true;
+}
+
+static void elf_symbols(struct objfile *obj, bool is64, bool is_rel,
+                        const struct elf_shdr *shdrs, unsigned int shnum,
+                        const int *map, const struct elf_shdr *symtab)
+{
+    const struct elf_shdr *strtab;
+    size_t symsize = is64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+    size_t size = 0;
+    uint64_t off, end;
+
+    if (symtab->link >= shnum || !in_image(obj, symtab->offset, symtab->size))
+        return;
+    strtab = &shdrs[symtab->link];
+
+    end = symtab->offset + symtab->size;
+    for (off = symtab->offset + symsize; off + symsize <= end; off += symsize) {
+        uint32_t name;
+        uint64_t value;
+        unsigned int shndx, type;
+        char *str;
+
+        if (is64) {
+            Elf64_Sym s;
+            memcpy(&s, obj->image + off, sizeof s);
+            name  = cpu_to_le32(s.st_name);
+            value = cpu_to_le64(s.st_value);
+            shndx = cpu_to_le16(s.st_shndx);
+            type  = ELF64_ST_TYPE(s.st_info);
+        } else {
+            Elf32_Sym s;
+            memcpy(&s, obj->image + off, sizeof s);
+            name  = cpu_to_le32(s.st_name);
+            value = cpu_to_le32(s.st_value);
+            shndx = cpu_to_le16(s.st_shndx);
+            type  = ELF32_ST_TYPE(s.st_info);
+        }
+
+        if (!name || type == STT_SECTION || type == STT_FILE ||
+            shndx == SHN_UNDEF || shndx >= shnum ||
+            map[shndx] < 0 || name >= strtab->size)
+            continue;
+
+        str = image_str(obj, strtab->offset + name, strtab->size - name);
+        if (!str)
+            continue;
+        if (!*str) {
+            nasm_free(str);
+            continue;
+        }
+
+        if (is_rel)
+            value += shdrs[shndx].addr;
+        add_sym(obj, &size, shndx, value, str);
+    }
+}
+
+static bool elf_open(struct objfile *obj)
+{
+    const uint8_t *ident = obj->image;
+    bool is64;
+    uint16_t type, machine, shentsize, shstrndx;
+    unsigned int shnum, i;
+    uint64_t shoff;
+    struct elf_shdr *shdrs;
+    const struct elf_shdr *shstr, *symtab = NULL;
+
+    if (obj->len < EI_NIDENT || memcmp(ident, "\177ELF", 4) ||
+        ident[EI_DATA] != ELFDATA2LSB)
+        return false;
+
+    if (ident[EI_CLASS] == ELFCLASS64) {
+        Elf64_Ehdr eh;
+
+        if (obj->len < sizeof eh)
+            return false;
+        memcpy(&eh, obj->image, sizeof eh);
+        type      = cpu_to_le16(eh.e_type);
+        machine   = cpu_to_le16(eh.e_machine);
+        shoff     = cpu_to_le64(eh.e_shoff);
+        shentsize = cpu_to_le16(eh.e_shentsize);
+        shnum     = cpu_to_le16(eh.e_shnum);
+        shstrndx  = cpu_to_le16(eh.e_shstrndx);
+        is64      = true;
+    } else if (ident[EI_CLASS] == ELFCLASS32) {
+        Elf32_Ehdr eh;
+
+        if (obj->len < sizeof eh)
+            return false;
+        memcpy(&eh, obj->image, sizeof eh);
+        type      = cpu_to_le16(eh.e_type);
+        machine   = cpu_to_le16(eh.e_machine);
+        shoff     = cpu_to_le32(eh.e_shoff);
+        shentsize = cpu_to_le16(eh.e_shentsize);
+        shnum     = cpu_to_le16(eh.e_shnum);
+        shstrndx  = cpu_to_le16(eh.e_shstrndx);
+        is64      = false;
+    } else {
+        return false;
+    }
+
+    switch (machine) {
+    case EM_386:
+        obj->bits = 32;
+        obj->format = "elf32";
+        break;
+    case EM_X86_64:
+        obj->bits = 64;
+        obj->format = is64 ? "elf64" : "elfx32";
+        break;
+    default:
+        return false;
+    }
+
+    if (!shnum || shentsize < (is64 ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr)))
+        return false;
+
+    shdrs = nasm_malloc(shnum * sizeof *shdrs);
+    for (i = 0; i < shnum; i++) {
+        if (!elf_shdr(obj, is64, shoff + (uint64_t)i * shentsize, &shdrs[i])) {
+            nasm_free(shdrs);
+            return false;
+        }
+    }
+    shstr = shstrndx < shnum ? &shdrs[shstrndx] : NULL;
+
+    for (i = 1; i < shnum; i++) {
+        const struct elf_shdr *sh = &shdrs[i];
+        struct objsect *s;
+
+        if (sh->type == SHT_SYMTAB ||
+            (sh->type == SHT_DYNSYM && !symtab))
+            symtab = sh;
+
+        if (sh->type != SHT_PROGBITS || !(sh->flags & SHF_EXECINSTR) ||
+            !in_image(obj, sh->offset, sh->size))
+            continue;
+
+        s = add_sect(obj);
+        s->index = i;
+        s->data  = obj->image + sh->offset;
+        s->size  = sh->size;
+        s->addr  = sh->addr;
+        if (shstr && sh->name < shstr->size)
+            s->name = image_str(obj, shstr->offset + sh->name,
+                                shstr->size - sh->name);
+        if (!s->name)
+            s->name = nasm_asprintf("%u", i);
+    }
+
+    if (symtab) {
+        int *map = sect_map(obj, shnum);
+        elf_symbols(obj, is64, type == ET_REL, shdrs, shnum, map, symtab);
+        nasm_free(map);
+    }
+
+    nasm_free(shdrs);
+    return true;
+}
+
+/*
+ * COFF objects and PE images
+ */
+
+#define COFF_HDR_SIZE   20
+#define COFF_SECT_SIZE  40
+#define COFF_SYM_SIZE   18
+
+static char *coff_name(const struct objfile *obj, const uint8_t *name,
+                       uint64_t strtab, uint64_t strsize)
+{
+    /* Long names are either "/nnn" or a zero word and an offset */
+    if (name[0] == '/' && nasm_isdigit(name[1])) {
+        char num[8];
+        uint32_t off;
+
+        memcpy(num, name + 1, 7);
+        num[7] = '\0';
+        off = strtoul(num, NULL, 10);
+        return off < strsize ? image_str(obj, strtab + off, strsize - off)
+            : NULL;
+    }
+    if (!get32(name)) {
+        uint32_t off = get32(name + 4);
+        return off < strsize ? image_str(obj, strtab + off, strsize - off)
+            : NULL;
+    }
+    return nasm_strndup((const char *)name,
+                        strnlen((const char *)name, 8));
+}
+
+static bool coff_open(struct objfile *obj)
+{
+    const uint8_t *hdr;
+    uint64_t off = 0, sectab, symtab, strtab, strsize = 0;
+    uint64_t imagebase = 0;
+    uint32_t nsyms, i;
+    uint16_t machine, nsects, opthdr;
+    bool is_pe = false;
+    size_t size = 0;
+    int *map;
+
+    if (obj->len >= 0x40 && !memcmp(obj->image, "MZ", 2)) {
+        off = get32(obj->image + 0x3c);
+        if (!in_image(obj, off, 4 + COFF_HDR_SIZE) ||
+            memcmp(obj->image + off, "PE\0\0", 4))
+            return false;
+        off += 4;
+        is_pe = true;
+    } else if (obj->len < COFF_HDR_SIZE) {
+        return false;
+    }
+
+    hdr     = obj->image + off;
+    machine = get16(hdr);
+    nsects  = get16(hdr + 2);
+    symtab  = get32(hdr + 8);
+    nsyms   = get32(hdr + 12);
+    opthdr  = get16(hdr + 16);
+
+    switch (machine) {
+    case IMAGE_FILE_MACHINE_I386:
+        obj->bits = 32;
+        obj->format = "win32";
+        break;
+    case IMAGE_FILE_MACHINE_AMD64:
+        obj->bits = 64;
+        obj->format = "win64";
+        break;
+    default:
+        return false;
+    }
+
+    /*
+     * A bare COFF object has nothing like a magic number, so be
+     * picky about what else we accept.
+     */
+    sectab = off + COFF_HDR_SIZE + opthdr;
+    if ((!is_pe && opthdr) || !nsects ||
+        !in_image(obj, sectab, (uint64_t)nsects * COFF_SECT_SIZE))
+        return false;
+
+    if (is_pe && opthdr >= 32) {
+        const uint8_t *opt = hdr + COFF_HDR_SIZE;
+
+        if (get16(opt) == 0x20b)
+            imagebase = get64(opt + 24);        /* PE32+ */
+        else
+            imagebase = get32(opt + 28);        /* PE32 */
+    }
+
+    if (symtab && nsyms &&
+        in_image(obj, symtab, (uint64_t)nsyms * COFF_SYM_SIZE)) {
+        strtab = symtab + (uint64_t)nsyms * COFF_SYM_SIZE;
+        if (in_image(obj, strtab, 4)) {
+            strsize = get32(obj->image + strtab);
+            if (!in_image(obj, strtab, strsize))
+                strsize = obj->len - strtab;
+        }
+    } else {
+        nsyms = 0;
+        strtab = 0;
+    }
+
+    for (i = 0; i < nsects; i++) {
+        const uint8_t *sh = obj->image + sectab + i * COFF_SECT_SIZE;
+        uint32_t vsize  = get32(sh + 8);
+        uint32_t vaddr  = get32(sh + 12);
+        uint32_t rsize  = get32(sh + 16);
+        uint32_t rptr   = get32(sh + 20);
+        uint32_t flags  = get32(sh + 36);
+        struct objsect *s;
+
+        if (!(flags & (IMAGE_SCN_CNT_CODE | IMAGE_SCN_MEM_EXECUTE)) ||
+            !rptr || !in_image(obj, rptr, rsize))
+            continue;
+
+        s = add_sect(obj);
+        s->index = i + 1;
+        s->data  = obj->image + rptr;
+        s->size  = (is_pe && vsize && vsize < rsize) ? vsize : rsize;
+        s->addr  = is_pe ? imagebase + vaddr : vaddr;
+        s->name  = coff_name(obj, sh, strtab, strsize);
+        if (!s->name)
+            s->name = nasm_asprintf("%u", i + 1);
+    }
+
+    map = sect_map(obj, nsects + 1);
+    for (i = 0; i < nsyms; i++) {
+        const uint8_t *sym = obj->image + symtab + i * COFF_SYM_SIZE;
+        uint32_t value  = get32(sym + 8);
+        int16_t sect    = get16(sym + 12);
+        uint8_t sclass  = sym[16];
+        uint8_t naux    = sym[17];
+        char *name;
+
+        i += naux;
+
+        /* Section definitions are static symbols with an aux record */
+        if (sect <= 0 || sect > nsects || map[sect] < 0 ||
+            sclass == IMAGE_SYM_CLASS_FILE ||
+            (sclass == IMAGE_SYM_CLASS_STATIC && naux))
+            continue;
+
+        name = coff_name(obj, sym, strtab, strsize);
+        if (!name)
+            continue;
+        if (!*name) {
+            nasm_free(name);
+            continue;
+        }
+        /* Symbol values are relative to their section */
+        add_sym(obj, &size, sect, obj->sects[map[sect]].addr + value, name);
+    }
+    nasm_free(map);
+
+    return true;
+}
+
+static int sym_cmp(const void *a, const void *b)
+{
+    const struct objsym *x = a, *y = b;
+
+    if (x->sect != y->sect)
+        return x->sect < y->sect ? -1 : 1;
+    if (x->addr != y->addr)
+        return x->addr < y->addr ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+size_t obj_find_sym(const struct objfile *obj, int sect, uint64_t addr)
+{
+    size_t lo = 0, hi = obj->nsyms;
+
+    while (lo < hi) {
+        size_t mid = lo + ((hi - lo) >> 1);
+        const struct objsym *s = &obj->syms[mid];
+
+        if (s->sect < sect || (s->sect == sect && s->addr < addr))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+bool obj_open(FILE *fp, struct objfile *obj)
+{
+    off_t len;
+
+    nasm_zero(*obj);
+
+    len = nasm_file_size(fp);
+    if (len == (off_t)-1 || len < COFF_HDR_SIZE ||
+        len != (off_t)(size_t)len)
+        return false;
+    obj->len = len;
+
+    obj->image = nasm_map_file(fp, 0, len);
+    if (obj->image) {
+        obj->mapped = true;
+    } else {
+        off_t pos = ftello(fp);
+        uint8_t *buf = nasm_malloc(len);
+
+        if (pos == (off_t)-1 || fseeko(fp, 0, SEEK_SET) ||
+            fread(buf, 1, len, fp) != (size_t)len) {
+            nasm_free(buf);
+            fseeko(fp, pos, SEEK_SET);
+            return false;
+        }
+        fseeko(fp, pos, SEEK_SET);
+        obj->image = buf;
+    }
+
+    if (!elf_open(obj) && !coff_open(obj)) {
+        obj_close(obj);
+        return false;
+    }
+
+    if (obj->nsyms)
+        qsort(obj->syms, obj->nsyms, sizeof *obj->syms, sym_cmp);
+
+    return true;
+}
+
+void obj_close(struct objfile *obj)
+{
+    int i;
+    size_t j;
+
+    for (i = 0; i < obj->nsects; i++)
+        nasm_free(obj->sects[i].name);
+    nasm_free(obj->sects);
+    for (j = 0; j < obj->nsyms; j++)
+        nasm_free(obj->syms[j].name);
+    nasm_free(obj->syms);
+
+    if (obj->mapped)
+        nasm_unmap_file(obj->image, obj->len);
+    else
+        nasm_free((void *)obj->image);
+
+    nasm_zero(*obj);
+}
@@ -0,0 +1,87 @@
+/* ----------------------------------------------------------------------- *
+ *
+ *   Copyright 1996-2020 The NASM Authors - All Rights Reserved
+ *   See the file AUTHORS included with the NASM distribution for
+ *   the specific copyright holders.
+ *
+ *   Redistribution and use in source and binary forms, with or without
+ *   modification, are permitted provided that the following
+ *   conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above
+ *     copyright notice, this list of conditions and the following
+ *     disclaimer in the documentation and/or other materials provided
+ *     with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * ----------------------------------------------------------------------- */
+
+
+/*
+ * objfile.h   header file for objfile.c
+ */
+
+#ifndef NASM_OBJFILE_H
+#define NASM_OBJFILE_H
+
+#include "compiler.h"
+
+/* An executable section */
+struct objsect {
+    char *name;
+    const uint8_t *data;        /* Contents, inside the file image */
+    uint64_t size;
+    uint64_t addr;              /* Virtual address of the first byte */
+    int index;                  /* Section number in the file */
+};
+
+/* A symbol defined in one of the sections */
+struct objsym {
+    uint64_t addr;
+    int sect;                   /* Section number in the file */
+    char *name;
+};
+
+struct objfile {
+    const char *format;         /* "elf32", "win64"... */
+    int bits;                   /* Processor mode from the header */
+    int nsects;
+    struct objsect *sects;
+    size_t nsyms;
+    struct objsym *syms;        /* Sorted by section, then address */
+
+    /* File image */
+    const uint8_t *image;
+    size_t len;
+    bool mapped;
+};
+
+/*
+ * Recognize an ELF or COFF/PE file; returns false, with the file
+ * position unchanged, if it is neither.
+ */
+bool obj_open(FILE *fp, struct objfile *obj);
+void obj_close(struct objfile *obj);
+
+/*
+ * Return the index of the first symbol in section sect at or after
+ * addr, or obj->nsyms if there is none.
+ */
+size_t obj_find_sym(const struct objfile *obj, int sect, uint64_t addr);
+
+#endif
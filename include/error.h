@@ -75,6 +75,8 @@ fatal_func nasm_panic_from_macro(const char *file, int line);
 void nasm_verror(errflags severity, const char *fmt, va_list ap);
 fatal_func nasm_verror_critical(errflags severity, const char *fmt, va_list ap);
 
+extern uint64_t diag_count;     /* Diagnostics not suppressed so far */
+
 /*
  * These are the error severity codes which get passed as the first
  * argument to an efunc.
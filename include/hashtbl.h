@@ -54,6 +54,9 @@ struct hash_table {
     size_t load;
     size_t size;
     size_t max_load;
+    uint64_t lookups;           /* Number of searches */
+    uint64_t probes;            /* Entries compared, over all searches */
+    size_t max_probes;          /* Most entries compared in one search */
 };
 
 struct hash_insert {
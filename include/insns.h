@@ -34,13 +34,37 @@ static inline bool itemp_has(const struct itemplate *itemp, unsigned int bit)
 /*
  * If n == -1, then p points to another table of 256
  * struct disasm_index, otherwise p points to a list of n
- * struct itemplates to consider.
+ * struct itemplates to consider, and mask to a parallel list
+ * of DM_* masks.
  */
 struct disasm_index {
     const void *p;
     int n;
+    const uint32_t *mask;
 };
 
+/*
+ * Disassembler prefilter: the decoder state bits in which a template
+ * can possibly match, generated by insns.pl.  The disassembler builds
+ * the set of bits describing the instruction at hand and skips any
+ * template whose mask doesn't contain all of them.
+ */
+#define DM_REG(r)       (UINT32_C(1) << (r)) /* ModRM spare field */
+#define DM_MODMEM       (UINT32_C(1) << 8)   /* ModRM.mod != 3 */
+#define DM_MODREG       (UINT32_C(1) << 9)   /* ModRM.mod == 3 */
+#define DM_O16          (UINT32_C(1) << 10)  /* operand size */
+#define DM_O32          (UINT32_C(1) << 11)
+#define DM_O64          (UINT32_C(1) << 12)
+#define DM_ODF          (UINT32_C(1) << 13)  /* default operand size */
+#define DM_ONDF         (UINT32_C(1) << 14)  /* non-default operand size */
+#define DM_NOREP        (UINT32_C(1) << 15)  /* no F2/F3 prefix */
+#define DM_REPNE        (UINT32_C(1) << 16)  /* F2 prefix */
+#define DM_REP          (UINT32_C(1) << 17)  /* F3 prefix */
+#define DM_NOOSP        (UINT32_C(1) << 18)  /* no 66 prefix */
+#define DM_OSP          (UINT32_C(1) << 19)  /* 66 prefix */
+#define DM_LEGACY       (UINT32_C(1) << 20)  /* 16/32-bit mode */
+#define DM_LONG         (UINT32_C(1) << 21)  /* 64-bit mode */
+
 /* Tables for the assembler and disassembler, respectively */
 extern const struct itemplate * const nasm_instructions[];
 extern const struct disasm_index itable[256];
@@ -60,6 +60,8 @@ enum label_type {
 };
 
 enum label_type lookup_label(const char *label, int32_t *segment, int64_t *offset);
+enum label_type lookup_label_pass(const char *label, int32_t *segment,
+                                  int64_t *offset, bool *current);
 static inline bool is_extern(enum label_type type)
 {
     return type == LBL_EXTERN || type == LBL_REQUIRED;
@@ -73,6 +75,8 @@ void set_label_mangle(enum mangle_index which, const char *what);
 int init_labels(void);
 void cleanup_labels(void);
 const char *local_scope(const char *label);
+void shift_labels(int64_t (*shift)(int32_t segment, int64_t offset));
+void unshift_labels(void);
 
 extern uint64_t global_offset_changed;
 
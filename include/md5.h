@@ -17,5 +17,6 @@ extern void   MD5Update(MD5_CTX *context, unsigned char const *buf,
 extern void   MD5Final(unsigned char digest[MD5_HASHBYTES], MD5_CTX *context);
 extern void   MD5Transform(uint32_t buf[4], uint32_t const in[16]);
 extern char * MD5End(MD5_CTX *, char *);
+extern bool   MD5File(const char *file, unsigned char digest[MD5_HASHBYTES]);
 
 #endif /* !MD5_H */
@@ -342,9 +342,32 @@ enum preproc_mode {
     PP_PREPROC                  /* Preprocessing only */
 };
 
+/*
+ * A token of a line returned by the preprocessor, already split up
+ * and classified, so that the scanner does not have to lex the line
+ * text all over again. Only tokens which the scanner would split up
+ * in exactly the same way are handed over; anything else is simply
+ * left to the scanner.
+ */
+enum linetok_type {
+    LT_ID,                      /* Identifier, or $-prefixed symbol */
+    LT_NUMBER,                  /* Integer */
+    LT_FLOAT                    /* Floating-point number */
+};
+
+struct linetok {
+    const char *pos;            /* Where the token starts in the line */
+    const char *text;           /* Token text, null-terminated */
+    size_t len;
+    enum linetok_type type;
+    struct tokenval tv;         /* Keyword lookup of an LT_ID */
+};
+
 struct preproc_ops {
     /*
-     * Called once at the very start of assembly.
+     * Called at the very start of assembly, before the system
+     * definitions are made.  A batch or server worker calls it again
+     * to make its own; those already made are dropped.
      */
     void (*init)(void);
 
@@ -356,6 +379,13 @@ struct preproc_ops {
     void (*reset)(const char *file, enum preproc_mode mode,
                   struct strlist *deplist);
 
+    /*
+     * Collect the dependencies of a file without running the full
+     * preprocessor. Returns false if that could not be done
+     * reliably; the caller should then do a PP_DEPS pass instead.
+     */
+    bool (*scan_deps)(const char *file, struct strlist *deplist);
+
     /*
      * Called to fetch a line of preprocessed source. The line
      * returned has been malloc'ed, and so should be freed after
@@ -363,6 +393,14 @@ struct preproc_ops {
      */
     char *(*getline)(void);
 
+    /*
+     * Return the tokens of the line last returned by getline(), in
+     * order, or NULL if there are none. They stay valid until the
+     * next call to getline(), and the line must not have been
+     * modified in the meantime.
+     */
+    const struct linetok *(*tokens)(size_t *ntoks);
+
     /* Called at the end of each pass. */
     void (*cleanup_pass)(void);
 
@@ -378,6 +416,13 @@ struct preproc_ops {
 
     /* Early definitions and undefinitions for macros */
     void (*pre_define)(char *definition);
+
+    /*
+     * Definitions made by NASM itself, for the output format and the
+     * time; they are run before all the command line ones.
+     */
+    void (*sys_define)(char *definition);
+
     void (*pre_undefine)(char *definition);
 
     /* Include file from command line */
@@ -389,6 +434,15 @@ struct preproc_ops {
     /* Include path from command line */
     void (*include_path)(struct strlist *ipath);
 
+    /* Snapshot file for the state left by the standard macros and -p/-d/-u */
+    void (*prelude_cache)(const char *file);
+
+    /*
+     * Run the prelude now and keep its snapshot in memory, for the
+     * processes forked later to start from
+     */
+    void (*prelude_warm)(void);
+
     /* Unwind the macro stack when printing an error message */
     void (*error_list_macros)(errflags severity);
 
@@ -413,12 +467,11 @@ static inline char *nasm_skip_identifier(const char *str)
 {
     const char *p = str;
 
-    if (!nasm_isidstart(*p++)) {
-        p = NULL;
-    } else {
-        while (nasm_isidchar(*p++))
-            ;
-    }
+    if (!nasm_isidstart(*p))
+        return NULL;
+
+    while (nasm_isidchar(*++p))
+        ;
     return (char *)p;
 }
 
@@ -588,6 +641,8 @@ typedef struct operand { /* operand to an instruction */
                                    (always a forward reference also) */
 #define OPFLAG_RELATIVE     8   /* operand is self-relative, e.g. [foo - $]
                                    where foo is not in the current segment */
+#define OPFLAG_PREVPASS     16  /* operand uses a label value which is
+                                   left over from the previous pass */
 
 enum extop_type { /* extended operand types */
     EOT_NOTHING = 0,
@@ -596,6 +651,7 @@ enum extop_type { /* extended operand types */
     EOT_DB_FLOAT,       /* Floating-pointer number (special byte string) */
     EOT_DB_STRING_FREE, /* Byte string which should be nasm_free'd*/
     EOT_DB_NUMBER,      /* Integer */
+    EOT_DB_PACKED,      /* Run of constant integers as a byte string */
     EOT_DB_RESERVE      /* ? */
 };
 
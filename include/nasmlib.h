@@ -310,6 +310,11 @@ void fwriteint32_t(uint32_t data, FILE * fp);
 void fwriteint64_t(uint64_t data, FILE * fp);
 void fwriteaddr(uint64_t data, int size, FILE * fp);
 
+/*
+ * Write a string as a quoted JSON string
+ */
+void fwritejson(const char *str, FILE *fp);
+
 /*
  * Binary search routine. Returns index into `array' of an entry
  * matching `string', or <0 if no match. `array' is taken to
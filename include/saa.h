@@ -91,4 +91,7 @@ void saa_wleb128u(struct SAA *, int);   /* write unsigned LEB128 value */
 void saa_wleb128s(struct SAA *, int);   /* write signed LEB128 value */
 void saa_writeaddr(struct SAA *, uint64_t, size_t);
 
+/* Bytes allocated to all SAAs in total, and the most in use at once */
+void saa_usage(size_t *total, size_t *peak);
+
 #endif                          /* NASM_SAA_H */
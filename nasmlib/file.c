@@ -74,6 +74,24 @@ void fwriteaddr(uint64_t data, int size, FILE * fp)
     nasm_write(&data, size, fp);
 }
 
+void fwritejson(const char *str, FILE *fp)
+{
+    unsigned char c;
+
+    putc('"', fp);
+    while ((c = *str++)) {
+        if (c == '"' || c == '\\') {
+            putc('\\', fp);
+            putc(c, fp);
+        } else if (c < ' ') {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            putc(c, fp);
+        }
+    }
+    putc('"', fp);
+}
+
 void fwritezero(off_t bytes, FILE *fp)
 {
     size_t blksize;
@@ -54,6 +54,15 @@
 #define hash_inc(hash, mask)    ((((hash) >> 32) & (mask)) | 1) /* always odd */
 #define hash_pos_next(pos, inc, mask) (((pos) + (inc)) & (mask))
 
+/* Keep count of the entries a search had to look at */
+static inline void hash_probed(struct hash_table *head, size_t probes)
+{
+    head->lookups++;
+    head->probes += probes;
+    if (probes > head->max_probes)
+        head->max_probes = probes;
+}
+
 static void hash_init(struct hash_table *head)
 {
     head->size     = HASH_INIT_SIZE;
@@ -81,16 +90,21 @@ void **hash_findb(struct hash_table *head, const void *key,
     size_t mask = hash_mask(head->size);
     size_t pos = hash_pos(hash, mask);
     size_t inc = hash_inc(hash, mask);
+    size_t probes = 0;
 
     if (likely(tbl)) {
         while ((np = &tbl[pos])->key) {
+            probes++;
             if (hash == np->hash &&
                 keylen == np->keylen &&
-                !memcmp(key, np->key, keylen))
+                !memcmp(key, np->key, keylen)) {
+                hash_probed(head, probes);
                 return &np->data;
+            }
             pos = hash_pos_next(pos, inc, mask);
         }
     }
+    hash_probed(head, probes);
 
     /* Not found.  Store info for insert if requested. */
     if (insert) {
@@ -125,16 +139,21 @@ void **hash_findib(struct hash_table *head, const void *key, size_t keylen,
     size_t mask = hash_mask(head->size);
     size_t pos = hash_pos(hash, mask);
     size_t inc = hash_inc(hash, mask);
+    size_t probes = 0;
 
     if (likely(tbl)) {
         while ((np = &tbl[pos])->key) {
+            probes++;
             if (hash == np->hash &&
                 keylen == np->keylen &&
-                !nasm_memicmp(key, np->key, keylen))
+                !nasm_memicmp(key, np->key, keylen)) {
+                hash_probed(head, probes);
                 return &np->data;
+            }
             pos = hash_pos_next(pos, inc, mask);
         }
     }
+    hash_probed(head, probes);
 
     /* Not found.  Store info for insert if requested. */
     if (insert) {
@@ -16,6 +16,7 @@
  */
 
 #include "md5.h"
+#include "nasmlib.h"
 
 #ifdef WORDS_LITTLEENDIAN
 #define byteReverse(buf, len)	/* Nothing */
@@ -244,3 +245,45 @@ void MD5Transform(uint32_t buf[4], uint32_t const in[16])
     buf[2] += c;
     buf[3] += d;
 }
+
+/*
+ * Digest the contents of a file; false if it cannot be read.
+ */
+bool MD5File(const char *file, unsigned char digest[MD5_HASHBYTES])
+{
+    FILE *fp;
+    off_t len;
+    const void *map;
+    unsigned char *buf;
+    MD5_CTX ctx;
+    bool ok = false;
+
+    fp = nasm_open_read(file, NF_BINARY|NF_FORMAP);
+    if (!fp)
+        return false;
+
+    len = nasm_file_size(fp);
+    if (len == (off_t)-1)
+        goto close;
+
+    MD5Init(&ctx);
+    map = nasm_map_file(fp, 0, len);
+    if (map) {
+        MD5Update(&ctx, map, len);
+        nasm_unmap_file(map, len);
+        ok = true;
+    } else {
+        buf = nasm_malloc(len + 1);
+        if (fread(buf, 1, len, fp) == (size_t)len) {
+            MD5Update(&ctx, buf, len);
+            ok = true;
+        }
+        nasm_free(buf);
+    }
+    if (ok)
+        MD5Final(digest, &ctx);
+
+close:
+    fclose(fp);
+    return ok;
+}
@@ -39,6 +39,23 @@
 #define SAA_BLKSHIFT	16
 #define SAA_BLKLEN	((size_t)1 << SAA_BLKSHIFT)
 
+/* Block memory of all SAAs: allocated in total, in use now and at most */
+static size_t saa_total, saa_inuse, saa_peak;
+
+static void saa_count(size_t len)
+{
+    saa_total += len;
+    saa_inuse += len;
+    if (saa_inuse > saa_peak)
+        saa_peak = saa_inuse;
+}
+
+void saa_usage(size_t *total, size_t *peak)
+{
+    *total = saa_total;
+    *peak  = saa_peak;
+}
+
 struct SAA *saa_init(size_t elem_len)
 {
     struct SAA *s;
@@ -58,6 +75,7 @@ struct SAA *saa_init(size_t elem_len)
     s->blk_ptrs = nasm_malloc(sizeof(char *));
     s->blk_ptrs[0] = data;
     s->wblk = s->rblk = &s->blk_ptrs[0];
+    saa_count(s->blk_len);
 
     return s;
 }
@@ -70,6 +88,7 @@ void saa_free(struct SAA *s)
     for (p = s->blk_ptrs, n = s->nblks; n; p++, n--)
         nasm_free(*p);
 
+    saa_inuse -= s->length;
     nasm_free(s->blk_ptrs);
     nasm_free(s);
 }
@@ -93,6 +112,7 @@ static void saa_extend(struct SAA *s)
 
     s->blk_ptrs[blkn] = nasm_malloc(s->blk_len);
     s->length += s->blk_len;
+    saa_count(s->blk_len);
 }
 
 void *saa_wstruct(struct SAA *s)
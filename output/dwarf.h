@@ -143,7 +143,10 @@ enum dwarf_form {
 	DW_FORM_sec_offset	= 0x17,
 	DW_FORM_exprloc		= 0x18,
 	DW_FORM_flag_present	= 0x19,
-	DW_FORM_ref_sig8	= 0x20
+	DW_FORM_ref_sig8	= 0x20,
+	/* DWARF 5 */
+	DW_FORM_data16		= 0x1e,
+	DW_FORM_line_strp	= 0x1f
 };
 
 enum dwarf_attribute {
@@ -578,6 +581,15 @@ enum dwarf_line_number_extended {
 	DW_LNE_hi_user		= 0xff
 };
 
+/* DWARF 5 */
+enum dwarf_line_number_content {
+	DW_LNCT_path		= 0x01,
+	DW_LNCT_directory_index	= 0x02,
+	DW_LNCT_timestamp	= 0x03,
+	DW_LNCT_size		= 0x04,
+	DW_LNCT_MD5		= 0x05
+};
+
 enum dwarf_macinfo_type {
 	DW_MACINFO_define	= 0x01,
 	DW_MACINFO_undef	= 0x02,
@@ -182,6 +182,9 @@
 #define SHF_GROUP		(1 << 9)	/* Section is member of a group */
 #define SHF_TLS			(1 << 10)	/* Section hold thread-local data */
 
+/* Section group flags */
+#define GRP_COMDAT		0x1		/* COMDAT group */
+
 /* Special section numbers */
 #define SHN_UNDEF       0x0000
 #define SHN_LORESERVE   0xff00
@@ -74,6 +74,9 @@
 #define N_PBUD				0x0c
 #define N_SECT				0x0e
 
+/* Symbol description bits */
+#define N_ALT_ENTRY			0x0200
+
 /* Section ordinals */
 #define NO_SECT				0x00
 #define MAX_SECT			0xff
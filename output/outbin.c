@@ -1414,28 +1414,64 @@ static void do_output_bin(void)
     }
 }
 
+/*
+ * Hex records are formatted directly into a large buffer, which is
+ * written out whenever the next record would not fit.
+ */
+#define HEX_OUTBUF_SIZE 65536
+
+static char hex_outbuf[HEX_OUTBUF_SIZE];
+static size_t hex_outlen;
+
+static const char hex_digits[16] = "0123456789ABCDEF";
+
+static void hex_flush(void)
+{
+    nasm_write(hex_outbuf, hex_outlen, ofile);
+    hex_outlen = 0;
+}
+
+/* Return a pointer to room for a record of up to len characters */
+static char *hex_reserve(size_t len)
+{
+    if (hex_outlen + len > HEX_OUTBUF_SIZE)
+        hex_flush();
+    return hex_outbuf + hex_outlen;
+}
+
+static inline char *hex_byte(char *p, uint8_t b)
+{
+    *p++ = hex_digits[b >> 4];
+    *p++ = hex_digits[b & 15];
+    return p;
+}
+
 /* Generate Intel hex file output */
 static void write_ith_record(unsigned int len, uint16_t addr,
                              uint8_t type, void *data)
 {
-    char buf[1+2+4+2+255*2+2+2];
-    char *p = buf;
+    char *p;
     uint8_t csum, *dptr = data;
     unsigned int i;
 
     nasm_assert(len <= 255);
 
+    p = hex_reserve(1+2+4+2+255*2+2+1);
     csum = len + addr + (addr >> 8) + type;
-    for (i = 0; i < len; i++)
-	csum += dptr[i];
-    csum = -csum;
 
-    p += sprintf(p, ":%02X%04X%02X", len, addr, type);
-    for (i = 0; i < len; i++)
-	p += sprintf(p, "%02X", dptr[i]);
-    p += sprintf(p, "%02X\n", csum);
+    *p++ = ':';
+    p = hex_byte(p, len);
+    p = hex_byte(p, addr >> 8);
+    p = hex_byte(p, addr);
+    p = hex_byte(p, type);
+    for (i = 0; i < len; i++) {
+	csum += dptr[i];
+	p = hex_byte(p, dptr[i]);
+    }
+    p = hex_byte(p, -csum);
+    *p++ = '\n';
 
-    nasm_write(buf, p-buf, ofile);
+    hex_outlen = p - hex_outbuf;
 }
 
 static void do_output_ith(void)
@@ -1483,14 +1519,14 @@ static void do_output_ith(void)
 
     /* Write closing record */
     write_ith_record(0, 0, 1, NULL);
+    hex_flush();
 }
 
 /* Generate Motorola S-records */
 static void write_srecord(unsigned int len,  unsigned int alen,
                           uint32_t addr, uint8_t type, void *data)
 {
-    char buf[2+2+8+255*2+2+2];
-    char *p = buf;
+    char *p;
     uint8_t csum, *dptr = data;
     unsigned int i;
 
@@ -1510,17 +1546,22 @@ static void write_srecord(unsigned int len,  unsigned int alen,
 	break;
     }
 
+    p = hex_reserve(2+2+8+255*2+2+1);
     csum = (len+alen+1) + addr + (addr >> 8) + (addr >> 16) + (addr >> 24);
-    for (i = 0; i < len; i++)
-	csum += dptr[i];
-    csum = 0xff-csum;
 
-    p += sprintf(p, "S%c%02X%0*X", type, len+alen+1, alen*2, addr);
-    for (i = 0; i < len; i++)
-	p += sprintf(p, "%02X", dptr[i]);
-    p += sprintf(p, "%02X\n", csum);
+    *p++ = 'S';
+    *p++ = type;
+    p = hex_byte(p, len+alen+1);
+    for (i = alen; i--; )
+	p = hex_byte(p, addr >> (i << 3));
+    for (i = 0; i < len; i++) {
+	csum += dptr[i];
+	p = hex_byte(p, dptr[i]);
+    }
+    p = hex_byte(p, 0xff-csum);
+    *p++ = '\n';
 
-    nasm_write(buf, p-buf, ofile);
+    hex_outlen = p - hex_outbuf;
 }
 
 static void do_output_srec(void)
@@ -1592,6 +1633,7 @@ static void do_output_srec(void)
 
     /* Write closing record */
     write_srecord(0, alen, 0, etype, NULL);
+    hex_flush();
 }
 
 
@@ -47,10 +47,12 @@
 #include "error.h"
 #include "saa.h"
 #include "raa.h"
+#include "hashtbl.h"
 #include "eval.h"
 #include "outform.h"
 #include "outlib.h"
 #include "pecoff.h"
+#include "ver.h"
 
 #if defined(OF_COFF) || defined(OF_WIN32) || defined(OF_WIN64)
 
@@ -163,6 +165,9 @@ struct coff_Section **coff_sects;
 static int sectlen;
 int coff_nsects;
 
+static struct hash_table coff_sect_names; /* name -> struct coff_Section */
+static struct RAA *coff_sect_segs;        /* segment -> section number */
+
 struct SAA *coff_syms;
 uint32_t coff_nsyms;
 
@@ -176,6 +181,7 @@ struct SAA *coff_strs;
 static uint32_t strslen;
 
 static void coff_gen_init(void);
+static void coff_deflabel(char *, int32_t, int64_t, int, char *);
 static void coff_sect_write(struct coff_Section *, const uint8_t *, uint32_t);
 static void coff_write(void);
 static void coff_section_header(char *, int32_t, int32_t, int32_t, int32_t, int32_t, int, int32_t);
@@ -209,6 +215,7 @@ static void coff_gen_init(void)
 
     coff_sects = NULL;
     coff_nsects = sectlen = 0;
+    coff_sect_segs = raa_init();
     coff_syms = saa_init(sizeof(struct coff_Symbol));
     coff_nsyms = 0;
     bsym = raa_init();
@@ -235,18 +242,39 @@ static void coff_cleanup(void)
             nasm_free(r);
         }
         nasm_free(coff_sects[i]->name);
+        nasm_free(coff_sects[i]->comdat_name);
         nasm_free(coff_sects[i]);
     }
     nasm_free(coff_sects);
+    hash_free(&coff_sect_names);
+    raa_free(coff_sect_segs);
     saa_free(coff_syms);
     raa_free(bsym);
     raa_free(symval);
     saa_free(coff_strs);
 }
 
+/*
+ * Find a section by name or by NASM segment number; these return the
+ * index into coff_sects[], or -1 if there is no such section.
+ */
+static int coff_find_section(const char *name)
+{
+    void **sp = hash_find(&coff_sect_names, name, NULL);
+    return sp ? ((struct coff_Section *)*sp)->number - 1 : -1;
+}
+
+static int coff_seg_section(int32_t segment)
+{
+    if (segment < 0 || (segment & 1))
+        return -1;
+    return raa_read(coff_sect_segs, segment >> 1) - 1;
+}
+
 int coff_make_section(char *name, uint32_t flags)
 {
     struct coff_Section *s;
+    struct hash_insert hi;
     size_t namelen;
 
     s = nasm_zalloc(sizeof(*s));
@@ -273,12 +301,18 @@ int coff_make_section(char *name, uint32_t flags)
     strncpy(s->name, name, namelen);
     s->name[namelen] = '\0';
     s->flags = flags;
+    s->comdat_sym = -1;
 
     if (coff_nsects >= sectlen) {
         sectlen += SECT_DELTA;
         coff_sects = nasm_realloc(coff_sects, sectlen * sizeof(*coff_sects));
     }
     coff_sects[coff_nsects++] = s;
+    s->number = coff_nsects;
+
+    if (!hash_find(&coff_sect_names, s->name, &hi))
+        hash_add(&hi, s->name, s);
+    coff_sect_segs = raa_write(coff_sect_segs, s->index >> 1, s->number);
 
     return coff_nsects - 1;
 }
@@ -288,10 +322,51 @@ static inline int32_t coff_sectalign_flags(unsigned int align)
     return (ilog2_32(align) + 1) << 20;
 }
 
+/*
+ * Parse the argument to comdat=, which is a selection (a number or
+ * one of the names below) and, after a colon, the name of the COMDAT
+ * symbol or, for associative sections, of the associated section.
+ */
+static const char * const comdat_selections[] = {
+    NULL, "nodup", "any", "same", "exact", "assoc", "largest"
+};
+
+static int coff_comdat_selection(char *arg, char **name)
+{
+    char *colon = strchr(arg, ':');
+    int sel;
+
+    if (!colon || !colon[1]) {
+        nasm_nonfatal("`comdat' requires a selection and a name");
+        return 0;
+    }
+    *colon = '\0';
+    *name = colon + 1;
+
+    if (nasm_isdigit(*arg)) {
+        sel = atoi(arg);
+        if (arg[strspn(arg, "0123456789")])
+            sel = 0;
+    } else {
+        for (sel = ARRAY_SIZE(comdat_selections) - 1; sel > 0; sel--)
+            if (!nasm_stricmp(arg, comdat_selections[sel]))
+                break;
+    }
+
+    if (sel < IMAGE_COMDAT_SELECT_NODUPLICATES ||
+        sel > IMAGE_COMDAT_SELECT_LARGEST) {
+        nasm_nonfatal("unknown COMDAT selection `%s'", arg);
+        return 0;
+    }
+    return sel;
+}
+
 static int32_t coff_section_names(char *name, int *bits)
 {
     char *p;
     uint32_t flags, align_and = ~0L, align_or = 0L;
+    int comdat_sel = 0;
+    char *comdat_name = NULL;
     int i;
 
     /*
@@ -373,13 +448,17 @@ static int32_t coff_section_names(char *name, int *bits)
                     }
                 }
             }
+        } else if (!nasm_strnicmp(q, "comdat=", 7)) {
+            if (!(win32 | win64))
+                nasm_nonfatal("standard COFF does not support"
+                              " COMDAT sections");
+            else
+                comdat_sel = coff_comdat_selection(q + 7, &comdat_name);
         }
     }
 
-    for (i = 0; i < coff_nsects; i++)
-        if (!strcmp(name, coff_sects[i]->name))
-            break;
-    if (i == coff_nsects) {
+    i = coff_find_section(name);
+    if (i < 0) {
         if (!flags) {
             if (!strcmp(name, ".data"))
                 flags = DATA_FLAGS;
@@ -399,12 +478,36 @@ static int32_t coff_section_names(char *name, int *bits)
             coff_sects[i]->flags = flags;
         coff_sects[i]->flags &= align_and;
         coff_sects[i]->flags |= align_or;
+
+        if (comdat_sel) {
+            struct coff_Section *s = coff_sects[i];
+
+            s->flags |= IMAGE_SCN_LNK_COMDAT;
+            s->comdat_sel = comdat_sel;
+            s->comdat_name = nasm_strdup(comdat_name);
+
+            /*
+             * The COMDAT symbol has to be the first symbol defined
+             * in the section, so define it right away; a label of
+             * the same name later on just gives it its value.
+             */
+            if (comdat_sel != IMAGE_COMDAT_SELECT_ASSOCIATIVE) {
+                coff_deflabel(comdat_name, s->index, 0, 1, NULL);
+                s->comdat_sym = coff_nsyms - 1;
+            }
+        }
+    } else if (comdat_sel &&
+               (comdat_sel != coff_sects[i]->comdat_sel ||
+                strcmp(comdat_name, coff_sects[i]->comdat_name))) {
+        nasm_nonfatal("COMDAT attributes changed on redeclaration"
+                      " of section `%s'", name);
     } else if (flags) {
         /* Check if any flags are respecified */
         unsigned int align_flags = flags & IMAGE_SCN_ALIGN_MASK;
 
         /* Warn if non-alignment flags differ */
-        if ((flags ^ coff_sects[i]->flags) & ~IMAGE_SCN_ALIGN_MASK &&
+        if ((flags ^ coff_sects[i]->flags) &
+            ~(IMAGE_SCN_ALIGN_MASK | IMAGE_SCN_LNK_COMDAT) &&
             coff_sects[i]->pass_last_seen == pass_count()) {
             nasm_warn(WARN_OTHER, "section attributes changed on"
                       " redeclaration of section `%s'", name);
@@ -443,6 +546,11 @@ static int32_t coff_section_names(char *name, int *bits)
         }
     }
 
+    if (coff_sects[i]->comdat_sel == IMAGE_COMDAT_SELECT_ASSOCIATIVE &&
+        pass_final() && coff_find_section(coff_sects[i]->comdat_name) < 0)
+        nasm_nonfatal("COMDAT section `%s' is associated with undefined"
+                      " section `%s'", name, coff_sects[i]->comdat_name);
+
     coff_sects[i]->pass_last_seen = pass_count();
     return coff_sects[i]->index;
 }
@@ -463,6 +571,17 @@ static void coff_deflabel(char *name, int32_t segment, int64_t offset,
         return;
     }
 
+    /* A label for a COMDAT symbol, which we have already defined */
+    if (segment != NO_SEG) {
+        int i = coff_seg_section(segment);
+
+        if (i >= 0 && coff_sects[i]->comdat_sym >= 0 &&
+            !strcmp(name, coff_sects[i]->comdat_name)) {
+            coff_sects[i]->comdat_value = offset;
+            return;
+        }
+    }
+
     if (strlen(name) > 8) {
         size_t nlen = strlen(name)+1;
         saa_wbytes(coff_strs, name, nlen);
@@ -481,13 +600,7 @@ static void coff_deflabel(char *name, int32_t segment, int64_t offset,
     if (segment == NO_SEG)
         sym->section = -1;      /* absolute symbol */
     else {
-        int i;
-        sym->section = 0;
-        for (i = 0; i < coff_nsects; i++)
-            if (segment == coff_sects[i]->index) {
-                sym->section = i + 1;
-                break;
-            }
+        sym->section = coff_seg_section(segment) + 1;
         if (!sym->section)
             sym->is_global = true;
     }
@@ -513,6 +626,7 @@ static int32_t coff_add_reloc(struct coff_Section *sect, int32_t segment,
                               int16_t type)
 {
     struct coff_Reloc *r;
+    int32_t fix = 0;
 
     r = *sect->tail = nasm_malloc(sizeof(struct coff_Reloc));
     sect->tail = &r->next;
@@ -522,17 +636,24 @@ static int32_t coff_add_reloc(struct coff_Section *sect, int32_t segment,
     if (segment == NO_SEG) {
         r->symbol = 0, r->symbase = ABS_SYMBOL;
     } else {
-        int i;
-        r->symbase = REAL_SYMBOLS;
-        for (i = 0; i < coff_nsects; i++) {
-            if (segment == coff_sects[i]->index) {
-                r->symbol = i * 2;
-                r->symbase = SECT_SYMBOLS;
-                break;
-            }
-        }
-        if (r->symbase == REAL_SYMBOLS)
+        int i = coff_seg_section(segment);
+        if (i >= 0 && coff_sects[i]->comdat_sym >= 0 &&
+            coff_sects[i] != sect) {
+            /*
+             * The linker may keep another object's copy of a COMDAT
+             * section rather than this one, so refer to it through
+             * the COMDAT symbol, not the section symbol.
+             */
+            r->symbol = coff_sects[i]->comdat_sym;
+            r->symbase = REAL_SYMBOLS;
+            fix = -coff_sects[i]->comdat_value;
+        } else if (i >= 0) {
+            r->symbol = i * 2;
+            r->symbase = SECT_SYMBOLS;
+        } else {
             r->symbol = raa_read(bsym, segment);
+            r->symbase = REAL_SYMBOLS;
+        }
     }
     r->type = type;
 
@@ -544,7 +665,7 @@ static int32_t coff_add_reloc(struct coff_Section *sect, int32_t segment,
     if (r->symbase == REAL_SYMBOLS && !(win32 | win64))
         return raa_read(symval, segment);
 
-    return 0;
+    return fix;
 }
 
 static void coff_out(int32_t segto, const void *data,
@@ -560,13 +681,8 @@ static void coff_out(int32_t segto, const void *data,
         nasm_nonfatal("WRT not supported by COFF output formats");
     }
 
-    s = NULL;
-    for (i = 0; i < coff_nsects; i++) {
-        if (segto == coff_sects[i]->index) {
-            s = coff_sects[i];
-            break;
-        }
-    }
+    i = coff_seg_section(segto);
+    s = i >= 0 ? coff_sects[i] : NULL;
     if (!s) {
         int tempint;            /* ignored */
         if (segto != coff_section_names(".text", &tempint))
@@ -713,14 +829,9 @@ static void AddExport(char *name)
     newS->String = (char *)nasm_malloc(newS->len + 1);
     strcpy(newS->String, name);
     if (rvp == NULL) {
-        int i;
-
-        for (i = 0; i < coff_nsects; i++) {
-            if (!strcmp(EXPORT_SECTION_NAME, coff_sects[i]->name))
-                break;
-        }
+        int i = coff_find_section(EXPORT_SECTION_NAME);
 
-        if (i == coff_nsects)
+        if (i < 0)
             i = coff_make_section(EXPORT_SECTION_NAME, EXPORT_SECTION_FLAGS);
 
         directive_sec = coff_sects[i];
@@ -799,10 +910,8 @@ coff_directives(enum directive directive, char *value)
             return 0;
 
         if (sxseg == -1) {
-            for (i = 0; i < coff_nsects; i++)
-                if (!strcmp(".sxdata",coff_sects[i]->name))
-                    break;
-            if (i == coff_nsects)
+            i = coff_find_section(".sxdata");
+            if (i < 0)
                 sxseg = coff_make_section(".sxdata", IMAGE_SCN_LNK_INFO);
             else
                 sxseg = i;
@@ -926,7 +1035,8 @@ static void coff_write(void)
         i = IMAGE_FILE_MACHINE_I386;
     fwriteint16_t(i,                    ofile); /* machine type */
     fwriteint16_t(coff_nsects,               ofile); /* number of sections */
-    fwriteint32_t(time(NULL),           ofile); /* time stamp */
+    /* Constant time stamp for regression tests */
+    fwriteint32_t(nasm_test_run() ? 0 : time(NULL), ofile);
     fwriteint32_t(sympos,               ofile);
     fwriteint32_t(coff_nsyms + initsym,      ofile);
     fwriteint16_t(0,                    ofile); /* no optional header */
@@ -1078,10 +1188,22 @@ static void coff_write_symbols(void)
     memset(filename, 0, 18);    /* useful zeroed buffer */
 
     for (i = 0; i < (uint32_t) coff_nsects; i++) {
-        coff_symbol(coff_sects[i]->name, 0L, 0L, i + 1, 0, 3, 1);
-        fwriteint32_t(coff_sects[i]->len,    ofile);
-        fwriteint16_t(coff_sects[i]->nrelocs,ofile);
-        nasm_write(filename, 12, ofile);
+        struct coff_Section *s = coff_sects[i];
+        int assoc = 0;
+
+        if (s->comdat_sel == IMAGE_COMDAT_SELECT_ASSOCIATIVE)
+            assoc = coff_find_section(s->comdat_name) + 1;
+
+        /* A long name is in the string table, as for the section header */
+        coff_symbol(s->namepos == -1 ? s->name : NULL, s->namepos,
+                    0L, i + 1, 0, 3, 1);
+        fwriteint32_t(s->len,       ofile);
+        fwriteint16_t(s->nrelocs,   ofile);
+        fwriteint16_t(0,            ofile); /* no line numbers */
+        fwriteint32_t(0,            ofile); /* no checksum */
+        fwriteint16_t(assoc,        ofile);
+        fputc(s->comdat_sel,        ofile);
+        nasm_write(filename, 3, ofile);
     }
 
     /*
@@ -1095,24 +1217,26 @@ static void coff_write_symbols(void)
     saa_rewind(coff_syms);
     for (i = 0; i < coff_nsyms; i++) {
         struct coff_Symbol *sym = saa_rstruct(coff_syms);
+        int32_t value = sym->value;
+
+        if (sym->section > 0 &&
+            coff_sects[sym->section - 1]->comdat_sym == (int32_t)i)
+            value = coff_sects[sym->section - 1]->comdat_value;
+
         coff_symbol(sym->strpos == -1 ? sym->name : NULL,
-                    sym->strpos, sym->value, sym->section,
+                    sym->strpos, value, sym->section,
                     sym->type, sym->is_global ? 2 : 3, 0);
     }
 }
 
 static void coff_sectalign(int32_t seg, unsigned int value)
 {
-    struct coff_Section *s = NULL;
+    struct coff_Section *s;
     uint32_t align;
     int i;
 
-    for (i = 0; i < coff_nsects; i++) {
-        if (coff_sects[i]->index == seg) {
-            s = coff_sects[i];
-            break;
-        }
-    }
+    i = coff_seg_section(seg);
+    s = i >= 0 ? coff_sects[i] : NULL;
 
     if (!s || !is_power2(value))
         return;
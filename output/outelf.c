@@ -50,6 +50,7 @@
 #include "rbtree.h"
 #include "hashtbl.h"
 #include "ver.h"
+#include "md5.h"
 
 #include "dwarf.h"
 #include "stabs.h"
@@ -62,6 +63,12 @@
 static struct elf_section **sects;
 static int nsects, sectlen;
 
+static struct elf_group **groups;
+static int ngroups, grouplen;
+static struct hash_table group_by_name;
+static int sec_group;           /* Index the first group was added with */
+static size_t group_name;       /* Offset of ".group" in .shstrtab */
+
 #define SHSTR_DELTA 256
 static char *shstrtab;
 static int shstrtablen, shstrtabsize;
@@ -156,13 +163,19 @@ static int stablen, stabstrlen, stabrellen;
 /* dwarf debug variables */
 static struct linelist *dwarf_flist = 0, *dwarf_clist = 0, *dwarf_elist = 0;
 static struct sectlist *dwarf_fsect = 0, *dwarf_csect = 0, *dwarf_esect = 0;
+static struct hash_table dwarf_files;   /* file name -> struct linelist */
+static struct RAA *dwarf_sects;         /* sects[] index -> struct sectlist */
 static int dwarf_numfiles = 0, dwarf_nsections;
 static uint8_t *arangesbuf = 0, *arangesrelbuf = 0, *pubnamesbuf = 0, *infobuf = 0,  *inforelbuf = 0,
                *abbrevbuf = 0, *linebuf = 0, *linerelbuf = 0, *framebuf = 0, *locbuf = 0;
 static int8_t line_base = -5, line_range = 14, opcode_base = 13;
 static int arangeslen, arangesrellen, pubnameslen, infolen, inforellen,
            abbrevlen, linelen, linerellen, framelen, loclen;
-static int64_t dwarf_infosym, dwarf_abbrevsym, dwarf_linesym;
+static int64_t dwarf_infosym, dwarf_abbrevsym, dwarf_linesym, dwarf_linestrsym;
+static int dwarf_version = 3;           /* .debug_line version, 3 or 5 */
+static struct SAA *dwarf_linestr;       /* .debug_line_str (DWARF 5) */
+static uint8_t *linestrbuf = 0;
+static int linestrlen;
 
 static struct elf_symbol *lastsym;
 
@@ -183,6 +196,10 @@ static void dwarf_generate(void);
 static void dwarf_cleanup(void);
 static void dwarf_findfile(const char *);
 static void dwarf_findsect(const int);
+static void dwarf_advance(struct SAA *, int, int);
+static size_t dwarf_line_epilogue(struct sectlist *);
+static void dwarf_line_tables5(struct SAA *, struct SAA *, size_t);
+static enum directive_result dwarf_pragma(const struct pragma *);
 
 struct elf_format_info {
     size_t word;                /* Word size (4 or 8) */
@@ -281,7 +298,8 @@ static inline size_t to_bytes(int val)
 
 /* parse section attributes */
 static void elf_section_attrib(char *name, char *attr, uint32_t *flags_and, uint32_t *flags_or,
-                               uint64_t *alignp, uint64_t *entsize, int *type)
+                               uint64_t *alignp, uint64_t *entsize, int *type,
+                               char **comdat)
 {
     char *opt, *val, *next;
     uint64_t align = 0;
@@ -355,6 +373,12 @@ static void elf_section_attrib(char *name, char *attr, uint32_t *flags_and, uint
 	    *type = SHT_INIT_ARRAY;
 	} else if (!nasm_stricmp(opt, "fini_array")) {
 	    *type = SHT_FINI_ARRAY;
+        } else if (!nasm_stricmp(opt, "comdat")) {
+            if (!val || !*val)
+                nasm_nonfatal("section comdat without a group signature"
+                              " specified");
+            else
+                *comdat = val;
         } else {
 	    uint64_t mult;
 	    size_t l;
@@ -531,6 +555,8 @@ static void elf_init(void)
     strlcpy(elf_module, inname, sizeof(elf_module));
     sects = NULL;
     nsects = sectlen = 0;
+    groups = NULL;
+    ngroups = grouplen = 0;
     syms = saa_init((int32_t)sizeof(struct elf_symbol));
     nlocals = nglobs = ndebugs = 0;
     bsym = raa_init();
@@ -595,6 +621,14 @@ static void elf_cleanup(void)
             nasm_free(r);
         }
     }
+    for (i = 0; i < ngroups; i++) {
+        if (groups[i]->data)
+            saa_free(groups[i]->data);
+        nasm_free(groups[i]->name);
+        nasm_free(groups[i]);
+    }
+    nasm_free(groups);
+    hash_free(&group_by_name);
     hash_free(&section_by_name);
     raa_free(section_by_index);
     nasm_free(sects);
@@ -609,7 +643,7 @@ static void elf_cleanup(void)
  * Returns the section index for this new section.
  *
  * IMPORTANT: this needs to match the order the section headers are
- * emitted.
+ * emitted, except for the COMDAT groups; see elf_secidx().
  */
 static int add_sectname(const char *firsthalf, const char *secondhalf)
 {
@@ -617,7 +651,8 @@ static int add_sectname(const char *firsthalf, const char *secondhalf)
     int l2 = strlen(secondhalf);
 
     while (shstrtablen + l1 + l2 + 1 > shstrtabsize)
-        shstrtab = nasm_realloc(shstrtab, (shstrtabsize += SHSTR_DELTA));
+        shstrtabsize = shstrtabsize ? shstrtabsize << 1 : SHSTR_DELTA;
+    shstrtab = nasm_realloc(shstrtab, shstrtabsize);
 
     memcpy(shstrtab + shstrtablen, firsthalf, l1);
     shstrtablen += l1;
@@ -648,13 +683,41 @@ elf_make_section(char *name, int type, int flags, uint64_t align)
     s->align    = align;
     s->shndx    = add_sectname("", name);
 
-    if (nsects >= sectlen)
-        sects = nasm_realloc(sects, (sectlen += SECT_DELTA) * sizeof(*sects));
+    if (nsects >= sectlen) {
+        sectlen = sectlen ? sectlen << 1 : SECT_DELTA;
+        sects = nasm_realloc(sects, sectlen * sizeof(*sects));
+    }
     sects[nsects++] = s;
 
     return s;
 }
 
+/*
+ * Find or create the COMDAT group with the given signature
+ */
+static struct elf_group *elf_find_group(const char *name)
+{
+    struct elf_group *g;
+    struct hash_insert hi;
+    void **hp;
+
+    hp = hash_find(&group_by_name, name, &hi);
+    if (hp)
+        return *hp;
+
+    g = nasm_zalloc(sizeof(*g));
+    g->name = nasm_strdup(name);
+    hash_add(&hi, g->name, g);
+
+    if (ngroups >= grouplen) {
+        grouplen = grouplen ? grouplen << 1 : SECT_DELTA;
+        groups = nasm_realloc(groups, grouplen * sizeof(*groups));
+    }
+    groups[ngroups++] = g;
+
+    return g;
+}
+
 static int32_t elf_section_names(char *name, int *bits)
 {
     char *p;
@@ -664,6 +727,7 @@ static int32_t elf_section_names(char *name, int *bits)
     struct elf_section *s;
     struct hash_insert hi;
     int type;
+    char *comdat = NULL;
 
     if (!name) {
         *bits = ofmt->maxbits;
@@ -675,7 +739,8 @@ static int32_t elf_section_names(char *name, int *bits)
         *p++ = '\0';
     flags_and = flags_or = type = align = entsize = 0;
 
-    elf_section_attrib(name, p, &flags_and, &flags_or, &align, &entsize, &type);
+    elf_section_attrib(name, p, &flags_and, &flags_or, &align, &entsize, &type,
+                       &comdat);
 
     hp = hash_find(&section_by_name, name, &hi);
     if (hp) {
@@ -700,14 +765,21 @@ static int32_t elf_section_names(char *name, int *bits)
 	    entsize = to_bytes(ks->entsize);
         flags = (ks->flags & ~flags_and) | flags_or;
 
+        if (comdat)
+            flags |= SHF_GROUP;
+
         s = elf_make_section(name, type, flags, align);
         hash_add(&hi, s->name, s);
         section_by_index = raa_write_ptr(section_by_index, s->index >> 1, s);
+
+        if (comdat)
+            s->group = elf_find_group(comdat);
     }
 
     if ((type && s->type != type)
         || ((s->flags & flags_and) != flags_or)
-        || (entsize && s->entsize && entsize != s->entsize)) {
+        || (entsize && s->entsize && entsize != s->entsize)
+        || (comdat && (!s->group || strcmp(comdat, s->group->name)))) {
         nasm_warn(WARN_OTHER, "incompatible section attributes ignored on"
                   " redeclaration of section `%s'", name);
     }
@@ -982,6 +1054,14 @@ static void elf_deflabel(char *name, int32_t segment, int64_t offset,
                 rb_insert(sects[sym->section-1]->gsyms, &sym->symv);
 
         }
+
+        /* A global of the same name is the signature of a group */
+        if (ngroups) {
+            void **hp = hash_find(&group_by_name, name, NULL);
+            if (hp && !((struct elf_group *)*hp)->sym)
+                ((struct elf_group *)*hp)->sym = sym;
+        }
+
         sym->globnum = nglobs;
         nglobs++;
     }
@@ -1079,6 +1159,31 @@ static int64_t elf_add_gsym_reloc(struct elf_section *sect,
     return r->offset;
 }
 
+/*
+ * An ordinary relocation against a section.  If the target section
+ * belongs to a COMDAT group other than our own, the linker may
+ * discard it in favour of another object's copy, so the reference
+ * must go through a global symbol rather than the section symbol
+ * whenever there is one.
+ *
+ * Return value is the addend, as for elf_add_gsym_reloc().
+ */
+static int64_t elf_add_sect_reloc(struct elf_section *sect,
+                                  int32_t segment, uint64_t offset,
+                                  int64_t pcrel, int type)
+{
+    struct elf_section *s = NULL;
+
+    if (segment != NO_SEG)
+        s = raa_read_ptr(section_by_index, segment >> 1);
+    if (s && s->group && s->group != sect->group &&
+        rb_search(s->gsyms, offset))
+        return elf_add_gsym_reloc(sect, segment, offset, pcrel, type, false);
+
+    elf_add_reloc(sect, segment, offset - pcrel, type);
+    return offset - pcrel;
+}
+
 static void elf32_out(int32_t segto, const void *data,
                       enum out_type type, uint64_t size,
                       int32_t segment, int32_t wrt)
@@ -1108,7 +1213,7 @@ static void elf32_out(int32_t segto, const void *data,
 
     /* again some stabs debugging stuff */
     sinfo.offset = s->len;
-    sinfo.section = s->shndx;
+    sinfo.section = s->shndx - 1;
     sinfo.segto = segto;
     sinfo.name = s->name;
     dfmt->debug_output(TY_DEBUGSYMLIN, &sinfo);
@@ -1154,13 +1259,16 @@ static void elf32_out(int32_t segto, const void *data,
                      */
                     switch (asize) {
                     case 1:
-                        elf_add_reloc(s, segment, 0, R_386_8);
+                        addr = elf_add_sect_reloc(s, segment, addr, 0,
+                                                  R_386_8);
                         break;
                     case 2:
-                        elf_add_reloc(s, segment, 0, R_386_16);
+                        addr = elf_add_sect_reloc(s, segment, addr, 0,
+                                                  R_386_16);
                         break;
                     case 4:
-                        elf_add_reloc(s, segment, 0, R_386_32);
+                        addr = elf_add_sect_reloc(s, segment, addr, 0,
+                                                  R_386_32);
                         break;
                     default: /* Error issued further down */
                         err = true;
@@ -1239,7 +1347,8 @@ rel12adr:
                           " segment base references");
         } else {
             if (wrt == NO_SEG) {
-                elf_add_reloc(s, segment, 0, reltype);
+                addr = elf_add_sect_reloc(s, segment, addr + size, size,
+                                          reltype);
             } else {
                 nasm_nonfatal("Unsupported %d-bit ELF relocation", bytes << 3);
             }
@@ -1256,9 +1365,11 @@ rel12adr:
                           " segment base references");
         } else {
             if (wrt == NO_SEG) {
-                elf_add_reloc(s, segment, 0, R_386_PC32);
+                addr = elf_add_sect_reloc(s, segment, addr + size, size,
+                                          R_386_PC32);
             } else if (wrt == elf_plt_sect + 1) {
-                elf_add_reloc(s, segment, 0, R_386_PLT32);
+                addr = elf_add_sect_reloc(s, segment, addr + size, size,
+                                          R_386_PLT32);
             } else if (wrt == elf_gotpc_sect + 1 ||
                        wrt == elf_gotoff_sect + 1 ||
                        wrt == elf_got_sect + 1) {
@@ -1312,7 +1423,7 @@ static void elf64_out(int32_t segto, const void *data,
 
     /* again some stabs debugging stuff */
     sinfo.offset = s->len;
-    sinfo.section = s->shndx;
+    sinfo.section = s->shndx - 1;
     sinfo.segto = segto;
     sinfo.name = s->name;
     dfmt->debug_output(TY_DEBUGSYMLIN, &sinfo);
@@ -1357,21 +1468,21 @@ static void elf64_out(int32_t segto, const void *data,
                 switch (isize) {
                 case 1:
                 case -1:
-                    elf_add_reloc(s, segment, addr, R_X86_64_8);
+                    elf_add_sect_reloc(s, segment, addr, 0, R_X86_64_8);
                     break;
                 case 2:
                 case -2:
-                    elf_add_reloc(s, segment, addr, R_X86_64_16);
+                    elf_add_sect_reloc(s, segment, addr, 0, R_X86_64_16);
                     break;
                 case 4:
-                    elf_add_reloc(s, segment, addr, R_X86_64_32);
+                    elf_add_sect_reloc(s, segment, addr, 0, R_X86_64_32);
                     break;
                 case -4:
-                    elf_add_reloc(s, segment, addr, R_X86_64_32S);
+                    elf_add_sect_reloc(s, segment, addr, 0, R_X86_64_32S);
                     break;
                 case 8:
                 case -8:
-                    elf_add_reloc(s, segment, addr, R_X86_64_64);
+                    elf_add_sect_reloc(s, segment, addr, 0, R_X86_64_64);
                     break;
                 default:
                     nasm_panic("internal error elf64-hpa-871");
@@ -1478,7 +1589,7 @@ rel12adr:
                           " segment base references");
         } else {
             if (wrt == NO_SEG) {
-                elf_add_reloc(s, segment, addr, reltype);
+                elf_add_sect_reloc(s, segment, addr + size, size, reltype);
                 addr = 0;
             } else {
                 nasm_nonfatal("Unsupported %d-bit ELF relocation", bytes << 3);
@@ -1498,7 +1609,8 @@ rel12adr:
                           " segment base references");
         } else {
             if (wrt == NO_SEG) {
-                elf_add_reloc(s, segment, addr, R_X86_64_PC32);
+                elf_add_sect_reloc(s, segment, addr + size, size,
+                                   R_X86_64_PC32);
                 addr = 0;
             } else if (wrt == elf_plt_sect + 1) {
                 elf_add_gsym_reloc(s, segment, addr+size, size,
@@ -1536,7 +1648,8 @@ rel12adr:
                           " segment base references");
         } else {
             if (wrt == NO_SEG) {
-                elf_add_reloc(s, segment, addr, R_X86_64_PC64);
+                elf_add_sect_reloc(s, segment, addr + size, size,
+                                   R_X86_64_PC64);
                 addr = 0;
             } else if (wrt == elf_gotpc_sect + 1 ||
                        wrt == elf_got_sect + 1) {
@@ -1592,7 +1705,7 @@ static void elfx32_out(int32_t segto, const void *data,
 
     /* again some stabs debugging stuff */
     sinfo.offset = s->len;
-    sinfo.section = s->shndx;
+    sinfo.section = s->shndx - 1;
     sinfo.segto = segto;
     sinfo.name = s->name;
     dfmt->debug_output(TY_DEBUGSYMLIN, &sinfo);
@@ -1637,21 +1750,21 @@ static void elfx32_out(int32_t segto, const void *data,
                 switch (isize) {
                 case 1:
                 case -1:
-                    elf_add_reloc(s, segment, addr, R_X86_64_8);
+                    elf_add_sect_reloc(s, segment, addr, 0, R_X86_64_8);
                     break;
                 case 2:
                 case -2:
-                    elf_add_reloc(s, segment, addr, R_X86_64_16);
+                    elf_add_sect_reloc(s, segment, addr, 0, R_X86_64_16);
                     break;
                 case 4:
-                    elf_add_reloc(s, segment, addr, R_X86_64_32);
+                    elf_add_sect_reloc(s, segment, addr, 0, R_X86_64_32);
                     break;
                 case -4:
-                    elf_add_reloc(s, segment, addr, R_X86_64_32S);
+                    elf_add_sect_reloc(s, segment, addr, 0, R_X86_64_32S);
                     break;
                 case 8:
                 case -8:
-                    elf_add_reloc(s, segment, addr, R_X86_64_64);
+                    elf_add_sect_reloc(s, segment, addr, 0, R_X86_64_64);
                     break;
                 default:
                     nasm_panic("internal error elfx32-hpa-871");
@@ -1748,7 +1861,7 @@ rel12adr:
                           " segment base references");
         } else {
             if (wrt == NO_SEG) {
-                elf_add_reloc(s, segment, addr, reltype);
+                elf_add_sect_reloc(s, segment, addr + size, size, reltype);
                 addr = 0;
             } else {
                 nasm_nonfatal("unsupported %d-bit ELF relocation", bytes << 3);
@@ -1768,7 +1881,8 @@ rel12adr:
                           " segment base references");
         } else {
             if (wrt == NO_SEG) {
-                elf_add_reloc(s, segment, addr, R_X86_64_PC32);
+                elf_add_sect_reloc(s, segment, addr + size, size,
+                                   R_X86_64_PC32);
                 addr = 0;
             } else if (wrt == elf_plt_sect + 1) {
                 elf_add_gsym_reloc(s, segment, addr+size, size,
@@ -1804,6 +1918,22 @@ rel12adr:
     }
 }
 
+/*
+ * The COMDAT group sections are added after all the others they
+ * refer to, but a group must come before its members, so they are
+ * written right after the null section.  The sections added before
+ * them move up to make room; those added after them keep their index.
+ * Map the index a section was added with to the one it is written at.
+ */
+static int elf_secidx(int section)
+{
+    if (!ngroups || section < 1 || section >= sec_group + ngroups)
+        return section;
+    if (section >= sec_group)
+        return section - sec_group + 1;
+    return section + ngroups;
+}
+
 /*
  * Section index/count with a specified overflow value (usually SHN_INDEX,
  * but 0 for e_shnum.
@@ -1861,6 +1991,29 @@ static void elf_write(void)
         add_sectname(".rela", ".debug_line");
         add_sectname("", ".debug_frame");
         add_sectname("", ".debug_loc");
+        if (dwarf_version >= 5)
+            add_sectname("", ".debug_line_str");
+    }
+
+    /*
+     * The COMDAT groups, and their member tables.  The relocation
+     * sections of the members are added to the tables below.
+     */
+    sec_group  = nsections;
+    group_name = shstrtablen;
+    for (i = 0; i < ngroups; i++)
+        groups[i]->shndx = add_sectname("", ".group");
+    for (i = 0; i < nsects; i++) {
+        struct elf_group *g = sects[i]->group;
+
+        if (!g)
+            continue;
+        if (!g->data) {
+            g->data = saa_init(1);
+            saa_write32(g->data, GRP_COMDAT);
+            g->member = sects[i]->shndx;
+        }
+        saa_write32(g->data, elf_secidx(sects[i]->shndx));
     }
 
     sec_shstrtab = add_sectname("", ".shstrtab");
@@ -1878,8 +2031,11 @@ static void elf_write(void)
 
     for (i = 0; i < nsects; i++) {
         if (sects[i]->head) {
-            add_sectname(efmt->relpfx, sects[i]->name);
+            sects[i]->rel_shndx = add_sectname(efmt->relpfx, sects[i]->name);
             sects[i]->rel = efmt->elf_build_reltab(sects[i]->head);
+            if (sects[i]->group)
+                saa_write32(sects[i]->group->data,
+                            elf_secidx(sects[i]->rel_shndx));
         }
     }
 
@@ -1931,6 +2087,16 @@ static void elf_write(void)
                        0, 0, 0);
     p = shstrtab + 1;
 
+    /* The COMDAT groups */
+    for (i = 0; i < ngroups; i++) {
+        struct elf_group *g = groups[i];
+
+        elf_section_header(group_name, SHT_GROUP, 0, g->data, true,
+                           g->data->datalen, sec_symtab,
+                           g->sym ? (int)symtablocal + g->sym->globnum : g->symnum,
+                           4, 4);
+    }
+
     /* The normal sections */
     for (i = 0; i < nsects; i++) {
         elf_section_header(p - shstrtab, sects[i]->type, sects[i]->flags,
@@ -1950,7 +2116,7 @@ static void elf_write(void)
 
         if (stabbuf && stabstrbuf && stabrelbuf) {
             elf_section_header(p - shstrtab, SHT_PROGBITS, 0, stabbuf, false,
-                               stablen, sec_stabstr, 0, 4, 12);
+                               stablen, elf_secidx(sec_stabstr), 0, 4, 12);
             p += strlen(p) + 1;
 
             elf_section_header(p - shstrtab, SHT_STRTAB, 0, stabstrbuf, false,
@@ -1960,7 +2126,7 @@ static void elf_write(void)
             /* link -> symtable  info -> section to refer to */
             elf_section_header(p - shstrtab, efmt->reltype, 0,
                                stabrelbuf, false, stabrellen,
-                               sec_symtab, sec_stab,
+                               sec_symtab, elf_secidx(sec_stab),
                                efmt->word, efmt->rel_size);
             p += strlen(p) + 1;
         }
@@ -1977,7 +2143,7 @@ static void elf_write(void)
 
         elf_section_header(p - shstrtab, SHT_RELA, 0, arangesrelbuf, false,
                            arangesrellen, sec_symtab,
-                           sec_debug_aranges,
+                           elf_secidx(sec_debug_aranges),
                            efmt->word, efmt->rela_size);
         p += strlen(p) + 1;
 
@@ -1991,7 +2157,7 @@ static void elf_write(void)
 
         elf_section_header(p - shstrtab, SHT_RELA, 0, inforelbuf, false,
                            inforellen, sec_symtab,
-                           sec_debug_info,
+                           elf_secidx(sec_debug_info),
                            efmt->word, efmt->rela_size);
         p += strlen(p) + 1;
 
@@ -2005,7 +2171,7 @@ static void elf_write(void)
 
         elf_section_header(p - shstrtab, SHT_RELA, 0, linerelbuf, false,
                            linerellen, sec_symtab,
-                           sec_debug_line,
+                           elf_secidx(sec_debug_line),
                            efmt->word, efmt->rela_size);
         p += strlen(p) + 1;
 
@@ -2016,8 +2182,19 @@ static void elf_write(void)
         elf_section_header(p - shstrtab, SHT_PROGBITS, 0, locbuf, false,
                            loclen, 0, 0, 1, 0);
         p += strlen(p) + 1;
+
+        if (dwarf_version >= 5) {
+            elf_section_header(p - shstrtab, SHT_PROGBITS,
+                               SHF_MERGE | SHF_STRINGS, linestrbuf, false,
+                               linestrlen, 0, 0, 1, 1);
+            p += strlen(p) + 1;
+        }
     }
 
+    /* The names of the COMDAT groups, written above */
+    for (i = 0; i < ngroups; i++)
+        p += strlen(p) + 1;
+
     /* .shstrtab */
     elf_section_header(p - shstrtab, SHT_STRTAB, 0, shstrtab, false,
                        shstrtablen, 0, 0, 1, 0);
@@ -2045,9 +2222,10 @@ static void elf_write(void)
     /* The relocation sections */
     for (i = 0; i < nsects; i++) {
         if (sects[i]->rel) {
-            elf_section_header(p - shstrtab, efmt->reltype, 0,
+            elf_section_header(p - shstrtab, efmt->reltype,
+                               sects[i]->group ? SHF_GROUP : 0,
                                sects[i]->rel, true, sects[i]->rel->datalen,
-                               sec_symtab, sects[i]->shndx,
+                               sec_symtab, elf_secidx(sects[i]->shndx),
                                efmt->word, efmt->rel_size);
             p += strlen(p) + 1;
         }
@@ -2069,7 +2247,7 @@ static size_t nsyms;
 
 static void elf_sym(const struct elf_symbol *sym)
 {
-    int shndx = sym->section;
+    int shndx = elf_secidx(sym->section);
 
     /*
      * Careful here. This relies on sym->section being signed; for
@@ -2103,7 +2281,7 @@ static void elf32_sym(const struct elf_symbol *sym)
     sym32.st_size     = cpu_to_le32(sym->size);
     sym32.st_info     = sym->type;
     sym32.st_other    = sym->other;
-    sym32.st_shndx    = elf_shndx(sym->section, SHN_XINDEX);
+    sym32.st_shndx    = elf_shndx(elf_secidx(sym->section), SHN_XINDEX);
     saa_wbytes(symtab, &sym32, sizeof sym32);
 }
 
@@ -2116,7 +2294,7 @@ static void elf64_sym(const struct elf_symbol *sym)
     sym64.st_size     = cpu_to_le64(sym->size);
     sym64.st_info     = sym->type;
     sym64.st_other    = sym->other;
-    sym64.st_shndx    = elf_shndx(sym->section, SHN_XINDEX);
+    sym64.st_shndx    = elf_shndx(elf_secidx(sym->section), SHN_XINDEX);
     saa_wbytes(symtab, &sym64, sizeof sym64);
 }
 
@@ -2171,6 +2349,36 @@ static size_t elf_build_symtab(void)
         dwarf_linesym   = nsyms;
         xsym.section    = sec_debug_line;
         elf_sym(&xsym);
+
+        if (dwarf_version >= 5) {
+            dwarf_linestrsym = nsyms;
+            xsym.section     = sec_debug_line_str;
+            elf_sym(&xsym);
+        }
+    }
+
+    /*
+     * A local symbol to name each COMDAT group which doesn't have a
+     * global symbol of the same name.
+     */
+    for (i = 0; i < ngroups; i++) {
+        struct elf_group *g = groups[i];
+        size_t len;
+
+        if (g->sym)
+            continue;
+
+        len = strlen(g->name) + 1;
+        nasm_zero(xsym);
+        xsym.strpos  = strslen;
+        xsym.type    = ELF32_ST_INFO(STB_LOCAL, STT_NOTYPE);
+        xsym.section = g->member;
+        saa_wbytes(strs, g->name, len);
+        strslen += len;
+
+        g->symnum = nsyms;
+        elf_sym(&xsym);
+        nlocals++;
     }
 
     /*
@@ -2401,6 +2609,11 @@ static const struct pragma_facility elf_pragma_list[] =
 };
 
 
+static const struct pragma_facility dwarf_pragma_list[] =
+{
+    { NULL, dwarf_pragma }  /* Implements the "dwarf" namespace */
+};
+
 static const struct dfmt elf32_df_dwarf = {
     "ELF32 (i386) dwarf (newer)",
     "dwarf",
@@ -2411,7 +2624,7 @@ static const struct dfmt elf32_df_dwarf = {
     debug_typevalue,
     dwarf_output,
     dwarf_cleanup,
-    NULL                        /* pragma list */
+    dwarf_pragma_list
 };
 
 static const struct dfmt elf32_df_stabs = {
@@ -2463,7 +2676,7 @@ static const struct dfmt elf64_df_dwarf = {
     debug_typevalue,
     dwarf_output,
     dwarf_cleanup,
-    NULL                        /* pragma list */
+    dwarf_pragma_list
 };
 
 static const struct dfmt elf64_df_stabs = {
@@ -2515,7 +2728,7 @@ static const struct dfmt elfx32_df_dwarf = {
     debug_typevalue,
     dwarf_output,
     dwarf_cleanup,
-    NULL                        /* pragma list */
+    dwarf_pragma_list
 };
 
 static const struct dfmt elfx32_df_stabs = {
@@ -2941,6 +3154,34 @@ static void dwarf_init(void)
     ndebugs = 3; /* 3 debug symbols */
 }
 
+/*
+ * %pragma dwarf version 3|5
+ *
+ * Selects the version of the line number tables; DWARF 5 tables keep
+ * their file names in .debug_line_str and carry MD5 checksums.
+ */
+static enum directive_result dwarf_pragma(const struct pragma *pragma)
+{
+    int64_t n;
+    bool err;
+
+    switch (pragma->opcode) {
+    case D_VERSION:
+        n = readnum(pragma->tail, &err);
+        if (err || (n != 3 && n != 5)) {
+            nasm_nonfatal("supported DWARF versions are 3 and 5");
+            return DIRR_ERROR;
+        }
+
+        dwarf_version = n;
+        ndebugs = (dwarf_version >= 5) ? 4 : 3;
+        return DIRR_OK;
+
+    default:
+        return DIRR_UNKNOWN;
+    }
+}
+
 static void dwarf_linenum(const char *filename, int32_t linenumber,
                             int32_t segto)
 {
@@ -2953,7 +3194,7 @@ static void dwarf_linenum(const char *filename, int32_t linenumber,
 /* called from elf_out with type == TY_DEBUGSYMLIN */
 static void dwarf_output(int type, void *param)
 {
-    int ln, aa, inx, maxln, soc;
+    int ln, aa, inx;
     struct symlininfo *s;
     struct SAA *plinep;
 
@@ -2985,20 +3226,7 @@ static void dwarf_output(int type, void *param)
     }
     /* check for line change */
     if (ln) {
-        /* test if in range of special op code */
-        maxln = line_base + line_range;
-        soc = (ln - line_base) + (line_range * aa) + opcode_base;
-        if (ln >= line_base && ln < maxln && soc < 256) {
-            saa_write8(plinep,soc);
-        } else {
-            saa_write8(plinep,DW_LNS_advance_line);
-            saa_wleb128s(plinep,ln);
-            if (aa) {
-                saa_write8(plinep,DW_LNS_advance_pc);
-                saa_wleb128u(plinep,aa);
-            }
-            saa_write8(plinep,DW_LNS_copy);
-        }
+        dwarf_advance(plinep, ln, aa);
         dwarf_csect->line = currentline;
         dwarf_csect->offset = s->offset;
     }
@@ -3007,6 +3235,207 @@ static void dwarf_output(int type, void *param)
     debug_immcall = 0;
 }
 
+/*
+ * Append one row to a line number program, advancing the line by ln
+ * and the address by aa.  A special opcode is always used to append
+ * the row; the advance_line, const_add_pc and advance_pc opcodes are
+ * only emitted for whatever part of the step does not fit in it.
+ */
+static void dwarf_advance(struct SAA *plinep, int ln, int aa)
+{
+    const int maxln = line_base + line_range;
+    const int const_pc = (255 - opcode_base) / line_range;
+    int soc;
+
+    if (ln < line_base || ln >= maxln) {
+        saa_write8(plinep,DW_LNS_advance_line);
+        saa_wleb128s(plinep,ln);
+        ln = 0;
+    }
+
+    soc = (ln - line_base) + (line_range * aa) + opcode_base;
+    if (soc > 255) {
+        if (soc - line_range * const_pc <= 255) {
+            saa_write8(plinep,DW_LNS_const_add_pc);
+            aa -= const_pc;
+        } else {
+            saa_write8(plinep,DW_LNS_advance_pc);
+            saa_wleb128u(plinep,aa);
+            aa = 0;
+        }
+        soc = (ln - line_base) + (line_range * aa) + opcode_base;
+    }
+    saa_write8(plinep,soc);
+}
+
+/*
+ * Terminate the line number program of one section.  Each program
+ * only depends on its own sectlist entry, so they can be finished in
+ * any order.  Returns the final length of the program.
+ */
+static size_t dwarf_line_epilogue(struct sectlist *psect)
+{
+    struct SAA *plinep = psect->psaa;
+
+    saa_write8(plinep,DW_LNS_advance_pc);
+    saa_wleb128u(plinep,(sects[psect->section]->len)-psect->offset);
+    saa_write8(plinep,DW_LNS_extended_op);
+    saa_write8(plinep,1);           /* operand length */
+    saa_write8(plinep,DW_LNE_end_sequence);
+
+    return plinep->datalen;
+}
+
+/*
+ * Write a RELA entry for a 32-bit offset into a debug section
+ */
+static void dwarf_rela_offset32(struct SAA *prel, size_t offset,
+                                int64_t sym, uint32_t addend)
+{
+    if (is_elf32()) {
+        saa_write32(prel, offset);
+        saa_write32(prel, (sym << 8) + R_386_32);
+        saa_write32(prel, addend);
+    } else if (is_elfx32()) {
+        saa_write32(prel, offset);
+        saa_write32(prel, (sym << 8) + R_X86_64_32);
+        saa_write32(prel, addend);
+    } else {
+        nasm_assert(is_elf64());
+        saa_write64(prel, offset);
+        saa_write64(prel, (sym << 32) + R_X86_64_32);
+        saa_write64(prel, addend);
+    }
+}
+
+/*
+ * Add a string to .debug_line_str and return its offset
+ */
+static uint32_t dwarf_line_str(const char *str)
+{
+    uint32_t strp;
+
+    if (!dwarf_linestr)
+        dwarf_linestr = saa_init(1L);
+
+    strp = dwarf_linestr->datalen;
+    saa_wbytes(dwarf_linestr, str, strlen(str) + 1);
+    return strp;
+}
+
+/*
+ * Write a DW_FORM_line_strp reference into the line header.  linehdr
+ * is the size of the part of the header which precedes plines.
+ *
+ * The offset must only be given once: tools add the addend to what
+ * is in place, and the i386 linker uses only what is in place.
+ */
+static void dwarf_line_strp(struct SAA *plines, struct SAA *plinesrel,
+                            size_t linehdr, uint32_t strp)
+{
+    if (is_elf32()) {
+        dwarf_rela_offset32(plinesrel, linehdr + plines->datalen,
+                            dwarf_linestrsym, 0);
+        saa_write32(plines,strp);
+    } else {
+        dwarf_rela_offset32(plinesrel, linehdr + plines->datalen,
+                            dwarf_linestrsym, strp);
+        saa_write32(plines,0);
+    }
+}
+
+/*
+ * Compute the MD5 checksum of a source file.  Returns false if the
+ * file cannot be read, e.g. because it is a name from %line.
+ */
+static bool dwarf_file_md5(const char *fname, uint8_t *digest)
+{
+    MD5_CTX ctx;
+    unsigned char buf[BUFSIZ];
+    size_t n;
+    bool ok;
+    FILE *f;
+
+    f = nasm_open_read(fname, NF_BINARY);
+    if (!f)
+        return false;
+
+    MD5Init(&ctx);
+    while ((n = fread(buf, 1, sizeof buf, f)) > 0)
+        MD5Update(&ctx, buf, n);
+    ok = !ferror(f);
+    fclose(f);
+
+    MD5Final(digest, &ctx);
+    return ok;
+}
+
+/*
+ * Write the DWARF 5 directory and file name tables.  File 0 is the
+ * primary source file; the files referenced by the line number
+ * programs follow as files 1 and up.  The names live in the shared
+ * .debug_line_str section.  DWARF 5 requires either all or none of
+ * the files to have an MD5 checksum, so the checksums are only
+ * emitted if every file can be read.
+ */
+static void dwarf_line_tables5(struct SAA *plines, struct SAA *plinesrel,
+                               size_t linehdr)
+{
+    struct linelist *ftentry;
+    uint8_t (*md5)[MD5_HASHBYTES];
+    bool have_md5;
+    uint32_t mainstrp, strp;
+    int indx;
+
+    md5 = nasm_malloc((dwarf_numfiles + 1) * sizeof(*md5));
+    have_md5 = dwarf_file_md5(elf_module, md5[0]);
+    ftentry = dwarf_flist;
+    for (indx = 1; indx <= dwarf_numfiles && have_md5; indx++) {
+        have_md5 = dwarf_file_md5(ftentry->filename, md5[indx]);
+        ftentry = ftentry->next;
+    }
+
+    /* Directory Table */
+    saa_write8(plines,1);           /* directory entry format count */
+    saa_wleb128u(plines,DW_LNCT_path);
+    saa_wleb128u(plines,DW_FORM_line_strp);
+    saa_wleb128u(plines,1);         /* directories count */
+    strp = dwarf_line_str(".");
+    dwarf_line_strp(plines, plinesrel, linehdr, strp);
+
+    /* File Name Table */
+    saa_write8(plines,have_md5 ? 3 : 2); /* file name entry format count */
+    saa_wleb128u(plines,DW_LNCT_path);
+    saa_wleb128u(plines,DW_FORM_line_strp);
+    saa_wleb128u(plines,DW_LNCT_directory_index);
+    saa_wleb128u(plines,DW_FORM_udata);
+    if (have_md5) {
+        saa_wleb128u(plines,DW_LNCT_MD5);
+        saa_wleb128u(plines,DW_FORM_data16);
+    }
+    saa_wleb128u(plines,dwarf_numfiles + 1); /* file names count */
+
+    mainstrp = dwarf_line_str(elf_module);
+    dwarf_line_strp(plines, plinesrel, linehdr, mainstrp);
+    saa_write8(plines,0);           /* directory LEB128u */
+    if (have_md5)
+        saa_wbytes(plines, md5[0], MD5_HASHBYTES);
+
+    ftentry = dwarf_flist;
+    for (indx = 1; indx <= dwarf_numfiles; indx++) {
+        if (!strcmp(ftentry->filename, elf_module))
+            strp = mainstrp;
+        else
+            strp = dwarf_line_str(ftentry->filename);
+        dwarf_line_strp(plines, plinesrel, linehdr, strp);
+        saa_write8(plines,0);       /* directory LEB128u */
+        if (have_md5)
+            saa_wbytes(plines, md5[indx], MD5_HASHBYTES);
+        ftentry = ftentry->next;
+    }
+
+    nasm_free(md5);
+}
 
 static void dwarf_generate(void)
 {
@@ -3016,7 +3445,7 @@ static void dwarf_generate(void)
     struct SAA *paranges, *ppubnames, *pinfo, *pabbrev, *plines, *plinep;
     struct SAA *parangesrel, *plinesrel, *pinforel;
     struct sectlist *psect;
-    size_t saalen, linepoff, totlen, highaddr;
+    size_t saalen, linepoff, linehdr, totlen, highaddr;
 
     if (is_elf32()) {
         /* write epilogues for each line program range */
@@ -3036,14 +3465,8 @@ static void dwarf_generate(void)
         totlen = 0;
         highaddr = 0;
         for (indx = 0; indx < dwarf_nsections; indx++) {
-            plinep = psect->psaa;
             /* Line Number Program Epilogue */
-            saa_write8(plinep,2);           /* std op 2 */
-            saa_write8(plinep,(sects[psect->section]->len)-psect->offset);
-            saa_write8(plinep,DW_LNS_extended_op);
-            saa_write8(plinep,1);           /* operand length */
-            saa_write8(plinep,DW_LNE_end_sequence);
-            totlen += plinep->datalen;
+            totlen += dwarf_line_epilogue(psect);
             /* range table relocation entry */
             saa_write32(parangesrel, paranges->datalen + 4);
             saa_write32(parangesrel, ((uint32_t) (psect->section + 2) << 8) +  R_386_32);
@@ -3081,14 +3504,8 @@ static void dwarf_generate(void)
         totlen = 0;
         highaddr = 0;
         for (indx = 0; indx < dwarf_nsections; indx++)  {
-            plinep = psect->psaa;
             /* Line Number Program Epilogue */
-            saa_write8(plinep,2);			/* std op 2 */
-            saa_write8(plinep,(sects[psect->section]->len)-psect->offset);
-            saa_write8(plinep,DW_LNS_extended_op);
-            saa_write8(plinep,1);			/* operand length */
-            saa_write8(plinep,DW_LNE_end_sequence);
-            totlen += plinep->datalen;
+            totlen += dwarf_line_epilogue(psect);
             /* range table relocation entry */
             saa_write32(parangesrel, paranges->datalen + 4);
             saa_write32(parangesrel, ((uint32_t) (psect->section + 2) << 8) +  R_X86_64_32);
@@ -3127,14 +3544,8 @@ static void dwarf_generate(void)
         totlen = 0;
         highaddr = 0;
         for (indx = 0; indx < dwarf_nsections; indx++) {
-            plinep = psect->psaa;
             /* Line Number Program Epilogue */
-            saa_write8(plinep,2);			/* std op 2 */
-            saa_write8(plinep,(sects[psect->section]->len)-psect->offset);
-            saa_write8(plinep,DW_LNS_extended_op);
-            saa_write8(plinep,1);			/* operand length */
-            saa_write8(plinep,DW_LNE_end_sequence);
-            totlen += plinep->datalen;
+            totlen += dwarf_line_epilogue(psect);
             /* range table relocation entry */
             saa_write64(parangesrel, paranges->datalen + 4);
             saa_write64(parangesrel, ((uint64_t) (psect->section + 2) << 32) +  R_X86_64_64);
@@ -3337,9 +3748,14 @@ static void dwarf_generate(void)
     saa_free(pabbrev);
 
     /* build line section */
+    /* fixed part of the header, up to and including header_length */
+    linehdr = (dwarf_version >= 5) ? 12 : 10;
     /* prolog */
     plines = saa_init(1L);
+    plinesrel = saa_init(1L);
     saa_write8(plines,1);           /* Minimum Instruction Length */
+    if (dwarf_version >= 5)
+        saa_write8(plines,1);       /* Maximum Operations per Instruction */
     saa_write8(plines,1);           /* Initial value of 'is_stmt' */
     saa_write8(plines,line_base);   /* Line Base */
     saa_write8(plines,line_range);  /* Line Range */
@@ -3357,23 +3773,31 @@ static void dwarf_generate(void)
     saa_write8(plines,0);           /* Std opcode 10 length */
     saa_write8(plines,0);           /* Std opcode 11 length */
     saa_write8(plines,1);           /* Std opcode 12 length */
-    /* Directory Table */
-    saa_write8(plines,0);           /* End of table */
-    /* File Name Table */
-    ftentry = dwarf_flist;
-    for (indx = 0; indx < dwarf_numfiles; indx++) {
-        saa_wbytes(plines, ftentry->filename, (int32_t)(strlen(ftentry->filename) + 1));
-        saa_write8(plines,0);       /* directory  LEB128u */
-        saa_write8(plines,0);       /* time LEB128u */
-        saa_write8(plines,0);       /* size LEB128u */
-        ftentry = ftentry->next;
+    if (dwarf_version >= 5) {
+        dwarf_line_tables5(plines, plinesrel, linehdr);
+    } else {
+        /* Directory Table */
+        saa_write8(plines,0);       /* End of table */
+        /* File Name Table */
+        ftentry = dwarf_flist;
+        for (indx = 0; indx < dwarf_numfiles; indx++) {
+            saa_wbytes(plines, ftentry->filename, (int32_t)(strlen(ftentry->filename) + 1));
+            saa_write8(plines,0);   /* directory  LEB128u */
+            saa_write8(plines,0);   /* time LEB128u */
+            saa_write8(plines,0);   /* size LEB128u */
+            ftentry = ftentry->next;
+        }
+        saa_write8(plines,0);       /* End of table */
     }
-    saa_write8(plines,0);           /* End of table */
     linepoff = plines->datalen;
-    linelen = linepoff + totlen + 10;
+    linelen = linepoff + totlen + linehdr;
     linebuf = pbuf = nasm_malloc(linelen);
     WRITELONG(pbuf,linelen-4);      /* initial length */
-    WRITESHORT(pbuf,3);             /* dwarf version */
+    WRITESHORT(pbuf,dwarf_version); /* dwarf version */
+    if (dwarf_version >= 5) {
+        WRITECHAR(pbuf,is_elf64() ? 8 : 4); /* address size */
+        WRITECHAR(pbuf,0);          /* segment selector size */
+    }
     WRITELONG(pbuf,linepoff);       /* offset to line number program */
     /* write line header */
     saalen = linepoff;
@@ -3381,8 +3805,7 @@ static void dwarf_generate(void)
     pbuf += linepoff;
     saa_free(plines);
     /* concatonate line program ranges */
-    linepoff += 13;
-    plinesrel = saa_init(1L);
+    linepoff += linehdr + 3;
     psect = dwarf_fsect;
     if (is_elf32()) {
         for (indx = 0; indx < dwarf_nsections; indx++) {
@@ -3435,6 +3858,14 @@ static void dwarf_generate(void)
     saa_rnbytes(plinesrel, pbuf, saalen);
     saa_free(plinesrel);
 
+    /* build line_str section */
+    if (dwarf_linestr) {
+        linestrlen = saalen = dwarf_linestr->datalen;
+        linestrbuf = pbuf = nasm_malloc(linestrlen);
+        saa_rnbytes(dwarf_linestr, pbuf, saalen);
+        saa_free(dwarf_linestr);
+    }
+
     /* build frame section */
     framelen = 4;
     framebuf = pbuf = nasm_malloc(framelen);
@@ -3458,6 +3889,8 @@ static void dwarf_generate(void)
 
 static void dwarf_cleanup(void)
 {
+    hash_free(&dwarf_files);
+    raa_free(dwarf_sects);
     nasm_free(arangesbuf);
     nasm_free(arangesrelbuf);
     nasm_free(pubnamesbuf);
@@ -3468,28 +3901,23 @@ static void dwarf_cleanup(void)
     nasm_free(linerelbuf);
     nasm_free(framebuf);
     nasm_free(locbuf);
+    nasm_free(linestrbuf);
 }
 
 static void dwarf_findfile(const char * fname)
 {
-    int finx;
-    struct linelist *match;
+    struct hash_insert hi;
+    void **hp;
 
     /* return if fname is current file name */
     if (dwarf_clist && !(strcmp(fname, dwarf_clist->filename)))
         return;
 
     /* search for match */
-    match = 0;
-    if (dwarf_flist) {
-        match = dwarf_flist;
-        for (finx = 0; finx < dwarf_numfiles; finx++) {
-            if (!(strcmp(fname, match->filename))) {
-                dwarf_clist = match;
-                return;
-            }
-            match = match->next;
-        }
+    hp = hash_find(&dwarf_files, fname, &hi);
+    if (hp) {
+        dwarf_clist = *hp;
+        return;
     }
 
     /* add file name to end of list */
@@ -3499,6 +3927,7 @@ static void dwarf_findfile(const char * fname)
     dwarf_clist->filename = nasm_malloc(strlen(fname) + 1);
     strcpy(dwarf_clist->filename,fname);
     dwarf_clist->next = 0;
+    hash_add(&hi, dwarf_clist->filename, dwarf_clist);
     if (!dwarf_flist) {     /* if first entry */
         dwarf_flist = dwarf_elist = dwarf_clist;
         dwarf_clist->last = 0;
@@ -3510,7 +3939,6 @@ static void dwarf_findfile(const char * fname)
 
 static void dwarf_findsect(const int index)
 {
-    int sinx;
     struct sectlist *match;
     struct SAA *plinep;
 
@@ -3519,16 +3947,10 @@ static void dwarf_findsect(const int index)
         return;
 
     /* search for match */
-    match = 0;
-    if (dwarf_fsect) {
-        match = dwarf_fsect;
-        for (sinx = 0; sinx < dwarf_nsections; sinx++) {
-            if (match->section == index) {
-                dwarf_csect = match;
-                return;
-            }
-            match = match->next;
-        }
+    match = raa_read_ptr(dwarf_sects, index);
+    if (match) {
+        dwarf_csect = match;
+        return;
     }
 
     /* add entry to end of list */
@@ -3540,6 +3962,7 @@ static void dwarf_findsect(const int index)
     dwarf_csect->file = 1;
     dwarf_csect->section = index;
     dwarf_csect->next = 0;
+    dwarf_sects = raa_write_ptr(dwarf_sects, index, dwarf_csect);
     /* set relocatable address at start of line program */
     saa_write8(plinep,DW_LNS_extended_op);
     saa_write8(plinep,is_elf64() ? 9 : 5);   /* operand length */
@@ -78,6 +78,7 @@ struct stabentry {
 #define sec_rela_debug_line     (sec_debug + 7)
 #define sec_debug_frame         (sec_debug + 8)
 #define sec_debug_loc           (sec_debug + 9)
+#define sec_debug_line_str      (sec_debug + 10)    /* DWARF 5 only */
 
 extern uint8_t elf_osabi;
 extern uint8_t elf_abiver;
@@ -99,6 +100,16 @@ struct elf_reloc {
     int                 type;           /* type of relocation */
 };
 
+/* A COMDAT section group */
+struct elf_group {
+    char                *name;          /* signature */
+    int                 shndx;          /* ELF index of the group section */
+    int                 member;         /* ELF index of the first member */
+    struct elf_symbol   *sym;           /* signature symbol, if defined */
+    int                 symnum;         /* otherwise, our own local symbol */
+    struct SAA          *data;          /* member table */
+};
+
 struct elf_symbol {
     struct rbtree       symv;           /* symbol value and symbol rbtree */
     int32_t             strpos;         /* string table position of name */
@@ -128,6 +139,8 @@ struct elf_section {
     struct elf_reloc    *head;
     struct elf_reloc    **tail;
     struct rbtree       *gsyms;         /* global symbols in section */
+    struct elf_group    *group;         /* COMDAT group, if any */
+    int                 rel_shndx;      /* ELF index of the rel section */
 };
 
 #endif /* OUTPUT_OUTELF_H */
@@ -75,6 +75,8 @@
 #include "nasmlib.h"
 #include "error.h"
 #include "ver.h"
+#include "raa.h"
+#include "hashtbl.h"
 
 #include "outform.h"
 #include "outlib.h"
@@ -90,7 +92,6 @@ static bool any_segs;
 static int arrindex;
 
 #define HUNKSIZE 1024           /* Size of the data hunk */
-#define EXT_BLKSIZ 512
 #define LDPERLINE 32            /* bytes per line in output */
 
 struct ieeeSection;
@@ -131,10 +132,14 @@ static struct ieeeExternal {
 
 static int externals;
 
-static struct ExtBack {
-    struct ExtBack *next;
-    int index[EXT_BLKSIZ];
-} *ebhead, **ebtail;
+/*
+ * Segments are indexed by NASM segment number and by name; externals
+ * map NASM segment number to IEEE external index.  Both are keyed by
+ * segment >> 1.
+ */
+static struct RAA *ieee_segs, *ieee_exts;
+static struct hash_table ieee_seg_names;
+static int32_t ieee_nsegs;
 
 /* NOTE: the first segment MUST be the lineno segment */
 static struct ieeeSection {
@@ -197,10 +202,11 @@ static void ieee_write_byte(struct ieeeSection *, int);
 static void ieee_write_word(struct ieeeSection *, int);
 static void ieee_write_dword(struct ieeeSection *, int32_t);
 static void ieee_putascii(char *, ...);
+static void ieee_flush(void);
 static void ieee_putcs(int);
 static int32_t ieee_putld(int32_t, int32_t, uint8_t *);
 static int32_t ieee_putlr(struct ieeeFixupp *);
-static void ieee_unqualified_name(char *, char *);
+static void ieee_putname(const char *);
 
 /*
  * pup init
@@ -214,8 +220,8 @@ static void ieee_init(void)
     exthead = NULL;
     exttail = &exthead;
     externals = 1;
-    ebhead = NULL;
-    ebtail = &ebhead;
+    ieee_segs = ieee_exts = raa_init();
+    ieee_nsegs = 0;
     seghead = ieee_seg_needs_update = NULL;
     segtail = &seghead;
     ieee_entry_seg = NO_SEG;
@@ -248,6 +254,7 @@ static void ieee_cleanup(void)
             segtmp->data = dattmp->next;
             nasm_free(dattmp);
         }
+        nasm_free(segtmp->name);
         nasm_free(segtmp);
     }
     while (fpubhead) {
@@ -260,11 +267,27 @@ static void ieee_cleanup(void)
         exthead = exthead->next;
         nasm_free(exttmp);
     }
-    while (ebhead) {
-        struct ExtBack *ebtmp = ebhead;
-        ebhead = ebhead->next;
-        nasm_free(ebtmp);
-    }
+    raa_free(ieee_segs);
+    raa_free(ieee_exts);
+    hash_free(&ieee_seg_names);
+}
+
+static struct ieeeSection *ieee_find_seg(int32_t segment)
+{
+    if (segment < 0 || (segment & 1))
+        return NULL;
+    return raa_read_ptr(ieee_segs, segment >> 1);
+}
+
+/*
+ * Return the IEEE external index for a NASM segment number, or 0
+ * if it isn't an external.
+ */
+static int32_t ieee_find_ext(int32_t segment)
+{
+    if (segment < 0)
+        return 0;
+    return raa_read(ieee_exts, segment >> 1);
 }
 
 /*
@@ -288,9 +311,7 @@ static void ieee_deflabel(char *name, int32_t segment,
      * position for later output of an EXTDEF.
      */
     struct ieeeExternal *ext;
-    struct ExtBack *eb;
     struct ieeeSection *seg;
-    int i;
 
     if (special)
         nasm_nonfatal("unrecognised symbol type `%s'", special);
@@ -307,12 +328,10 @@ static void ieee_deflabel(char *name, int32_t segment,
     }
 
     /*
-     * Case (i):
+     * Case (i): the segment already has its name.
      */
-    if (ieee_seg_needs_update) {
-        ieee_seg_needs_update->name = name;
+    if (ieee_seg_needs_update)
         return;
-    }
     if (segment < SEG_ABS && segment != NO_SEG && segment % 2)
         return;
 
@@ -336,19 +355,19 @@ static void ieee_deflabel(char *name, int32_t segment,
         return;
     }
 
-    for (seg = seghead; seg && is_global; seg = seg->next)
-        if (seg->index == segment) {
-            struct ieeePublic *pub;
-
-            last_defined = pub = *seg->pubtail = nasm_malloc(sizeof(*pub));
-            seg->pubtail = &pub->next;
-            pub->next = NULL;
-            pub->name = name;
-            pub->offset = offset;
-            pub->index = seg->ieee_index;
-            pub->segment = -1;
-            return;
-        }
+    seg = is_global ? ieee_find_seg(segment) : NULL;
+    if (seg) {
+        struct ieeePublic *pub;
+
+        last_defined = pub = *seg->pubtail = nasm_malloc(sizeof(*pub));
+        seg->pubtail = &pub->next;
+        pub->next = NULL;
+        pub->name = name;
+        pub->offset = offset;
+        pub->index = seg->ieee_index;
+        pub->segment = -1;
+        return;
+    }
 
     /*
      * Case (iii).
@@ -362,24 +381,9 @@ static void ieee_deflabel(char *name, int32_t segment,
             ext->commonsize = offset;
         else
             ext->commonsize = 0;
-        i = segment / 2;
-        eb = ebhead;
-        if (!eb) {
-            eb = *ebtail = nasm_zalloc(sizeof(*eb));
-            eb->next = NULL;
-            ebtail = &eb->next;
-        }
-        while (i > EXT_BLKSIZ) {
-            if (eb && eb->next)
-                eb = eb->next;
-            else {
-                eb = *ebtail = nasm_zalloc(sizeof(*eb));
-                eb->next = NULL;
-                ebtail = &eb->next;
-            }
-            i -= EXT_BLKSIZ;
-        }
-        eb->index[i] = externals++;
+        if (segment >= 0)
+            ieee_exts = raa_write(ieee_exts, segment >> 1, externals);
+        externals++;
     }
 
 }
@@ -408,9 +412,7 @@ static void ieee_out(int32_t segto, const void *data,
     /*
      * Find the segment we are targetting.
      */
-    for (seg = seghead; seg; seg = seg->next)
-        if (seg->index == segto)
-            break;
+    seg = ieee_find_seg(segto);
     if (!seg)
         nasm_panic("code directed to nonexistent segment?");
 
@@ -430,8 +432,9 @@ static void ieee_out(int32_t segto, const void *data,
             ldata += (size - 2);
         if (type == OUT_REL4ADR)
             ldata += (size - 4);
-        ieee_write_fixup(segment, wrt, seg, size, type, ldata);
-        if (size == 2)
+        if (segment != NO_SEG || wrt != NO_SEG)
+            ieee_write_fixup(segment, wrt, seg, size, type, ldata);
+        else if (size == 2)
             ieee_write_word(seg, ldata);
         else
             ieee_write_dword(seg, ldata);
@@ -481,15 +484,10 @@ static void ieee_write_fixup(int32_t segment, int32_t wrt,
                 && realtype != OUT_REL4ADR) {
                 wrt--;
 
-                for (target = seghead; target; target = target->next)
-                    if (target->index == wrt)
-                        break;
+                target = ieee_find_seg(wrt);
                 if (target) {
                     s.id1 = target->ieee_index;
-                    for (target = seghead; target; target = target->next)
-                        if (target->index == segment)
-                            break;
-
+                    target = ieee_find_seg(segment);
                     if (target)
                         s.id2 = target->ieee_index;
                     else {
@@ -497,21 +495,13 @@ static void ieee_write_fixup(int32_t segment, int32_t wrt,
                          * Now we assume the segment field is being used
                          * to hold an extern index
                          */
-                        int32_t i = segment / 2;
-                        struct ExtBack *eb = ebhead;
-                        while (i > EXT_BLKSIZ) {
-                            if (eb)
-                                eb = eb->next;
-                            else
-                                break;
-                            i -= EXT_BLKSIZ;
-                        }
+                        int32_t ext = ieee_find_ext(segment);
                         /* if we have an extern decide the type and make a record
                          */
-                        if (eb) {
+                        if (ext) {
                             s.ftype = FT_EXTWRT;
                             s.addend = 0;
-                            s.id2 = eb->index[i];
+                            s.id2 = ext;
                         } else
                             nasm_nonfatal("source of WRT must be an offset");
                     }
@@ -535,9 +525,7 @@ static void ieee_write_fixup(int32_t segment, int32_t wrt,
         } else if (segment % 2) {
             /* fixup to named segment */
             /* look it up */
-            for (target = seghead; target; target = target->next)
-                if (target->index == segment - 1)
-                    break;
+            target = ieee_find_seg(segment - 1);
             if (target)
                 s.id1 = target->ieee_index;
             else {
@@ -545,25 +533,17 @@ static void ieee_write_fixup(int32_t segment, int32_t wrt,
                  * Now we assume the segment field is being used
                  * to hold an extern index
                  */
-                int32_t i = segment / 2;
-                struct ExtBack *eb = ebhead;
-                while (i > EXT_BLKSIZ) {
-                    if (eb)
-                        eb = eb->next;
-                    else
-                        break;
-                    i -= EXT_BLKSIZ;
-                }
+                int32_t ext = ieee_find_ext(segment);
                 /* if we have an extern decide the type and make a record
                  */
-                if (eb) {
+                if (ext) {
                     if (realtype == OUT_REL2ADR || realtype == OUT_REL4ADR) {
                         nasm_panic("Segment of a rel not supported in ieee_write_fixup");
                     } else {
                         /* If we want the segment */
                         s.ftype = FT_EXTSEG;
                         s.addend = 0;
-                        s.id1 = eb->index[i];
+                        s.id1 = ext;
                     }
 
                 } else
@@ -575,9 +555,7 @@ static void ieee_write_fixup(int32_t segment, int32_t wrt,
             /* Assume we are offsetting directly from a section
              * So look up the target segment
              */
-            for (target = seghead; target; target = target->next)
-                if (target->index == segment)
-                    break;
+            target = ieee_find_seg(segment);
             if (target) {
                 if (realtype == OUT_REL2ADR || realtype == OUT_REL4ADR) {
                     /* PC rel to a known offset */
@@ -597,27 +575,19 @@ static void ieee_write_fixup(int32_t segment, int32_t wrt,
                  * Now we assume the segment field is being used
                  * to hold an extern index
                  */
-                int32_t i = segment / 2;
-                struct ExtBack *eb = ebhead;
-                while (i > EXT_BLKSIZ) {
-                    if (eb)
-                        eb = eb->next;
-                    else
-                        break;
-                    i -= EXT_BLKSIZ;
-                }
+                int32_t ext = ieee_find_ext(segment);
                 /* if we have an extern decide the type and make a record
                  */
-                if (eb) {
+                if (ext) {
                     if (realtype == OUT_REL2ADR || realtype == OUT_REL4ADR) {
                         s.ftype = FT_EXTREL;
                         s.addend = 0;
-                        s.id1 = eb->index[i];
+                        s.id1 = ext;
                     } else {
                         /* else we want the external offset */
                         s.ftype = FT_EXT;
                         s.addend = 0;
-                        s.id1 = eb->index[i];
+                        s.id1 = ext;
                     }
 
                 } else
@@ -638,10 +608,14 @@ static void ieee_install_fixup(struct ieeeSection *seg,
                                struct ieeeFixupp *fix)
 {
     struct ieeeFixupp *f;
+    int i;
+
     f = nasm_malloc(sizeof(struct ieeeFixupp));
     memcpy(f, fix, sizeof(struct ieeeFixupp));
     f->offset = seg->currentpos;
-    seg->currentpos += fix->size;
+    /* The LR record supplies these bytes; keep the hunks in step */
+    for (i = 0; i < fix->size; i++)
+        ieee_write_byte(seg, 0);
     f->next = NULL;
     if (seg->fptr)
         seg->flptr = seg->flptr->next = f;
@@ -669,7 +643,9 @@ static int32_t ieee_segment(char *name, int *bits)
         return seghead->index;
     } else {
         struct ieeeSection *seg;
-        int ieee_idx, attrs;
+        struct hash_insert hi;
+        void **segp;
+        int attrs;
 	bool rn_error;
         char *p;
 
@@ -699,30 +675,30 @@ static int32_t ieee_segment(char *name, int *bits)
             attrs++;
         }
 
-        ieee_idx = 1;
-        for (seg = seghead; seg; seg = seg->next) {
-            ieee_idx++;
-            if (!strcmp(seg->name, name)) {
-                if (attrs > 0 && seg->pass_last_seen == pass_count())
-                    nasm_warn(WARN_OTHER, "segment attributes specified on"
-                              " redeclaration of segment: ignoring");
-                if (seg->use32)
-                    *bits = 32;
-                else
-                    *bits = 16;
+        segp = hash_find(&ieee_seg_names, name, &hi);
+        if (segp) {
+            seg = *segp;
+            if (attrs > 0 && seg->pass_last_seen == pass_count())
+                nasm_warn(WARN_OTHER, "segment attributes specified on"
+                          " redeclaration of segment: ignoring");
+            if (seg->use32)
+                *bits = 32;
+            else
+                *bits = 16;
 
-                seg->pass_last_seen = pass_count();
-                return seg->index;
-            }
+            seg->pass_last_seen = pass_count();
+            return seg->index;
         }
 
         *segtail = seg = nasm_malloc(sizeof(*seg));
         seg->next = NULL;
         segtail = &seg->next;
         seg->index = seg_alloc();
-        seg->ieee_index = ieee_idx;
+        seg->ieee_index = ++ieee_nsegs;
         any_segs = true;
-        seg->name = NULL;
+        seg->name = nasm_strdup(name);
+        hash_add(&hi, seg->name, seg);
+        ieee_segs = raa_write_ptr(ieee_segs, seg->index >> 1, seg);
         seg->currentpos = 0;
         seg->align = 1;         /* default */
         seg->use32 = *bits == 32;       /* default to user spec */
@@ -823,12 +799,7 @@ ieee_directive(enum directive directive, char *value)
 
 static void ieee_sectalign(int32_t seg, unsigned int value)
 {
-    struct ieeeSection *s;
-
-    list_for_each(s, seghead) {
-        if (s->index == seg)
-            break;
-    }
+    struct ieeeSection *s = ieee_find_seg(seg);
 
     /*
      * 256 is maximum there, note it may happen
@@ -850,13 +821,7 @@ static int32_t ieee_segbase(int32_t segment)
 {
     struct ieeeSection *seg;
 
-    /*
-     * Find the segment in our list.
-     */
-    for (seg = seghead; seg; seg = seg->next)
-        if (seg->index == segment - 1)
-            break;
-
+    seg = ieee_find_seg(segment - 1);
     if (!seg)
         return segment;         /* not one of ours - leave it alone */
 
@@ -895,12 +860,15 @@ static void ieee_write_file(void)
     ieee_putascii("AD8,4,L.\n");
 
     /*
-     * date and time
+     * date and time, constant for regression tests
      */
-    ieee_putascii("DT%04d%02d%02d%02d%02d%02d.\n",
-                  1900 + thetime->tm_year, thetime->tm_mon + 1,
-                  thetime->tm_mday, thetime->tm_hour, thetime->tm_min,
-                  thetime->tm_sec);
+    if (nasm_test_run())
+        ieee_putascii("DT19700101000000.\n");
+    else
+        ieee_putascii("DT%04d%02d%02d%02d%02d%02d.\n",
+                      1900 + thetime->tm_year, thetime->tm_mon + 1,
+                      thetime->tm_mday, thetime->tm_hour, thetime->tm_min,
+                      thetime->tm_sec);
     /*
      * if debugging, dump file names
      */
@@ -922,7 +890,6 @@ static void ieee_write_file(void)
     if (!debuginfo && !strcmp(seg->name, "??LINE"))
         seg = seg->next;
     while (seg) {
-        char buf[256];
         char attrib;
         switch (seg->combine) {
         case CMB_PUBLIC:
@@ -936,15 +903,14 @@ static void ieee_write_file(void)
             attrib = 'M';
             break;
         }
-        ieee_unqualified_name(buf, seg->name);
         if (seg->align >= SEG_ABS) {
-            ieee_putascii("ST%X,A,%02X%s.\n", seg->ieee_index,
-                          strlen(buf), buf);
+            ieee_putascii("ST%X,A,", seg->ieee_index);
+            ieee_putname(seg->name);
             ieee_putascii("ASL%X,%lX.\n", seg->ieee_index,
                           (seg->align - SEG_ABS) * 16);
         } else {
-            ieee_putascii("ST%X,%c,%02X%s.\n", seg->ieee_index, attrib,
-                          strlen(buf), buf);
+            ieee_putascii("ST%X,%c,", seg->ieee_index, attrib);
+            ieee_putname(seg->name);
             ieee_putascii("SA%X,%lX.\n", seg->ieee_index, seg->align);
             ieee_putascii("ASS%X,%X.\n", seg->ieee_index,
                           seg->currentpos);
@@ -954,10 +920,8 @@ static void ieee_write_file(void)
     /*
      * write the start address if there is one
      */
-    if (ieee_entry_seg) {
-        for (seg = seghead; seg; seg = seg->next)
-            if (seg->index == ieee_entry_seg)
-                break;
+    if (ieee_entry_seg != NO_SEG) {
+        seg = ieee_find_seg(ieee_entry_seg);
         if (!seg)
             nasm_panic("Start address records are incorrect");
         else
@@ -972,9 +936,8 @@ static void ieee_write_file(void)
     i = 1;
     for (seg = seghead; seg; seg = seg->next) {
         for (pub = seg->pubhead; pub; pub = pub->next) {
-            char buf[256];
-            ieee_unqualified_name(buf, pub->name);
-            ieee_putascii("NI%X,%02X%s.\n", i, strlen(buf), buf);
+            ieee_putascii("NI%X,", i);
+            ieee_putname(pub->name);
             if (pub->segment == -1)
                 ieee_putascii("ASI%X,R%X,%lX,+.\n", i, pub->index,
                               pub->offset);
@@ -993,9 +956,8 @@ static void ieee_write_file(void)
     pub = fpubhead;
     i = 1;
     while (pub) {
-        char buf[256];
-        ieee_unqualified_name(buf, pub->name);
-        ieee_putascii("NI%X,%02X%s.\n", i, strlen(buf), buf);
+        ieee_putascii("NI%X,", i);
+        ieee_putname(pub->name);
         if (pub->segment == -1)
             ieee_putascii("ASI%X,R%X,%lX,+.\n", i, pub->index,
                           pub->offset);
@@ -1017,9 +979,8 @@ static void ieee_write_file(void)
     ext = exthead;
     i = 1;
     while (ext) {
-        char buf[256];
-        ieee_unqualified_name(buf, ext->name);
-        ieee_putascii("NX%X,%02X%s.\n", i++, strlen(buf), buf);
+        ieee_putascii("NX%X,", i++);
+        ieee_putname(ext->name);
         ext = ext->next;
     }
     ieee_putcs(false);
@@ -1044,9 +1005,8 @@ static void ieee_write_file(void)
     i = 1;
     for (seg = seghead; seg && debuginfo; seg = seg->next) {
         for (loc = seg->lochead; loc; loc = loc->next) {
-            char buf[256];
-            ieee_unqualified_name(buf, loc->name);
-            ieee_putascii("NN%X,%02X%s.\n", i, strlen(buf), buf);
+            ieee_putascii("NN%X,", i);
+            ieee_putname(loc->name);
             if (loc->segment == -1)
                 ieee_putascii("ASN%X,R%X,%lX,+.\n", i, loc->index,
                               loc->offset);
@@ -1071,31 +1031,30 @@ static void ieee_write_file(void)
         seg = seg->next;
     while (seg) {
         if (seg->currentpos) {
-            int32_t size, org = 0;
+            int32_t size, end, org = 0;
             data = seg->data;
             ieee_putascii("SB%X.\n", seg->ieee_index);
             fix = seg->fptr;
-            while (fix) {
-                size = HUNKSIZE - (org % HUNKSIZE);
-                size =
-                    size + org >
-                    seg->currentpos ? seg->currentpos - org : size;
-                size = fix->offset - org > size ? size : fix->offset - org;
-                org = ieee_putld(org, org + size, data->data);
-                if (org % HUNKSIZE == 0)
-                    data = data->next;
-                if (org == fix->offset) {
-                    org += ieee_putlr(fix);
+            while (org < seg->currentpos) {
+                end = fix ? fix->offset : seg->currentpos;
+                while (org < end) {
+                    size = HUNKSIZE - (org % HUNKSIZE);
+                    if (size > end - org)
+                        size = end - org;
+                    org = ieee_putld(org, org + size, data->data);
+                    if (org % HUNKSIZE == 0)
+                        data = data->next;
+                }
+                if (fix) {
+                    /* Skip the bytes reserved for the fixup */
+                    size = ieee_putlr(fix);
+                    while (size--) {
+                        if (++org % HUNKSIZE == 0)
+                            data = data->next;
+                    }
                     fix = fix->next;
                 }
             }
-            while (org < seg->currentpos && data) {
-                size =
-                    seg->currentpos - org >
-                    HUNKSIZE ? HUNKSIZE : seg->currentpos - org;
-                org = ieee_putld(org, org + size, data->data);
-                data = data->next;
-            }
             ieee_putcs(false);
 
         }
@@ -1105,6 +1064,7 @@ static void ieee_write_file(void)
      * module end record
      */
     ieee_putascii("ME.\n");
+    ieee_flush();
 }
 
 static void ieee_write_byte(struct ieeeSection *seg, int data)
@@ -1128,20 +1088,89 @@ static void ieee_write_dword(struct ieeeSection *seg, int32_t data)
     ieee_write_byte(seg, (data >> 16) & 0xFF);
     ieee_write_byte(seg, (data >> 24) & 0xFF);
 }
+/*
+ * Records are formatted into a large buffer and written out in
+ * blocks; the checksum is accumulated as the text goes in.
+ */
+#define IEEE_OUTBUF_SIZE 65536
+
+static char ieee_outbuf[IEEE_OUTBUF_SIZE];
+static size_t ieee_outlen;
+
+static const char ieee_hexdigits[16] = "0123456789ABCDEF";
+
+static void ieee_flush(void)
+{
+    nasm_write(ieee_outbuf, ieee_outlen, ofile);
+    ieee_outlen = 0;
+}
+
+static void ieee_putbuf(const char *str, size_t len)
+{
+    while (len) {
+        size_t n = IEEE_OUTBUF_SIZE - ieee_outlen;
+        char *out = ieee_outbuf + ieee_outlen;
+
+        if (!n) {
+            ieee_flush();
+            continue;
+        }
+        if (n > len)
+            n = len;
+        ieee_outlen += n;
+        len -= n;
+        while (n--) {
+            char c = *str++;
+            if ((uint8_t)c > 31)
+                checksum += c;
+            *out++ = c;
+        }
+    }
+}
+
 static void ieee_putascii(char *format, ...)
 {
     char buffer[256];
-    int i, l;
     va_list ap;
 
     va_start(ap, format);
     vsnprintf(buffer, sizeof(buffer), format, ap);
-    l = strlen(buffer);
-    for (i = 0; i < l; i++)
-        if ((uint8_t)buffer[i] > 31)
-            checksum += buffer[i];
     va_end(ap);
-    fputs(buffer, ofile);
+    ieee_putbuf(buffer, strlen(buffer));
+}
+
+/*
+ * Put out a length-prefixed name and terminate the record,
+ * upper-casing it if requested
+ */
+static void ieee_putname(const char *name)
+{
+    char buf[256];
+    size_t len = strlen(name);
+    size_t n, i;
+    char *p = buf + 8;
+
+    /* At least two hex digits of length */
+    do {
+        *--p = ieee_hexdigits[len & 15];
+        len >>= 4;
+    } while (len || p > buf + 6);
+    ieee_putbuf(p, buf + 8 - p);
+
+    len = strlen(name);
+    while (len) {
+        n = len < sizeof(buf) ? len : sizeof(buf);
+        if (ieee_uppercase) {
+            for (i = 0; i < n; i++)
+                buf[i] = toupper(name[i]);
+            ieee_putbuf(buf, n);
+        } else {
+            ieee_putbuf(name, n);
+        }
+        name += n;
+        len -= n;
+    }
+    ieee_putbuf(".\n", 2);
 }
 
 /*
@@ -1160,32 +1189,28 @@ static void ieee_putcs(int toclear)
 
 static int32_t ieee_putld(int32_t start, int32_t end, uint8_t *buf)
 {
-    int32_t val;
-    if (start == end)
-        return (start);
-    val = start % HUNKSIZE;
-    /* fill up multiple lines */
-    while (end - start >= LDPERLINE) {
-        int i;
-        ieee_putascii("LD");
-        for (i = 0; i < LDPERLINE; i++) {
-            ieee_putascii("%02X", buf[val++]);
-            start++;
-        }
-        ieee_putascii(".\n");
-    }
-    /* if no partial lines */
-    if (start == end)
-        return (start);
-    /* make a partial line */
-    ieee_putascii("LD");
+    char line[2 + 2 * LDPERLINE + 2];
+    int32_t val = start % HUNKSIZE;
+
     while (start < end) {
-        ieee_putascii("%02X", buf[val++]);
-        start++;
+        int32_t n = end - start > LDPERLINE ? LDPERLINE : end - start;
+        char *p = line;
+
+        start += n;
+        *p++ = 'L';
+        *p++ = 'D';
+        while (n--) {
+            uint8_t b = buf[val++];
+            *p++ = ieee_hexdigits[b >> 4];
+            *p++ = ieee_hexdigits[b & 15];
+        }
+        *p++ = '.';
+        *p++ = '\n';
+        ieee_putbuf(line, p - line);
     }
-    ieee_putascii(".\n");
-    return (start);
+    return start;
 }
+
 static int32_t ieee_putlr(struct ieeeFixupp *p)
 {
 /*
@@ -1253,17 +1278,6 @@ static int32_t ieee_putlr(struct ieeeFixupp *p)
     return (size);
 }
 
-/* Dump all segment data (text and fixups )*/
-
-static void ieee_unqualified_name(char *dest, char *source)
-{
-    if (ieee_uppercase) {
-        while (*source)
-            *dest++ = toupper(*source++);
-        *dest = 0;
-    } else
-        strcpy(dest, source);
-}
 static void dbgls_init(void)
 {
     int tempint;
@@ -1328,9 +1342,7 @@ static void dbgls_linnum(const char *lnfname, int32_t lineno, int32_t segto)
     /*
      * Find the segment we are targetting.
      */
-    for (seg = seghead; seg; seg = seg->next)
-        if (seg->index == segto)
-            break;
+    seg = ieee_find_seg(segto);
     if (!seg)
         nasm_panic("lineno directed to nonexistent segment?");
 
@@ -1391,23 +1403,21 @@ static void dbgls_deflabel(char *name, int32_t segment,
      * call to ieee_deflabel so we can skip that.
      */
 
-    for (seg = seghead; seg; seg = seg->next)
-        if (seg->index == segment) {
-            struct ieeePublic *loc;
-            /*
-             * Case (ii). Maybe MODPUB someday?
-             */
-            if (!is_global) {
-                last_defined = loc = nasm_malloc(sizeof(*loc));
-                *seg->loctail = loc;
-                seg->loctail = &loc->next;
-                loc->next = NULL;
-                loc->name = nasm_strdup(name);
-                loc->offset = offset;
-                loc->segment = -1;
-                loc->index = seg->ieee_index;
-            }
-        }
+    seg = ieee_find_seg(segment);
+    if (seg && !is_global) {
+        struct ieeePublic *loc;
+        /*
+         * Case (ii). Maybe MODPUB someday?
+         */
+        last_defined = loc = nasm_malloc(sizeof(*loc));
+        *seg->loctail = loc;
+        seg->loctail = &loc->next;
+        loc->next = NULL;
+        loc->name = nasm_strdup(name);
+        loc->offset = offset;
+        loc->segment = -1;
+        loc->index = seg->ieee_index;
+    }
 }
 static void dbgls_typevalue(int32_t type)
 {
@@ -201,6 +201,9 @@ static uint32_t nundefsym;
 static struct symbol **extdefsyms = NULL;
 static struct symbol **undefsyms = NULL;
 
+/* Final symbol number, indexed by initial_snum */
+static int32_t *snum_map = NULL;
+
 static struct RAA *extsyms;
 static struct SAA *strs;
 static uint32_t strslen;
@@ -215,6 +218,22 @@ static uint64_t seg_vmsize = 0;
 static uint32_t seg_nsects = 0;
 static uint64_t rel_padcnt = 0;
 
+/*
+ * With MH_SUBSECTIONS_VIA_SYMBOLS the linker starts a new atom at
+ * every symbol not marked N_ALT_ENTRY. atom_segs records the
+ * subsections whose first symbol has been seen; alt_entries lists
+ * the locations named by the alt_entry directive.
+ */
+struct alt_entry {
+    struct alt_entry *next;
+    int32_t segment;
+    int64_t offset;
+};
+
+static struct RAA *atom_segs;
+static struct alt_entry *alt_entries;
+static uint32_t nltmps;
+
 /*
  * Functions for handling fixed-length zero-padded string
  * fields, that may or may not be null-terminated.
@@ -361,6 +380,10 @@ static void macho_init(void)
 
     section_by_index = raa_init();
 
+    atom_segs = raa_init();
+    alt_entries = NULL;
+    nltmps = 0;
+
     /* string table starts with a zero byte so index 0 is an empty string */
     saa_wbytes(strs, zero_buffer, 1);
     strslen = 1;
@@ -1095,6 +1118,19 @@ static void macho_symdef(char *name, int32_t section, int64_t offset,
 	    s->syms[1] = rb_insert(s->syms[1], &sym->symv[1]);
     }
 
+    /*
+     * Only the label that opened a subsection starts an atom; any
+     * other symbol, such as a local label inside a function, must not
+     * split it, since references to it have already been resolved.
+     */
+    if ((head_flags & MH_SUBSECTIONS_VIA_SYMBOLS) &&
+	s && s != &absolute_sect) {
+	if (section != s->index && !raa_read(atom_segs, section >> 1))
+	    atom_segs = raa_write(atom_segs, section >> 1, 1);
+	else
+	    sym->desc |= N_ALT_ENTRY;
+    }
+
     ++nsyms;
 
     if (special && !special_used)
@@ -1144,6 +1180,7 @@ static void macho_layout_symbols (uint32_t *numsyms,
     struct symbol *sym, **symp;
     uint32_t i,j;
 
+    snum_map = nasm_malloc(*numsyms * sizeof(*snum_map));
     *numsyms = 0;
     *strtabsize = sizeof (char);
 
@@ -1222,6 +1259,77 @@ static void macho_layout_symbols (uint32_t *numsyms,
 	undefsyms[j]->snum = *numsyms;
 	*numsyms += 1;
     }
+
+    for (sym = syms; sym != NULL; sym = sym->next)
+	snum_map[sym->initial_snum] = sym->snum;
+}
+
+/* Set N_ALT_ENTRY on every symbol at this offset in the tree */
+static void mark_alt_entry(struct rbtree *srb, uint64_t offset)
+{
+    while (srb) {
+	if (srb->key == offset) {
+	    container_of(srb, struct symbol, symv)->desc |= N_ALT_ENTRY;
+	    mark_alt_entry(srb->left, offset);
+	    srb = srb->right;
+	} else if (srb->key < offset) {
+	    srb = srb->right;
+	} else {
+	    srb = srb->left;
+	}
+    }
+}
+
+static void macho_mark_alt_entries(void)
+{
+    struct alt_entry *ae;
+    struct section *s;
+
+    for (ae = alt_entries; ae; ae = ae->next) {
+	s = get_section_by_index(ae->segment);
+	if (s)
+	    mark_alt_entry(s->syms[0], ae->offset);
+    }
+}
+
+/*
+ * The linker attributes the bytes of a section ahead of its first
+ * atom to whatever precedes them in the link, so give every section
+ * that doesn't start with an atom a local symbol at offset 0, the
+ * way the native assembler does.
+ */
+static void macho_add_atom_symbols(void)
+{
+    struct section *s;
+    struct symbol *sym;
+    bool *atom0;
+
+    atom0 = nasm_zalloc((seg_nsects + 1) * sizeof(bool));
+    for (sym = syms; sym != NULL; sym = sym->next) {
+	if ((sym->type & N_TYPE) == N_SECT && sym->sect != NO_SECT &&
+	    sym->symv[0].key == 0 && !(sym->desc & N_ALT_ENTRY))
+	    atom0[sym->sect] = true;
+    }
+
+    for (s = sects; s != NULL; s = s->next) {
+	char name[32];
+	size_t len;
+
+	if (!s->size || atom0[s->fileindex])
+	    continue;
+
+	len = snprintf(name, sizeof name, "ltmp%"PRIu32, nltmps++) + 1;
+	sym = nasm_zalloc(sizeof(struct symbol) + len);
+	sym->name = memcpy(sym + 1, name, len);
+	sym->type = N_SECT;
+	sym->sect = s->fileindex;
+	sym->initial_snum = nsyms++;
+
+	*symstail = sym;
+	symstail = &sym->next;
+    }
+
+    nasm_free(atom0);
 }
 
 /* Calculate some values we'll need for writing later.  */
@@ -1548,17 +1656,9 @@ static void macho_write_symtab (void)
    doing this only for externally referenced symbols. */
 static void macho_fixup_relocs (struct reloc *r)
 {
-    struct symbol *sym;
-
     while (r != NULL) {
-	if (r->ext) {
-	    for (sym = syms; sym != NULL; sym = sym->next) {
-		if (sym->initial_snum == r->snum) {
-		    r->snum = sym->snum;
-		    break;
-		}
-	    }
-	}
+	if (r->ext)
+	    r->snum = snum_map[r->snum];
 	r = r->next;
     }
 }
@@ -1690,6 +1790,11 @@ static void macho_cleanup(void)
 
     dfmt->cleanup();
 
+    /* Settle which symbols start atoms.  */
+    macho_mark_alt_entries();
+    if (head_flags & MH_SUBSECTIONS_VIA_SYMBOLS)
+	macho_add_atom_symbols();
+
     /* Sort all symbols.  */
     macho_layout_symbols (&nsyms, &strslen);
 
@@ -1729,6 +1834,13 @@ static void macho_cleanup(void)
 
     nasm_free(extdefsyms);
     nasm_free(undefsyms);
+    nasm_free(snum_map);
+    raa_free(atom_segs);
+    while (alt_entries) {
+	struct alt_entry *ae = alt_entries;
+	alt_entries = ae->next;
+	nasm_free(ae);
+    }
     nasm_free(sectstab);
     raa_free(section_by_index);
     hash_free(&section_by_name);
@@ -1755,10 +1867,48 @@ static bool macho_set_section_attribute_by_symbol(const char *label, uint32_t fl
     return true;
 }
 
+static bool macho_no_dead_strip_symbol(const char *label)
+{
+    return macho_set_section_attribute_by_symbol(label, S_ATTR_NO_DEAD_STRIP);
+}
+
 /*
- * Mark a symbol for no dead stripping
+ * Record a symbol as an alternate entry point into the atom
+ * containing it, rather than the start of an atom of its own
  */
-static enum directive_result macho_no_dead_strip(const char *labels)
+static bool macho_alt_entry_symbol(const char *label)
+{
+    struct alt_entry *ae;
+    int32_t nasm_seg;
+    int64_t offset;
+
+    if (lookup_label(label, &nasm_seg, &offset) == LBL_none) {
+	nasm_error(ERR_NONFATAL, "unknown symbol `%s' in alt_entry", label);
+	return false;
+    }
+
+    if (!get_section_by_index(nasm_seg)) {
+	nasm_error(ERR_NONFATAL, "symbol `%s' is external or absolute", label);
+	return false;
+    }
+
+    /* Locations only need recording once they are final */
+    if (pass_final()) {
+	ae = nasm_malloc(sizeof *ae);
+	ae->segment = nasm_seg;
+	ae->offset = offset;
+	ae->next = alt_entries;
+	alt_entries = ae;
+    }
+    return true;
+}
+
+/*
+ * Apply a function to each symbol in a list
+ */
+static enum directive_result
+macho_symbol_list(const char *labels, const char *what,
+		  bool (*func)(const char *))
 {
     char *s, *p, *ep;
     char ec;
@@ -1768,7 +1918,7 @@ static enum directive_result macho_no_dead_strip(const char *labels)
     while (*p) {
 	ep = nasm_skip_identifier(p);
 	if (!ep) {
-	    nasm_error(ERR_NONFATAL, "invalid symbol in NO_DEAD_STRIP");
+	    nasm_error(ERR_NONFATAL, "invalid symbol in %s", what);
 	    goto err;
 	}
 	ec = *ep;
@@ -1778,7 +1928,7 @@ static enum directive_result macho_no_dead_strip(const char *labels)
 	}
 	*ep = '\0';
 	if (!pass_first()) {
-	    if (!macho_set_section_attribute_by_symbol(p, S_ATTR_NO_DEAD_STRIP))
+	    if (!func(p))
 		rv = DIRR_ERROR;
 	}
 	*ep = ec;
@@ -1814,7 +1964,12 @@ macho_pragma(const struct pragma *pragma)
 	return DIRR_OK;
 
     case D_NO_DEAD_STRIP:
-	return macho_no_dead_strip(pragma->tail);
+	return macho_symbol_list(pragma->tail, "NO_DEAD_STRIP",
+				 macho_no_dead_strip_symbol);
+
+    case D_ALT_ENTRY:
+	return macho_symbol_list(pragma->tail, "ALT_ENTRY",
+				 macho_alt_entry_symbol);
 
     default:
 	return DIRR_UNKNOWN;	/* Not a Mach-O directive */
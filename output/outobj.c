@@ -47,6 +47,8 @@
 #include "stdscan.h"
 #include "eval.h"
 #include "ver.h"
+#include "raa.h"
+#include "hashtbl.h"
 
 #include "outform.h"
 #include "outlib.h"
@@ -173,6 +175,7 @@ struct ObjRecord {
 };
 
 static void obj_fwrite(ObjRecord * orp);
+static void obj_flush(void);
 static void ori_ledata(ObjRecord * orp);
 static void ori_pubdef(ObjRecord * orp);
 static void ori_null(ObjRecord * orp);
@@ -206,9 +209,24 @@ static ObjRecord *obj_clear(ObjRecord * orp)
  */
 static ObjRecord *obj_emit(ObjRecord * orp)
 {
-    if (orp->back) {
-        obj_emit(orp->back);
-        nasm_free(orp->back);
+    ObjRecord *part, *prev, *next;
+
+    /*
+     * A segment's LEDATA records can form a long chain of previous
+     * parts; reverse it and write it out oldest first, rather than
+     * recursing once per record.
+     */
+    prev = NULL;
+    for (part = orp->back; part; part = next) {
+        next = part->back;
+        part->back = prev;
+        prev = part;
+    }
+    for (part = prev; part; part = next) {
+        next = part->back;
+        part->back = NULL;
+        obj_emit(part);
+        nasm_free(part);
     }
 
     if (orp->committed)
@@ -507,7 +525,6 @@ static int arrindex;
 
 #define GROUP_MAX 256           /* we won't _realistically_ have more
                                  * than this many segs in a group */
-#define EXT_BLKSIZ 256          /* block size for externals list */
 
 struct Segment;                 /* need to know these structs exist */
 struct Group;
@@ -564,11 +581,6 @@ static struct External {
 
 static int externals;
 
-static struct ExtBack {
-    struct ExtBack *next;
-    struct External *exts[EXT_BLKSIZ];
-} *ebhead, **ebtail;
-
 static struct Segment {
     struct Segment *next;
     char *name;
@@ -603,6 +615,48 @@ static struct Group {
     } segs[GROUP_MAX];          /* ...in this */
 } *grphead, **grptail, *obj_grp_needs_update;
 
+/*
+ * Segments, groups and externals by NASM segment number (shifted
+ * right by one, so the segment-base number maps to the same slot),
+ * and segments and groups by name.
+ */
+static struct RAA *obj_segs, *obj_grps, *obj_exts;
+static struct hash_table obj_seg_names, obj_grp_names;
+static int obj_nsegs, obj_ngrps;
+
+static struct Segment *obj_find_seg(int32_t segment)
+{
+    if (segment < 0 || (segment & 1))
+        return NULL;
+    return raa_read_ptr(obj_segs, segment >> 1);
+}
+
+static struct Group *obj_find_grp(int32_t segment)
+{
+    if (segment < 0 || (segment & 1))
+        return NULL;
+    return raa_read_ptr(obj_grps, segment >> 1);
+}
+
+static struct External *obj_find_ext(int32_t segment)
+{
+    if (segment < 0)
+        return NULL;
+    return raa_read_ptr(obj_exts, segment >> 1);
+}
+
+static struct Segment *obj_find_seg_name(const char *name)
+{
+    void **sp = hash_find(&obj_seg_names, name, NULL);
+    return sp ? *sp : NULL;
+}
+
+static struct Group *obj_find_grp_name(const char *name)
+{
+    void **gp = hash_find(&obj_grp_names, name, NULL);
+    return gp ? *gp : NULL;
+}
+
 static struct ImpDef {
     struct ImpDef *next;
     char *extname;
@@ -651,12 +705,12 @@ static void obj_init(void)
     exptail = &exphead;
     dws = NULL;
     externals = 0;
-    ebhead = NULL;
-    ebtail = &ebhead;
     seghead = obj_seg_needs_update = NULL;
     segtail = &seghead;
     grphead = obj_grp_needs_update = NULL;
     grptail = &grphead;
+    obj_segs = obj_grps = obj_exts = raa_init();
+    obj_nsegs = obj_ngrps = 0;
     obj_entry_seg = NO_SEG;
     obj_uppercase = false;
     obj_use32 = false;
@@ -707,16 +761,16 @@ static void obj_cleanup(void)
         nasm_free(exptmp->intname);
         nasm_free(exptmp);
     }
-    while (ebhead) {
-        struct ExtBack *ebtmp = ebhead;
-        ebhead = ebhead->next;
-        nasm_free(ebtmp);
-    }
     while (grphead) {
         struct Group *grptmp = grphead;
         grphead = grphead->next;
         nasm_free(grptmp);
     }
+    raa_free(obj_segs);
+    raa_free(obj_grps);
+    raa_free(obj_exts);
+    hash_free(&obj_seg_names);
+    hash_free(&obj_grp_names);
 }
 
 static void obj_ext_set_defwrt(struct External *ext, char *id)
@@ -724,21 +778,21 @@ static void obj_ext_set_defwrt(struct External *ext, char *id)
     struct Segment *seg;
     struct Group *grp;
 
-    for (seg = seghead; seg; seg = seg->next)
-        if (!strcmp(seg->name, id)) {
-            ext->defwrt_type = DEFWRT_SEGMENT;
-            ext->defwrt_ptr.seg = seg;
-            nasm_free(id);
-            return;
-        }
+    seg = obj_find_seg_name(id);
+    if (seg) {
+        ext->defwrt_type = DEFWRT_SEGMENT;
+        ext->defwrt_ptr.seg = seg;
+        nasm_free(id);
+        return;
+    }
 
-    for (grp = grphead; grp; grp = grp->next)
-        if (!strcmp(grp->name, id)) {
-            ext->defwrt_type = DEFWRT_GROUP;
-            ext->defwrt_ptr.grp = grp;
-            nasm_free(id);
-            return;
-        }
+    grp = obj_find_grp_name(id);
+    if (grp) {
+        ext->defwrt_type = DEFWRT_GROUP;
+        ext->defwrt_ptr.grp = grp;
+        nasm_free(id);
+        return;
+    }
 
     ext->defwrt_type = DEFWRT_STRING;
     ext->defwrt_ptr.string = id;
@@ -766,9 +820,7 @@ static void obj_deflabel(char *name, int32_t segment,
      * segment number to the external index.
      */
     struct External *ext;
-    struct ExtBack *eb;
     struct Segment *seg;
-    int i;
     bool used_special = false;   /* have we used the special text? */
 
     if (debug_level(2))
@@ -838,23 +890,23 @@ static void obj_deflabel(char *name, int32_t segment,
             nasm_panic("strange segment conditions in OBJ driver");
     }
 
-    for (seg = seghead; seg && is_global; seg = seg->next)
-        if (seg->index == segment) {
-            struct Public *loc = nasm_malloc(sizeof(*loc));
-            /*
-             * Case (ii). Maybe MODPUB someday?
-             */
-            *seg->pubtail = loc;
-            seg->pubtail = &loc->next;
-            loc->next = NULL;
-            loc->name = nasm_strdup(name);
-            loc->offset = offset;
-
-            if (special)
-                nasm_nonfatal("OBJ supports no special symbol features"
-                              " for this symbol type");
-            return;
-        }
+    seg = is_global ? obj_find_seg(segment) : NULL;
+    if (seg) {
+        struct Public *loc = nasm_malloc(sizeof(*loc));
+        /*
+         * Case (ii). Maybe MODPUB someday?
+         */
+        *seg->pubtail = loc;
+        seg->pubtail = &loc->next;
+        loc->next = NULL;
+        loc->name = nasm_strdup(name);
+        loc->offset = offset;
+
+        if (special)
+            nasm_nonfatal("OBJ supports no special symbol features"
+                          " for this symbol type");
+        return;
+    }
 
     /*
      * Case (iii).
@@ -981,24 +1033,7 @@ static void obj_deflabel(char *name, int32_t segment,
         }
     }
 
-    i = segment / 2;
-    eb = ebhead;
-    if (!eb) {
-        eb = *ebtail = nasm_zalloc(sizeof(*eb));
-        eb->next = NULL;
-        ebtail = &eb->next;
-    }
-    while (i >= EXT_BLKSIZ) {
-        if (eb && eb->next)
-            eb = eb->next;
-        else {
-            eb = *ebtail = nasm_zalloc(sizeof(*eb));
-            eb->next = NULL;
-            ebtail = &eb->next;
-        }
-        i -= EXT_BLKSIZ;
-    }
-    eb->exts[i] = ext;
+    obj_exts = raa_write_ptr(obj_exts, segment >> 1, ext);
     ext->index = ++externals;
 
     if (special && !used_special)
@@ -1033,9 +1068,7 @@ static void obj_out(int32_t segto, const void *data,
     /*
      * Find the segment we are targetting.
      */
-    for (seg = seghead; seg; seg = seg->next)
-        if (seg->index == segto)
-            break;
+    seg = obj_find_seg(segto);
     if (!seg)
         nasm_panic("code directed to nonexistent segment?");
 
@@ -1226,29 +1259,17 @@ static void obj_write_fixup(ObjRecord * orp, int bytes,
      * See if we can find the segment ID in our segment list. If
      * so, we have a T4 (LSEG) target.
      */
-    for (s = seghead; s; s = s->next)
-        if (s->index == seg)
-            break;
+    s = obj_find_seg(seg);
     if (s)
         method = 4, tidx = s->obj_index;
     else {
-        for (g = grphead; g; g = g->next)
-            if (g->index == seg)
-                break;
+        g = obj_find_grp(seg);
         if (g)
             method = 5, tidx = g->obj_index;
         else {
-            int32_t i = seg / 2;
-            struct ExtBack *eb = ebhead;
-            while (i >= EXT_BLKSIZ) {
-                if (eb)
-                    eb = eb->next;
-                else
-                    break;
-                i -= EXT_BLKSIZ;
-            }
-            if (eb)
-                method = 6, e = eb->exts[i], tidx = e->index;
+            e = obj_find_ext(seg);
+            if (e)
+                method = 6, tidx = e->index;
             else
                 nasm_panic("unrecognised segment value in obj_write_fixup");
         }
@@ -1284,29 +1305,17 @@ static void obj_write_fixup(ObjRecord * orp, int bytes,
          * See if we can find the WRT-segment ID in our segment
          * list. If so, we have a F0 (LSEG) frame.
          */
-        for (s = seghead; s; s = s->next)
-            if (s->index == wrt - 1)
-                break;
+        s = obj_find_seg(wrt - 1);
         if (s)
             method |= 0x00, fidx = s->obj_index;
         else {
-            for (g = grphead; g; g = g->next)
-                if (g->index == wrt - 1)
-                    break;
+            g = obj_find_grp(wrt - 1);
             if (g)
                 method |= 0x10, fidx = g->obj_index;
             else {
-                int32_t i = wrt / 2;
-                struct ExtBack *eb = ebhead;
-                while (i >= EXT_BLKSIZ) {
-                    if (eb)
-                        eb = eb->next;
-                    else
-                        break;
-                    i -= EXT_BLKSIZ;
-                }
-                if (eb)
-                    method |= 0x20, fidx = eb->exts[i]->index;
+                struct External *we = obj_find_ext(wrt);
+                if (we)
+                    method |= 0x20, fidx = we->index;
                 else
                     nasm_panic("unrecognised WRT value in obj_write_fixup");
             }
@@ -1340,6 +1349,7 @@ static int32_t obj_segment(char *name, int *bits)
         struct Segment *seg;
         struct Group *grp;
         struct External **extp;
+        struct hash_insert hi;
         int obj_idx, i, attrs;
 	bool rn_error;
         char *p;
@@ -1370,24 +1380,21 @@ static int32_t obj_segment(char *name, int *bits)
             attrs++;
         }
 
-        for (seg = seghead, obj_idx = 1; ; seg = seg->next, obj_idx++) {
-            if (!seg)
-                break;
-
-            if (!strcmp(seg->name, name)) {
-                if (attrs > 0 && seg->pass_last_seen == pass_count())
-                    nasm_warn(WARN_OTHER, "segment attributes specified on"
-                              " redeclaration of segment: ignoring");
-                if (seg->use32)
-                    *bits = 32;
-                else
-                    *bits = 16;
-                current_seg = seg;
-                seg->pass_last_seen = pass_count();
-                return seg->index;
-            }
+        seg = obj_find_seg_name(name);
+        if (seg) {
+            if (attrs > 0 && seg->pass_last_seen == pass_count())
+                nasm_warn(WARN_OTHER, "segment attributes specified on"
+                          " redeclaration of segment: ignoring");
+            if (seg->use32)
+                *bits = 32;
+            else
+                *bits = 16;
+            current_seg = seg;
+            seg->pass_last_seen = pass_count();
+            return seg->index;
         }
 
+        obj_idx = ++obj_nsegs;
         *segtail = seg = nasm_malloc(sizeof(*seg));
         seg->next = NULL;
         segtail = &seg->next;
@@ -1447,15 +1454,10 @@ static int32_t obj_segment(char *name, int *bits)
                  * already exist; then we must set the default
                  * group of this segment to be the FLAT group.
                  */
-                struct Group *grp;
-                for (grp = grphead; grp; grp = grp->next)
-                    if (!strcmp(grp->name, "FLAT"))
-                        break;
+                struct Group *grp = obj_find_grp_name("FLAT");
                 if (!grp) {
                     obj_directive(D_GROUP, "FLAT");
-                    for (grp = grphead; grp; grp = grp->next)
-                        if (!strcmp(grp->name, "FLAT"))
-                            break;
+                    grp = obj_find_grp_name("FLAT");
                     if (!grp)
                         nasm_panic("failure to define FLAT?!");
                 }
@@ -1521,6 +1523,11 @@ static int32_t obj_segment(char *name, int *bits)
             define_label(name, seg->index + 1, 0L, false);
         obj_seg_needs_update = NULL;
 
+        /* The name is final now that the label has been defined */
+        obj_segs = raa_write_ptr(obj_segs, seg->index >> 1, seg);
+        hash_find(&obj_seg_names, seg->name, &hi);
+        hash_add(&hi, seg->name, seg);
+
         /*
          * See if this segment is defined in any groups.
          */
@@ -1577,6 +1584,7 @@ obj_directive(enum directive directive, char *value)
             struct Group *grp;
             struct Segment *seg;
             struct External **extp;
+            struct hash_insert hi;
             int obj_idx;
 
             q = value;
@@ -1602,15 +1610,12 @@ obj_directive(enum directive directive, char *value)
              * }
              */
 
-            obj_idx = 1;
-            for (grp = grphead; grp; grp = grp->next) {
-                obj_idx++;
-                if (!strcmp(grp->name, v)) {
-                    nasm_nonfatal("group `%s' defined twice", v);
-                    return DIRR_ERROR;
-                }
+            if (obj_find_grp_name(v)) {
+                nasm_nonfatal("group `%s' defined twice", v);
+                return DIRR_ERROR;
             }
 
+            obj_idx = ++obj_ngrps;
             *grptail = grp = nasm_malloc(sizeof(*grp));
             grp->next = NULL;
             grptail = &grp->next;
@@ -1623,6 +1628,12 @@ obj_directive(enum directive directive, char *value)
             backend_label(v, grp->index + 1, 0L);
             obj_grp_needs_update = NULL;
 
+            obj_grps = raa_write_ptr(obj_grps, grp->index >> 1, grp);
+            if (grp->name) {
+                hash_find(&obj_grp_names, grp->name, &hi);
+                hash_add(&hi, grp->name, grp);
+            }
+
             while (*q) {
                 p = q;
                 while (*q && !nasm_isspace(*q))
@@ -1635,9 +1646,7 @@ obj_directive(enum directive directive, char *value)
                 /*
                  * Now p contains a segment name. Find it.
                  */
-                for (seg = seghead; seg; seg = seg->next)
-                    if (!strcmp(seg->name, p))
-                        break;
+                seg = obj_find_seg_name(p);
                 if (seg) {
                     /*
                      * We have a segment index. Shift a name entry
@@ -1813,12 +1822,7 @@ obj_directive(enum directive directive, char *value)
 
 static void obj_sectalign(int32_t seg, unsigned int value)
 {
-    struct Segment *s;
-
-    list_for_each(s, seghead) {
-        if (s->index == seg)
-            break;
-    }
+    struct Segment *s = obj_find_seg(seg);
 
     /*
      * it should not be too big value
@@ -1861,33 +1865,15 @@ static int32_t obj_segbase(int32_t segment)
     /*
      * Find the segment in our list.
      */
-    for (seg = seghead; seg; seg = seg->next)
-        if (seg->index == segment - 1)
-            break;
+    seg = obj_find_seg(segment - 1);
 
     if (!seg) {
         /*
          * Might be an external with a default WRT.
          */
-        int32_t i = segment / 2;
-        struct ExtBack *eb = ebhead;
-        struct External *e;
-
-        while (i >= EXT_BLKSIZ) {
-            if (eb)
-                eb = eb->next;
-            else
-                break;
-            i -= EXT_BLKSIZ;
-        }
-        if (eb) {
-            e = eb->exts[i];
-	    if (!e) {
-                /* Not available yet, probably a forward reference */
-		nasm_assert(!pass_final());
-		return NO_SEG;
-	    }
+        struct External *e = obj_find_ext(segment);
 
+        if (e) {
 	    switch (e->defwrt_type) {
 	    case DEFWRT_NONE:
                 return segment; /* fine */
@@ -2410,24 +2396,47 @@ static void obj_write_file(void)
         obj_byte(orp, 0);
     obj_emit2(orp);
     nasm_free(orp);
+
+    obj_flush();
+}
+
+/*
+ * Finished records are collected here and written out in large
+ * blocks rather than a few bytes at a time.
+ */
+#define OBJ_OUTBUF_SIZE 65536
+
+static uint8_t obj_outbuf[OBJ_OUTBUF_SIZE];
+static size_t obj_outlen;
+
+static void obj_flush(void)
+{
+    nasm_write(obj_outbuf, obj_outlen, ofile);
+    obj_outlen = 0;
 }
 
 static void obj_fwrite(ObjRecord * orp)
 {
     unsigned int cksum, len;
-    uint8_t *ptr;
+    uint8_t *out, *ptr;
+
+    len = orp->committed + 1;
+    if (obj_outlen + len + 3 > OBJ_OUTBUF_SIZE)
+        obj_flush();
+    out = obj_outbuf + obj_outlen;
+    obj_outlen += len + 3;
 
     cksum = orp->type;
     if (orp->x_size == 32)
         cksum |= 1;
-    fputc(cksum, ofile);
-    len = orp->committed + 1;
+    WRITECHAR(out, cksum);
     cksum += (len & 0xFF) + ((len >> 8) & 0xFF);
-    fwriteint16_t(len, ofile);
-    nasm_write(orp->buf, len-1, ofile);
-    for (ptr = orp->buf; --len; ptr++)
+    WRITESHORT(out, len);
+    for (ptr = orp->buf; --len; ptr++) {
         cksum += *ptr;
-    fputc((-cksum) & 0xFF, ofile);
+        *out++ = *ptr;
+    }
+    WRITECHAR(out, (-cksum) & 0xFF);
 }
 
 static enum directive_result
@@ -2506,9 +2515,7 @@ static void dbgbi_linnum(const char *lnfname, int32_t lineno, int32_t segto)
     /*
      * Find the segment we are targetting.
      */
-    for (seg = seghead; seg; seg = seg->next)
-        if (seg->index == segto)
-            break;
+    seg = obj_find_seg(segto);
     if (!seg)
         nasm_panic("lineno directed to nonexistent segment?");
 
@@ -2574,18 +2581,18 @@ static void dbgbi_deflabel(char *name, int32_t segment,
      * call to obj_deflabel so we can skip that.
      */
 
-    for (seg = seghead; seg; seg = seg->next)
-        if (seg->index == segment) {
-            struct Public *loc = nasm_malloc(sizeof(*loc));
-            /*
-             * Case (ii). Maybe MODPUB someday?
-             */
-            last_defined = *seg->loctail = loc;
-            seg->loctail = &loc->next;
-            loc->next = NULL;
-            loc->name = nasm_strdup(name);
-            loc->offset = offset;
-        }
+    seg = obj_find_seg(segment);
+    if (seg) {
+        struct Public *loc = nasm_malloc(sizeof(*loc));
+        /*
+         * Case (ii). Maybe MODPUB someday?
+         */
+        last_defined = *seg->loctail = loc;
+        seg->loctail = &loc->next;
+        loc->next = NULL;
+        loc->name = nasm_strdup(name);
+        loc->offset = offset;
+    }
 }
 static void dbgbi_typevalue(int32_t type)
 {
@@ -485,6 +485,11 @@ struct coff_Section {
     int32_t namepos;            /* Offset of name into the strings table */
     int32_t pos, relpos;
     int64_t pass_last_seen;
+    int number;                 /* COFF section number (1-based) */
+    int comdat_sel;             /* COMDAT selection, 0 if not COMDAT */
+    char *comdat_name;          /* COMDAT symbol, or associated section */
+    int32_t comdat_sym;         /* Index of the COMDAT symbol, or -1 */
+    int32_t comdat_value;       /* Offset of the COMDAT symbol */
 };
 
 struct coff_Reloc {
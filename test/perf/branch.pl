@@ -0,0 +1,62 @@
+#!/usr/bin/perl
+#
+# Time the optimization of a branch-heavy source
+#
+# Usage: branch.pl [--nasm=nasm] [blocks]
+#
+# Generates a 64-bit module with the given number of basic blocks,
+# most of them ending in a conditional or unconditional jump to a
+# nearby block, so that settling the jump sizes takes many steps.
+# Reports how long nasm takes and how many passes it needed.
+#
+
+use strict;
+use File::Temp qw(tempdir);
+use Time::HiRes qw(time);
+
+my $nasm = 'nasm';
+my $blocks = 50000;
+
+foreach my $arg (@ARGV) {
+    if ($arg =~ /^--nasm=(.*)$/) {
+	$nasm = $1;
+    } elsif ($arg =~ /^[0-9]+$/) {
+	$blocks = $arg;
+    } else {
+	die "$0: unknown argument: $arg\n";
+    }
+}
+
+my $dir = tempdir(CLEANUP => 1);
+open(my $out, '>', "$dir/branch.asm") or die "$0: $dir/branch.asm: $!\n";
+
+srand(1);
+print $out "\tbits 64\n";
+print $out "\tsection .text\n";
+for (my $i = 0; $i < $blocks; $i++) {
+    my $t = $i + int(rand(64)) - 16;
+    $t = 0 if ($t < 0);
+    $t = $blocks - 1 if ($t >= $blocks);
+
+    print $out "L$i:\n";
+    my $k = int(rand(8));
+    if ($k < 3) {
+	print $out "\tjz L$t\n";
+    } elsif ($k < 5) {
+	print $out "\tjmp L$t\n";
+    } elsif ($k == 5) {
+	print $out "\tmov rax,[rbx+rcx*8+0x100]\n";
+    } else {
+	print $out "\tadd eax,ebx\n";
+    }
+}
+
+close($out);
+
+my $start = time();
+my $info = `$nasm -Ov -f elf64 -o $dir/branch.o $dir/branch.asm 2>&1`;
+die "$0: $nasm failed\n" if ($?);
+my $secs = time() - $start;
+
+my $passes = ($info =~ /required (\S+) passes/) ? $1 : '?';
+printf "%d blocks in %.3f s, %s passes\n", $blocks, $secs, $passes;
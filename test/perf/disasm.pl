@@ -0,0 +1,112 @@
+#!/usr/bin/perl
+#
+# Measure disassembler throughput on a large x86-64 text section
+#
+# Usage: disasm.pl [--nasm=nasm] [--ndisasm=ndisasm] [instructions]
+#
+# Generates a code-like mix of integer, SSE and AVX instructions,
+# assembles it with nasm -f bin and reports how many bytes per second
+# ndisasm -b 64 gets through.
+#
+
+use strict;
+use File::Temp qw(tempdir);
+use Time::HiRes qw(time);
+
+my $nasm    = 'nasm';
+my $ndisasm = 'ndisasm';
+my $len     = 1000000;
+
+foreach my $arg (@ARGV) {
+    if ($arg =~ /^--nasm=(.*)$/) {
+	$nasm = $1;
+    } elsif ($arg =~ /^--ndisasm=(.*)$/) {
+	$ndisasm = $1;
+    } elsif ($arg =~ /^[0-9]+$/) {
+	$len = $arg;
+    } else {
+	die "$0: unknown argument: $arg\n";
+    }
+}
+
+my @alu  = qw(add sub adc sbb and or xor cmp mov test);
+my @r64  = qw(rax rbx rcx rdx rsi rdi rbp r8 r9 r10 r11 r12 r13 r14 r15);
+my @r32  = qw(eax ebx ecx edx esi edi ebp r8d r9d r10d r11d r12d r13d);
+my @r8   = qw(al bl cl dl sil dil r8b r9b);
+my @sse  = qw(addps addpd addss addsd mulps mulsd subps xorps andpd
+	      movaps movups movdqa movdqu pxor paddd pcmpeqb pshufb);
+my @avx  = qw(vaddps vmulpd vxorps vpaddd vpxor vpand vpcmpeqb vpshufb);
+my @jcc  = qw(jz jnz jc jnc jl jge jle jg js jns ja jbe);
+
+srand(0);
+sub pickone(@) {
+    return $_[int(rand(scalar @_))];
+}
+
+sub mem() {
+    my $m = pickone(@r64);
+    $m .= '+' . pickone(@r64[0..6]) . '*' . pickone(1, 2, 4, 8)
+	if (rand(3) < 1);
+    $m .= '+' . int(rand(256) * 8) if (rand(2) < 1);
+    return "[$m]";
+}
+
+my $dir = tempdir(CLEANUP => 1);
+open(my $out, '>', "$dir/disasm.asm") or die "$0: $dir/disasm.asm: $!\n";
+
+print $out "\tbits 64\n";
+print $out "\n";
+
+for (my $i = 0; $i < $len; $i++) {
+    my $r = rand(32);
+
+    if ($i % 64 == 0) {
+	print $out "l$i:\n";
+    }
+    if ($r < 8) {
+	print $out "\t", pickone(@alu), " ", pickone(@r64), ",",
+	    pickone(@r64), "\n";
+    } elsif ($r < 12) {
+	print $out "\t", pickone(@alu), " ", pickone(@r32), ",", mem(), "\n";
+    } elsif ($r < 15) {
+	print $out "\tmov ", mem(), ",", pickone(@r64), "\n";
+    } elsif ($r < 17) {
+	print $out "\t", pickone(@alu), " dword ", mem(), ",",
+	    int(rand(1000)), "\n";
+    } elsif ($r < 18) {
+	print $out "\tmovzx ", pickone(@r32), ",", pickone(@r8), "\n";
+    } elsif ($r < 20) {
+	print $out "\tlea ", pickone(@r64), ",", mem(), "\n";
+    } elsif ($r < 21) {
+	print $out "\t", pickone(qw(push pop)), " ", pickone(@r64), "\n";
+    } elsif ($r < 22) {
+	print $out "\tcall l", int($i / 64) * 64, "\n";
+    } elsif ($r < 24) {
+	print $out "\t", pickone(@jcc), " l", int($i / 64) * 64, "\n";
+    } elsif ($r < 26) {
+	print $out "\t", pickone(qw(shl shr sar rol)), " ",
+	    pickone(@r32), ",", int(rand(31)) + 1, "\n";
+    } elsif ($r < 29) {
+	print $out "\t", pickone(@sse), " xmm", int(rand(16)), ",",
+	    (rand(2) < 1 ? 'xmm' . int(rand(16)) : mem()), "\n";
+    } elsif ($r < 31) {
+	print $out "\t", pickone(@avx), " ymm", int(rand(16)), ",ymm",
+	    int(rand(16)), ",", (rand(2) < 1 ? 'ymm' . int(rand(16)) : mem()),
+	    "\n";
+    } else {
+	print $out "\t", pickone(qw(ret nop cdq cqo leave)), "\n";
+    }
+}
+
+close($out);
+
+system($nasm, '-f', 'bin', '-o', "$dir/disasm.bin", "$dir/disasm.asm") == 0
+    or die "$0: $nasm failed\n";
+
+my $bytes = -s "$dir/disasm.bin";
+my $start = time();
+system("$ndisasm -b 64 $dir/disasm.bin > $dir/disasm.out") == 0
+    or die "$0: $ndisasm failed\n";
+my $secs = time() - $start;
+
+printf "%d bytes in %.3f s: %.0f bytes/s\n", $bytes, $secs, $bytes / $secs;
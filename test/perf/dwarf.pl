@@ -0,0 +1,109 @@
+#!/usr/bin/perl
+#
+# Time and check DWARF line number generation
+#
+# Usage: dwarf.pl [--nasm=nasm] [--ref=nasm] [lines [sections]]
+#
+# First checks that nasm still produces the travis/test/dwarf-elf*.o.t
+# goldens; run it from the top of the source tree for that.  Then
+# generates a 64-bit module with the given number of instructions
+# spread over a number of sections, with runs of "times" lines, and
+# reports how long nasm takes with and without -g -F dwarf.  With
+# --ref, the same is done with the reference nasm, and the decoded
+# line tables of the two are compared with objdump.
+#
+
+use strict;
+use File::Temp qw(tempdir);
+use Time::HiRes qw(time);
+
+my $nasm = 'nasm';
+my $ref;
+my @nums;
+
+foreach my $arg (@ARGV) {
+    if ($arg =~ /^--nasm=(.*)$/) {
+	$nasm = $1;
+    } elsif ($arg =~ /^--ref=(.*)$/) {
+	$ref = $1;
+    } elsif ($arg =~ /^[0-9]+$/) {
+	push(@nums, $arg);
+    } else {
+	die "$0: unknown argument: $arg\n";
+    }
+}
+
+my $len = $nums[0] || 1000000;
+my $nsect = $nums[1] || 16;
+
+my $dir = tempdir(CLEANUP => 1);
+
+my $golden = './travis/test/dwarf.asm';
+if (-f $golden) {
+    local $ENV{'NASM_TEST_RUN'} = 'y';    # As the goldens were made
+    foreach my $fmt (qw(elf32 elf64)) {
+	my $out = "$dir/dwarf-$fmt.o";
+	system($nasm, '-f', $fmt, '-g', '-F', 'dwarf', '-o', $out, $golden) == 0
+	    or die "$0: $nasm failed on $golden\n";
+	system('cmp', '-s', $out, "./travis/test/dwarf-$fmt.o.t") == 0
+	    or die "$0: $fmt output differs from travis/test/dwarf-$fmt.o.t\n";
+    }
+    print "travis/test/dwarf-elf32.o.t and dwarf-elf64.o.t match\n";
+} else {
+    print "$golden not found, golden check skipped\n";
+}
+
+my @insns = qw(add sub adc sbb and or xor mov);
+my @regs  = qw(rax rbx rcx rdx rsi rdi r8 r9);
+
+srand(0);
+sub pickone(@) {
+    return $_[int(rand(scalar @_))];
+}
+
+open(my $out, '>', "$dir/dwarf.asm") or die "$0: $dir/dwarf.asm: $!\n";
+print $out "\tbits 64\n\n";
+for (my $i = 0; $i < $len; $i++) {
+    if ($i % int($len/$nsect + 1) == 0) {
+	print $out "\tsection .text.", $i, " exec\n";
+    }
+    if (rand(8) < 1) {
+	print $out "\ttimes ", int(rand(64)), " nop\n";
+    }
+    print $out "\t", pickone(@insns), " ",
+        pickone(@regs), ",", pickone(@regs), "\n";
+}
+close($out);
+
+sub run($$@) {
+    my($prog, $obj, @opts) = @_;
+    my $start = time();
+    system($prog, '-f', 'elf64', @opts, '-o', "$dir/$obj", "$dir/dwarf.asm") == 0
+	or die "$0: $prog failed\n";
+    return time() - $start;
+}
+
+sub lines($) {
+    my($obj) = @_;
+    my $lines = `objdump --dwarf=decodedline $dir/$obj`;
+    die "$0: objdump failed on $obj\n" if ($?);
+    $lines =~ s/^.*?:\s+file format.*?\n//s;
+    return $lines;
+}
+
+my $plain = run($nasm, 'plain.o');
+my $debug = run($nasm, 'debug.o', '-g', '-F', 'dwarf');
+printf "%-12s %d lines: %.3f s plain, %.3f s with -g (%.2fx)\n",
+    'nasm', $len, $plain, $debug, $debug / $plain;
+
+if (defined($ref)) {
+    my $rplain = run($ref, 'rplain.o');
+    my $rdebug = run($ref, 'rdebug.o', '-g', '-F', 'dwarf');
+    printf "%-12s %d lines: %.3f s plain, %.3f s with -g (%.2fx)\n",
+	'reference', $len, $rplain, $rdebug, $rdebug / $rplain;
+    printf "-g takes %.2fx the time of the reference\n", $debug / $rdebug;
+
+    lines('debug.o') eq lines('rdebug.o')
+	or die "$0: the line tables differ from those of the reference\n";
+    print "line tables match the reference\n";
+}
@@ -0,0 +1,57 @@
+#!/usr/bin/perl
+#
+# Compare IEEE-695 and ELF output on a symbol-heavy source
+#
+# Usage: ieee.pl [--nasm=nasm] [symbols]
+#
+# Generates a 32-bit module with the given number of public labels
+# and as many external references, split over a few sections, and
+# reports how long nasm takes to write it with -f ieee and -f elf32.
+#
+
+use strict;
+use File::Temp qw(tempdir);
+use Time::HiRes qw(time);
+
+my $nasm = 'nasm';
+my $syms = 100000;
+
+foreach my $arg (@ARGV) {
+    if ($arg =~ /^--nasm=(.*)$/) {
+	$nasm = $1;
+    } elsif ($arg =~ /^[0-9]+$/) {
+	$syms = $arg;
+    } else {
+	die "$0: unknown argument: $arg\n";
+    }
+}
+
+my @sects = qw(code data const bss2);
+
+my $dir = tempdir(CLEANUP => 1);
+open(my $out, '>', "$dir/ieee.asm") or die "$0: $dir/ieee.asm: $!\n";
+
+print $out "\tbits 32\n";
+for (my $i = 0; $i < $syms; $i++) {
+    my $s = $sects[$i % scalar(@sects)];
+
+    print $out "\tsection $s\n" if ($i % 256 == 0 || $i < scalar(@sects));
+    print $out "\tglobal pub$i\n";
+    print $out "\textern ext$i\n";
+    print $out "pub$i:\n";
+    print $out "\tmov eax,[ext$i]\n";
+    print $out "\tdd pub$i, ext$i\n";
+    print $out "\tsection code\n" if ($i % 256 == 255);
+}
+
+close($out);
+
+foreach my $fmt (qw(ieee elf32)) {
+    my $start = time();
+    system($nasm, '-f', $fmt, '-o', "$dir/ieee.$fmt", "$dir/ieee.asm") == 0
+	or die "$0: $nasm -f $fmt failed\n";
+    my $secs = time() - $start;
+
+    printf "%-6s %d symbols in %.3f s: %.0f symbols/s\n",
+	$fmt, $syms, $secs, $syms / $secs;
+}
@@ -0,0 +1,144 @@
+#!/usr/bin/perl
+#
+# Time assembling a set of files without and with --cache
+#
+# Usage: outcache.pl [--nasm=nasm] [files]
+#
+# Generates the given number of modules sharing an include file and
+# assembles them without a cache, with an empty one, and then again
+# with the cache filled after touching every source, the way a fresh
+# checkout would.  Checks that the outputs are all the same, and that
+# changing the include file is noticed, and reports how long each
+# round took.  Then checks that environment variables, files which
+# would now be found earlier on the include path and the date and
+# time macros are all noticed.
+#
+
+use strict;
+use File::Temp qw(tempdir);
+use Time::HiRes qw(time);
+
+my $nasm = 'nasm';
+my $files = 200;
+
+foreach my $arg (@ARGV) {
+    if ($arg =~ /^--nasm=(.*)$/) {
+	$nasm = $1;
+    } elsif ($arg =~ /^[0-9]+$/) {
+	$files = $arg;
+    } else {
+	die "$0: unknown argument: $arg\n";
+    }
+}
+
+my $dir = tempdir(CLEANUP => 1);
+my $cache = "$dir/cache";
+mkdir($cache) or die "$0: $cache: $!\n";
+
+sub write_inc($) {
+    my($val) = @_;
+    open(my $inc, '>', "$dir/common.inc") or die "$0: $dir/common.inc: $!\n";
+    print $inc "%define MAGIC $val\n";
+    print $inc "%macro entry 1\n";
+    print $inc "\tglobal %1\n%1:\n\tpush rbp\n\tmov rbp,rsp\n";
+    print $inc "%endmacro\n";
+    close($inc);
+}
+
+write_inc(1);
+for (my $i = 0; $i < $files; $i++) {
+    open(my $out, '>', "$dir/m$i.asm") or die "$0: $dir/m$i.asm: $!\n";
+    print $out "%include \"common.inc\"\n";
+    print $out "\tbits 64\n\tsection .text\n";
+    print $out "entry func$i\n";
+    print $out "%assign n 0\n%rep 500\n\tmov eax,n+MAGIC\n\tadd ebx,eax\n";
+    print $out "%assign n n+$i\n%endrep\n\tleave\n\tret\n";
+    close($out);
+}
+
+sub run_all($$) {
+    my($options, $suffix) = @_;
+    my $start = time();
+
+    for (my $i = 0; $i < $files; $i++) {
+	system("$nasm $options -f elf64 -I$dir/ -o $dir/m$i.$suffix $dir/m$i.asm") == 0
+	    or die "$0: $nasm failed on m$i.asm\n";
+    }
+    return time() - $start;
+}
+
+sub compare($$) {
+    my($a, $b) = @_;
+    for (my $i = 0; $i < $files; $i++) {
+	system("cmp -s $dir/m$i.$a $dir/m$i.$b") == 0
+	    or die "$0: outputs differ for m$i.asm\n";
+    }
+}
+
+my $plain = run_all('', 'o');
+my $cold = run_all("--cache $cache", 'co');
+utime(undef, undef, map { "$dir/m$_.asm" } (0..$files-1));
+my $warm = run_all("--cache $cache", 'wo');
+
+compare('o', 'co');
+compare('o', 'wo');
+
+write_inc(2);
+run_all("--cache $cache", 'xo');
+system("cmp -s $dir/m0.o $dir/m0.xo") != 0
+    or die "$0: change to the include file not noticed\n";
+
+printf "%d files: %.3f s without a cache, %.3f s filling it, %.3f s from it\n",
+    $files, $plain, $cold, $warm;
+
+# Assemble one file with the cache, and return the output
+sub one($$$) {
+    my($options, $name, $text) = @_;
+    open(my $out, '>', "$dir/$name.asm") or die "$0: $dir/$name.asm: $!\n";
+    print $out $text;
+    close($out);
+    system("$nasm --cache $cache $options -o $dir/$name.bin $dir/$name.asm") == 0
+	or die "$0: $nasm failed on $name.asm\n";
+    open(my $in, '<', "$dir/$name.bin") or die "$0: $dir/$name.bin: $!\n";
+    local $/;
+    my $data = <$in>;
+    close($in);
+    return $data;
+}
+
+my $envsrc = "%defstr E %!OUTCACHE_TEST\n%ifenv OUTCACHE_SET\ndb 1\n%endif\ndb E\n";
+$ENV{'OUTCACHE_TEST'} = 'one';
+one('', 'env', $envsrc) eq 'one'
+    or die "$0: wrong output for %!\n";
+$ENV{'OUTCACHE_TEST'} = 'two';
+one('', 'env', $envsrc) eq 'two'
+    or die "$0: change to an environment variable not noticed\n";
+$ENV{'OUTCACHE_SET'} = '';
+one('', 'env', $envsrc) eq "\001two"
+    or die "$0: new environment variable for %ifenv not noticed\n";
+delete $ENV{'OUTCACHE_SET'};
+delete $ENV{'OUTCACHE_TEST'};
+
+mkdir("$dir/first") or die "$0: $dir/first: $!\n";
+my $incsrc = "%include \"common.inc\"\ndb MAGIC\n";
+one("-I$dir/first/ -I$dir/", 'inc', $incsrc) eq "\002"
+    or die "$0: wrong output for the include path\n";
+open(my $inc, '>', "$dir/first/common.inc") or die "$0: $dir/first/common.inc: $!\n";
+print $inc "%define MAGIC 3\n";
+close($inc);
+one("-I$dir/first/ -I$dir/", 'inc', $incsrc) eq "\003"
+    or die "$0: file earlier on the include path not noticed\n";
+
+sub cached() {
+    opendir(my $dh, $cache) or die "$0: $cache: $!\n";
+    my @files = grep { !/^\./ } readdir($dh);
+    closedir($dh);
+    return scalar(@files);
+}
+
+my $before = cached();
+one('', 'dated', "dd __?POSIX_TIME?__\n");
+cached() == $before
+    or die "$0: output using the time was cached\n";
+
+print "environment, include path and time checks passed\n";
@@ -0,0 +1,84 @@
+#!/usr/bin/perl
+#
+# Time assembling many small files one invocation at a time, with and
+# without a server started with --server
+#
+# Usage: server.pl [--nasm=nasm] [files]
+#
+# Generates the given number of small modules sharing an include file,
+# assembles each with a separate nasm, and then again with separate
+# "nasm --connect" clients of one server.  Checks that the outputs are
+# the same and reports how long each took.
+#
+
+use strict;
+use File::Temp qw(tempdir);
+use Time::HiRes qw(time sleep);
+
+my $nasm = 'nasm';
+my $files = 500;
+
+foreach my $arg (@ARGV) {
+    if ($arg =~ /^--nasm=(.*)$/) {
+	$nasm = $1;
+    } elsif ($arg =~ /^[0-9]+$/) {
+	$files = $arg;
+    } else {
+	die "$0: unknown argument: $arg\n";
+    }
+}
+
+my $dir = tempdir(CLEANUP => 1);
+my $sock = "$dir/nasm.sock";
+
+open(my $inc, '>', "$dir/common.inc") or die "$0: $dir/common.inc: $!\n";
+print $inc "%macro entry 1\n";
+print $inc "\tglobal %1\n%1:\n\tpush rbp\n\tmov rbp,rsp\n";
+print $inc "%endmacro\n";
+close($inc);
+
+for (my $i = 0; $i < $files; $i++) {
+    open(my $out, '>', "$dir/m$i.asm") or die "$0: $dir/m$i.asm: $!\n";
+    print $out "%include \"common.inc\"\n";
+    print $out "\tbits 64\n\tsection .text\n";
+    print $out "entry func$i\n\tmov eax,$i\n\tleave\n\tret\n";
+    close($out);
+}
+
+sub run_all($$) {
+    my($prefix, $suffix) = @_;
+    my $start = time();
+
+    for (my $i = 0; $i < $files; $i++) {
+	system("$nasm $prefix -f elf64 -I$dir/ -o $dir/m$i.$suffix $dir/m$i.asm") == 0
+	    or die "$0: $nasm failed on m$i.asm\n";
+    }
+    return time() - $start;
+}
+
+my $direct = run_all('', 'o');
+
+my $pid = fork();
+die "$0: fork: $!\n" unless (defined($pid));
+if (!$pid) {
+    # With the clients' options, so they can use the prelude it runs
+    exec($nasm, '-f', 'elf64', "-I$dir/", '--server', $sock)
+	or die "$0: $nasm: $!\n";
+}
+for (my $i = 0; $i < 100 && ! -S $sock; $i++) {
+    sleep(0.05);
+}
+die "$0: server did not start\n" unless (-S $sock);
+
+my $served = run_all("--connect $sock", 'so');
+
+kill('TERM', $pid);
+waitpid($pid, 0);
+
+for (my $i = 0; $i < $files; $i++) {
+    system("cmp -s $dir/m$i.o $dir/m$i.so") == 0
+	or die "$0: outputs differ for m$i.asm\n";
+}
+
+printf "%d files: %.3f s separately, %.3f s through a server\n",
+    $files, $direct, $served;
@@ -0,0 +1,188 @@
+#!/usr/bin/perl
+#
+# Check that assembling through a server gives the same results as
+# assembling directly
+#
+# Usage: server.pl [--nasm=nasm]
+#
+# Starts a server with --server and runs a number of assemblies both
+# directly and as "nasm --connect" clients, from another directory
+# than the server's, with options and environment which differ from
+# the server's own.  The output files, the messages and the exit
+# status of each pair must be the same.
+#
+
+use strict;
+use Cwd qw(getcwd abs_path);
+use POSIX qw(:sys_wait_h);
+use File::Temp qw(tempdir);
+use Time::HiRes qw(sleep);
+
+my $nasm = 'nasm';
+
+foreach my $arg (@ARGV) {
+    if ($arg =~ /^--nasm=(.*)$/) {
+	$nasm = $1;
+    } else {
+	die "$0: unknown argument: $arg\n";
+    }
+}
+$nasm = abs_path($nasm) if ($nasm =~ m:/:);
+
+my $dir = tempdir(CLEANUP => 1);
+my $sock = "$dir/nasm.sock";
+my $srvdir = "$dir/server";
+my $cdir = "$dir/client";
+mkdir($srvdir) and mkdir($cdir) and mkdir("$cdir/inc")
+    or die "$0: mkdir: $!\n";
+
+sub put($$) {
+    my($file, $text) = @_;
+    open(my $out, '>', $file) or die "$0: $file: $!\n";
+    print $out $text;
+    close($out);
+}
+
+# Only found through the client's -I, relative to its directory
+put("$cdir/inc/common.inc", "%define COMMON 42\n");
+# The server's pre-include, also given to the direct runs
+put("$srvdir/pre.mac", "%define PRE 'server'\n");
+
+put("$cdir/fmt.asm", <<'EOF');
+	%defstr FMT __?OUTPUT_FORMAT?__
+	%ifdef __?DEBUG_FORMAT?__
+	%defstr DBG __?DEBUG_FORMAT?__
+	%else
+	%define DBG 'none'
+	%endif
+	section .data
+	db FMT, 0, DBG, 0, PRE, 0
+	%ifdef EXTRA
+	db EXTRA
+	%endif
+EOF
+put("$cdir/inc.asm", <<'EOF');
+	%include "common.inc"
+	%ifenv %!CLIENTVAR
+	db %!CLIENTVAR
+	%endif
+	dd COMMON
+EOF
+put("$cdir/err.asm", "\tdb 1\n\tnonsense eax\n");
+
+# Name, options, environment
+my @cases = (
+    [ 'bin',    [ 'fmt.asm', '-o', 'fmt.bin' ] ],
+    [ 'elf64',  [ '-f', 'elf64', 'fmt.asm', '-o', 'fmt.o' ] ],
+    [ 'dwarf',  [ '-f', 'elf32', '-g', 'fmt.asm', '-o', 'fmtg.o' ] ],
+    [ 'define', [ '-DEXTRA=7', 'fmt.asm', '-o', 'fmtd.bin' ] ],
+    [ 'incdir', [ '-Iinc/', 'inc.asm', '-o', 'inc.bin' ] ],
+    [ 'env',    [ '-Iinc/', 'inc.asm', '-o', 'incenv.bin' ],
+      { 'CLIENTVAR' => "'x'" } ],
+    [ 'nasmenv', [ 'fmt.asm', '-o', 'fmtenv.bin' ],
+      { 'NASMENV' => '-DEXTRA=9' } ],
+    [ 'error',  [ 'err.asm', '-o', 'err.bin' ] ],
+    [ 'list',   [ '-f', 'elf64', 'fmt.asm', '-o', 'fmtl.o', '-l', 'fmt.lst' ] ],
+);
+
+# Run nasm in the client directory; returns the exit status and messages
+sub run($@) {
+    my($env, @cmd) = @_;
+    my $here = getcwd();
+    local %ENV = %ENV;
+
+    delete $ENV{'NASMENV'};
+    delete $ENV{'CLIENTVAR'};
+    $ENV{$_} = $env->{$_} foreach (keys(%$env));
+
+    chdir($cdir) or die "$0: $cdir: $!\n";
+    my $msgs = `$nasm @cmd 2>&1`;
+    my $status = $? >> 8;
+    chdir($here) or die "$0: $here: $!\n";
+
+    return ($status, $msgs);
+}
+
+sub slurp($) {
+    my($file) = @_;
+    open(my $in, '<', $file) or return undef;
+    binmode($in);
+    local $/;
+    my $data = <$in>;
+    close($in);
+    return $data;
+}
+
+my @direct;
+foreach my $c (@cases) {
+    my($name, $opts, $env) = @$c;
+    my @res = run($env, '-P', "$srvdir/pre.mac", @$opts);
+    my @outs;
+    for (my $i = 0; $i < @$opts; $i++) {
+	if ($opts->[$i] eq '-o' || $opts->[$i] eq '-l') {
+	    my $out = "$cdir/$opts->[$i+1]";
+	    push(@outs, slurp($out));
+	    unlink($out);
+	}
+    }
+    push(@direct, [ @res, @outs ]);
+}
+
+my $pid = fork();
+die "$0: fork: $!\n" unless (defined($pid));
+if (!$pid) {
+    chdir($srvdir) or die "$0: $srvdir: $!\n";
+    exec($nasm, '-P', "$srvdir/pre.mac", '--server', $sock)
+	or die "$0: $nasm: $!\n";
+}
+for (my $i = 0; $i < 100 && ! -S $sock; $i++) {
+    sleep(0.05);
+}
+die "$0: server did not start\n" unless (-S $sock);
+
+my $failed = 0;
+foreach my $c (@cases) {
+    my($name, $opts, $env) = @$c;
+    my @res = run($env, '--connect', $sock, @$opts);
+    my @outs;
+    for (my $i = 0; $i < @$opts; $i++) {
+	if ($opts->[$i] eq '-o' || $opts->[$i] eq '-l') {
+	    push(@outs, slurp("$cdir/$opts->[$i+1]"));
+	}
+    }
+    my $want = shift(@direct);
+    my @got = (@res, @outs);
+    my $ok = (@got == @$want);
+    for (my $i = 0; $ok && $i < @got; $i++) {
+	$ok = (defined($got[$i]) == defined($want->[$i])) &&
+	    (!defined($got[$i]) || $got[$i] eq $want->[$i]);
+    }
+    printf "%-10s %s\n", $name, $ok ? 'ok' : 'FAILED';
+    $failed++ unless ($ok);
+}
+
+# A path which is not a socket is left alone, and the server fails
+put("$dir/notsock", "data\n");
+my $npid = fork();
+die "$0: fork: $!\n" unless (defined($npid));
+if (!$npid) {
+    open(STDERR, '>', '/dev/null');
+    exec($nasm, '--server', "$dir/notsock") or die "$0: $nasm: $!\n";
+}
+my $done = 0;
+for (my $i = 0; $i < 40 && !$done; $i++) {
+    sleep(0.05);
+    $done = (waitpid($npid, WNOHANG) == $npid);
+}
+if (!$done) {
+    kill('TERM', $npid);
+    waitpid($npid, 0);
+}
+my $ok = ($done && $? != 0 && slurp("$dir/notsock") eq "data\n");
+printf "%-10s %s\n", 'notsock', $ok ? 'ok' : 'FAILED';
+$failed++ unless ($ok);
+
+kill('TERM', $pid);
+waitpid($pid, 0);
+
+die "$0: $failed failed\n" if ($failed);
@@ -22,6 +22,10 @@ parser.add_argument('--nasm',
                     dest = 'nasm', default = './nasm',
                     help = 'Nasm executable to use')
 
+parser.add_argument('--ndisasm',
+                    dest = 'ndisasm', default = './ndisasm',
+                    help = 'Ndisasm executable to use')
+
 parser.add_argument('--hexdump',
                     dest = 'hexdump', default = '/usr/bin/hexdump',
                     help = 'Hexdump executable to use')
@@ -272,7 +276,10 @@ def prepare_run_opts(desc):
 
 def exec_nasm(desc):
     print("\tProcessing %s" % (desc['_test-name']))
-    opts = [args.nasm] + prepare_run_opts(desc)
+    if desc.get('program') == 'ndisasm':
+        opts = [args.ndisasm] + prepare_run_opts(desc)
+    else:
+        opts = [args.nasm] + prepare_run_opts(desc)
 
     nasm_env = os.environ.copy()
     nasm_env['NASM_TEST_RUN'] = 'y'
@@ -0,0 +1,14 @@
+;
+; Preprocessed once for each line of batch.lst, each with its own
+; definitions on top of those from the command line.
+;
+%ifdef FIRST
+	db "first", COMMON
+%elifdef SECOND
+	db "second", COMMON
+%elifdef FORMAT
+	%defstr FMT __?OUTPUT_FORMAT?__
+	db FMT, COMMON
+%else
+	db "neither", COMMON
+%endif
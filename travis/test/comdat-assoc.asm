@@ -0,0 +1,3 @@
+	section .text$c code comdat=assoc:.text$nowhere
+	section .text$d code comdat=any:d
+	section .pdata$d rdata comdat=5:.text$d
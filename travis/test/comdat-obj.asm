@@ -0,0 +1,34 @@
+;
+; COMDAT sections with the different selections, a label which moves
+; the COMDAT symbol, and associative .pdata/.xdata sections
+;
+	bits 64
+	default rel
+
+	section .text$foo code comdat=any:foo
+foo:	ret
+
+	section .text$bar code comdat=largest:bar
+	nop
+bar:	ret
+
+	section .text$baz code comdat=nodup:baz
+baz:	xor eax, eax
+	ret
+
+	section .pdata$foo rdata comdat=assoc:.text$foo
+	dd foo wrt ..imagebase
+	dd foo.end wrt ..imagebase
+	dd xfoo wrt ..imagebase
+
+	section .xdata$foo rdata comdat=assoc:.text$foo
+xfoo:	db 1, 0, 0, 0
+
+	section .text$foo
+foo.end:
+
+	section .text code
+	global main
+main:	call foo
+	call bar
+	jmp baz
@@ -0,0 +1,5 @@
+	section .text$a code comdat=bogus:a
+	section .text$b code comdat=any
+	section .text$c code comdat=assoc:.text$nowhere
+	section .text$d code comdat=any:d
+	section .text$d code comdat=largest:d
@@ -0,0 +1,25 @@
+;
+; Runs of constant data elements are stored and emitted as packed
+; byte strings; relocations, relative references and out-of-range
+; values in between must still be handled element by element.
+;
+	bits 64
+	extern ext
+
+	section .data
+start:
+	db 1, 2, 3, -1, 255
+	dw 1, 2, 0x1234, -1
+	dd 1, 2, 3
+	dq 1, -2, 0x123456789abcdef0
+	db 1, 300, 2, 3
+	dd 1, ext, 2, 3
+	dd 1, 2, start - $, 4
+	dq 5, start, 6, 7
+	dw 1, 2, word 3, byte 4, 5
+	dw 2 dup (byte 1, byte 2)
+	dw 2 dup (byte 1)
+	db 3 dup (1, 2, 3), 4
+	db 'abc', 1, 2, 'd', 3
+	dd 1.5, 1, 2
+	times 3 db 9, 8, 7
@@ -0,0 +1,11 @@
+;
+; Test dependency generation (-M): include guards, conditional
+; includes, incbin and %depend.
+;
+%include "depend.inc"
+%include "depend.inc"		; guarded, only scanned once
+%ifdef DEPEND_UNDEFINED
+%include "nonexistent.inc"
+%endif
+	incbin "inc1.asm"
+%depend "depend.dat"
@@ -0,0 +1,23 @@
+	bits 32
+
+	section .text
+start:
+	mov	eax, ebx
+	add	eax, 1
+	times	20 nop		; const_add_pc
+	xor	eax, eax
+	times	300 nop		; advance_pc
+	ret
+
+%line 1000+1 other.asm
+	section .text.other exec
+other:
+	push	ebp
+	mov	ebp, esp
+%line 20+1 other.asm
+	pop	ebp
+	ret
+
+%line 30+1 dwarf.asm
+	section .text
+	jmp	other
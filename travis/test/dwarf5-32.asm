@@ -0,0 +1,25 @@
+;
+; DWARF 5 line tables on elf32: the .debug_line_str offsets must only
+; be in the relocation addends
+;
+	%pragma dwarf version 5
+
+	bits 32
+
+	section .text
+start:
+	mov	eax, ebx
+	add	eax, 1
+%line 100+1 first/include/file.inc
+	times	20 nop
+%line 200+1 second/include/file.inc
+	call	other
+%line 300+1 third/include/file.inc
+	ret
+
+	section .text.other exec
+other:
+	push	ebp
+	mov	ebp, esp
+	pop	ebp
+	ret
@@ -0,0 +1,18 @@
+	%pragma dwarf version 5
+
+	bits 64
+
+	section .text
+start:
+	mov	rax, rbx
+	add	rax, 1
+	times	20 nop
+	call	other
+	ret
+
+	section .text.other exec
+other:
+	push	rbp
+	mov	rbp, rsp
+	pop	rbp
+	ret
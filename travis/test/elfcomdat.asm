@@ -0,0 +1,25 @@
+;
+; ELF COMDAT section groups
+;
+	section .text.foo progbits alloc exec align=16 comdat=foo
+	global foo:function weak
+foo:	mov eax, [rel foo_data]
+	ret
+
+	section .data.foo progbits alloc write comdat=foo
+foo_data:
+	dd 1
+
+	section .text.bar exec comdat=bar_group
+bar:	call foo wrt ..plt
+	ret
+
+	section .text
+	global _start
+_start:	call foo
+	call bar
+	lea rax, [rel bar]
+	ret
+
+	section .data
+	dq foo
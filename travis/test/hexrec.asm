@@ -0,0 +1,13 @@
+;
+; Intel hex and S-record output: records split on 32-byte
+; boundaries, an extended address record at 64K and a section
+; past 16M to force 32-bit S-records.
+;
+	section .text start=0x7fe6
+	mov eax, 0x12345678
+	times 40 db 0x5a
+	section .data start=0xffd0 align=16
+	dd 1, 2, 3, 4
+	times 70 db 0xa5
+	section .high start=0x1000010
+	db 'hex records', 0
@@ -0,0 +1,10 @@
+:1A7FE60066B8785634125A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A47
+:148000005A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A64
+:10FFD0000100000002000000030000000400000017
+:20FFE000A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A561
+:020000040001F9
+:20000000A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A540
+:06002000A5A5A5A5A5A5FC
+:020000040100F9
+:0C001000686578207265636F726473008D
+:00000001FF
@@ -0,0 +1,9 @@
+S0030000FC
+S31F00007FE666B8785634125A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A41
+S319000080005A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5E
+S3150000FFD00100000002000000030000000400000011
+S3250000FFE0A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A55B
+S32500010000A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A5A539
+S30B00010020A5A5A5A5A5A5F5
+S31101000010686578207265636F7264730086
+S70500000000FA
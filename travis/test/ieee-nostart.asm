@@ -0,0 +1,7 @@
+;
+; IEEE-695 output of a module without an entry point
+;
+	global value
+
+	section data
+value:	dd 1, value
@@ -0,0 +1,19 @@
+MBFNASM,1E./travis/test/ieee-nostart.asm.
+CO0,1BThe Netwide Assembler CONST.
+AD8,4,L.
+DT19700101000000.
+CO101,07ENDHEAD.
+CS4C.
+ST1,C,04data.
+SA1,1.
+ASS1,8.
+CS2F.
+NI1,05value.
+ASI1,R1,0,+.
+CS58.
+CO100,06ENDSYM.
+SB1.
+LD01000000.
+LR(R1,0,+,4).
+CS2F.
+ME.
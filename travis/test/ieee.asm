@@ -0,0 +1,23 @@
+;
+; IEEE-695 output: sections switched back and forth, public and
+; external symbols, and address fixups against both, with an entry
+; point given by ..start
+;
+	bits 32
+	extern ext1, ext2
+	global start, table
+
+	section code
+..start:
+start:	mov eax, [table]
+	call ext1
+	jmp done
+
+	section data
+table:	dd start, done, ext2
+	dw 1234h
+	dd table + 4
+
+	section code
+done:	mov eax, ext2
+	ret
@@ -0,0 +1,39 @@
+MBFNASM,16./travis/test/ieee.asm.
+CO0,1BThe Netwide Assembler CONST.
+AD8,4,L.
+DT19700101000000.
+CO101,07ENDHEAD.
+CS05.
+ST1,C,04code.
+SA1,1.
+ASS1,12.
+ST2,C,04data.
+SA2,1.
+ASS2,12.
+ASG,R1,0,+.
+CS0D.
+NI1,05start.
+ASI1,R1,0,+.
+NI2,05table.
+ASI2,R2,0,+.
+NX1,04ext1.
+NX2,04ext2.
+CS49.
+CO100,06ENDSYM.
+SB1.
+LDA1.
+LR(R2,0,+,4).
+LDE8.
+LR(X1,P,-,4,-,4).
+LDEB00B8.
+LR(X2,4).
+LDC3.
+CS4A.
+SB2.
+LR(R1,0,+,4).
+LR(R1,C,+,4).
+LR(X2,4).
+LD3412.
+LR(R2,4,+,4).
+CS4B.
+ME.
@@ -0,0 +1,42 @@
+;
+; The parser takes identifiers and numbers as the preprocessor split
+; them up, except where the text would lex differently on its own.
+;
+	bits 32
+
+%define cat(a,b) a %+ b
+%macro op 3
+	%1 e%2, 0x%3
+%endmacro
+
+	section .text
+start:
+	mov eax, ebx
+	mov cat(e,ax), cat(12,34)
+	op mov, cx, ff
+	mov eax, $eax
+	add eax, [$eax + 4]
+	mov ecx, 1_000h + $10 + 0q17 + 0b101
+	dd 1.5, 2.5e3, 0x1.8p1, 3.
+	dq 1e10, 1.e2
+	mov edx, [start]
+	jmp short start
+
+%push ctx
+%$loc:
+	dec eax
+	jnz %$loc
+%pop
+
+%macro mk 1
+l%1_label:
+	dd l%1_label - start, %1
+%endmacro
+	mk 5
+	mk 0x10
+	dd cat(1,.5)
+	dd 1 .nolist
+
+$eax:	dd 0
+a_very_long_identifier_name_which_is_not_a_keyword_at_all_but_long:
+	dd a_very_long_identifier_name_which_is_not_a_keyword_at_all_but_long
@@ -0,0 +1,33 @@
+;
+; Machine-readable listing: data, relocations, zero-extension and
+; reserved space, INCBIN and TIMES runs, and the nesting levels of
+; macros, .nolist macros and include files, which must match those
+; of the text listing.
+;
+	bits 32
+start:
+	db 1, 2, 3
+	dd start
+	dq start
+	incbin "listjson.dat"
+	incbin "listjson.dat", 2, 3
+	times 3 db 9
+	align 4, db 0x90
+
+%macro plain 1
+	dd %1
+	incbin "listjson.dat", 6
+%endmacro
+
+%macro quiet 1.nolist
+	dw %1
+	plain %1
+%endmacro
+
+	plain 5
+	quiet 6
+%include "listjson.inc"
+	resb 2
+
+	section .bss
+	resd 4
@@ -0,0 +1,22 @@
+{"file":"./travis/test/listjson.asm","line":9,"level":0,"type":"data","segment":16,"offset":0,"length":3,"bytes":"010203"}
+{"file":"./travis/test/listjson.asm","line":10,"level":0,"type":"address","segment":16,"offset":3,"length":4,"target":16,"value":0}
+{"file":"./travis/test/listjson.asm","line":11,"level":0,"type":"message","severity":"warning","text":"warning: 64-bit unsigned relocation zero-extended from 32 bits [-w+zext-reloc]"}
+{"file":"./travis/test/listjson.asm","line":11,"level":0,"type":"address","segment":16,"offset":7,"length":4,"target":16,"value":0}
+{"file":"./travis/test/listjson.asm","line":11,"level":0,"type":"zero","segment":16,"offset":11,"length":4}
+{"file":"./travis/test/listjson.asm","line":12,"level":0,"type":"incbin","segment":16,"offset":15,"length":8}
+{"file":"./travis/test/listjson.asm","line":13,"level":0,"type":"incbin","segment":16,"offset":23,"length":3}
+{"file":"./travis/test/listjson.asm","line":14,"level":0,"type":"data","segment":16,"offset":26,"length":1,"bytes":"09"}
+{"file":"./travis/test/listjson.asm","line":14,"level":0,"type":"times","segment":16,"offset":27,"length":2}
+{"file":"./travis/test/listjson.asm","line":15,"level":0,"type":"data","segment":16,"offset":29,"length":1,"bytes":"90"}
+{"file":"./travis/test/listjson.asm","line":15,"level":0,"type":"times","segment":16,"offset":30,"length":2}
+{"file":"./travis/test/listjson.asm","line":27,"level":1,"type":"data","segment":16,"offset":32,"length":4,"bytes":"05000000"}
+{"file":"./travis/test/listjson.asm","line":27,"level":1,"type":"incbin","segment":16,"offset":36,"length":2}
+{"file":"./travis/test/listjson.asm","line":28,"level":0,"type":"data","segment":16,"offset":38,"length":2,"bytes":"0600"}
+{"file":"./travis/test/listjson.asm","line":28,"level":0,"type":"data","segment":16,"offset":40,"length":4,"bytes":"06000000"}
+{"file":"./travis/test/listjson.asm","line":28,"level":0,"type":"incbin","segment":16,"offset":44,"length":2}
+{"file":"./travis/test/listjson.inc","line":4,"level":2,"type":"data","segment":16,"offset":46,"length":4,"bytes":"07000000"}
+{"file":"./travis/test/listjson.inc","line":4,"level":2,"type":"incbin","segment":16,"offset":50,"length":2}
+{"file":"./travis/test/listjson.inc","line":5,"level":1,"type":"data","segment":16,"offset":52,"length":2,"bytes":"3400"}
+{"file":"./travis/test/listjson.asm","line":30,"level":0,"type":"reserve","segment":16,"offset":54,"length":2}
+{"file":"./travis/test/listjson.asm","line":30,"level":0,"type":"message","severity":"warning","text":"warning: uninitialized space declared in non-BSS section `.text': zeroing [-w+zeroing]"}
+{"file":"./travis/test/listjson.asm","line":33,"level":0,"type":"reserve","segment":18,"offset":0,"length":16}
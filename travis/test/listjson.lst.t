@@ -0,0 +1,45 @@
+     1                                  ;
+     2                                  ; Machine-readable listing: data, relocations, zero-extension and
+     3                                  ; reserved space, INCBIN and TIMES runs, and the nesting levels of
+     4                                  ; macros, .nolist macros and include files, which must match those
+     5                                  ; of the text listing.
+     6                                  ;
+     7                                  	bits 32
+     8                                  start:
+     9 00000000 010203                  	db 1, 2, 3
+    10 00000003 [00000000]              	dd start
+    11 00000007 [00000000]00000000      	dq start
+    11          ******************       warning: 64-bit unsigned relocation zero-extended from 32 bits [-w+zext-reloc]
+    12 0000000F <bin 8h>                	incbin "listjson.dat"
+    13 00000017 <bin 3h>                	incbin "listjson.dat", 2, 3
+    14 0000001A 09<rep 3h>              	times 3 db 9
+    15 0000001D 90<rep 3h>              	align 4, db 0x90
+    16                                  
+    17                                  %macro plain 1
+    18                                  	dd %1
+    19                                  	incbin "listjson.dat", 6
+    20                                  %endmacro
+    21                                  
+    22                                  %macro quiet 1.nolist
+    23                                  	dw %1
+    24                                  	plain %1
+    25                                  %endmacro
+    26                                  
+    27                                  	plain 5
+    18 00000020 05000000            <1>  dd %1
+    19 00000024 <bin 2h>            <1>  incbin "listjson.dat", 6
+    28 0000002C 060006000000-           	quiet 6
+    28 0000002C <bin 2h>           
+    29                                  %include "listjson.inc"
+     1                              <1> ;
+     2                              <1> ; Included by listjson.asm
+     3                              <1> ;
+     4                              <1> 	plain 7
+    18 0000002E 07000000            <2>  dd %1
+    19 00000032 <bin 2h>            <2>  incbin "listjson.dat", 6
+     5 00000034 3400                <1> 	dw $ - $$
+    30 00000036 <res 2h>                	resb 2
+    30          ******************       warning: uninitialized space declared in non-BSS section `.text': zeroing [-w+zeroing]
+    31                                  
+    32                                  	section .bss
+    33 00000000 <res 10h>               	resd 4
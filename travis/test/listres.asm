@@ -0,0 +1,11 @@
+;
+; Listing of reservations too large for the hex column
+;
+	bits 64
+	section .bss
+	resb 0x10
+	resb 0x1000000000000
+	resb 0x10000000000000
+	resq 0x100000000000000
+	section .text
+	nop
@@ -0,0 +1,14 @@
+     1                                  ;
+     2                                  ; Listing of reservations too large for the hex column
+     3                                  ;
+     4                                  	bits 64
+     5                                  	section .bss
+     6 00000000 <res 10h>               	resb 0x10
+     7 00000000 -                       	resb 0x1000000000000
+     7 00000010 <res 1000000000000h>
+     8 00000010 -                       	resb 0x10000000000000
+     8 00000010 <res 10000000000000h>
+     9 00000010 -                       	resq 0x100000000000000
+     9 00000010 <res 800000000000000h>
+    10                                  	section .text
+    11 00000000 90                      	nop
@@ -0,0 +1,22 @@
+;
+; Mach-O atoms with subsections_via_symbols and alt_entry
+;
+	subsections_via_symbols
+
+	section .text
+	nop
+	global _f, _g, _g_alt
+_f:	mov ecx, 10
+.loop:	dec ecx
+	jnz .loop
+	ret
+_g:	xor eax, eax
+_g_alt:	inc eax
+	ret
+	alt_entry _g_alt
+
+	section .data
+table:	dq _f, _g_alt
+
+	section .bss
+	resb 4
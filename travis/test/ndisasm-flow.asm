@@ -0,0 +1,19 @@
+;
+; Disassembled by ndisasm-flow.json in control flow-guided mode and in
+; the usual linear mode, with overlapping regions to skip
+;
+	bits 32
+start:	jmp main
+msg:	db "Hello, world", 0
+main:	call func
+	test eax, eax
+	jz .done
+	mov ecx, 3
+.loop:	dec ecx
+	jnz .loop
+.done:	ret
+	db 0xff, 0xff, 0xff, 0xff
+func:	mov eax, msg
+	ret
+table:	dd 0x90909090, 0x90909090, 0x90909090, 0x90909090
+	dd 0xc3c3c3c3, 0xc3c3c3c3
@@ -0,0 +1,29 @@
+;
+; Assembled to ELF and COFF objects by ndisasm-obj.json, whose code
+; sections ndisasm then disassembles with their symbols; the data
+; section is left out
+;
+	section .text
+	global start
+start:
+	call helper
+	lea rax,[rel table]
+	ret
+local:
+	xor eax,eax
+	ret
+
+	section .text.more exec
+helper:
+	mov ecx,3
+.loop:
+	dec ecx
+	jnz .loop
+	ret
+other:
+	nop
+	ret
+
+	section .data
+table:
+	dd 1, 2, 3
@@ -0,0 +1,5 @@
+;
+; Assembled twice with the same prelude cache and a different
+; environment each time; the output must follow the environment.
+;
+db ENVVAL
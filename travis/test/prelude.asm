@@ -0,0 +1,17 @@
+;
+; The same source assembled with the prelude processed as usual, with
+; the prelude cache being written or checked, and with it being loaded.
+;
+bits 32
+prologue
+prologue 32
+db FRAME_VER, ADD(1,2), SHOUT, counter, OLDNAME
+withdef 1
+withdef 1,2
+mov eax, r0d
+db %$local
+%pop
+epilogue
+db __?PASS?__
+dd __?LINE?__
+db __?FILE?__
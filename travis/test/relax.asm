@@ -0,0 +1,41 @@
+;
+; Jump sizes are settled by relaxation rather than one optimization
+; pass at a time; the result must be what plain passes would give.
+; With -DFEEDBACK, code sizes also depend on label values in ways
+; other than jumps, and the assembler falls back to plain passes.
+;
+	bits 32
+
+%assign n 400
+%assign seed 12345
+
+%assign i 0
+%rep n
+L%[i]:
+ %assign seed (seed * 1103515245 + 12345) % 0x80000000
+ %assign t i + (seed >> 8) % 64 - 12
+ %if t < 0
+  %assign t 0
+ %elif t >= n
+  %assign t n - 1
+ %endif
+ %assign k (seed >> 16) % 8
+ %if k < 3
+	jz L%[t]
+ %elif k < 5
+	jmp L%[t]
+ %elif k == 5
+	call L%[t]
+ %elif k == 6
+	mov eax, [ebx+ecx*4+0x100]
+ %else
+	add eax, ebx
+ %endif
+ %ifdef FEEDBACK
+  %if i % 97 == 50
+	align 16
+	times (L%[i] - L0) & 3 nop
+  %endif
+ %endif
+ %assign i i + 1
+%endrep
@@ -0,0 +1,26 @@
+;
+; TIMES lines with fixed encodings are encoded once and replicated;
+; relative references and relocations are still emitted per copy.
+;
+	bits 64
+	extern ext
+
+	section .text
+start:
+	times 4 nop
+	times 3 mov eax, 0x12345678
+	times 2 vaddps ymm1, ymm2, [rax+rbx*4+64]
+	times 3 jmp start
+	times 2 call ext
+	times 3 lea rax, [rel start]
+	times 2 mov rax, [ext]
+	times 0 int3
+	times 5 db 1, 2, 'ab'
+	times 3 dq start
+	times 2 dw $ - start
+	times 3 dd 1.5
+	times 7 db 0xcc
+
+	section .bss
+	times 4 resd 2
+	times 3 resb 5
@@ -46,6 +46,24 @@ require 'x86/insns-iflags.ph';
 # This should match MAX_OPERANDS from nasm.h
 $MAX_OPERANDS = 5;
 
+# Disassembler prefilter mask bits; these must match DM_* in insns.h
+$DM_REGS   = 0xff;              # ModRM.reg == 0..7, one bit each
+$DM_MODMEM = 1 << 8;
+$DM_MODREG = 1 << 9;
+$DM_O16    = 1 << 10;
+$DM_O32    = 1 << 11;
+$DM_O64    = 1 << 12;
+$DM_ODF    = 1 << 13;
+$DM_ONDF   = 1 << 14;
+$DM_NOREP  = 1 << 15;
+$DM_REPNE  = 1 << 16;
+$DM_REP    = 1 << 17;
+$DM_NOOSP  = 1 << 18;
+$DM_OSP    = 1 << 19;
+$DM_LEGACY = 1 << 20;
+$DM_LONG   = 1 << 21;
+$DM_ALL    = (1 << 22) - 1;
+
 # Add VEX/XOP prefixes
 @vex_class = ( 'vex', 'xop', 'evex' );
 $vex_classes = scalar(@vex_class);
@@ -139,7 +157,7 @@ while (<F>) {
 
     foreach $fptr (@field_list) {
         @fields = @$fptr;
-        ($formatted, $nd) = format_insn(@fields);
+        ($formatted, $nd, $dm) = format_insn(@fields);
         if ($formatted) {
             $insns++;
             $aname = "aa_$fields[0]";
@@ -158,6 +176,7 @@ while (<F>) {
         }
         if ($formatted && !$nd) {
             push @big, $formatted;
+            push @dmask, $dm;
             my @sseq = startseq($fields[2], $fields[4]);
             foreach $i (@sseq) {
                 if (!defined($dinstables{$i})) {
@@ -291,6 +310,11 @@ if ( $output eq 'd' ) {
             print D "    instrux + $j,\n";
         }
         print D "};\n";
+        print D "\nstatic const uint32_t dmask_${h}[] = {\n";
+        foreach $j (@{$dinstables{$h}}) {
+            printf D "    0x%06x, /* %4d */\n", $dmask[$j], $j;
+        }
+        print D "};\n";
     }
 
     @prefix_list = ();
@@ -317,12 +341,12 @@ if ( $output eq 'd' ) {
             if ($is_prefix{$nn}) {
                 die "$fname:$line: ambiguous decoding of $nn\n"
                     if (defined($dinstables{$nn}));
-                printf D "    /* 0x%02x */ { itable_%s, -1 },\n", $c, $nn;
+                printf D "    /* 0x%02x */ { itable_%s, -1, NULL },\n", $c, $nn;
             } elsif (defined($dinstables{$nn})) {
-                printf D "    /* 0x%02x */ { itable_%s, %u },\n", $c,
-                       $nn, scalar(@{$dinstables{$nn}});
+                printf D "    /* 0x%02x */ { itable_%s, %u, dmask_%s },\n", $c,
+                       $nn, scalar(@{$dinstables{$nn}}), $nn;
             } else {
-                printf D "    /* 0x%02x */ { NULL, 0 },\n", $c;
+                printf D "    /* 0x%02x */ { NULL, 0, NULL },\n", $c;
             }
         }
         print D "};\n";
@@ -529,10 +553,11 @@ sub format_insn($$$$$) {
 
     @bytecode = (decodify($codes, $relax), 0);
     push(@bytecode_list, [@bytecode]);
+    $dmask = dismask(\@bytecode, \@ops, \%flags);
     $codes = hexstr(@bytecode);
     count_bytecodes(@bytecode);
 
-    ("{I_$opcode, $num, {$operands}, $decorators, \@\@CODES-$codes\@\@, $flagsindex},", $nd);
+    ("{I_$opcode, $num, {$operands}, $decorators, \@\@CODES-$codes\@\@, $flagsindex},", $nd, $dmask);
 }
 
 #
@@ -689,6 +714,177 @@ sub startseq($$) {
     return $prefix;
 }
 
+# Compute the disassembler prefilter mask for an instruction template,
+# i.e. the set of decoder states (see DM_* in insns.h) in which the
+# template can possibly match.  A bit may only be cleared if matches()
+# in disasm.c is certain to reject the template in that state, so
+# anything we don't fully understand leaves the mask alone.
+#
+# Besides the prefix and mode checks, which can appear anywhere in the
+# code string, we look at the byte which follows the opcode byte used
+# to select the disassembler bucket: if that is a ModRM byte, the
+# spare field and the register/memory class of the EA operand are
+# known, and if it is a literal byte it has to match exactly.
+sub dismask($$$) {
+    my($codes, $ops, $flags) = @_;
+    my @codes = @$codes;
+    my $mask = $DM_ALL;
+    my $osize_fixed = 1;
+    my %rmreg = ();
+    my($c, $i, $opex, $prefix, $ea);
+
+    $mask &= ~$DM_LONG   if ($flags->{'NOLONG'});
+    $mask &= ~$DM_LEGACY if ($flags->{'LONG'});
+
+    $opex = 0;
+    for ($i = 0; $i < scalar(@codes); $i++) {
+        $c = $codes[$i];
+        my $op1 = ($c & 3) + (($opex & 1) << 2);
+        $opex = 0;
+        last if ($c == 0);
+        if ($c >= 01 && $c <= 04) {
+            $i += $c;
+        } elsif ($c >= 05 && $c <= 07) {
+            $opex = $c;
+        } elsif ($c >= 010 && $c <= 013) {
+            $rmreg{$op1}++;
+            $i++;
+        } elsif ($c == 0330) {
+            $i++;
+        } elsif ($c >= 0100 && $c <= 0137) {
+            $rmreg{$op1}++;
+        } elsif ($c == 0172 || $c == 0173) {
+            my $ab = $codes[++$i];
+            $rmreg{$ab >> 3}++;
+        } elsif ($c >= 0174 && $c <= 0177) {
+            $rmreg{$op1}++;
+        } elsif (($c & ~3) == 0240 || $c == 0250) {
+            $rmreg{$op1}++ if ($c != 0250);
+            $i += 3;
+        } elsif (($c & ~3) == 0260 || $c == 0270) {
+            $rmreg{$op1}++ if ($c != 0270);
+            $i += 2;
+        } elsif ($c == 0320) {
+            $mask &= ~($DM_O32|$DM_O64) if ($osize_fixed);
+        } elsif ($c == 0321) {
+            $mask &= ~($DM_O16|$DM_O64) if ($osize_fixed);
+        } elsif ($c == 0322) {
+            $mask &= ~$DM_ONDF if ($osize_fixed);
+        } elsif ($c == 0323) {
+            $osize_fixed = 0;
+        } elsif ($c == 0324) {
+            $mask &= ~($DM_O16|$DM_O32) if ($osize_fixed);
+        } elsif ($c == 0326) {
+            $mask &= ~$DM_REP;
+        } elsif ($c == 0331) {
+            $mask &= ~($DM_REPNE|$DM_REP);
+        } elsif ($c == 0332) {
+            $mask &= ~($DM_NOREP|$DM_REP);
+        } elsif ($c == 0333) {
+            $mask &= ~($DM_NOREP|$DM_REPNE);
+        } elsif ($c == 0360) {
+            $mask &= ~($DM_OSP|$DM_REPNE|$DM_REP);
+        } elsif ($c == 0361) {
+            $mask &= ~($DM_NOOSP|$DM_REPNE|$DM_REP);
+        } elsif ($c == 0364) {
+            $mask &= ~$DM_OSP;
+        } elsif ($c == 0366) {
+            $mask &= ~$DM_NOOSP;
+        }
+    }
+
+    # Find the bucket opcode byte the same way startseq() does, giving
+    # up on anything which consumes data before it.
+    $prefix = '';
+    $i = 0;
+    while (1) {
+        $c = $codes[$i];
+        if ($c >= 01 && $c <= 04) {
+            my $fbs = $prefix;
+            my $nb = 0;
+            while ($codes[$i] >= 01 && $codes[$i] <= 04) {
+                $c = $codes[$i++];
+                $fbs .= hexstr(@codes[$i..($i+$c-1)]);
+                $i += $c;
+                $nb += $c;
+            }
+            foreach $pfx (@disasm_prefixes) {
+                if (substr($fbs, 0, length($pfx)) eq $pfx) {
+                    $prefix = $pfx;
+                    $fbs = substr($fbs, length($pfx));
+                    last;
+                }
+            }
+            if ($fbs ne '') {
+                my $left = length($fbs) >> 1;
+                return $mask if ($left > $nb);
+                if ($left > 1) {
+                    # The byte after the bucket byte is a literal
+                    my $b = hex(substr($fbs, 2, 2));
+                    $mask &= ~$DM_REGS | (1 << (($b >> 3) & 7));
+                    $mask &= ~(($b >> 6) == 3 ? $DM_MODMEM : $DM_MODREG);
+                    return $mask;
+                }
+                last;
+            }
+        } elsif (($c & ~3) == 0260 || $c == 0270 ||
+                 ($c & ~3) == 0240 || $c == 0250) {
+            my $m = $codes[$i+1];
+            $prefix .= sprintf('%s%02X%01X', $vex_class[$m >> 6], $m & 31,
+                               $codes[$i+2] & 3);
+            $i += ($c < 0260) ? 4 : 3;
+        } elsif (!dm_ignorable($c)) {
+            return $mask;
+        } else {
+            $i++;
+        }
+    }
+
+    # Now look at the byte which follows it
+    $opex = 0;
+    while (dm_ignorable($c = $codes[$i])) {
+        $opex = $c if ($c >= 05 && $c <= 07);
+        $i++;
+    }
+
+    if ($c >= 01 && $c <= 04) {
+        my $b = $codes[$i+1];
+        $mask &= ~$DM_REGS | (1 << (($b >> 3) & 7));
+        $mask &= ~(($b >> 6) == 3 ? $DM_MODMEM : $DM_MODREG);
+        return $mask;
+    } elsif ($c >= 0100 && $c <= 0137) {
+        $ea = (($c >> 3) & 3) + (($opex & 2) << 1);
+        return $mask if ($rmreg{$ea} || (($c & 3) + (($opex & 1) << 2)) == $ea);
+    } elsif ($c >= 0200 && $c <= 0237) {
+        $ea = (($c >> 3) & 3) + (($opex & 2) << 1);
+        $mask &= ~$DM_REGS | (1 << ($c & 7));
+        return $mask if ($rmreg{$ea});
+    } else {
+        return $mask;
+    }
+
+    # Register/memory class of the EA operand; see the final operand
+    # check in disasm().  Register classes with a subclass (e.g. xmm0-15
+    # only) are not rejected there, so leave those alone.
+    my $base = (split(/\|/, $ops->[$ea]))[0];
+    if ($base =~ /^(memory|mem_offs|[xyz]mem)$/) {
+        $mask &= ~$DM_MODREG;
+    } elsif ($base =~ /^(reg_gpr|mmxreg|[xyz]mmreg|kreg|bndreg)$/) {
+        $mask &= ~$DM_MODMEM;
+    }
+    return $mask;
+}
+
+# Codes which neither consume data nor change the operand registers
+sub dm_ignorable($) {
+    my($c) = @_;
+
+    return (($c >= 05 && $c <= 07) || ($c >= 014 && $c <= 017) ||
+            ($c >= 0271 && $c <= 0273) ||
+            ($c >= 0310 && $c <= 0337 && $c != 0330) || $c == 0341 ||
+            ($c >= 0360 && $c <= 0376));
+}
+
 # EVEX tuple types offset is 0300. e.g. 0301 is for full vector(fv).
 sub tupletype($) {
     my ($tuplestr) = @_;